@@ -25,6 +25,9 @@
 
 #include <linux/module.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
 #include <linux/printk.h>
 #include <linux/spi/spi.h>
 #include <linux/gpio.h>
@@ -33,8 +36,37 @@
 #include <linux/interrupt.h>
 #include <linux/delay.h>
 #include <linux/timekeeping.h>
+#include <linux/hrtimer.h>
+#include <linux/circ_buf.h>
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <asm/byteorder.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+
+#define CREATE_TRACE_POINTS
+#include "symspi_trace.h"
+
+#ifdef SYMSPI_INTEGRITY
+#include <linux/crc32c.h>
+#endif
+
+#ifdef SYMSPI_RUNTIME_PM
+#include <linux/pm_runtime.h>
+#include <linux/pm_qos.h>
+#endif
+
+#ifdef SYMSPI_CHARDEV
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/kref.h>
+#include "symspi_uapi.h"
+#endif
 
 
 // DEV STACK
@@ -113,12 +145,41 @@
 
 #define SYMSPI_LOG_PREFIX "SymSPI: "
 
-// The maximum single xfer size in bytes
-// (is limited by the SPI hardware FIFO buffer)
+// The maximum single xfer (frame) size in bytes.
+//
+// The frame which doesn't fit into a single SPI transfer (see
+// SYMSPI_SPI_TRANSFER_MAX_BYTES) is sent as a chain of SPI
+// transfers within a single SPI message, so the whole frame
+// is xfered within a single handshake cycle.
 //
-// NOTE: usually it is the same for all SPI controllers
-//          on chip and for both Master and Slave modes
+// NOTE: if the SPI slave side hardware is not capable to receive
+//      the frames bigger than its FIFO buffer (usually 64 bytes),
+//      keep this value within the FIFO size.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_XFER_SIZE_MAX_BYTES
 #define SYMSPI_XFER_SIZE_MAX_BYTES 64
+#endif
+
+// The maximum size of a single SPI transfer within the SPI
+// message in bytes. The actual value is additionally limited
+// by spi_max_transfer_size(...) of the SPI device.
+// 0: no limit except one of the SPI device.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_SPI_TRANSFER_MAX_BYTES
+#define SYMSPI_SPI_TRANSFER_MAX_BYTES 0
+#endif
+
+// The xfer buffers size (in bytes) to be preallocated at
+// symspi_init(...). The xfer buffers are grow-only, so while
+// the xfer size doesn't exceed this value no memory allocation
+// happens after the init.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_XFER_PREALLOC_SIZE_BYTES
+#define SYMSPI_XFER_PREALLOC_SIZE_BYTES SYMSPI_XFER_SIZE_MAX_BYTES
+#endif
 
 // Which TTL level will be interpreted as ACTIVE flag state
 #define SYMSPI_MASTER_FLAG_ACTIVE_VALUE 1
@@ -132,8 +193,11 @@
 // It looks like other side might ignore our flag raise
 // if not enough time passed since its drop.
 //
-// Can be set via kernel config.
+// Can be set via kernel config, and then at runtime via
+// procfs params file (see struct symspi_params).
+#ifndef SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC
 #define SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC 750
+#endif
 // The required precision of inactive interval in percents
 #define SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_VARIANCE_PERCENT 10
 
@@ -156,31 +220,330 @@
 //  	error indication flag line oscillation. Too low value will
 //  	trigger unnecessary error recovery procedures which will slow
 //  	us down without a reason to do so.
+//
+// Can be set via kernel config, and then at runtime via
+// procfs params file (see struct symspi_params).
 #ifndef SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC
 #define SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC 60
 #endif
 
+// The max number of frames (xfers) to be xfered back-to-back within
+// a single xfer cycle (burst). Every frame of the burst is still
+// handshaked by the flags (drop: "frame processed", raise: "ready
+// for the next frame"), but between the frames our flag is kept
+// dropped only for SYMSPI_BURST_FRAME_GAP_USEC instead of the full
+// flag silence period, and the IDLE round trip is skipped. Only
+// after the last frame of the burst the flag silence period is
+// waited. The burst ends earlier, as soon as we have no new data
+// for the next frame. 1: no burst mode, every frame takes a full
+// xfer cycle.
+//
+// NOTE: the side which ends the burst earlier than the other one
+//      sees the next burst frame of the other side as an ordinary
+//      xfer request, so the sides are kept in sync regardless the
+//      value, while the same value on both sides is recommended.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_BURST_FRAMES
+#define SYMSPI_BURST_FRAMES 1
+#endif
+
+// The time our flag is kept dropped between the frames within
+// a burst (see SYMSPI_BURST_FRAMES), so the other side detects both
+// drop and raise edges. The SPI slave raises its flag only
+// when it is ready for the next frame, and SPI master waits for it
+// as for any other frame.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_BURST_FRAME_GAP_USEC
+#define SYMSPI_BURST_FRAME_GAP_USEC 50
+#endif
+
+// The number of entries in the consumer TX ring (see
+// symspi_data_xchange_batch(...)), must be a power of 2.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_TX_RING_SIZE
+#define SYMSPI_TX_RING_SIZE 16
+#endif
+
+#if (SYMSPI_TX_RING_SIZE < 2) \
+		|| (SYMSPI_TX_RING_SIZE & (SYMSPI_TX_RING_SIZE - 1))
+#error SYMSPI_TX_RING_SIZE must be a power of 2 (and at least 2).
+#endif
+
+// The number of entries in the RX ring (see
+// symspi_dev::rx_ready_callback), must be a power of 2.
+// Every entry has a preallocated buffer of the max xfer size.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_RX_RING_SIZE
+#define SYMSPI_RX_RING_SIZE 16
+#endif
+
+#if (SYMSPI_RX_RING_SIZE < 2) \
+		|| (SYMSPI_RX_RING_SIZE & (SYMSPI_RX_RING_SIZE - 1))
+#error SYMSPI_RX_RING_SIZE must be a power of 2 (and at least 2).
+#endif
+
+// The number of entries in their flag edge log (filled by hard IRQ
+// handler, replayed by IRQ thread), must be a power of 2.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_EDGE_LOG_SIZE
+#define SYMSPI_EDGE_LOG_SIZE 16
+#endif
+
+#if (SYMSPI_EDGE_LOG_SIZE < 2) \
+		|| (SYMSPI_EDGE_LOG_SIZE & (SYMSPI_EDGE_LOG_SIZE - 1))
+#error SYMSPI_EDGE_LOG_SIZE must be a power of 2 (and at least 2).
+#endif
+
+// The max time (us) SPI master (without SPI_RDY hardware support)
+// busy-waits (polling their flag GPIO) for the other side readiness
+// upon entering WAITING_RDY state before relying on their flag
+// interrupt. Trades CPU time for the xfer start latency.
+// 0 disables busy polling.
+//
+// Can be set via kernel config, and then at runtime via
+// procfs params file (see struct symspi_params).
+#ifndef SYMSPI_BUSY_POLL_USEC
+#define SYMSPI_BUSY_POLL_USEC 0
+#endif
+
+// The max time (us) of the busy polling (see SYMSPI_BUSY_POLL_USEC)
+// when we get to WAITING_RDY from interrupt (or IRQs disabled) context,
+// the bigger busy poll budget is used only from IRQ thread and works.
+#define SYMSPI_BUSY_POLL_ATOMIC_MAX_USEC 10
+
+// If defined, then the first xfer after symspi_init(...) is the
+// capabilities negotiation frame (see struct symspi_caps_word):
+// both sides exchange their timing and framing capabilities and then
+// use the fastest timing supported by both sides.
+//
+// NOTE: MUST be enabled on both sides, otherwise the other side
+//      consumer will get our capabilities frame as ordinary data.
+//
+// Can be set via kernel config.
+// #define SYMSPI_CAPS_NEGOTIATION
+
+// If defined, then every data frame is followed by the CRC32C
+// trailer (SYMSPI_INTEGRITY_TRAILER_BYTES, little endian) computed
+// over the frame payload: TX trailer is computed right before the xfer
+// start, RX trailer is verified right in the SPI xfer done callback,
+// so a corrupted frame is never delivered to the consumer but goes
+// directly to the error path (SYMSPI_ERROR_INTEGRITY). The trailer is
+// not part of the consumer xfer data.
+//
+// CRC32C is computed via libcrc32c, which uses the kernel crypto API
+// and thus the arch-accelerated implementation when available.
+//
+// NOTE: MUST be enabled on both sides.
+//
+// Can be set via kernel config.
+// #define SYMSPI_INTEGRITY
+
+// The size of the integrity trailer
+#define SYMSPI_INTEGRITY_TRAILER_BYTES 4
+
+// If defined, then SPI master scales the SPI clock with the link load:
+// the link runs at SYMSPI_CLOCK_LOW_HZ normally and switches to the
+// high speed clock when the frame size reaches
+// SYMSPI_CLOCK_UP_FRAME_BYTES, or our TX ring backlog, or the number of
+// back to back xfer cycles (our or their pending data) reaches
+// SYMSPI_CLOCK_UP_BACKLOG_FRAMES. The clock drops back to low speed
+// as soon as the link gets idle. The clock is switched only between
+// frames. The speed_hz set by native_transfer_configuration_hook is
+// overridden then.
+//
+// The high speed clock is min of SYMSPI_CLOCK_HIGH_HZ and the SPI
+// device max speed. With SYMSPI_CAPS_NEGOTIATION the SPI slave
+// announces its max clock during negotiation, and the high speed is
+// limited by it (if the other side doesn't announce the clock, or
+// negotiation falls back, then only low speed is used).
+//
+// Can be set via kernel config.
+// #define SYMSPI_CLOCK_SCALING
+
+// The low speed (idle link) SPI clock.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CLOCK_LOW_HZ
+#define SYMSPI_CLOCK_LOW_HZ 1000000
+#endif
+
+// The high speed (bulk transfers) SPI clock, 0 means SPI device
+// max speed.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CLOCK_HIGH_HZ
+#define SYMSPI_CLOCK_HIGH_HZ 0
+#endif
+
+// The backlog (queued TX frames or back to back xfer cycles)
+// which switches the link to high speed clock.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CLOCK_UP_BACKLOG_FRAMES
+#define SYMSPI_CLOCK_UP_BACKLOG_FRAMES 2
+#endif
+
+// The frame size which switches the link to high speed clock.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CLOCK_UP_FRAME_BYTES
+#define SYMSPI_CLOCK_UP_FRAME_BYTES 1024
+#endif
+
+// The minimal our flag inactive time we support when the capabilities
+// negotiation is enabled (the used value is the max of both sides
+// values).
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CAPS_MIN_FLAG_INACTIVE_TIME_USEC
+#define SYMSPI_CAPS_MIN_FLAG_INACTIVE_TIME_USEC 100
+#endif
+
+// The number of link errors after successful negotiation upon which
+// we fall back to the conservative timing
+// (SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC).
+#define SYMSPI_CAPS_FALLBACK_ERRORS 3
+
+// The capabilities word magic ("SCAP") and version.
+#define SYMSPI_CAPS_MAGIC 0x53434150
+#define SYMSPI_CAPS_VERSION 2
+
+// Capabilities negotiation states.
+//
+// OFF: negotiation is disabled (or not possible), compile time
+//      configuration is used
+// NEGOTIATING: the next xfer is the capabilities frame
+// NEGOTIATED: negotiated timing is used
+// FALLBACK: negotiation failed or link errors happened with
+//      negotiated timing, so conservative timing is used
+#define SYMSPI_CAPS_OFF 0
+#define SYMSPI_CAPS_NEGOTIATING 1
+#define SYMSPI_CAPS_NEGOTIATED 2
+#define SYMSPI_CAPS_FALLBACK 3
+
 // The duration of the silence which immediately follows
 // the error recovery procedure (this is actually the time
 // between the error indication to the other side and resuming
 // normal workflow)
+//
+// Can be set at runtime via procfs params file
+// (see struct symspi_params).
+#ifndef SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS
 #define SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS 10
+#endif
 // The required precision of silence time waiting
 #define SYMSPI_ERROR_RECOVERY_SILENCE_TIME_VARIANCE_PERCENT 5
 
+// The number of our flag pulses (raise-drop pairs) which follow
+// the initial flag drop in the error recovery procedure to
+// indicate the error to the other side. Every flag edge is followed
+// by our flag inactive state minimal time. The less pulses, the
+// sooner the link is back after recovery, but the other side must
+// still be able to detect the error indication.
+//
+// NOTE: at least 1 pulse is needed: the single flag drop is seen by
+//      the other side as ordinary "previous xfer done", so the error
+//      would not be noticed.
+//
+// Can be set at runtime via procfs params file
+// (see struct symspi_params).
+#ifndef SYMSPI_ERROR_RECOVERY_PULSES
+#define SYMSPI_ERROR_RECOVERY_PULSES 2
+#endif
+#if SYMSPI_ERROR_RECOVERY_PULSES < 1
+#error SYMSPI_ERROR_RECOVERY_PULSES must be at least 1.
+#endif
+
 // The timeout to wait for hardware xfer to be finished
 // on device closing (in milliseconds)
 #define SYMSPI_CLOSE_HW_WAIT_TIMEOUT_MSEC 500
 
+// If defined, then SymSPI device is runtime PM managed: it holds
+// the SPI device (and thus the SPI controller) active only while the
+// link is out of IDLE state, and lets it autosuspend after
+// SYMSPI_AUTOSUSPEND_DELAY_MSEC of idleness. Their flag raise (as well
+// as our own xfer request) resumes the device. The xfer preparation
+// which starts while the device is still resuming is deferred to the
+// work queue (see symspi_do_xfer_work_wrapper(...)), so we never raise
+// our flag (tell the other side we are ready) before the SPI
+// controller can be armed.
+//
+// Can be set via kernel config.
+// #define SYMSPI_RUNTIME_PM
+
+// The idle time after which the SymSPI device autosuspends. The
+// busy link never gets suspended as long as every xfer resets the
+// autosuspend timer.
+//
+// NOTE: can be changed at runtime via the SPI device
+//      power/autosuspend_delay_ms sysfs file.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_AUTOSUSPEND_DELAY_MSEC
+#define SYMSPI_AUTOSUSPEND_DELAY_MSEC 2000
+#endif
+
+// The time the idle link keeps the runtime PM usage reference of the
+// SPI device, so back to back xfer cycles (with short idle gaps in
+// between) don't take and release the reference every cycle. The
+// autosuspend delay starts counting after this time.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_PM_IDLE_HOLD_MSEC
+#define SYMSPI_PM_IDLE_HOLD_MSEC 20
+#endif
+
+// The resume latency budget: it is set as the device resume latency
+// PM QoS constraint (so PM domain governors don't pick deeper power
+// states), and every resume out of budget is accounted and reported.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_RESUME_LATENCY_BUDGET_USEC
+#define SYMSPI_RESUME_LATENCY_BUDGET_USEC 1000
+#endif
+
+// If defined, then every probed SymSPI device gets the misc char
+// device /dev/symspi<index>, which lets a userspace process use the
+// link via TX/RX rings shared with the driver (mmap) and poll/eventfd
+// notifications, with no per frame syscalls (see symspi_uapi.h).
+// The open char device owns the SymSPI device: the link is started
+// on open and closed on release, so the char device can be opened
+// only while no kernel consumer runs the device.
+//
+// Can be set via kernel config.
+// #define SYMSPI_CHARDEV
+
+// The number of slots in each (TX and RX) char device shared ring,
+// must be a power of 2. Every slot holds a frame of max xfer size.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_CHARDEV_RING_SLOTS
+#define SYMSPI_CHARDEV_RING_SLOTS 64
+#endif
+
+#if (SYMSPI_CHARDEV_RING_SLOTS < 2) \
+		|| (SYMSPI_CHARDEV_RING_SLOTS & (SYMSPI_CHARDEV_RING_SLOTS - 1))
+#error SYMSPI_CHARDEV_RING_SLOTS must be a power of 2 (and at least 2).
+#endif
+
 
 // Selects the workqueue to use to run operations ordered
 // from interrupt context.
-// Three options are available now:
+// Four options are available now:
 // * "SYMSPI_WQ_SYSTEM": see system_wq in workqueue.h.
 // * "SYMSPI_WQ_SYSTEM_HIGHPRI": see system_highpri_wq in
 //   workqueue.h.
 // * "SYMSPI_WQ_PRIVATE": use privately constructed high priority
 //   workqueue.
+// * "SYMSPI_WQ_KTHREAD": use dedicated kthread worker running with
+//   SCHED_FIFO policy (see SYMSPI_KTHREAD_PRIO) optionally bound to
+//   the given CPU (see SYMSPI_KTHREAD_CPU), gives bounded
+//   postprocessing jitter on real time systems.
 //
 // NOTE: the selection of the workqueue depends on the
 //      generic considerations on SymSPI functioning
@@ -191,7 +554,8 @@
 //      On the other hand if no delays are allowed in handling SymSPI
 //      communication (say, to communicate to hardware watchdog)
 //      then "SYMSPI_WQ_SYSTEM_HIGHPRI" or "SYMSPI_WQ_PRIVATE" is
-//      surely more preferrable.
+//      surely more preferrable. If real time guarantees are needed
+//      (PREEMPT_RT), then "SYMSPI_WQ_KTHREAD" is the option.
 //
 // Can be set via kernel config.
 #ifndef SYMSPI_WORKQUEUE_MODE
@@ -201,6 +565,7 @@
 #define SYMSPI_WQ_SYSTEM 0
 #define SYMSPI_WQ_SYSTEM_HIGHPRI 1
 #define SYMSPI_WQ_PRIVATE 2
+#define SYMSPI_WQ_KTHREAD 3
 
 // Comparator
 #define SYMSPI_WQ_MODE_MATCH(x)		\
@@ -209,7 +574,32 @@
 #ifndef SYMSPI_WORKQUEUE_MODE
 #error SYMSPI_WORKQUEUE_MODE must be defined to \
 		one of [SYMSPI_WQ_SYSTEM, SYMSPI_WQ_SYSTEM_HIGHPRI, \
-		SYMSPI_WQ_PRIVATE].
+		SYMSPI_WQ_PRIVATE, SYMSPI_WQ_KTHREAD].
+#endif
+
+// The SCHED_FIFO priority of SymSPI kthread worker
+// (used only in SYMSPI_WQ_KTHREAD mode).
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_KTHREAD_PRIO
+#define SYMSPI_KTHREAD_PRIO 50
+#endif
+
+// The CPU to bind SymSPI kthread worker to, -1 means no binding
+// (used only in SYMSPI_WQ_KTHREAD mode).
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_KTHREAD_CPU
+#define SYMSPI_KTHREAD_CPU -1
+#endif
+
+// The work type and work init used by selected workqueue mode
+#if SYMSPI_WQ_MODE_MATCH(KTHREAD)
+#define symspi_work_struct kthread_work
+#define SYMSPI_INIT_WORK(work, fn) kthread_init_work(work, fn)
+#else
+#define symspi_work_struct work_struct
+#define SYMSPI_INIT_WORK(work, fn) INIT_WORK(work, fn)
 #endif
 
 // Define this to work as SPI master (for now
@@ -264,9 +654,14 @@
 		   , ##__VA_ARGS__)
 #define symspi_warning_raw(fmt, ...)					\
 	pr_warning(SYMSPI_LOG_PREFIX""fmt"\n", ##__VA_ARGS__)
+// for the warnings in the xfer cycle hot path
+#define symspi_warning_ratelimited(fmt, ...)				\
+	pr_warn_ratelimited(SYMSPI_LOG_PREFIX"%s: "fmt"\n", __func__	\
+			    , ##__VA_ARGS__)
 #else
 #define symspi_warning(fmt, ...)
 #define symspi_warning_raw(fmt, ...)
+#define symspi_warning_ratelimited(fmt, ...)
 #endif
 
 #if SYMSPI_VERBOSITY >= 3
@@ -379,9 +774,9 @@
 	SYMSPI_CHECK_PRIVATE(msg, error_action)
 
 #define SYMSPI_CHECK_STATE(expected_state, error_action)		\
-	if (symspi->p->state != expected_state) {			\
+	if (symspi_get_state(symspi) != expected_state) {		\
 		symspi_err("called not in %d state but in %d state."	\
-			   , expected_state, symspi->p->state);		\
+			   , expected_state, symspi_get_state(symspi));	\
 		error_action;						\
 	}
 
@@ -438,22 +833,99 @@
 // Error: error (was) detected, recovery is planned (about to be planned)
 #define SYMSPI_STATE_ERROR 7
 
+// The layout of the state word (see symspi_dev_private::state_word):
+// the state machine state goes in the low bits, and their flag drop
+// counter goes in the high bits.
+#define SYMSPI_STATE_WORD_STATE_BITS 8
+#define SYMSPI_STATE_WORD_STATE_MASK					\
+	((1 << SYMSPI_STATE_WORD_STATE_BITS) - 1)
+#define SYMSPI_STATE_WORD_COUNTER_ONE (1 << SYMSPI_STATE_WORD_STATE_BITS)
+#define SYMSPI_STATE_WORD(state, counter)				\
+	(((counter) << SYMSPI_STATE_WORD_STATE_BITS) | (state))
+#define SYMSPI_STATE_WORD_TO_STATE(word)				\
+	((char)((word) & SYMSPI_STATE_WORD_STATE_MASK))
+#define SYMSPI_STATE_WORD_TO_COUNTER(word)				\
+	((word) >> SYMSPI_STATE_WORD_STATE_BITS)
+
 
 // Internal struct magic number for additional initialization verification
 // (see @symspi_dev_private description)
 #define SYMSPI_PRIVATE_MAGIC 0x0E31553B
 
 // the root directory in proc file system, which contains
-// SymSPI information for user space
+// SymSPI information for user space (for device 0, other
+// devices get the device index appended: "symspi1", ...)
 #define SYMSPI_PROC_ROOT_NAME "symspi"
+#define SYMSPI_PROC_ROOT_NAME_MAX_LEN 16
 // the name of the character device to readout SymSPI info
 #define SYMSPI_INFO_FILE_NAME "info"
+// the name of the file to readout SymSPI latency histograms
+#define SYMSPI_LATENCY_FILE_NAME "latency"
+// the name of the file to readout SymSPI statistics in key=value format
+#define SYMSPI_STATS_FILE_NAME "stats"
+// the name of the file to read/write SymSPI runtime parameters
+#define SYMSPI_PARAMS_FILE_NAME "params"
+#define SYMSPI_PROC_RW_PERMISSIONS 0644
+// the max size of a single params file write
+#define SYMSPI_PARAMS_WRITE_MAX_BYTES 256
 #define SYMSPI_PROC_R_PERMISSIONS 0444
 
+// The latency phases tracked in latency histograms (see
+// struct symspi_latency_stats). Every state phase is the time spent
+// in the corresponding state:
+//   * XFER_PREPARE + WAITING_PREV: request -> our flag raised and
+//     previous xfer confirmed by the other side,
+//   * WAITING_RDY: their flag -> xfer start,
+//   * XFER: xfer start -> xfer done,
+//   * POSTPROCESSING: xfer done -> back to IDLE (or next frame);
+// CYCLE phase is the time from leaving IDLE till coming back to IDLE.
+#define SYMSPI_LAT_PHASE_XFER_PREPARE 0
+#define SYMSPI_LAT_PHASE_WAITING_PREV 1
+#define SYMSPI_LAT_PHASE_WAITING_RDY 2
+#define SYMSPI_LAT_PHASE_XFER 3
+#define SYMSPI_LAT_PHASE_POSTPROCESSING 4
+#define SYMSPI_LAT_PHASE_CYCLE 5
+#define SYMSPI_LAT_PHASES_COUNT 6
+
+// The number of log2 buckets in latency histogram: bucket 0 keeps
+// durations < 1us, bucket N keeps [2^(N-1), 2^N) us, the last bucket
+// also keeps all longer durations.
+#define SYMSPI_LAT_BUCKETS_COUNT 24
+
+// The throughput meter moving averages (see struct symspi_rate_meter):
+// sampled every second, with fixed point (SYMSPI_EMA_SHIFT bits of
+// fraction) decay factors exp(-1/W) for windows W = 1s, 10s, 60s
+// (same approach as the kernel load average).
+#define SYMSPI_EMA_SHIFT 11
+#define SYMSPI_EMA_FIXED_1 (1UL << SYMSPI_EMA_SHIFT)
+#define SYMSPI_EMA_WINDOWS_COUNT 3
+#define SYMSPI_EMA_EXP_1S 753
+#define SYMSPI_EMA_EXP_10S 1853
+#define SYMSPI_EMA_EXP_60S 2014
+// The max number of idle seconds applied to the moving averages at
+// once: the meter is stopped on idle link, and after that long all
+// averages are 0 anyway.
+#define SYMSPI_EMA_DECAY_MAX_SEC 600
+
+// The max number of SymSPI devices (links) which can be probed
+// at the same time.
+//
+// Can be set via kernel config.
+#ifndef SYMSPI_MAX_DEVICES
+#define SYMSPI_MAX_DEVICES 4
+#endif
+
 /* ------------------------ GLOBAL VARIABLES ----------------------------*/
 
+// the first probed device (index 0), kept for the symspi_get_global_device()
+// consumers; contains ERR_PTR if the device 0 probe failed
 static struct symspi_dev *symspi_global_device_ptr = NULL;
 
+// all probed devices, indexed by symspi_dev::index
+// (protected by symspi_devices_lock)
+static struct symspi_dev *symspi_devices[SYMSPI_MAX_DEVICES];
+static DEFINE_MUTEX(symspi_devices_lock);
+
 /* ----------------- FORWARD DECLARATIONS SECTION -----------------------*/
 
 static void __symspi_error_report_init(struct symspi_dev *symspi);
@@ -461,34 +933,53 @@ static inline void __symspi_restart_timeout_timer(struct symspi_dev *symspi);
 static inline void __symspi_stop_timeout_timer(struct symspi_dev *symspi);
 static inline void __symspi_stop_timeout_timer_sync(struct symspi_dev *symspi);
 static void __symspi_other_side_wait_timeout(struct timer_list *t);
+static void __symspi_start_flag_silence_timer(struct symspi_dev *symspi
+		, bool start_next_xfer);
+static enum hrtimer_restart __symspi_flag_silence_timer_callback(
+		struct hrtimer *timer);
 static inline int __symspi_init_workqueue(
 		const struct symspi_dev *const symspi);
 static inline void __symspi_close_workqueue(
 		const struct symspi_dev *const symspi);
 static inline void __symspi_schedule_work(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work);
+		, struct symspi_work_struct *work);
 static inline void __symspi_cancel_work_sync(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work);
+		, struct symspi_work_struct *work);
 static inline bool __symspi_is_closing(struct symspi_dev *symspi);
 static int symspi_idle_to_xfer_prepare_sequence(struct full_duplex_xfer *xfer
 		, struct symspi_dev* symspi
-		, bool force_size_change);
+		, bool force_size_change
+		, bool pull_tx_ring);
+static inline unsigned int symspi_tx_ring_count(struct symspi_dev *symspi);
+static void symspi_tx_ring_drain(struct symspi_dev *symspi);
+static void symspi_rx_ring_push(struct symspi_dev *symspi);
 static void symspi_xfer_init_empty(struct full_duplex_xfer *xfer);
 static int symspi_xfer_init_copy(struct full_duplex_xfer *target
-		, struct full_duplex_xfer *source);
-static void symspi_xfer_free(struct full_duplex_xfer *target);
+		, struct full_duplex_xfer *source
+		, size_t *capacity_bytes);
+static void symspi_xfer_free(struct full_duplex_xfer *target
+		, size_t *capacity_bytes);
+static void symspi_xfer_swap_buffers(struct full_duplex_xfer *xfer_a
+		, struct full_duplex_xfer *xfer_b);
+static int symspi_do_bind_consumer_xfer(struct symspi_dev *symspi
+		, struct full_duplex_xfer *new_xfer
+		, bool force_size_change);
+static void symspi_do_release_bound_xfer(struct symspi_dev *symspi);
 static int symspi_verify_consumer_input(struct symspi_dev *symspi
 		, struct full_duplex_xfer *xfer, bool check_xfer);
 static int symspi_init_gpio_irqs(struct symspi_dev *symspi);
 static void symspi_close_qpio_irqs(struct symspi_dev *symspi);
 static int symspi_xfer_prepare_to_waiting_prev_sequence(
 		struct symspi_dev *symspi);
+static int __symspi_xfer_prepare_to_waiting_prev_sequence(
+		struct symspi_dev *symspi);
 inline static void symspi_do_update_native_spi_xfer_data(
 		struct symspi_dev *symspi);
 static void symspi_do_resize_xfer(struct full_duplex_xfer *xfer
-		, const size_t new_size_bytes);
+		, const size_t new_size_bytes
+		, size_t *capacity_bytes);
 static inline bool symspi_is_current_xfer_ok(struct symspi_dev *symspi);
 static bool regions_overlap(void *r_1, size_t size_1, void *r_2
 		, size_t size_2);
@@ -501,42 +992,109 @@ static int symspi_update_xfer_sequence(struct symspi_dev __kernel *symspi
 		, bool force_size_change);
 inline static bool symspi_is_their_request(
 		struct symspi_dev __kernel *symspi);
-inline static char *symspi_get_state_ptr(void *symspi_dev);
+inline static int symspi_their_flag_drop_counter(
+		struct symspi_dev *symspi);
+inline static void symspi_their_flag_drop_counter_set(
+		struct symspi_dev *symspi, const int value);
+inline static bool __symspi_switch_strict(void *symspi_dev_ptr
+		, char expected_state
+		, char dst_state
+		, int expected_counter);
 inline static char symspi_get_state(void *symspi_dev);
 inline static bool symspi_switch_strict(void *symspi_dev_ptr
 		, char expected_state
 		, char dst_state);
 inline static char symspi_switch_state_val_forced(void *symspi_dev_ptr
 		, char dst_state);
-static void symspi_do_xfer_work_wrapper(struct work_struct *work);
+static void symspi_do_xfer_work_wrapper(struct symspi_work_struct *work);
 static int symspi_do_xfer(struct symspi_dev *symspi);
-static void symspi_recovery_sequence_wrapper(struct work_struct *work);
+static void symspi_recovery_sequence_wrapper(struct symspi_work_struct *work);
+static void symspi_recovery_finish_wrapper(struct symspi_work_struct *work);
+static void symspi_next_xfer_work_wrapper(struct symspi_work_struct *work);
 static int symspi_recovery_sequence(struct symspi_dev *symspi);
-static void symspi_wait_flag_silence_period(void);
+static int __symspi_stop(struct symspi_dev *symspi);
+static int __symspi_restart(struct symspi_dev *symspi
+			    , struct full_duplex_xfer *default_xfer);
+static int symspi_recovery_finish_sequence(struct symspi_dev *symspi);
+static enum hrtimer_restart __symspi_recovery_timer_callback(
+		struct hrtimer *timer);
+static void symspi_wait_flag_silence_period(struct symspi_dev *symspi);
 static void symspi_our_flag_set(struct symspi_dev *symspi);
 static void symspi_our_flag_drop(struct symspi_dev *symspi);
 inline static bool symspi_their_flag_is_set(struct symspi_dev *symspi);
 static int symspi_try_leave_waiting_prev_sequence(struct symspi_dev *symspi);
 static int symspi_try_leave_waiting_rdy_sequence( struct symspi_dev *symspi);
+static bool symspi_busy_poll_their_flag(struct symspi_dev *symspi);
 static inline int symspi_get_next_xfer_id(struct symspi_dev *symspi);
 static void symspi_inc_current_xfer_counter(struct symspi_dev *symspi);
-static void symspi_postprocessing_sequence(struct work_struct *work);
+static void symspi_postprocessing_sequence(struct symspi_work_struct *work);
+static bool symspi_burst_next_frame_sequence(struct symspi_dev *symspi
+					     , const bool has_new_data);
+static int symspi_tx_ring_pull_sequence(struct symspi_dev *symspi
+					, const int original_state);
 static int symspi_try_to_error_sequence(struct symspi_dev *symspi
 					, int internal_error);
 static int symspi_to_idle_sequence(struct symspi_dev *symspi
 				   , const int original_state
 				   , bool start_next_xfer
 				   , const int internal_error);
+static int __symspi_do_to_idle_sequence(struct symspi_dev *symspi
+		, const int original_state
+		, bool start_next_xfer
+		, const int internal_error
+		, const bool defer_next_xfer);
+static int __symspi_to_idle_sequence(struct symspi_dev *symspi
+				     , const int original_state
+				     , bool start_next_xfer
+				     , const int internal_error);
 static inline int __symspi_procfs_init(struct symspi_dev *symspi);
 static inline void __symspi_procfs_close(struct symspi_dev *symspi);
 static inline int __symspi_info_init(struct symspi_dev *symspi);
+static void __symspi_counters_reset(struct symspi_dev *symspi);
 static void __symspi_info_close(struct symspi_dev *symspi);
 static ssize_t __symspi_info_read(struct file *file
 		, char __user *ubuf, size_t count, loff_t *ppos);
+static inline int __symspi_latency_init(struct symspi_dev *symspi);
+static void __symspi_latency_close(struct symspi_dev *symspi);
+static ssize_t __symspi_latency_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos);
+static inline void symspi_latency_on_switch(struct symspi_dev *symspi
+		, const char from_state, const char to_state);
+static inline int __symspi_stats_init(struct symspi_dev *symspi);
+static void __symspi_stats_close(struct symspi_dev *symspi);
+static ssize_t __symspi_stats_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos);
+static void __symspi_rate_meter_tick(struct timer_list *t);
+static inline int __symspi_params_init(struct symspi_dev *symspi);
+static void __symspi_params_close(struct symspi_dev *symspi);
+static ssize_t __symspi_params_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos);
+static ssize_t __symspi_params_write(struct file *file
+		, const char __user *ubuf, size_t count, loff_t *ppos);
+static void __symspi_params_apply_pending(struct symspi_dev *symspi);
+static void __symspi_clock_init(struct symspi_dev *symspi);
+static int symspi_caps_init(struct symspi_dev *symspi);
+static void symspi_caps_close(struct symspi_dev *symspi);
+static void symspi_caps_complete(struct symspi_dev *symspi);
+static void __symspi_caps_apply_pending(struct symspi_dev *symspi);
+static void __symspi_caps_on_error(struct symspi_dev *symspi
+				   , unsigned char err_no);
 static void symspi_spi_xfer_done_callback(void *context);
 static irqreturn_t symspi_their_flag_isr(int irq, void *symspi_device);
+static irqreturn_t symspi_their_flag_isr_thread(int irq
+						, void *symspi_device);
 static void symspi_their_flag_drop_isr_sequence(struct symspi_dev *symspi);
 static void symspi_their_flag_set_isr_sequence(struct symspi_dev *symspi);
+static void symspi_pm_init(struct symspi_dev *symspi);
+static void symspi_pm_close(struct symspi_dev *symspi);
+static inline void symspi_pm_wake(struct symspi_dev *symspi);
+static inline void symspi_pm_idle(struct symspi_dev *symspi);
+static void symspi_pm_release(struct symspi_dev *symspi);
+#ifdef SYMSPI_RUNTIME_PM
+static void __symspi_pm_idle_timer_callback(struct timer_list *t);
+#endif
+static inline bool symspi_pm_xfer_allowed(struct symspi_dev *symspi);
+static void symspi_pm_resume_sync(struct symspi_dev *symspi);
 
 #ifdef SYMSPI_DEBUG
 static void symspi_xfer_printout(struct full_duplex_xfer *xfer);
@@ -565,7 +1123,13 @@ static const char SYMSPI_ERROR_S_IRQ_ACQUISITION[] = "";
 static const char SYMSPI_ERROR_S_ISR_SETUP[] = "";
 static const char SYMSPI_ERROR_S_WAIT_OTHER_SIDE[]
 		= "Timeout waiting for other side reaction.";
-#if SYMSPI_WQ_MODE_MATCH(PRIVATE)
+static const char SYMSPI_ERROR_S_BUFFER_OWNERSHIP[]
+	= "Consumer owned xfer buffers are missing or are"
+	  " still owned by SymSPI.";
+static const char SYMSPI_ERROR_S_XFER_SIZE_TOO_BIG[] = "";
+static const char SYMSPI_ERROR_S_INTEGRITY[]
+		= "Integrity check of received frame failed.";
+#if SYMSPI_WQ_MODE_MATCH(PRIVATE) || SYMSPI_WQ_MODE_MATCH(KTHREAD)
 static const char SYMSPI_ERROR_S_WORKQUEUE_INIT[]
 		= "Failed to create own workqueue.";
 #endif
@@ -617,11 +1181,176 @@ struct symspi_error_rec {
 // @xfers_done_ok how many raw SPI xfers were successfully finished
 // @their_flag_edges how many edges of the other side flag was
 //  	detected since startup
+// @rx_ring_overruns how many received frames were dropped cause
+// 		RX ring was full (consumer didn't drain it in time)
+// @their_flag_level_resamples how many times the other side flag
+// 		level was sampled again by IRQ thread cause the edge
+// 		log was full
+// @edge_log_overruns how many their flag edges were not logged cause
+// 		the edge log was full (IRQ thread didn't keep up)
+// @bytes_tx how many bytes were sent to the other side
+// 		(by successfully finished xfers)
+// @bytes_rx how many received bytes were delivered to consumer
+// @integrity_errors how many received frames failed the integrity
+// 		check (see SYMSPI_INTEGRITY)
+// @tx_unchanged_updates how many xfer updates carried the same TX
+// 		data as the current xfer, and thus were applied without
+// 		data copying and SPI message rebuild
+// @pm_suspends how many times the device was runtime suspended
+// 		(see SYMSPI_RUNTIME_PM)
+// @pm_resumes how many times the device was runtime resumed
+// @pm_resumes_over_budget how many runtime resumes took longer
+// 		than SYMSPI_RESUME_LATENCY_BUDGET_USEC
+// @pm_deferred_xfers how many xfers were deferred to the work queue
+// 		cause the device was still resuming
+// @clock_ups how many times the SPI clock was switched to high speed
+// 		(see SYMSPI_CLOCK_SCALING)
+// @clock_downs how many times the SPI clock was switched to low speed
 struct symspi_info {
 	unsigned long long other_side_indicated_errors;
 	unsigned long long other_side_no_reaction_errors;
 	unsigned long long xfers_done_ok;
 	unsigned long long their_flag_edges;
+	unsigned long long rx_ring_overruns;
+	unsigned long long their_flag_level_resamples;
+	unsigned long long edge_log_overruns;
+	unsigned long long bytes_tx;
+	unsigned long long bytes_rx;
+	unsigned long long integrity_errors;
+	unsigned long long tx_unchanged_updates;
+	unsigned long long pm_suspends;
+	unsigned long long pm_resumes;
+	unsigned long long pm_resumes_over_budget;
+	unsigned long long pm_deferred_xfers;
+	unsigned long long clock_ups;
+	unsigned long long clock_downs;
+};
+
+// SymSPI runtime tunable timing parameters. Defaults are taken from
+// compile time configuration, and can be changed at runtime via
+// procfs params file.
+//
+// @our_flag_inactive_min_time_usec see
+//      SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC
+// @their_flag_wait_timeout_msec see SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC
+// @error_recovery_silence_time_ms see
+//      SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS
+// @burst_frame_gap_usec see SYMSPI_BURST_FRAME_GAP_USEC
+// @busy_poll_usec see SYMSPI_BUSY_POLL_USEC
+// @error_recovery_pulses see SYMSPI_ERROR_RECOVERY_PULSES
+struct symspi_params {
+	unsigned int our_flag_inactive_min_time_usec;
+	unsigned int their_flag_wait_timeout_msec;
+	unsigned int error_recovery_silence_time_ms;
+	unsigned int burst_frame_gap_usec;
+	unsigned int busy_poll_usec;
+	unsigned int error_recovery_pulses;
+};
+
+// The capabilities word, sent at the beginning of the capabilities
+// negotiation frame (rest of the frame is filled with 0).
+// Little endian on the wire.
+//
+// @magic SYMSPI_CAPS_MAGIC
+// @version SYMSPI_CAPS_VERSION of the sender
+// @burst_frames the burst frames number of the sender
+//      (see SYMSPI_BURST_FRAMES)
+// @min_flag_inactive_usec the minimal flag inactive time the sender
+//      can handle
+// @max_frame_bytes the max xfer size of the sender
+// @max_speed_hz the max SPI clock the sender can handle for high speed
+//      xfers, 0 if the sender doesn't support clock scaling
+//      (see SYMSPI_CLOCK_SCALING), since version 2
+struct symspi_caps_word {
+	__le32 magic;
+	u8 version;
+	u8 burst_frames;
+	__le16 min_flag_inactive_usec;
+	__le32 max_frame_bytes;
+	__le32 max_speed_hz;
+} __packed;
+
+// Tracks the exponential moving averages of SymSPI throughput.
+// Is updated once a second by the rate meter timer from
+// symspi_info totals. The timer is stopped on idle link and is
+// restarted by the next xfer (see __symspi_rate_meter_wake(...)),
+// the stopped seconds are applied as zero samples.
+//
+// @last_sample_jiffies the time of the last sample.
+// @last_xfers xfers_done_ok value at the last sample.
+// @last_bytes bytes_tx value at the last sample.
+// @last_bytes_rx bytes_rx value at the last sample.
+// @xfers_per_sec_ema the xfers/sec averages (fixed point, see
+//      SYMSPI_EMA_SHIFT) for 1s, 10s, 60s windows.
+// @bytes_per_sec_ema the same as @xfers_per_sec_ema but for TX
+//      bytes/sec.
+// @bytes_rx_per_sec_ema the same as @xfers_per_sec_ema but for RX
+//      bytes/sec (delivered to consumer).
+struct symspi_rate_meter {
+	unsigned long last_sample_jiffies;
+	unsigned long long last_xfers;
+	unsigned long long last_bytes;
+	unsigned long long last_bytes_rx;
+	unsigned long long xfers_per_sec_ema[SYMSPI_EMA_WINDOWS_COUNT];
+	unsigned long long bytes_per_sec_ema[SYMSPI_EMA_WINDOWS_COUNT];
+	unsigned long long bytes_rx_per_sec_ema[SYMSPI_EMA_WINDOWS_COUNT];
+};
+
+// Latency histogram of a single phase.
+// NOTE: updated without locking (per CPU), so values only give the
+// 		big picture (an update interrupted by other update
+// 		on the same CPU might be lost).
+//
+// @buckets the log2 histogram buckets (see SYMSPI_LAT_BUCKETS_COUNT)
+// @count the total number of samples
+// @sum_us the total duration of all samples (us)
+// @min_us the min sample duration (us), valid if @count > 0
+// @max_us the max sample duration (us)
+struct symspi_latency_hist {
+	unsigned int buckets[SYMSPI_LAT_BUCKETS_COUNT];
+	unsigned long long count;
+	unsigned long long sum_us;
+	unsigned long long min_us;
+	unsigned long long max_us;
+};
+
+// Per CPU latency statistics: histogram per phase
+// (see SYMSPI_LAT_PHASE_*).
+struct symspi_latency_stats {
+	struct symspi_latency_hist phases[SYMSPI_LAT_PHASES_COUNT];
+};
+
+// Their flag edge log entry.
+//
+// @timestamp the time the edge was caught by the hard IRQ handler.
+// @level the their flag level sampled by hard IRQ handler
+//      (true: ACTIVE; false: INACTIVE).
+struct symspi_edge_log_entry {
+	ktime_t timestamp;
+	bool level;
+};
+
+// The RX ring entry.
+//
+// @data {valid ptr} the entry buffer (in RX ring slab), of
+//      xfer_size_max_bytes size.
+// @size_bytes the size of received data in @data.
+// @xfer_id the id of the xfer the data was received with.
+struct symspi_rx_ring_entry {
+	void *data;
+	size_t size_bytes;
+	int xfer_id;
+};
+
+// The consumer TX ring entry.
+//
+// @xfer {valid ptr} the consumer xfer to be xfered.
+//      OWNERSHIP: consumer, but is not to be touched by consumer
+//          till released via xfer_accepted_callback
+// @force_size_change see symspi_data_xchange(...)
+struct symspi_tx_ring_entry {
+	struct full_duplex_xfer *xfer;
+	bool force_size_change;
 };
 
 // Opaque struct which is allocated and managed by SymSPI internally.
@@ -634,8 +1363,49 @@ struct symspi_info {
 // @current_xfer The data to work with upon next entering
 //      SYMSPI_STATE_XFER_PREPARE state.
 //      OWNERSHIP: our module
-// @spi_xfer the underlying SPI device xfer data.
+// @back_xfer the back (inactive) TX/RX buffers pair of double-buffered
+//      @current_xfer. Only data_tx, data_rx_buf and size_bytes fields
+//      are used. Consumer gets the back TX buffer with
+//      symspi_xfer_buffer_acquire(...) and fills it with the next xfer
+//      data, then upon the xfer replacement the @current_xfer and
+//      @back_xfer buffers are swapped instead of data copying.
+//      OWNERSHIP: our module
+// @current_xfer_capacity_bytes the actually allocated size of
+//      @current_xfer buffers (each), is never less than its size_bytes.
+//      The buffers are grow-only: any size not bigger than capacity
+//      is served without memory reallocation.
+// @back_xfer_capacity_bytes the same as @current_xfer_capacity_bytes
+//      but for @back_xfer.
+// @bound_xfer {NULL || valid ptr} used only in consumer owned buffers
+//      mode (see symspi_dev::consumer_owned_buffers): the consumer
+//      xfer which buffers are currently bound to @current_xfer.
+//      OWNERSHIP: consumer (but its buffers are owned by our module
+//          till released via xfer_accepted_callback)
+// @xfer_size_max_bytes the maximum xfer size of the device.
+// @spi_xfers the underlying SPI device xfers chain: the current
+//      xfer is split into @spi_xfers_used chunks of
+//      @spi_xfer_chunk_bytes size (the last one might be shorter)
+//      which are xfered within the single @spi_msg.
 //      OWNERSHIP: our module
+// @spi_xfers_count the number of allocated @spi_xfers, enough
+//      to carry the xfer of @xfer_size_max_bytes size (not including
+//      the integrity trailer transfer).
+// @spi_xfers_used the number of @spi_xfers currently chained into
+//      @spi_msg (not including the integrity trailer transfer).
+// @integrity_trailer the TX (first SYMSPI_INTEGRITY_TRAILER_BYTES)
+//      and RX (second SYMSPI_INTEGRITY_TRAILER_BYTES) integrity
+//      trailer buffers, chained into @spi_msg as the last transfer
+//      (right after @spi_xfers_used transfers).
+//      NOTE: used only when SYMSPI_INTEGRITY is defined.
+//      OWNERSHIP: our module
+// @tx_generation the generation of @current_xfer TX payload (and of
+//      @spi_msg chain built from it), incremented every time when the
+//      TX payload might have changed; stays the same when consumer
+//      provides the same TX data again (see symspi_replace_xfer(...)),
+//      so nothing is to be updated then.
+// @integrity_tx_generation the @tx_generation the TX integrity trailer
+//      was computed for.
+// @spi_xfer_chunk_bytes the max size of a single SPI transfer.
 // @spi_msg the underlying SPI device message data.
 //      OWNERSHIP: our module
 // @next_xfer_id keeps the next xfer id.
@@ -647,17 +1417,24 @@ struct symspi_info {
 //      by other running/pending tasks. So to stay on a safe side we
 //      will allocate our own single-threaded workqueue for our purposes.
 //      NOTE: used only when SYMSPI_WORKQUEUE_MODE equals SYMSPI_WQ_PRIVATE
-// @xfer_work launches the xfer out of interrupt context.
-//      Not used for now, but this might be changed due to performance
-//      investigations.
+// @kworker the dedicated SCHED_FIFO kthread worker to handle
+//      communication jobs.
+//      NOTE: used only when SYMSPI_WORKQUEUE_MODE equals SYMSPI_WQ_KTHREAD
+// @xfer_work prepares and launches the xfer out of interrupt context.
+//      Used only for the xfers deferred till the SPI device runtime
+//      resume is done (see SYMSPI_RUNTIME_PM).
 // @postprocessing_work work triggers the xfer postprocessing procedures
 //      (provides RX and TX data to consumer and calls consumer data
 //      processing callback)
-// @state the current state of SymSPI state machine.
-// @their_flag_drop_counter stores number of registered (while
+// @state_word keeps both the current state of SymSPI state machine
+//      (low SYMSPI_STATE_WORD_STATE_BITS bits) and their flag drop
+//      counter (the rest), so the state and the counter are read and
+//      updated consistently with a single atomic operation (see
+//      symspi_get_state(...), symspi_their_flag_drop_counter(...)).
+//      Their flag drop counter stores number of registered (while
 //      having GPIO ISR active) since last zeroing drops (from ACTIVE
 //      to INACTIVE state) of other side flag.
-// NOTE: their_flag_drop_counter values:
+// NOTE: their flag drop counter values:
 //      0   - other side didn't yet done with the previous xfer
 //      1   - other side done with the previous xfer
 //      >1  - other side indicates failure
@@ -681,6 +1458,38 @@ struct symspi_info {
 //      set/drop interrupt. If < 0, then ISQ is not used by us
 //      (latter happens only if their flag IRQ request fails and
 //      we are not able to start).
+// @edge_log their flag edges log (single producer: hard IRQ handler,
+//      single consumer: IRQ thread), see symspi_their_flag_isr(...).
+// @edge_log_head the index of the next entry to be written by
+//      hard IRQ handler, is written only by it.
+// @edge_log_tail the index of the next entry to be replayed by
+//      IRQ thread, is written only by it.
+// @edge_log_resample set by hard IRQ handler when the edge log was
+//      full, then IRQ thread samples their flag level again after
+//      the log replay, cleared only by IRQ thread.
+// @their_flag_last_level the last their flag level seen by IRQ
+//      thread (tracked in COLD state as well), when we listen to both
+//      edges, the logged level equal to it is not an edge and is not
+//      replayed.
+// @tx_ring the consumer TX ring (single producer: consumer, single
+//      consumer: our module), see symspi_data_xchange_batch(...).
+// @tx_ring_head the index of the next entry to be written by
+//      consumer, is written only by consumer.
+// @tx_ring_tail the index of the next entry to be read by our
+//      module, is written only by our module.
+// @rx_ring the RX ring (single producer: our module, single
+//      consumer: consumer), used only when symspi_dev::rx_ready_callback
+//      is set.
+// @rx_ring_slab the preallocated memory for all @rx_ring buffers.
+//      OWNERSHIP: our module
+// @rx_ring_head the index of the next entry to be written by our
+//      module, is written only by our module.
+// @rx_ring_tail the index of the next entry to be read by consumer,
+//      is written only by consumer.
+// @burst_frames the number of frames within a single handshake
+//      cycle (see SYMSPI_BURST_FRAMES).
+// @burst_frames_done the number of frames done within the current
+//      xfer cycle, is dropped on every IDLE entry.
 // @delayed_xfer_request is set to true, when default data xfer was
 //      ordered while we were not in IDLE state. Upon the xfer done,
 //      start_immediately callback flag is ored with
@@ -689,6 +1498,11 @@ struct symspi_info {
 // @close_request if set to true (this can happen only once
 //      in a lifecycle (all flow from COLD to COLD state)). Triggered
 //      and checked atomically.
+// @stopped if true, then the device was stopped by lightweight
+//      reset (see __symspi_stop(...)): it is in COLD state with
+//      @close_request set, but all its resources are still allocated,
+//      so it can be started again by __symspi_restart(...) (or fully
+//      closed by symspi_close(...)).
 // @final_leave_xfer_completion this completion is triggered when
 //      the device switches from XFER state to any other while
 //      the close_request is already issued, this completion
@@ -700,6 +1514,55 @@ struct symspi_info {
 //      it is enabled every time when we start waiting for the
 //      other side action, and is disabled every time we finish
 //      the waiting.
+// @flag_silence_timer the timer which finalizes the xfer cycle
+//      after our flag inactive state minimal time passed (see
+//      SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC): returns us
+//      from POSTPROCESSING state to IDLE and schedules the next xfer
+//      start if needed, so the workqueue is not blocked by the waiting.
+// @flag_silence_start_next_xfer the start_next_xfer value to be used
+//      by @flag_silence_timer on the xfer cycle finalization.
+// @next_xfer_work starts the next xfer after the xfer cycle was
+//      finalized by @flag_silence_timer or the TX ring was filled
+//      by consumer (the xfer start may need sleepable context, say
+//      to resize the xfer buffers).
+// @recovery_timer the timer which drives the error indication
+//      sequence of the error recovery (our flag edges and following
+//      silence), so no worker is blocked while recovery is in
+//      progress. Upon sequence end it schedules @recover_finish_work.
+// @recovery_edges_left the number of our flag edges left to be
+//      made by @recovery_timer in current recovery sequence.
+// @pm_held 1 if we hold the runtime PM usage reference of the SPI
+//      device (the link is busy or was busy within last
+//      SYMSPI_PM_IDLE_HOLD_MSEC), 0 else. Is toggled atomically
+//      by symspi_pm_wake(...) and __symspi_pm_put(...), so the
+//      reference is taken and released exactly once per busy period.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_last_idle_jiffies the time the link got idle last time.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_wake_time the time the last wake up was requested, used
+//      to measure the resume latency.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_enabled true, if runtime PM of the SPI device was enabled by us.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_idle_timer releases the runtime PM usage reference after the
+//      link stayed idle for SYMSPI_PM_IDLE_HOLD_MSEC.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_qos the SPI device resume latency PM QoS request
+//      (SYMSPI_RESUME_LATENCY_BUDGET_USEC).
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_resume_last_usec the latency of the last runtime resume.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @pm_resume_max_usec the max latency of runtime resume since start.
+//      NOTE: used only when SYMSPI_RUNTIME_PM is defined.
+// @clock_ceiling_hz the high speed SPI clock (agreed with the other
+//      side, see SYMSPI_CLOCK_SCALING).
+// @clock_applied_hz the SPI clock currently set in @spi_xfers,
+//      0 if not set yet.
+// @clock_applied_generation the @tx_generation the clock was applied
+//      to (SPI message rebuild invalidates it).
+// @clock_backlog_cycles the number of back to back xfer cycles.
+// @clock_high true if the link is switched to high speed clock,
+//      till the link gets idle.
 // @magic {always SYMSPI_PRIVATE_MAGIC after struct was initialized}
 //      this field is used for verification that private structure
 //      of symspi was actually initialized.
@@ -709,6 +1572,7 @@ struct symspi_info {
 //      overall error statistics)
 // @init_level contains the SYMSPI_INIT_LEVEL_* value which tells the
 //      close routine from which point do we need a cleanup started.
+// @proc_root_name the name of @proc_root directory.
 // @proc_root the root SymSPI directory in the proc file system
 //      this directory is now aiming to provide SymSPI runtime
 //      information but later might be used to set some SymSPI
@@ -717,56 +1581,211 @@ struct symspi_info {
 //      info to user space.
 // @info_ops defines info file operations to call upon request
 //      from user space
-// @info tracks representation of current status of SymSPI
+// @latency_file the file in proc fs which provides the SymSPI
+//      latency histograms to user space.
+// @latency_ops defines latency file operations.
+// @latency {NULL || valid per CPU ptr} the per CPU latency
+//      statistics, if NULL, then latency is not tracked.
+// @state_enter_time the time (ktime_t) the current state was entered
+//      (updated on every state switch when @latency is tracked).
+//      NOTE: is atomic64_t, as switches run in IRQ thread, works and
+//          timers, and 64 bit ktime_t can tear on 32 bit systems.
+// @cycle_start_time the time (ktime_t) the current xfer cycle left
+//      IDLE state, 0 if not known. Is atomic64_t as @state_enter_time.
+// @stats_file the file in proc fs which provides the SymSPI
+//      statistics in machine-parsable key=value format.
+// @stats_ops defines stats file operations.
+// @rate_meter_timer the 1 second timer to sample @rate_meter, is not
+//      running on idle link.
+// @rate_meter the throughput moving averages.
+// @params the currently used timing parameters. Is changed only
+//      upon transition to IDLE state (see __symspi_to_idle_sequence),
+//      so the parameters never change within the xfer cycle.
+// @pending_params the parameters set by user, to be applied upon
+//      next transition to IDLE state.
+// @params_pending true if @pending_params are to be applied.
+// @params_lock protects @pending_params and @params_pending.
+// @params_file the file in proc fs to read/write @params.
+// @caps_state the capabilities negotiation state (SYMSPI_CAPS_*).
+// @caps_tx {NULL || valid ptr} the capabilities frame TX buffer.
+//      OWNERSHIP: our module
+// @caps_rx {NULL || valid ptr} the capabilities frame RX buffer.
+//      OWNERSHIP: our module
+// @caps_spi_xfer the SPI transfer of the capabilities frame.
+// @caps_spi_msg the SPI message of the capabilities frame
+//      (used instead of @spi_msg while in NEGOTIATING state).
+// @caps_xfer_in_flight true while @caps_spi_msg is being xfered.
+// @caps_frame_received true, when capabilities frame was xfered
+//      successfully and is to be handled by postprocessing.
+// @caps_errors the number of link errors since negotiation
+//      (counted from any context).
+// @caps_pending true if the negotiated @caps_xfer_size_max_bytes,
+//      @caps_burst_frames and @caps_clock_ceiling_hz are to be applied
+//      upon the transition to IDLE state (when we own the xfer and
+//      nothing of the xfer cycle is running).
+// @caps_xfer_size_max_bytes the negotiated max xfer size.
+// @caps_burst_frames the negotiated burst frames number.
+// @caps_clock_ceiling_hz the negotiated high speed SPI clock.
+// @params_ops defines params file operations.
+// @info {per CPU} tracks representation of current status of SymSPI
 //      from performance POV (error statistics, data statistics)
-//      and also its configuration.
+//      and also its configuration. Every CPU updates only its own
+//      copy, so no contended RMW happens in ISR and SPI completion,
+//      readers sum up all copies (see __symspi_info_collect(...)).
 //      NOTE: it is filled with 0 at each start, so keep it in such
 //          a way that 0 is a correct initial value.
+//
+// NOTE: the fields are grouped by access pattern, and every group
+//      starts on its own cache line, so the state machine fields
+//      written from ISR (running on one CPU) and SPI completion do not
+//      share cache lines with xfer data and bookkeeping data used by
+//      works (running on other CPU):
+//      * read mostly: configuration, set up on init,
+//      * hot: state machine fields,
+//      * hot: their flag edge log,
+//      * xfer data,
+//      * cold: bookkeeping data.
 struct symspi_dev_private {
+	/* read mostly: configuration and links, set up on init */
+
 	struct symspi_dev *symspi;
+	unsigned int magic;
 
-	int next_xfer_id;
-	struct full_duplex_xfer current_xfer;
+	bool spi_master_mode;
+	bool hardware_spi_rdy;
+	int their_flag_irq_number;
 
-	struct spi_transfer spi_xfer;
-	struct spi_message spi_msg;
+	size_t xfer_size_max_bytes;
+	size_t spi_xfers_count;
+	size_t spi_xfer_chunk_bytes;
+	int burst_frames;
+
+	struct symspi_params params;
 
 #if SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	struct workqueue_struct *work_queue;
+#elif SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	struct kthread_worker *kworker;
 #endif
 
-	struct work_struct xfer_work;
-	struct work_struct postprocessing_work;
-	struct work_struct recover_work;
+	struct symspi_info __percpu *info;
+	struct symspi_latency_stats __percpu *latency;
+
+	/* hot: state machine, written from ISR, SPI completion and works */
 
-	char state;
+	atomic_t state_word ____cacheline_aligned_in_smp;
+	int last_error;
+	bool delayed_xfer_request;
+	bool close_request;
+	bool caps_xfer_in_flight;
+	bool caps_frame_received;
+	bool flag_silence_start_next_xfer;
+	int burst_frames_done;
+	unsigned int recovery_edges_left;
+	atomic64_t state_enter_time;
+	atomic64_t cycle_start_time;
+#ifdef SYMSPI_RUNTIME_PM
+	atomic_t pm_held;
+	ktime_t pm_wake_time;
+	unsigned long pm_last_idle_jiffies;
+#endif
 
-	int their_flag_drop_counter;
+	/* hot: their flag edge log, ISR (producer) -> IRQ thread */
 
-	bool spi_master_mode;
-	bool hardware_spi_rdy;
+	struct symspi_edge_log_entry edge_log[SYMSPI_EDGE_LOG_SIZE]
+		____cacheline_aligned_in_smp;
+	unsigned int edge_log_head;
+	unsigned int edge_log_tail;
+	bool edge_log_resample;
+	bool their_flag_last_level;
 
-	int their_flag_irq_number;
+	/* xfer data: postprocessing work and API calls */
 
-	bool delayed_xfer_request;
-	bool close_request;
-	struct completion final_leave_xfer_completion;
+	int next_xfer_id ____cacheline_aligned_in_smp;
+	struct full_duplex_xfer current_xfer;
+	struct full_duplex_xfer back_xfer;
+	size_t current_xfer_capacity_bytes;
+	size_t back_xfer_capacity_bytes;
+	struct full_duplex_xfer *bound_xfer;
+
+	struct spi_transfer *spi_xfers;
+	size_t spi_xfers_used;
+	u8 *integrity_trailer;
+	unsigned int tx_generation;
+	unsigned int integrity_tx_generation;
+	struct spi_message spi_msg;
 
-	int last_error;
+	unsigned int clock_ceiling_hz;
+	unsigned int clock_applied_hz;
+	unsigned int clock_applied_generation;
+	unsigned int clock_backlog_cycles;
+	bool clock_high;
 
-	struct timer_list wait_timeout_timer;
+	struct symspi_tx_ring_entry tx_ring[SYMSPI_TX_RING_SIZE];
+	unsigned int tx_ring_head;
+	unsigned int tx_ring_tail;
 
-	unsigned int magic;
+	struct symspi_rx_ring_entry rx_ring[SYMSPI_RX_RING_SIZE];
+	void *rx_ring_slab;
+	unsigned int rx_ring_head;
+	unsigned int rx_ring_tail;
+
+	/* cold: bookkeeping, timers, works, procfs */
+
+	struct symspi_work_struct xfer_work ____cacheline_aligned_in_smp;
+	struct symspi_work_struct postprocessing_work;
+	struct symspi_work_struct recover_work;
+	struct symspi_work_struct recover_finish_work;
+	struct symspi_work_struct next_xfer_work;
+
+	struct completion final_leave_xfer_completion;
+	bool stopped;
+
+	struct timer_list wait_timeout_timer;
+	struct hrtimer flag_silence_timer;
+	struct hrtimer recovery_timer;
 
 	struct symspi_error_rec errors[SYMSPI_ERROR_TYPES_COUNT];
 
 	uint8_t init_level;
 
+	char proc_root_name[SYMSPI_PROC_ROOT_NAME_MAX_LEN];
 	struct proc_dir_entry *proc_root;
 	struct proc_dir_entry *info_file;
 	struct file_operations info_ops;
 
-	struct symspi_info info;
+	struct proc_dir_entry *latency_file;
+	struct file_operations latency_ops;
+
+	struct proc_dir_entry *stats_file;
+	struct file_operations stats_ops;
+	struct timer_list rate_meter_timer;
+	struct symspi_rate_meter rate_meter;
+
+	struct symspi_params pending_params;
+	bool params_pending;
+	spinlock_t params_lock;
+	struct proc_dir_entry *params_file;
+	struct file_operations params_ops;
+
+	int caps_state;
+	void *caps_tx;
+	void *caps_rx;
+	struct spi_transfer caps_spi_xfer;
+	struct spi_message caps_spi_msg;
+	atomic_t caps_errors;
+	bool caps_pending;
+	size_t caps_xfer_size_max_bytes;
+	int caps_burst_frames;
+	unsigned int caps_clock_ceiling_hz;
+
+#ifdef SYMSPI_RUNTIME_PM
+	bool pm_enabled;
+	struct timer_list pm_idle_timer;
+	struct dev_pm_qos_request pm_qos;
+	unsigned int pm_resume_last_usec;
+	unsigned int pm_resume_max_usec;
+#endif
 };
 
 
@@ -787,6 +1806,71 @@ struct symspi_dev *symspi_get_global_device(void)
 	return symspi_global_device_ptr;
 }
 
+// API:
+//      provides the probed symspi device by its index.
+//
+// @index {0..SYMSPI_MAX_DEVICES-1} the index of the device,
+//      devices get their indexes in probe order.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      valid ptr: to the device with given index
+//      ERR_PTR(-ENODEV): if no such device
+__maybe_unused
+struct symspi_dev *symspi_get_device(const unsigned int index)
+{
+	if (index >= SYMSPI_MAX_DEVICES) {
+		return ERR_PTR(-ENODEV);
+	}
+
+	mutex_lock(&symspi_devices_lock);
+	struct symspi_dev *symspi = symspi_devices[index];
+	mutex_unlock(&symspi_devices_lock);
+
+	return symspi ? symspi : ERR_PTR(-ENODEV);
+}
+
+// API:
+//      provides the probed symspi device by the name of its
+//      SPI device (like "spi1.0").
+//
+// @name {valid ptr to null-terminated string} the SPI device name.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      valid ptr: to the device with given name
+//      ERR_PTR(-ENODEV): if no such device
+//      ERR_PTR(-EINVAL): if name is not provided
+__maybe_unused
+struct symspi_dev *symspi_get_device_by_name(const char *name)
+{
+	if (IS_ERR_OR_NULL(name)) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	struct symspi_dev *result = ERR_PTR(-ENODEV);
+	int i;
+
+	mutex_lock(&symspi_devices_lock);
+	for (i = 0; i < SYMSPI_MAX_DEVICES; i++) {
+		struct symspi_dev *symspi = symspi_devices[i];
+
+		if (symspi && symspi->spi
+				&& strcmp(dev_name(&symspi->spi->dev)
+					  , name) == 0) {
+			result = symspi;
+			break;
+		}
+	}
+	mutex_unlock(&symspi_devices_lock);
+
+	return result;
+}
+
 
 // API:
 //
@@ -796,6 +1880,10 @@ struct symspi_dev *symspi_get_global_device(void)
 // If xfer is NULL and SymSPI is not in IDLE state, then the
 // xfer request will be scheduled.
 //
+// If xfer is NULL and the TX ring is not empty (see
+// symspi_data_xchange_batch(...)), then the next TX ring xfer
+// is used instead of default one.
+//
 // It is guaranteed, that in case of delayed xfer, the xfer
 // done callback invocation will follow after the
 // symspi_data_xchange(...) call.
@@ -840,7 +1928,8 @@ int symspi_data_xchange(void __kernel *device
 
 	// will check input data correctness internally
 	int res = symspi_idle_to_xfer_prepare_sequence(xfer, symspi
-						       , force_size_change);
+						       , force_size_change
+						       , xfer == NULL);
 	// if we are in xfer right now
 	if (res == -FULL_DUPLEX_ERROR_NOT_READY && xfer == NULL) {
 		symspi->p->delayed_xfer_request = true;
@@ -889,7 +1978,8 @@ int symspi_default_data_update(void __kernel *device
 
 	// will check input data correctness internally
 	int res = symspi_idle_to_xfer_prepare_sequence(xfer, symspi
-						       , force_size_change);
+						       , force_size_change
+						       , false);
 	if (res != SYMSPI_SUCCESS) {
 		// TODO: shedule update upon xfer done if failed due to
 		//      "not in IDLE state".
@@ -956,6 +2046,13 @@ int symspi_init(void __kernel *device
 	// Verify if this device is already initialized
 	if (!IS_ERR_OR_NULL(symspi->p)) {
 		if (symspi->p->magic == SYMSPI_PRIVATE_MAGIC) {
+			// all resources are here, only need to start
+			if (symspi->p->stopped) {
+				symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL
+					    , "Given symspi instance is"
+					    " stopped. Will restart it.");
+				return __symspi_restart(symspi, default_xfer);
+			}
 			symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL
 				    , "Given symspi instance is already"
 				    " initialized. Will reuse it.");
@@ -981,6 +2078,35 @@ int symspi_init(void __kernel *device
 	symspi->p->last_error = SYMSPI_SUCCESS;
 
 	symspi->p->next_xfer_id = SYMSPI_INITIAL_XFER_ID;
+	symspi->p->xfer_size_max_bytes = SYMSPI_XFER_SIZE_MAX_BYTES;
+	symspi->p->burst_frames = SYMSPI_BURST_FRAMES;
+
+	symspi->p->params.our_flag_inactive_min_time_usec
+		= SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC;
+	symspi->p->params.their_flag_wait_timeout_msec
+		= SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC;
+	symspi->p->params.error_recovery_silence_time_ms
+		= SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS;
+	symspi->p->params.burst_frame_gap_usec = SYMSPI_BURST_FRAME_GAP_USEC;
+	symspi->p->params.busy_poll_usec = SYMSPI_BUSY_POLL_USEC;
+	symspi->p->params.error_recovery_pulses = SYMSPI_ERROR_RECOVERY_PULSES;
+	symspi->p->params_pending = false;
+	spin_lock_init(&symspi->p->params_lock);
+
+	// statistics are updated by every CPU in its own copy
+	symspi->p->info = alloc_percpu(struct symspi_info);
+	if (!symspi->p->info) {
+		symspi_err("Failed to allocate statistics. Abort!");
+		symspi_close((void*)symspi);
+		return -SYMSPI_ERROR_NO_MEMORY;
+	}
+
+	// latency tracking is not vital, so we go on without it
+	symspi->p->latency = alloc_percpu(struct symspi_latency_stats);
+	if (!symspi->p->latency) {
+		symspi_warning("no memory for latency statistics,"
+			       " latency will not be tracked.");
+	}
 
 	__symspi_error_report_init(symspi);
 
@@ -988,60 +2114,167 @@ int symspi_init(void __kernel *device
 	timer_setup(&symspi->p->wait_timeout_timer,
 		    __symspi_other_side_wait_timeout, 0);
 
-	res = symspi_xfer_init_copy(&symspi->p->current_xfer, default_xfer);
+	// throughput meter timer
+	timer_setup(&symspi->p->rate_meter_timer,
+		    __symspi_rate_meter_tick, 0);
+
+	// flag silence timer
+	hrtimer_init(&symspi->p->flag_silence_timer, CLOCK_MONOTONIC
+		     , HRTIMER_MODE_REL);
+	symspi->p->flag_silence_timer.function
+		= &__symspi_flag_silence_timer_callback;
+	hrtimer_init(&symspi->p->recovery_timer, CLOCK_MONOTONIC
+		     , HRTIMER_MODE_REL);
+	symspi->p->recovery_timer.function
+		= &__symspi_recovery_timer_callback;
+
+	if (symspi->consumer_owned_buffers) {
+		// no own buffers at all, default xfer buffers are used
+		symspi_xfer_init_empty(&symspi->p->current_xfer);
+		res = symspi_do_bind_consumer_xfer(symspi, default_xfer, true);
+	} else {
+		res = symspi_xfer_init_copy(&symspi->p->current_xfer
+				, default_xfer
+				, &symspi->p->current_xfer_capacity_bytes);
+	}
 	if (res < 0) {
 		symspi_err("Failed to init new xfer, error: %d. Abort!", -res);
 		symspi_close((void*)symspi);
 		return res;
 	};
 	__SYMSPI_INIT_LEVEL(XFER_CREATED);
+
+	// the back buffers are of the same size as default xfer
+	symspi_xfer_init_empty(&symspi->p->back_xfer);
+	if (!symspi->consumer_owned_buffers) {
+		symspi_do_resize_xfer(&symspi->p->back_xfer
+				, max_t(size_t, default_xfer->size_bytes
+					, SYMSPI_XFER_PREALLOC_SIZE_BYTES)
+				, &symspi->p->back_xfer_capacity_bytes);
+		symspi_do_resize_xfer(&symspi->p->back_xfer
+				, default_xfer->size_bytes
+				, &symspi->p->back_xfer_capacity_bytes);
+		if (symspi->p->back_xfer.size_bytes == 0) {
+			symspi_err("Failed to allocate back xfer buffers."
+				   " Abort!");
+			symspi_close((void*)symspi);
+			return -SYMSPI_ERROR_NO_MEMORY;
+		}
+	}
+
 	symspi->p->current_xfer.xfers_counter = 0;
 	symspi->p->current_xfer.id = symspi_get_next_xfer_id(symspi);
 	default_xfer->xfers_counter = symspi->p->current_xfer.xfers_counter;
 	default_xfer->id = symspi->p->current_xfer.id;
 
 	// SPI services data initialization (see spi_write() for example)
-	// The SPI transfer pointer remains always the same, as does
+	// The SPI transfers array remains always the same, as does
 	// the message. We don't use queuing mechanics for messages
 	// cause it doesn't fit our flow (when size and contents of
 	// next xfer are in general case defined by data from previous
 	// xfer).
 
-	// init spi xfer
-	memset(&symspi->p->spi_xfer, 0, sizeof(struct spi_transfer));
-	symspi_do_update_native_spi_xfer_data(symspi);
-
-	// init spi message
-	spi_message_init(&symspi->p->spi_msg);
-	spi_message_add_tail(&symspi->p->spi_xfer, &symspi->p->spi_msg);
-	symspi->p->spi_msg.spi = symspi->spi;
-	// We will call consumer callback indirectly (through the
-	// work queue) from our.
-	symspi->p->spi_msg.complete = &symspi_spi_xfer_done_callback;
-	symspi->p->spi_msg.context = (void*)symspi;
-
-	// init workqueue to be used
-	res = __symspi_init_workqueue(symspi);
-	if (res < 0) {
-		symspi_err("Failed to init SymSPI private workqueue"
+	// init spi xfers chain
+	// NOTE: spi_max_transfer_size(...) returns SIZE_MAX for the
+	//      controllers without limit, so we clamp it to our max xfer
+	//      size first (DIV_ROUND_UP would overflow otherwise)
+	symspi->p->spi_xfer_chunk_bytes
+		= min_t(size_t, spi_max_transfer_size(symspi->spi)
+			, symspi->p->xfer_size_max_bytes);
+	if (SYMSPI_SPI_TRANSFER_MAX_BYTES > 0) {
+		symspi->p->spi_xfer_chunk_bytes
+			= min_t(size_t, symspi->p->spi_xfer_chunk_bytes
+				, SYMSPI_SPI_TRANSFER_MAX_BYTES);
+	}
+	if (WARN_ON(symspi->p->spi_xfer_chunk_bytes == 0)) {
+		symspi_err("Invalid SPI transfer size limit. Abort!");
+		symspi_close((void*)symspi);
+		return -SYMSPI_ERROR_SPI;
+	}
+	symspi->p->spi_xfers_count
+		= DIV_ROUND_UP(symspi->p->xfer_size_max_bytes
+			       , symspi->p->spi_xfer_chunk_bytes);
+	if (WARN_ON(symspi->p->spi_xfers_count == 0)) {
+		symspi_err("No SPI transfers to allocate. Abort!");
+		symspi_close((void*)symspi);
+		return -SYMSPI_ERROR_SPI;
+	}
+#ifdef SYMSPI_INTEGRITY
+	// + the integrity trailer transfer
+	const size_t spi_xfers_alloc = symspi->p->spi_xfers_count + 1;
+#else
+	const size_t spi_xfers_alloc = symspi->p->spi_xfers_count;
+#endif
+	symspi->p->spi_xfers = kcalloc(spi_xfers_alloc
+				       , sizeof(struct spi_transfer)
+				       , GFP_KERNEL);
+	if (!symspi->p->spi_xfers) {
+		symspi_err("Failed to allocate SPI xfers. Abort!");
+		symspi_close((void*)symspi);
+		return -SYMSPI_ERROR_NO_MEMORY;
+	}
+#ifdef SYMSPI_INTEGRITY
+	symspi->p->integrity_trailer
+		= kzalloc(2 * SYMSPI_INTEGRITY_TRAILER_BYTES, GFP_KERNEL);
+	if (!symspi->p->integrity_trailer) {
+		symspi_err("Failed to allocate integrity trailer. Abort!");
+		symspi_close((void*)symspi);
+		return -SYMSPI_ERROR_NO_MEMORY;
+	}
+#endif
+
+	// init RX ring
+	if (symspi->rx_ready_callback) {
+		const size_t entry_size = symspi->p->xfer_size_max_bytes;
+		symspi->p->rx_ring_slab = kmalloc_array(SYMSPI_RX_RING_SIZE
+						, entry_size, GFP_KERNEL);
+		if (!symspi->p->rx_ring_slab) {
+			symspi_err("Failed to allocate RX ring. Abort!");
+			symspi_close((void*)symspi);
+			return -SYMSPI_ERROR_NO_MEMORY;
+		}
+		int i;
+		for (i = 0; i < SYMSPI_RX_RING_SIZE; i++) {
+			symspi->p->rx_ring[i].data
+				= symspi->p->rx_ring_slab + i * entry_size;
+		}
+	}
+
+	// init spi message (with the xfers chain)
+	symspi_do_update_native_spi_xfer_data(symspi);
+
+	__symspi_clock_init(symspi);
+
+	// capabilities negotiation is not vital, we go on without it
+	symspi_caps_init(symspi);
+
+	// init workqueue to be used
+	res = __symspi_init_workqueue(symspi);
+	if (res < 0) {
+		symspi_err("Failed to init SymSPI private workqueue"
 				   ", error: %d. Abort!", -res);
 		symspi_close((void*)symspi);
 		return -SYMSPI_ERROR_WORKQUEUE_INIT;
 	}
 	// works init
-	INIT_WORK(&symspi->p->xfer_work, symspi_do_xfer_work_wrapper);
-	INIT_WORK(&symspi->p->postprocessing_work, symspi_postprocessing_sequence);
-	INIT_WORK(&symspi->p->recover_work, symspi_recovery_sequence_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->xfer_work, symspi_do_xfer_work_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->postprocessing_work
+			 , symspi_postprocessing_sequence);
+	SYMSPI_INIT_WORK(&symspi->p->recover_work
+			 , symspi_recovery_sequence_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->recover_finish_work
+			 , symspi_recovery_finish_wrapper);
+	SYMSPI_INIT_WORK(&symspi->p->next_xfer_work
+			 , symspi_next_xfer_work_wrapper);
 	__SYMSPI_INIT_LEVEL(WORKQUEUE_INIT);
 
 	// still cold for now
-	symspi->p->state = SYMSPI_STATE_COLD;
-
 	// NOTE: to be selfconsistend with regular flow, we need to set up
 	//      counter to 1 here, to assume, that other side finished with
 	//      previous xfer, as long either there was no xfer before at all
 	//      either it was reset after error, so previous xfer is still done.
-	symspi->p->their_flag_drop_counter = 1;
+	atomic_set(&symspi->p->state_word
+		   , SYMSPI_STATE_WORD(SYMSPI_STATE_COLD, 1));
 
 	// our steady configuration
 	symspi->p->spi_master_mode = SYMSPI_SPI_MASTER;
@@ -1065,13 +2298,20 @@ int symspi_init(void __kernel *device
 
 	__symspi_procfs_init(symspi);
 	__symspi_info_init(symspi);
+	__symspi_latency_init(symspi);
+	__symspi_stats_init(symspi);
+	__symspi_params_init(symspi);
+
+	symspi_pm_init(symspi);
 
 	// Make it run. Starting from that point
 	// we go to normal workflow.
 	// TODO: verify close_request sequence
 	__SYMSPI_INIT_LEVEL(FULL);
 	symspi->p->close_request = false;
-	symspi->p->state = SYMSPI_STATE_IDLE;
+	atomic64_set(&symspi->p->state_enter_time, ktime_get());
+	// publishes all initialization done above
+	symspi_switch_state_val_forced(symspi, SYMSPI_STATE_IDLE);
 
 	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "initialization done");
 #ifdef SYMSPI_DEBUG
@@ -1116,11 +2356,14 @@ int symspi_close(void __kernel *device)
 	bool res = __atomic_compare_exchange_n(&symspi->p->close_request
 			, &expected_state, dst_state, false
 			, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
-	if (!res) {
+	// stopped device has close request set, but still owns
+	// all resources
+	if (!res && !symspi->p->stopped) {
 		symspi_err("device is closing already");
 		return -EALREADY;
 	}
-	if (symspi->p->state == SYMSPI_STATE_COLD) {
+	symspi->p->stopped = false;
+	if (res && symspi_get_state(symspi) == SYMSPI_STATE_COLD) {
 		symspi_err("device is already closed");
 		return SYMSPI_SUCCESS;
 	}
@@ -1140,6 +2383,9 @@ int symspi_close(void __kernel *device)
 	}
 
 full:
+	__symspi_params_close(symspi);
+	__symspi_stats_close(symspi);
+	__symspi_latency_close(symspi);
 	__symspi_info_close(symspi);
 	__symspi_procfs_close(symspi);
 
@@ -1160,7 +2406,7 @@ full:
 	// * non closeable (need to wait for hardware)
 	//   * SYMSPI_STATE_XFER
 
-	if (symspi->p->state == SYMSPI_STATE_XFER) {
+	if (symspi_get_state(symspi) == SYMSPI_STATE_XFER) {
 		const unsigned long wait_jiffies = msecs_to_jiffies(
 				  SYMSPI_CLOSE_HW_WAIT_TIMEOUT_MSEC);
 		unsigned long res = wait_for_completion_timeout(
@@ -1176,6 +2422,8 @@ full:
 		}
 	}
 
+	symspi_pm_close(symspi);
+
 	// Unless SPI transfer got frozen, we are effectively
 	// stopped already at this point - no state switches allowed,
 	// no API calls from this point (can be called but they do
@@ -1191,6 +2439,9 @@ gpio_irqs:
 
 	// close waiting timer
 	__symspi_stop_timeout_timer_sync(symspi);
+	hrtimer_cancel(&symspi->p->flag_silence_timer);
+	hrtimer_cancel(&symspi->p->recovery_timer);
+	del_timer_sync(&symspi->p->rate_meter_timer);
 
 	// No one can leave this state except init(), which should
 	// not be called by contract
@@ -1211,6 +2462,10 @@ workqueue_init:
 	__symspi_cancel_work_sync(symspi, &symspi->p->xfer_work);
 	__symspi_cancel_work_sync(symspi, &symspi->p->postprocessing_work);
 	__symspi_cancel_work_sync(symspi, &symspi->p->recover_work);
+	// recovery work might have restarted the recovery timer
+	hrtimer_cancel(&symspi->p->recovery_timer);
+	__symspi_cancel_work_sync(symspi, &symspi->p->recover_finish_work);
+	__symspi_cancel_work_sync(symspi, &symspi->p->next_xfer_work);
 
 	// wrap up with used workqueue
 	__symspi_close_workqueue(symspi);
@@ -1221,19 +2476,48 @@ workqueue_init:
 	// dead by now, and we can run raw resources cleanup.
 
 xfer_created:
+	// not xfered ring xfers are returned to consumer
+	symspi_tx_ring_drain(symspi);
+
 	// Spi_message doesn't point to any resources which
 	// are needed to be freed by us. SPI device is owned
 	// by consumer.
 	memset(&symspi->p->spi_msg, 0, sizeof(struct spi_message));
+	kfree(symspi->p->spi_xfers);
+	symspi->p->spi_xfers = NULL;
+	kfree(symspi->p->integrity_trailer);
+	symspi->p->integrity_trailer = NULL;
+	kfree(symspi->p->rx_ring_slab);
+	symspi->p->rx_ring_slab = NULL;
+	symspi_caps_close(symspi);
+	symspi->p->spi_xfers_count = 0;
+	symspi->p->spi_xfers_used = 0;
 
 	// spi xfer and symspi xfer point on the same data,
 	// so we free only once
-	symspi_xfer_free(&symspi->p->current_xfer);
+	if (symspi->consumer_owned_buffers) {
+		// consumer buffers are returned, not freed
+		symspi_do_release_bound_xfer(symspi);
+	} else {
+		symspi_xfer_free(&symspi->p->current_xfer
+				 , &symspi->p->current_xfer_capacity_bytes);
+	}
+	symspi_xfer_free(&symspi->p->back_xfer
+			 , &symspi->p->back_xfer_capacity_bytes);
 	symspi_do_update_native_spi_xfer_data(symspi);
 
 	__SYMSPI_INIT_LEVEL(PRIVATE_ALLOCATED);
 
 private_allocated:
+	if (symspi->p->latency) {
+		free_percpu(symspi->p->latency);
+		symspi->p->latency = NULL;
+	}
+	if (symspi->p->info) {
+		free_percpu(symspi->p->info);
+		symspi->p->info = NULL;
+	}
+
 	// returning symspi_dev to original state
 	symspi->p->magic = 0;
 	kfree(symspi->p);
@@ -1252,7 +2536,164 @@ bool symspi_is_running(void __kernel *device)
 		return false;
 	}
 	// TODO: to update as mutex on init is done is used
-	return symspi->p->state != SYMSPI_STATE_COLD;
+	return symspi_get_state(symspi) != SYMSPI_STATE_COLD;
+}
+
+// Helper. Stops the fully initialized device: brings it to COLD
+// state (as symspi_close(...) does), but keeps all its resources
+// (workqueue, IRQs, buffers, procfs) allocated, so the device can
+// be started again cheaply with __symspi_restart(...).
+//
+// CONTEXT:
+//      sleepable, but not from SymSPI callbacks (the SymSPI works
+//      are waited for)
+//
+// RETURNS:
+//      0: on success
+//      -EALREADY: the device is already closing
+//      -ETIMEDOUT: SPI xfer didn't finish in time, device is not
+//          stopped
+static int __symspi_stop(struct symspi_dev *symspi)
+{
+	bool expected_state = false;
+	// the same as in symspi_close(...): blocks all API entries
+	// and strict state switches except leaving XFER state
+	bool res = __atomic_compare_exchange_n(&symspi->p->close_request
+			, &expected_state, true, false
+			, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	if (!res) {
+		return -EALREADY;
+	}
+
+	if (symspi_get_state(symspi) == SYMSPI_STATE_XFER) {
+		const unsigned long wait_jiffies = msecs_to_jiffies(
+				  SYMSPI_CLOSE_HW_WAIT_TIMEOUT_MSEC);
+		if (wait_for_completion_timeout(
+				&symspi->p->final_leave_xfer_completion
+				, wait_jiffies) == 0) {
+			symspi_err("timeout waiting for SPI xfer"
+				   " to be finished, can not stop.");
+			symspi->p->close_request = false;
+			return -ETIMEDOUT;
+		}
+	}
+
+	__symspi_stop_timeout_timer_sync(symspi);
+	hrtimer_cancel(&symspi->p->flag_silence_timer);
+	hrtimer_cancel(&symspi->p->recovery_timer);
+
+	__symspi_cancel_work_sync(symspi, &symspi->p->xfer_work);
+	__symspi_cancel_work_sync(symspi, &symspi->p->postprocessing_work);
+	__symspi_cancel_work_sync(symspi, &symspi->p->recover_work);
+	// recovery work might have restarted the recovery timer
+	hrtimer_cancel(&symspi->p->recovery_timer);
+	__symspi_cancel_work_sync(symspi, &symspi->p->recover_finish_work);
+	__symspi_cancel_work_sync(symspi, &symspi->p->next_xfer_work);
+
+	symspi_switch_state_val_forced(symspi, SYMSPI_STATE_COLD);
+	symspi_our_flag_drop(symspi);
+	symspi_pm_release(symspi);
+
+	// not xfered ring xfers are returned to consumer
+	symspi_tx_ring_drain(symspi);
+
+	symspi->p->stopped = true;
+
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "stopped");
+
+	return SYMSPI_SUCCESS;
+}
+
+// Helper. Starts the device stopped by __symspi_stop(...) again,
+// the same way as symspi_init(...) would do, but without any
+// resources allocation (except the small capabilities frame, as
+// the restarted link negotiates again).
+//
+// @default_xfer {NULL || valid xfer ptr} the new default xfer to be
+//      used, if NULL then current xfer is kept.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code, device remains stopped then
+static int __symspi_restart(struct symspi_dev *symspi
+			    , struct full_duplex_xfer *default_xfer)
+{
+	if (!symspi->p->stopped) {
+		return -SYMSPI_ERROR_LOGICAL;
+	}
+
+	// NOTE: we own the device exclusively here: it is COLD and
+	//      close request is set.
+	if (default_xfer) {
+		default_xfer->xfers_counter = 0;
+		default_xfer->id = symspi_get_next_xfer_id(symspi);
+
+		symspi_switch_state_val_forced(symspi
+					       , SYMSPI_STATE_XFER_PREPARE);
+		const int res = symspi_replace_xfer(symspi, default_xfer
+						    , true);
+		symspi_switch_state_val_forced(symspi, SYMSPI_STATE_COLD);
+
+		if (res != SYMSPI_SUCCESS) {
+			symspi_err("Failed to apply new default xfer"
+				   ", error: %d.", -res);
+			return res;
+		}
+	}
+
+	// see the same in symspi_init(...)
+	symspi_their_flag_drop_counter_set(symspi, 1);
+	symspi->p->last_error = SYMSPI_SUCCESS;
+	symspi->p->delayed_xfer_request = false;
+	symspi->p->burst_frames_done = 0;
+	reinit_completion(&symspi->p->final_leave_xfer_completion);
+
+	// the restarted link negotiates and scales the clock from
+	// scratch, as the freshly inited one
+	symspi->p->xfer_size_max_bytes = SYMSPI_XFER_SIZE_MAX_BYTES;
+	symspi->p->burst_frames = SYMSPI_BURST_FRAMES;
+	if (symspi->p->caps_state != SYMSPI_CAPS_OFF) {
+		__symspi_params_stage_flag_inactive_time(symspi
+				, SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC);
+		__symspi_params_apply_pending(symspi);
+	}
+	__symspi_clock_init(symspi);
+	symspi_caps_close(symspi);
+	symspi_caps_init(symspi);
+
+	// other side must see our flag drop
+	symspi_wait_flag_silence_period(symspi);
+
+	// the edges logged and the level seen before COLD are outdated,
+	// so we start the edge log as symspi_init(...) does; the IRQ is
+	// held off till we are IDLE, so the first edge is compared to
+	// the level we start with (edges in between are resent on
+	// enable_irq(...))
+	disable_irq(symspi->p->their_flag_irq_number);
+	symspi->p->edge_log_head = 0;
+	symspi->p->edge_log_tail = 0;
+	symspi->p->edge_log_resample = false;
+	symspi->p->their_flag_last_level = symspi_their_flag_is_set(symspi);
+
+	// the restarted link counts from scratch as the freshly inited one
+	__symspi_counters_reset(symspi);
+
+	symspi->p->stopped = false;
+	symspi->p->close_request = false;
+	atomic64_set(&symspi->p->state_enter_time, ktime_get());
+	symspi_switch_state_val_forced(symspi, SYMSPI_STATE_IDLE);
+	enable_irq(symspi->p->their_flag_irq_number);
+
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "restarted");
+
+	if (symspi_their_flag_is_set(symspi)) {
+		symspi_data_xchange(symspi, NULL, false);
+	}
+
+	return SYMSPI_SUCCESS;
 }
 
 // API:
@@ -1267,6 +2708,25 @@ bool symspi_is_running(void __kernel *device)
 //          the symspi device can be in any state (totaly uninited,
 //          COLD, IDLE,...)
 //
+// NOTE: the fully initialized device is reset in lightweight way:
+//      workqueue, IRQs, buffers and procfs are kept, and only state
+//      machine is stopped and started again, and counters (info,
+//      latency, rate meter) are cleared (see __symspi_stop(...) and
+//      __symspi_restart(...)), so the link is back in about one
+//      flag silence period. Otherwise (or if lightweight way failed)
+//      device is fully closed and initialized again.
+//
+// NOTE: in consumer owned buffers mode the full reset returns the
+//      bound xfer to consumer (see xfer_accepted_callback), so it
+//      needs the new @default_xfer: with NULL @default_xfer it
+//      fails with -EINVAL (SymSPI keeps owning the bound xfer then,
+//      and consumer is to call symspi_reset(...) again with the new
+//      default xfer).
+//
+// CONTEXT:
+//      sleepable, but not from SymSPI callbacks (the SymSPI works
+//      are waited for)
+//
 // CONCURRENCE: not thread safe, no other calls to symspi device are
 //      allowed before symspi_init exits with success status.
 //
@@ -1278,9 +2738,38 @@ int symspi_reset(void __kernel *device
 {
 	struct symspi_dev *symspi = (struct symspi_dev *)device;
 	struct full_duplex_xfer tmp_xfer;
-	if (symspi_is_current_xfer_ok(symspi) && !default_xfer) {
+
+	if (!IS_ERR_OR_NULL(symspi) && !IS_ERR_OR_NULL(symspi->p)
+			&& symspi->p->magic == SYMSPI_PRIVATE_MAGIC
+			&& symspi->p->init_level == SYMSPI_INIT_LEVEL_FULL
+			&& (!default_xfer
+			    || symspi_verify_consumer_input(symspi
+					, default_xfer, true)
+			       == SYMSPI_SUCCESS)) {
+		int res = SYMSPI_SUCCESS;
+		if (!symspi->p->stopped) {
+			res = __symspi_stop(symspi);
+		}
+		if (res == SYMSPI_SUCCESS) {
+			res = __symspi_restart(symspi, default_xfer);
+		}
+		if (res == SYMSPI_SUCCESS) {
+			return SYMSPI_SUCCESS;
+		}
+		symspi_warning("lightweight reset failed: %d, will do"
+			       " full reset", res);
+	}
+	if (symspi_is_current_xfer_ok(symspi) && !default_xfer
+			&& symspi->consumer_owned_buffers) {
+		// the bound xfer is returned to consumer on close, so
+		// we can't bind its buffers again on init
+		symspi_err("full reset in consumer owned buffers mode"
+			   " needs new default xfer. Abort.");
+		return -EINVAL;
+	} else if (symspi_is_current_xfer_ok(symspi) && !default_xfer) {
 		int res = symspi_xfer_init_copy(&tmp_xfer
-										, &symspi->p->current_xfer);
+										, &symspi->p->current_xfer
+										, NULL);
 		if (res < 0) {
 			symspi_err("Failed to init xfer, error: %d. Abort!"
 						, -res);
@@ -1298,7 +2787,313 @@ int symspi_reset(void __kernel *device
 
 	symspi_close((void*)symspi);
 
-	return symspi_init((void*)symspi, default_xfer);
+	res = symspi_init((void*)symspi, default_xfer);
+
+	if (default_xfer == &tmp_xfer) {
+		symspi_xfer_free(&tmp_xfer, NULL);
+	}
+
+	return res;
+}
+
+// API:
+//
+// Enqueues the xfers into the device TX ring, the xfers will be
+// xfered one by one in the given order (each one taking a full
+// handshake cycle), without the need for consumer to provide the
+// next xfer via done_callback or to retry on SymSPI being busy.
+// After the ring xfer is xfered and postprocessed, SymSPI
+// automatically starts the next ring xfer (if any) instead of
+// returning to IDLE.
+//
+// Every ring xfer, when it's taken from the ring, becomes
+// the current (default) xfer, the same way as with
+// symspi_data_xchange(...), the done_callback/fail_callback of
+// the ring xfer are then used for it. The xfer is released to
+// consumer via xfer_accepted_callback right after it was taken
+// from the ring.
+//
+// NOTE: the ring xfers are taken from the ring only in sleepable
+//      context (SymSPI work), so xfer_accepted_callback stays
+//      sleepable for them as well, and this function only kicks
+//      the work when the link is IDLE.
+// NOTE: the ring xfer size must not exceed the max xfer size of the
+//      link (see SYMSPI_XFER_SIZE_MAX_BYTES and capabilities
+//      negotiation), bigger xfers are rejected with
+//      SYMSPI_ERROR_XFER_SIZE_TOO_BIG.
+//
+// @device {valid ptr to initialized symspi device}
+// @xfers {valid ptr to array of @count valid xfer pointers}
+//      the xfers to enqueue.
+//      OWNERSHIP: consumer, but every enqueued xfer is not to be
+//          touched by consumer till released via
+//          xfer_accepted_callback.
+// @count {>=0} the number of xfers in @xfers.
+// @force_size_change see symspi_data_xchange(...), applied to
+//      all given xfers.
+//
+// CONTEXT:
+//      any
+//
+// CONCURRENCE: single producer - consumer must not call this function
+//      concurrently for the same device.
+//
+// RETURNS:
+//      >= 0: the number of enqueued xfers (from @xfers beginning),
+//          can be less than @count if the ring got full
+//          (back-pressure).
+//      < 0: the negated error code
+//
+// ERRORS:
+//      ENODEV
+//      FULL_DUPLEX_ERROR_NOT_READY
+//      SYMSPI_ERROR_NO_XFER
+//      SYMSPI_ERROR_XFER_SIZE_TOO_BIG
+__maybe_unused
+int symspi_data_xchange_batch(void __kernel *device
+			      , struct full_duplex_xfer **xfers
+			      , size_t count
+			      , bool force_size_change)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("can't enqueue;", return -ENODEV);
+	SYMSPI_CHECK_NOT_CLOSING("will not enqueue"
+				 , return -FULL_DUPLEX_ERROR_NOT_READY);
+	SYMSPI_CHECK_PTR(xfers, return -SYMSPI_ERROR_NO_XFER);
+
+	const unsigned int head = symspi->p->tx_ring_head;
+	const unsigned int tail = smp_load_acquire(&symspi->p->tx_ring_tail);
+	const size_t space = CIRC_SPACE(head, tail, SYMSPI_TX_RING_SIZE);
+	const size_t to_enqueue = min_t(size_t, count, space);
+	size_t i;
+
+	for (i = 0; i < to_enqueue; i++) {
+		int res = symspi_verify_consumer_input(symspi, xfers[i], true);
+		if (res != SYMSPI_SUCCESS) {
+			symspi_err("Incorrect input at %zu xfer.", i);
+			return res;
+		}
+	}
+
+	for (i = 0; i < to_enqueue; i++) {
+		struct symspi_tx_ring_entry *entry = &symspi->p->tx_ring[
+				(head + i) & (SYMSPI_TX_RING_SIZE - 1)];
+		entry->xfer = xfers[i];
+		entry->force_size_change = force_size_change;
+	}
+
+	// publish the entries
+	smp_store_release(&symspi->p->tx_ring_head
+			  , (head + to_enqueue) & (SYMSPI_TX_RING_SIZE - 1));
+
+	// kick the xfer from the work (the ring xfer is taken and
+	// released to consumer in sleepable context), if we are busy,
+	// the ring will be processed upon returning to IDLE
+	if (to_enqueue > 0 && symspi_get_state(symspi) == SYMSPI_STATE_IDLE) {
+		__symspi_schedule_work(symspi, &symspi->p->next_xfer_work);
+	}
+
+	return (int)to_enqueue;
+}
+
+// API:
+//
+// Provides the oldest received frame from the RX ring (see
+// symspi_dev::rx_ready_callback). The frame stays in the ring
+// till symspi_rx_ring_release(...) is called.
+//
+// @device {valid ptr to initialized symspi device}
+// @size_bytes__out {NULL || valid ptr} the frame size is written here.
+// @xfer_id__out {NULL || valid ptr} the frame xfer id is written here.
+//
+// CONTEXT:
+//      any
+//
+// CONCURRENCE: single consumer - consumer must not call RX ring
+//      functions concurrently for the same device.
+//
+// RETURNS:
+//      valid ptr: to the frame data (valid till the frame released)
+//      NULL: if RX ring is empty
+//      ERR_PTR(negated error code): on failure
+//
+// ERRORS:
+//      ENODEV
+//      SYMSPI_ERROR_STATE: when not in RX ring mode
+__maybe_unused
+const void *symspi_rx_ring_peek(void __kernel *device
+				, size_t *size_bytes__out
+				, int *xfer_id__out)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("can't peek;", return ERR_PTR(-ENODEV));
+
+	if (!symspi->p->rx_ring_slab) {
+		symspi_err("not in RX ring mode.");
+		return ERR_PTR(-SYMSPI_ERROR_STATE);
+	}
+
+	const unsigned int head = smp_load_acquire(&symspi->p->rx_ring_head);
+	const unsigned int tail = symspi->p->rx_ring_tail;
+
+	if (CIRC_CNT(head, tail, SYMSPI_RX_RING_SIZE) == 0) {
+		return NULL;
+	}
+
+	const struct symspi_rx_ring_entry *entry = &symspi->p->rx_ring[tail];
+
+	if (size_bytes__out) {
+		*size_bytes__out = entry->size_bytes;
+	}
+	if (xfer_id__out) {
+		*xfer_id__out = entry->xfer_id;
+	}
+	return entry->data;
+}
+
+// API:
+//
+// Releases the oldest received frame in RX ring, so its buffer
+// can be reused by SymSPI.
+//
+// @device {valid ptr to initialized symspi device}
+//
+// CONTEXT:
+//      any
+//
+// CONCURRENCE: see symspi_rx_ring_peek(...)
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+//
+// ERRORS:
+//      ENODEV
+//      SYMSPI_ERROR_STATE: when not in RX ring mode
+//      ENODATA: when RX ring is empty
+__maybe_unused
+int symspi_rx_ring_release(void __kernel *device)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("can't release;", return -ENODEV);
+
+	if (!symspi->p->rx_ring_slab) {
+		symspi_err("not in RX ring mode.");
+		return -SYMSPI_ERROR_STATE;
+	}
+
+	const unsigned int head = smp_load_acquire(&symspi->p->rx_ring_head);
+	const unsigned int tail = symspi->p->rx_ring_tail;
+
+	if (CIRC_CNT(head, tail, SYMSPI_RX_RING_SIZE) == 0) {
+		return -ENODATA;
+	}
+
+	smp_store_release(&symspi->p->rx_ring_tail
+			  , (tail + 1) & (SYMSPI_RX_RING_SIZE - 1));
+
+	return SYMSPI_SUCCESS;
+}
+
+// API:
+//
+// Provides the number of received frames dropped cause RX ring was
+// full (see symspi_dev::rx_ready_callback), the same value as
+// rx_ring_overruns in the SymSPI stats procfs file.
+//
+// @device {valid ptr to initialized symspi device}
+//
+// CONTEXT:
+//      any
+//
+// RETURNS:
+//      the number of dropped frames since symspi_init(...)
+//      (0 if device is not initialized)
+__maybe_unused
+unsigned long long symspi_rx_ring_overruns(void __kernel *device)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("no overruns;", return 0);
+
+	unsigned long long overruns = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		overruns += READ_ONCE(per_cpu_ptr(symspi->p->info, cpu)
+				      ->rx_ring_overruns);
+	}
+	return overruns;
+}
+
+// API:
+//
+// Provides the back (inactive) TX buffer of the double-buffered
+// current xfer, so the consumer can write the next xfer data directly
+// into it. When an xfer with data_tx pointing to this buffer is
+// provided to symspi_data_xchange(...), symspi_default_data_update(...)
+// or returned as next xfer by done_callback, then SymSPI switches
+// current xfer to this buffer by swapping pointers, without copying
+// the data.
+//
+// After the switch the back buffer is the previously active one,
+// so consumer needs to acquire the buffer again for every next xfer.
+//
+// @device {valid ptr to initialized symspi device}
+// @size_bytes {>0} the size of the next xfer in bytes.
+//
+// CONTEXT:
+//      sleepable
+//
+// CONCURRENCE: the back buffer is owned by consumer from this call till
+//      the xfer which uses it is accepted by SymSPI, consumer should not
+//      call this function concurrently with the xfer data updates which
+//      provide the back buffer.
+//
+// RETURNS:
+//      valid ptr: to the back TX buffer of @size_bytes size
+//      ERR_PTR(negated error code): on failure
+//
+// ERRORS:
+//      ENODEV
+//      FULL_DUPLEX_ERROR_NOT_READY
+//      SYMSPI_ERROR_BUFFER_OWNERSHIP: in consumer owned buffers mode
+//      SYMSPI_ERROR_XFER_SIZE_ZERO
+//      SYMSPI_ERROR_XFER_SIZE_TOO_BIG
+//      SYMSPI_ERROR_NO_MEMORY
+__maybe_unused
+void *symspi_xfer_buffer_acquire(void __kernel *device
+				 , const size_t size_bytes)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("can't provide buffer;"
+					, return ERR_PTR(-ENODEV));
+	SYMSPI_CHECK_NOT_CLOSING("will not provide buffer"
+				 , return ERR_PTR(-FULL_DUPLEX_ERROR_NOT_READY));
+
+	if (symspi->consumer_owned_buffers) {
+		symspi_err("no back buffer in consumer owned buffers mode.");
+		return ERR_PTR(-SYMSPI_ERROR_BUFFER_OWNERSHIP);
+	}
+
+	if (size_bytes == 0) {
+		symspi_err("zero size buffer requested.");
+		return ERR_PTR(-SYMSPI_ERROR_XFER_SIZE_ZERO);
+	}
+	if (size_bytes > symspi->p->xfer_size_max_bytes) {
+		symspi_err("buffer size %zu exceeds max xfer size.", size_bytes);
+		return ERR_PTR(-SYMSPI_ERROR_XFER_SIZE_TOO_BIG);
+	}
+
+	struct full_duplex_xfer *back_xfer = &symspi->p->back_xfer;
+
+	symspi_do_resize_xfer(back_xfer, size_bytes
+			      , &symspi->p->back_xfer_capacity_bytes);
+	if (back_xfer->size_bytes == 0) {
+		symspi_err("no memory for back buffer.");
+		return ERR_PTR(-SYMSPI_ERROR_NO_MEMORY);
+	}
+
+	return back_xfer->data_tx;
 }
 
 const struct full_duplex_sym_iface symspi_full_duplex_iface = {
@@ -1352,9 +3147,12 @@ static void __symspi_error_report_init(struct symspi_dev *symspi)
 	SYMSPI_ERR_REC(11, IRQ_ACQUISITION, 0);
 	SYMSPI_ERR_REC(12, ISR_SETUP, 0);
 	SYMSPI_ERR_REC(13, WAIT_OTHER_SIDE, 5);
-#if SYMSPI_WQ_MODE_MATCH(PRIVATE)
+#if SYMSPI_WQ_MODE_MATCH(PRIVATE) || SYMSPI_WQ_MODE_MATCH(KTHREAD)
 	SYMSPI_ERR_REC(14, WORKQUEUE_INIT, 0);
 #endif
+	SYMSPI_ERR_REC(15, BUFFER_OWNERSHIP, 0);
+	SYMSPI_ERR_REC(16, XFER_SIZE_TOO_BIG, 0);
+	SYMSPI_ERR_REC(17, INTEGRITY, 5);
 
 #undef SYMSPI_ERR_REC
 }
@@ -1511,14 +3309,16 @@ static void __symspi_error_handle_(struct symspi_dev *symspi
 
 	// Update info/error statistics
 	if (err_no == SYMSPI_ERROR_OTHER_SIDE) {
-		symspi->p->info.other_side_indicated_errors += 1;
+		this_cpu_inc(symspi->p->info->other_side_indicated_errors);
 	} else if (err_no == SYMSPI_ERROR_WAIT_OTHER_SIDE) {
-		symspi->p->info.other_side_no_reaction_errors += 1;
+		this_cpu_inc(symspi->p->info->other_side_no_reaction_errors);
 	}
 
 	bool report = __symspi_error_report(symspi, err_no, sub_error_no
 					    , func_name);
 
+	__symspi_caps_on_error(symspi, err_no);
+
 	// NOTE: if error happened while we are in XFER state, we will
 	//      wait until SPI layer ends its xfer and returns with callback
 	//      and only then will goto ERROR state. Aborting SPI can be
@@ -1620,13 +3420,15 @@ static void __symspi_error_handle_(struct symspi_dev *symspi
 //      any
 static inline void __symspi_restart_timeout_timer(struct symspi_dev *symspi)
 {
+	const unsigned int timeout_ms
+		= symspi->p->params.their_flag_wait_timeout_msec;
 	const unsigned long expiration_time_jf
-		= jiffies + msecs_to_jiffies(SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC);
+		= jiffies + msecs_to_jiffies(timeout_ms);
 	mod_timer(&symspi->p->wait_timeout_timer, expiration_time_jf);
 	symspi_trace(
-		    "timer set: in %d ms, in %lu jiffies"
+		    "timer set: in %u ms, in %lu jiffies"
 		    " (at %lu jiffies), timer: %px, now: %lu jiffies"
-		    , SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC
+		    , timeout_ms
 		    , expiration_time_jf >= jiffies ? (expiration_time_jf - jiffies) : 0
 		    , expiration_time_jf
 		    , &symspi->p->wait_timeout_timer
@@ -1665,23 +3467,78 @@ static inline void __symspi_stop_timeout_timer_sync(struct symspi_dev *symspi)
 }
 
 
-// Launches error recovery on timeout
-static void __symspi_other_side_wait_timeout(struct timer_list *t)
-{
-	struct symspi_dev_private *priv = from_timer(priv, t, wait_timeout_timer);
-	struct symspi_dev *symspi = container_of(&priv, struct symspi_dev, p);
-
-	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided for recovery."
-					, return);
-	__symspi_error_handle(SYMSPI_ERROR_WAIT_OTHER_SIDE, 0);
-}
-
 // Helper.
-// Inits the workqueue which is to be used by SymSPI
-// in its current configuration. If we use system-provided
-// workqueu - does nothing.
+// Starts the flag silence timer, which finalizes the xfer cycle
+// (see symspi_to_idle_sequence(...)) from POSTPROCESSING state after
+// our flag stayed inactive for the required time.
 //
-// RETURNS:
+// To be called right after our flag drop.
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      SYMSPI_STATE_POSTPROCESSING
+static void __symspi_start_flag_silence_timer(struct symspi_dev *symspi
+					      , bool start_next_xfer)
+{
+	const u64 usecs = symspi->p->params.our_flag_inactive_min_time_usec;
+	const u64 variance
+		= SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_VARIANCE_PERCENT;
+
+	if (!usecs) {
+		symspi_to_idle_sequence(symspi, SYMSPI_STATE_POSTPROCESSING
+					, start_next_xfer, SYMSPI_SUCCESS);
+		return;
+	}
+
+	symspi->p->flag_silence_start_next_xfer = start_next_xfer;
+
+	// the same range as symspi_wait_flag_silence_period() uses
+	hrtimer_start_range_ns(&symspi->p->flag_silence_timer
+			, ns_to_ktime(((usecs * (100 - variance)) / 100)
+				      * NSEC_PER_USEC)
+			, ((usecs * 2 * variance) / 100) * NSEC_PER_USEC
+			, HRTIMER_MODE_REL);
+}
+
+// Finalizes the xfer cycle when our flag silence period is over.
+//
+// CONTEXT:
+//      can not sleep (hrtimer callback)
+static enum hrtimer_restart __symspi_flag_silence_timer_callback(
+		struct hrtimer *timer)
+{
+	struct symspi_dev_private *priv = container_of(timer
+			, struct symspi_dev_private, flag_silence_timer);
+	struct symspi_dev *symspi = priv->symspi;
+
+	// the next xfer start is deferred to the workqueue, as it can
+	// need sleepable context
+	__symspi_do_to_idle_sequence(symspi, SYMSPI_STATE_POSTPROCESSING
+				     , priv->flag_silence_start_next_xfer
+				     , SYMSPI_SUCCESS, true);
+
+	return HRTIMER_NORESTART;
+}
+
+// Launches error recovery on timeout
+static void __symspi_other_side_wait_timeout(struct timer_list *t)
+{
+	struct symspi_dev_private *priv = from_timer(priv, t, wait_timeout_timer);
+	struct symspi_dev *symspi = priv->symspi;
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided for recovery."
+					, return);
+	__symspi_error_handle(SYMSPI_ERROR_WAIT_OTHER_SIDE, 0);
+}
+
+// Helper.
+// Inits the workqueue which is to be used by SymSPI
+// in its current configuration. If we use system-provided
+// workqueu - does nothing.
+//
+// RETURNS:
 //      >= 0     - on success
 //      < 0     - negative error code
 //
@@ -1700,7 +3557,8 @@ static inline int __symspi_init_workqueue(
 	return SYMSPI_SUCCESS;
 #elif SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "using private wq");
-	symspi->p->work_queue = alloc_workqueue("symspi", WQ_HIGHPRI, 0);
+	symspi->p->work_queue = alloc_workqueue("symspi%d", WQ_HIGHPRI, 0
+						, symspi->index);
 
 	if (symspi->p->work_queue) {
 		return SYMSPI_SUCCESS;
@@ -1709,6 +3567,45 @@ static inline int __symspi_init_workqueue(
 				   , __func__);
 		return -SYMSPI_ERROR_WORKQUEUE_INIT;
 	}
+#elif SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "using kthread worker"
+		    ", prio: %d, cpu: %d", SYMSPI_KTHREAD_PRIO
+		    , SYMSPI_KTHREAD_CPU);
+
+	struct kthread_worker *kworker;
+
+	if (SYMSPI_KTHREAD_CPU >= 0) {
+		kworker = kthread_create_worker_on_cpu(SYMSPI_KTHREAD_CPU, 0
+						       , "symspi%d/%d"
+						       , symspi->index
+						       , SYMSPI_KTHREAD_CPU);
+	} else {
+		kworker = kthread_create_worker(0, "symspi%d"
+						, symspi->index);
+	}
+
+	if (IS_ERR(kworker)) {
+		symspi_err("%s: the kthread worker init failed: %ld"
+			   , __func__, PTR_ERR(kworker));
+		symspi->p->kworker = NULL;
+		return -SYMSPI_ERROR_WORKQUEUE_INIT;
+	}
+
+	const struct sched_param param = {
+		.sched_priority = SYMSPI_KTHREAD_PRIO
+	};
+	const int res = sched_setscheduler(kworker->task, SCHED_FIFO
+					   , &param);
+	if (res != 0) {
+		symspi_err("%s: failed to set SCHED_FIFO for kthread"
+			   " worker: %d", __func__, res);
+		kthread_destroy_worker(kworker);
+		symspi->p->kworker = NULL;
+		return -SYMSPI_ERROR_WORKQUEUE_INIT;
+	}
+
+	symspi->p->kworker = kworker;
+	return SYMSPI_SUCCESS;
 #endif
 }
 
@@ -1722,6 +3619,11 @@ static inline void __symspi_close_workqueue(
 #if SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	destroy_workqueue(symspi->p->work_queue);
 	symspi->p->work_queue = NULL;
+#elif SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	if (symspi->p->kworker) {
+		kthread_destroy_worker(symspi->p->kworker);
+		symspi->p->kworker = NULL;
+	}
 #else
 	(void)symspi;
 #endif
@@ -1733,7 +3635,7 @@ static inline void __symspi_close_workqueue(
 // Schedules SymSPI work to the target queue.
 static inline void __symspi_schedule_work(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work)
+		, struct symspi_work_struct *work)
 {
 #if SYMSPI_WQ_MODE_MATCH(SYSTEM)
 	(void)symspi;
@@ -1743,6 +3645,8 @@ static inline void __symspi_schedule_work(
 	queue_work(system_highpri_wq, work);
 #elif SYMSPI_WQ_MODE_MATCH(PRIVATE)
 	queue_work(symspi->p->work_queue, work);
+#elif SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	kthread_queue_work(symspi->p->kworker, work);
 #else
 #error no known SymSPI work queue mode defined
 #endif
@@ -1753,9 +3657,33 @@ static inline void __symspi_schedule_work(
 // need some custom queue operations on cancelling.
 static inline void __symspi_cancel_work_sync(
 		const struct symspi_dev *const symspi
-		, struct work_struct *work)
+		, struct symspi_work_struct *work)
+{
+#if SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	kthread_cancel_work_sync(work);
+#else
+	cancel_work_sync(work);
+#endif
+}
+
+// Helper.
+// Cancels the consumer work queued via __symspi_schedule_work(...)
+// after the device was closed (and so no more works are queued).
+//
+// NOTE: in KTHREAD mode the closed device worker is already gone,
+//      it has run all queued works before, and its pointer in the
+//      work must not be touched (the work is to be reinited with
+//      SYMSPI_INIT_WORK(...) before the next device start).
+static inline void __symspi_cancel_closed_work_sync(
+		const struct symspi_dev *const symspi
+		, struct symspi_work_struct *work)
 {
+	(void)symspi;
+#if SYMSPI_WQ_MODE_MATCH(KTHREAD)
+	(void)work;
+#else
 	cancel_work_sync(work);
+#endif
 }
 
 // Helper.
@@ -1776,9 +3704,13 @@ static inline bool __symspi_is_closing(struct symspi_dev *symspi)
 // NOTE: doesn't start the xfer
 // NOTE: doesn't return to IDLE state
 // NOTE: handles consumer data checks
+//
+// @pull_tx_ring if true, and @xfer is NULL, then the next TX ring
+//      xfer (if any) is taken as the new xfer.
 static int symspi_idle_to_xfer_prepare_sequence(struct full_duplex_xfer *xfer
 						, struct symspi_dev* symspi
-						, bool force_size_change)
+						, bool force_size_change
+						, bool pull_tx_ring)
 {
 	int res = symspi_verify_consumer_input(symspi, xfer, xfer != NULL);
 	if (res != SYMSPI_SUCCESS) {
@@ -1794,6 +3726,9 @@ static int symspi_idle_to_xfer_prepare_sequence(struct full_duplex_xfer *xfer
 		return -FULL_DUPLEX_ERROR_NOT_READY;
 	}
 
+	// resumes in parallel with xfer preparation
+	symspi_pm_wake(symspi);
+
 	res = symspi_try_to_error_sequence(symspi, SYMSPI_SUCCESS);
 	if (res != SYMSPI_SUCCESS) {
 		return res;
@@ -1805,8 +3740,118 @@ static int symspi_idle_to_xfer_prepare_sequence(struct full_duplex_xfer *xfer
 	// counter (and switching to ERROR state : TODO verify ERROR state switch
 	// status).
 
-	return symspi_update_xfer_sequence(symspi, xfer
-			, SYMSPI_STATE_XFER_PREPARE, force_size_change);
+	// And so we are the only TX ring reader now.
+	if (xfer || !pull_tx_ring || symspi_tx_ring_count(symspi) == 0) {
+		return symspi_update_xfer_sequence(symspi, xfer
+				, SYMSPI_STATE_XFER_PREPARE, force_size_change);
+	}
+
+	return symspi_tx_ring_pull_sequence(symspi, SYMSPI_STATE_XFER_PREPARE);
+}
+
+// Takes the next TX ring xfer (the ring must not be empty) as the
+// new current xfer, and releases it to consumer.
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      @original_state, we are the only TX ring reader there
+//
+// RETURNS:
+//      see symspi_update_xfer_sequence(...)
+static int symspi_tx_ring_pull_sequence(struct symspi_dev *symspi
+					, const int original_state)
+{
+	const unsigned int tail = symspi->p->tx_ring_tail;
+	struct symspi_tx_ring_entry *entry = &symspi->p->tx_ring[tail];
+	struct full_duplex_xfer *ring_xfer = entry->xfer;
+
+	const int res = symspi_update_xfer_sequence(symspi, ring_xfer
+			, original_state, entry->force_size_change);
+
+	// free the entry
+	smp_store_release(&symspi->p->tx_ring_tail
+			  , (tail + 1) & (SYMSPI_TX_RING_SIZE - 1));
+
+	// bound consumer buffers get released only on replacement
+	if (symspi->xfer_accepted_callback
+			&& (!symspi->consumer_owned_buffers
+			    || ring_xfer != symspi->p->bound_xfer)) {
+		symspi->xfer_accepted_callback(ring_xfer);
+	}
+
+	return res;
+}
+
+// Helper.
+// Copies the current xfer RX data into the RX ring and notifies
+// consumer. If the ring is full, then the data is dropped (counted
+// in rx_ring_overruns, the warning is ratelimited).
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      SYMSPI_STATE_POSTPROCESSING
+static void symspi_rx_ring_push(struct symspi_dev *symspi)
+{
+	const struct full_duplex_xfer *current_xfer
+			= &symspi->p->current_xfer;
+	const unsigned int head = symspi->p->rx_ring_head;
+	const unsigned int tail = smp_load_acquire(&symspi->p->rx_ring_tail);
+
+	if (CIRC_SPACE(head, tail, SYMSPI_RX_RING_SIZE) == 0) {
+		this_cpu_inc(symspi->p->info->rx_ring_overruns);
+		symspi_warning_ratelimited("RX ring overrun, frame dropped.");
+	} else {
+		struct symspi_rx_ring_entry *entry = &symspi->p->rx_ring[head];
+
+		memcpy(entry->data, current_xfer->data_rx_buf
+		       , current_xfer->size_bytes);
+		entry->size_bytes = current_xfer->size_bytes;
+		entry->xfer_id = current_xfer->id;
+		this_cpu_add(symspi->p->info->bytes_rx
+			     , current_xfer->size_bytes);
+
+		smp_store_release(&symspi->p->rx_ring_head
+				  , (head + 1) & (SYMSPI_RX_RING_SIZE - 1));
+	}
+
+	symspi->rx_ready_callback(symspi);
+}
+
+// Helper.
+// RETURNS:
+//      the number of xfers in the TX ring
+static inline unsigned int symspi_tx_ring_count(struct symspi_dev *symspi)
+{
+	return CIRC_CNT(smp_load_acquire(&symspi->p->tx_ring_head)
+			, symspi->p->tx_ring_tail, SYMSPI_TX_RING_SIZE);
+}
+
+// Helper.
+// Drops all xfers from TX ring, releasing them to consumer.
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      SYMSPI_STATE_COLD
+static void symspi_tx_ring_drain(struct symspi_dev *symspi)
+{
+	while (symspi_tx_ring_count(symspi) > 0) {
+		const unsigned int tail = symspi->p->tx_ring_tail;
+		struct full_duplex_xfer *ring_xfer
+				= symspi->p->tx_ring[tail].xfer;
+
+		smp_store_release(&symspi->p->tx_ring_tail
+				  , (tail + 1) & (SYMSPI_TX_RING_SIZE - 1));
+
+		if (symspi->xfer_accepted_callback) {
+			symspi->xfer_accepted_callback(ring_xfer);
+		}
+	}
 }
 
 // Helper function. No checks thus. Initializes the empty xfer.
@@ -1821,8 +3866,14 @@ static void symspi_xfer_init_empty(struct full_duplex_xfer *xfer)
 // with data from provided one. Both @target and @source should
 // be allocated. @source should be valid (which also means not
 // empty) xfer.
+//
+// @capacity_bytes {NULL || valid ptr} if not NULL, then @target
+//      buffers are grow-only and get preallocated to be at least of
+//      SYMSPI_XFER_PREALLOC_SIZE_BYTES size, the final capacity is
+//      written to it. If NULL, @target gets exactly sized buffers.
 static int symspi_xfer_init_copy(struct full_duplex_xfer *target
-				 , struct full_duplex_xfer *source)
+				 , struct full_duplex_xfer *source
+				 , size_t *capacity_bytes)
 {
 #ifdef SYMSPI_DEBUG
 	if (!target) {
@@ -1839,7 +3890,14 @@ static int symspi_xfer_init_copy(struct full_duplex_xfer *target
 	}
 #endif
 	symspi_xfer_init_empty(target);
-	symspi_do_resize_xfer(target, source->size_bytes);
+	if (capacity_bytes) {
+		*capacity_bytes = 0;
+		symspi_do_resize_xfer(target
+				      , max_t(size_t, source->size_bytes
+					      , SYMSPI_XFER_PREALLOC_SIZE_BYTES)
+				      , capacity_bytes);
+	}
+	symspi_do_resize_xfer(target, source->size_bytes, capacity_bytes);
 	if (target->size_bytes == 0) {
 		symspi_err("No memory for new xfer.");
 		return -SYMSPI_ERROR_NO_MEMORY;
@@ -1851,13 +3909,118 @@ static int symspi_xfer_init_copy(struct full_duplex_xfer *target
 }
 
 // Helper function.
-static void symspi_xfer_free(struct full_duplex_xfer *target)
+//
+// @capacity_bytes {NULL || valid ptr} the capacity of @target
+//      buffers (for grow-only buffers), is set to 0.
+static void symspi_xfer_free(struct full_duplex_xfer *target
+			     , size_t *capacity_bytes)
 {
-	symspi_do_resize_xfer(target, 0);
+	symspi_do_resize_xfer(target, 0, capacity_bytes);
 	target->done_callback = NULL;
 	target->consumer_data = NULL;
 }
 
+// Helper function. No checks thus. Swaps the data buffers (and
+// their sizes) of two xfers. Other xfer fields are untouched.
+static void symspi_xfer_swap_buffers(struct full_duplex_xfer *xfer_a
+				     , struct full_duplex_xfer *xfer_b)
+{
+	swap(xfer_a->data_tx, xfer_b->data_tx);
+	swap(xfer_a->data_rx_buf, xfer_b->data_rx_buf);
+	swap(xfer_a->size_bytes, xfer_b->size_bytes);
+}
+
+// Helper function ('do_'). Consumer owned buffers mode only.
+//
+// Binds the consumer xfer buffers directly to our current xfer
+// (and thus to underlying SPI transfer), no data is copied.
+// The previously bound consumer xfer (if any and if differs from
+// @new_xfer) is released to consumer via xfer_accepted_callback.
+//
+// @new_xfer {valid ptr} the consumer xfer to bind, should have
+//      valid TX and RX buffers.
+// @force_size_change see symspi_replace_xfer(...)
+//
+// RETURNS:
+//      >= 0     - on success
+//      < 0     - negative error code
+//
+// ERRORS:
+//      SYMSPI_ERROR_BUFFER_OWNERSHIP
+//      SYMSPI_ERROR_XFER_SIZE_MISMATCH
+static int symspi_do_bind_consumer_xfer(struct symspi_dev *symspi
+					, struct full_duplex_xfer *new_xfer
+					, bool force_size_change)
+{
+	struct full_duplex_xfer *curr_xfer = &(symspi->p->current_xfer);
+	struct full_duplex_xfer *prev_xfer = symspi->p->bound_xfer;
+
+	if (IS_ERR_OR_NULL(new_xfer->data_tx)
+			|| IS_ERR_OR_NULL(new_xfer->data_rx_buf)) {
+		symspi_err("%s: new xfer lacks TX or RX buffer."
+			   " Will not apply.", __func__);
+		return -SYMSPI_ERROR_BUFFER_OWNERSHIP;
+	}
+	// Other xfer can not use the buffers we still own,
+	// while the same xfer might be legally provided again.
+	if (new_xfer != prev_xfer && curr_xfer->size_bytes != 0
+		&& (regions_overlap(curr_xfer->data_tx, curr_xfer->size_bytes
+				    , new_xfer->data_tx, new_xfer->size_bytes)
+		    || regions_overlap(curr_xfer->data_rx_buf
+				       , curr_xfer->size_bytes
+				       , new_xfer->data_rx_buf
+				       , new_xfer->size_bytes))) {
+		symspi_err("%s: new xfer buffers are still owned by"
+			   " SymSPI via other xfer. Will not apply."
+			   , __func__);
+		return -SYMSPI_ERROR_BUFFER_OWNERSHIP;
+	}
+	if (curr_xfer->size_bytes != 0
+			&& curr_xfer->size_bytes != new_xfer->size_bytes
+			&& symspi_get_state(symspi) != SYMSPI_STATE_XFER
+			&& !force_size_change) {
+		symspi_err("%s: sudden change in xfer size"
+			   " while not in XFER state. Will"
+			   " not apply.", __func__);
+		return -SYMSPI_ERROR_XFER_SIZE_MISMATCH;
+	}
+
+	curr_xfer->data_tx = new_xfer->data_tx;
+	curr_xfer->data_rx_buf = new_xfer->data_rx_buf;
+	curr_xfer->size_bytes = new_xfer->size_bytes;
+	curr_xfer->id = new_xfer->id;
+	curr_xfer->done_callback = new_xfer->done_callback;
+	curr_xfer->fail_callback = new_xfer->fail_callback;
+	curr_xfer->consumer_data = new_xfer->consumer_data;
+	curr_xfer->xfers_counter = new_xfer->xfers_counter;
+	symspi->p->bound_xfer = new_xfer;
+
+	symspi_do_update_native_spi_xfer_data(symspi);
+
+	if (prev_xfer && prev_xfer != new_xfer
+			&& symspi->xfer_accepted_callback) {
+		symspi->xfer_accepted_callback(prev_xfer);
+	}
+
+	return SYMSPI_SUCCESS;
+}
+
+// Helper function ('do_'). Consumer owned buffers mode only.
+//
+// Unbinds the consumer xfer buffers from our current xfer and
+// returns them to consumer via xfer_accepted_callback.
+static void symspi_do_release_bound_xfer(struct symspi_dev *symspi)
+{
+	struct full_duplex_xfer *prev_xfer = symspi->p->bound_xfer;
+
+	symspi_xfer_init_empty(&symspi->p->current_xfer);
+	symspi->p->bound_xfer = NULL;
+
+	if (prev_xfer && symspi->xfer_accepted_callback) {
+		symspi->xfer_accepted_callback(prev_xfer);
+	}
+}
+
 #ifdef SYMSPI_DEBUG
 static void symspi_xfer_printout(struct full_duplex_xfer *xfer)
 {
@@ -1895,10 +4058,10 @@ static void symspi_printout(struct symspi_dev *symspi)
 		    , "xfer accepted callback: %px"
 		    , symspi->xfer_accepted_callback);
 	symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL
-		    , "symspi state: %d", (int)symspi->p->state);
+		    , "symspi state: %d", (int)symspi_get_state(symspi));
 	symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL
 		    , "their flag drop counter: %d"
-		    , symspi->p->their_flag_drop_counter);
+		    , symspi_their_flag_drop_counter(symspi));
 	if (symspi->p->spi_master_mode) {
 		symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL, "master mode");
 	} else {
@@ -1918,6 +4081,11 @@ static void symspi_printout(struct symspi_dev *symspi)
 
 // Helper function. Verifies the consumer input data for
 // symspi init procedure.
+//
+// NOTE: the xfer size is checked against the link max xfer size
+//      (negotiated, see symspi_caps_complete(...)), the device max
+//      one (SYMSPI_XFER_SIZE_MAX_BYTES) is used only while the device
+//      has no private part yet.
 // RETURNS:
 //      SYMSPI_SUCCESS if data is correct
 //      negaged error code if data is not correct
@@ -1949,10 +4117,26 @@ static int symspi_verify_consumer_input(struct symspi_dev *symspi
 		symspi_err("%s: Zero size default xfer.", __func__);
 		return -SYMSPI_ERROR_NO_XFER;
 	}
+
+	const size_t size_max = IS_ERR_OR_NULL(symspi->p)
+				? SYMSPI_XFER_SIZE_MAX_BYTES
+				: READ_ONCE(symspi->p->xfer_size_max_bytes);
+
+	if (xfer->size_bytes > size_max) {
+		symspi_err("%s: Default xfer size %d exceeds max xfer"
+			   " size %d.", __func__, (int)xfer->size_bytes
+			   , (int)size_max);
+		return -SYMSPI_ERROR_XFER_SIZE_TOO_BIG;
+	}
 	if (IS_ERR_OR_NULL(xfer->data_tx)) {
 		symspi_err("%s: Default xfer no TX data.", __func__);
 		return -SYMSPI_ERROR_NO_XFER;
 	}
+	if (symspi->consumer_owned_buffers
+			&& IS_ERR_OR_NULL(xfer->data_rx_buf)) {
+		symspi_err("%s: Default xfer no RX buffer.", __func__);
+		return -SYMSPI_ERROR_NO_XFER;
+	}
 
 	return SYMSPI_SUCCESS;
 }
@@ -1989,8 +4173,17 @@ static int symspi_init_gpio_irqs(struct symspi_dev *symspi)
 	unsigned long irq_flags = IRQF_TRIGGER_FALLING;
 	irq_flags |= (symspi->p->hardware_spi_rdy ? 0 : IRQF_TRIGGER_RISING);
 
-	int ret = request_irq(irqnr, symspi_their_flag_isr, irq_flags
-			      , SYMSPI_DRIVER_NAME, symspi);
+	symspi->p->edge_log_head = 0;
+	symspi->p->edge_log_tail = 0;
+	symspi->p->edge_log_resample = false;
+	symspi->p->their_flag_last_level = symspi_their_flag_is_set(symspi);
+
+	// NOTE: no IRQF_ONESHOT: the line must stay unmasked while
+	//      the thread replays the edges, otherwise we lose them
+	int ret = request_threaded_irq(irqnr, symspi_their_flag_isr
+				       , symspi_their_flag_isr_thread
+				       , irq_flags, SYMSPI_DRIVER_NAME
+				       , symspi);
 	if (ret < 0) {
 		symspi_err("%s: setup ISR failed, underlying error: %d\n"
 			   , __func__, ret);
@@ -2044,6 +4237,27 @@ static int symspi_xfer_prepare_to_waiting_prev_sequence(
 			    , return -SYMSPI_ERROR_LOGICAL);
 #endif
 
+	// our flag raise tells the other side that we are ready for
+	// the xfer, so the SPI device must be active by then; the work
+	// queue will resume the device and go on with the sequence
+	if (!symspi_pm_xfer_allowed(symspi)) {
+		return SYMSPI_SUCCESS;
+	}
+
+	return __symspi_xfer_prepare_to_waiting_prev_sequence(symspi);
+}
+
+// The same as symspi_xfer_prepare_to_waiting_prev_sequence(...), but
+// doesn't check the SPI device runtime PM status.
+//
+// CONTEXT:
+//      any
+//
+// STATE:
+//      SYMSPI_STATE_XFER_PREPARE -> SYMSPI_STATE_WAITING_PREV
+static int __symspi_xfer_prepare_to_waiting_prev_sequence(
+		struct symspi_dev *symspi)
+{
 	// TODO: Consider optimization to set the flag earlier to give other side
 	// more time to prepare for xfer.
 	symspi_our_flag_set(symspi);
@@ -2066,7 +4280,7 @@ static int symspi_xfer_prepare_to_waiting_prev_sequence(
 
 	// note, spi slave will bypass waiting prev state
 	// immediately to xfer state
-	if (symspi->p->their_flag_drop_counter == 1
+	if (symspi_their_flag_drop_counter(symspi) == 1
 			|| !symspi->p->spi_master_mode) {
 		return symspi_try_leave_waiting_prev_sequence(symspi);
 	}
@@ -2076,110 +4290,409 @@ static int symspi_xfer_prepare_to_waiting_prev_sequence(
 
 
 // Helper function. Updates underlying SPI layer transfer data
-// from our current xfer
+// from our current xfer: splits current xfer into the chain of
+// SPI transfers (of spi_xfer_chunk_bytes size at most) and
+// rebuilds the SPI message with the chain. Starts new TX payload
+// generation.
+//
+// NOTE: current xfer size must not exceed xfer_size_max_bytes.
 inline static void symspi_do_update_native_spi_xfer_data(
 		struct symspi_dev *symspi)
 {
-	struct spi_transfer *dst = &symspi->p->spi_xfer;
 	struct full_duplex_xfer *src = &symspi->p->current_xfer;
+	struct spi_message *msg = &symspi->p->spi_msg;
 
-	// this shall configure the transport level details
-	// of the transfer if it is needed
-	if (symspi->native_transfer_configuration_hook) {
-		symspi->native_transfer_configuration_hook(
-				    src, dst, sizeof(*dst));
+	if (!symspi->p->spi_xfers) {
+		return;
 	}
 
-	dst->tx_buf = src->data_tx;
-	dst->rx_buf = src->data_rx_buf;
-	dst->len = src->size_bytes;
-}
+	symspi->p->tx_generation++;
 
+	spi_message_init(msg);
+	msg->spi = symspi->spi;
+	// We will call consumer callback indirectly (through the
+	// work queue) from our.
+	msg->complete = &symspi_spi_xfer_done_callback;
+	msg->context = (void*)symspi;
 
-// Helper function ('do_'). Thus no checks.
-//
-// Resizes our xfer data.
-// If resize fails, frees xfer data and sets it's size to 0.
-//
-// PARAMS:
-//      @xfer {valid pointer to selfconsistent xfer} xfer
-//          might be empty, and then all its internal pointers
-//          should be NULL, and @size_bytes should be 0.
-//      @new_size_bytes { >= 0 } new xfer data size in bytes
-//          (size of one buffer)
-//
-// TODO: to implement growing-only allocation mode for the xfer
-//          to reduce real allocations amount and increase speed.
-//          Other option might be just pointers switching to
-//          switch the current xfer.
-// TODO: move all xfer accociated methods to the full_duplex_interface
-//      and make them globally accessible
-static void symspi_do_resize_xfer(struct full_duplex_xfer *xfer
-				  , const size_t new_size_bytes)
-{
-	if (xfer->size_bytes == new_size_bytes) {
-		return;
-	}
+	const size_t chunk = symspi->p->spi_xfer_chunk_bytes;
+	size_t offset = 0;
+	size_t i = 0;
 
-	xfer->size_bytes = new_size_bytes;
+	while (offset < src->size_bytes && i < symspi->p->spi_xfers_count) {
+		struct spi_transfer *dst = &symspi->p->spi_xfers[i];
 
-	if (new_size_bytes == 0) {
-		goto out_of_memory;
-	}
+		// this shall configure the transport level details
+		// of the transfer if it is needed
+		if (symspi->native_transfer_configuration_hook) {
+			symspi->native_transfer_configuration_hook(
+					    src, dst, sizeof(*dst));
+		}
 
-	// reallocating current xfer buffers
-	if (!(xfer->data_tx = krealloc(xfer->data_tx
-				       , new_size_bytes
-				       , GFP_KERNEL))) {
-		goto out_of_memory;
-	}
-	if (!(xfer->data_rx_buf = krealloc(xfer->data_rx_buf
-					   , new_size_bytes
-					   , GFP_KERNEL))) {
-		goto out_of_memory;
+		dst->tx_buf = src->data_tx + offset;
+		dst->rx_buf = src->data_rx_buf + offset;
+		dst->len = min_t(size_t, chunk, src->size_bytes - offset);
+		// keep CS active for the whole frame
+		dst->cs_change = 0;
+
+		spi_message_add_tail(dst, msg);
+
+		offset += dst->len;
+		i++;
 	}
 
-	return;
+	symspi->p->spi_xfers_used = i;
 
-out_of_memory:
-	kfree(xfer->data_tx);
-	kfree(xfer->data_rx_buf);
-	xfer->size_bytes = 0;
+	// the integrity trailer goes in the same frame right after
+	// the payload
+	if (symspi->p->integrity_trailer) {
+		struct spi_transfer *dst = &symspi->p->spi_xfers[i];
 
-	return;
+		if (symspi->native_transfer_configuration_hook) {
+			symspi->native_transfer_configuration_hook(
+					    src, dst, sizeof(*dst));
+		}
+
+		dst->tx_buf = symspi->p->integrity_trailer;
+		dst->rx_buf = symspi->p->integrity_trailer
+			      + SYMSPI_INTEGRITY_TRAILER_BYTES;
+		dst->len = SYMSPI_INTEGRITY_TRAILER_BYTES;
+		dst->cs_change = 0;
+
+		spi_message_add_tail(dst, msg);
+	}
 }
 
+#ifdef SYMSPI_INTEGRITY
 // Helper.
-// RETURNS:
-//      true if current default xfer exists and is not empty,
-//      else false.
-static inline bool symspi_is_current_xfer_ok(struct symspi_dev *symspi)
+// Computes the integrity trailer value of given data.
+static inline u32 __symspi_integrity_crc(const void *data, size_t size)
 {
-	return symspi && symspi->p
-		      && symspi->p->current_xfer.size_bytes
-		      && symspi->p->current_xfer.data_tx
-		      && symspi->p->current_xfer.data_rx_buf;
+	return ~crc32c(~0U, data, size);
 }
+#endif
 
-// Helper function, checks if memory regions overlap
+// Helper.
+// Fills the TX integrity trailer of the current xfer, if integrity
+// stage is enabled.
 //
-// RETURNS:
-//      true - if overlap, fals - else
-static inline bool regions_overlap(void *r_1, size_t size_1
-		, void *r_2, size_t size_2)
+// CONTEXT:
+//      any
+//
+// STATE:
+//      SYMSPI_STATE_XFER
+static inline void symspi_integrity_tx_seal(struct symspi_dev *symspi)
 {
-	return (r_2 < r_1 + size_1) && (r_2 + size_2 - 1 >= r_1);
+#ifndef SYMSPI_INTEGRITY
+	(void)symspi;
+#else
+	if (!symspi->p->integrity_trailer) {
+		return;
+	}
+	// the same TX payload, the same trailer
+	if (symspi->p->integrity_tx_generation == symspi->p->tx_generation) {
+		return;
+	}
+
+	const struct full_duplex_xfer *xfer = &symspi->p->current_xfer;
+	const __le32 crc = cpu_to_le32(__symspi_integrity_crc(xfer->data_tx
+							, xfer->size_bytes));
+
+	memcpy(symspi->p->integrity_trailer, &crc, sizeof(crc));
+	symspi->p->integrity_tx_generation = symspi->p->tx_generation;
+#endif
 }
 
-// Replaces our current xfer with newly provided one
-// (including the underlying SPI transfer data).
-//
-// NOTE:
-//      No one is assumed to using the current_xfer data
-//      at the moment of execution of this function.
-// NOTE:
-//      data_rx_buf is not zeroed, to not to waste
-//      resourses
+// Helper.
+// Verifies the RX integrity trailer of the current xfer, if integrity
+// stage is enabled.
+//
+// CONTEXT:
+//      any
+//
+// RETURNS:
+//      true: if received data is intact (or integrity stage is
+//          disabled)
+//      false: else
+static inline bool symspi_integrity_rx_check(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_INTEGRITY
+	(void)symspi;
+	return true;
+#else
+	if (!symspi->p->integrity_trailer) {
+		return true;
+	}
+
+	const struct full_duplex_xfer *xfer = &symspi->p->current_xfer;
+	__le32 crc;
+
+	memcpy(&crc, symspi->p->integrity_trailer
+		     + SYMSPI_INTEGRITY_TRAILER_BYTES, sizeof(crc));
+
+	return le32_to_cpu(crc) == __symspi_integrity_crc(xfer->data_rx_buf
+							  , xfer->size_bytes);
+#endif
+}
+
+// Helper. Inits the clock scaling state: the high speed SPI clock
+// (might be limited by the other side during capabilities
+// negotiation) and the low speed clock to start with.
+//
+// CONTEXT:
+//      sleepable, device is COLD
+static void __symspi_clock_init(struct symspi_dev *symspi)
+{
+	symspi->p->clock_ceiling_hz = symspi->spi->max_speed_hz;
+	if (SYMSPI_CLOCK_HIGH_HZ > 0) {
+		symspi->p->clock_ceiling_hz
+			= symspi->p->clock_ceiling_hz
+			  ? min_t(unsigned int, symspi->p->clock_ceiling_hz
+				  , SYMSPI_CLOCK_HIGH_HZ)
+			  : SYMSPI_CLOCK_HIGH_HZ;
+	}
+	symspi->p->clock_high = false;
+	symspi->p->clock_backlog_cycles = 0;
+	// forces the clock to be set on the next xfer
+	symspi->p->clock_applied_hz = 0;
+}
+
+// Helper. Selects the SPI clock for the next frame (SPI master only).
+//
+// CONTEXT:
+//      any
+//
+// STATE:
+//      SYMSPI_STATE_XFER
+//
+// RETURNS:
+//      the SPI clock to use (Hz)
+static inline unsigned int symspi_clock_select(struct symspi_dev *symspi)
+{
+	const unsigned int low_hz = SYMSPI_CLOCK_LOW_HZ;
+	const unsigned int ceiling_hz = READ_ONCE(symspi->p->clock_ceiling_hz);
+
+	if (ceiling_hz <= low_hz) {
+		return low_hz;
+	}
+
+	// big frames or queued backlog (ours or theirs) bring the link
+	// to high speed till the link gets idle
+	if (!symspi->p->clock_high
+			&& (symspi->p->current_xfer.size_bytes
+				>= SYMSPI_CLOCK_UP_FRAME_BYTES
+			    || symspi_tx_ring_count(symspi)
+				>= SYMSPI_CLOCK_UP_BACKLOG_FRAMES
+			    || symspi->p->clock_backlog_cycles
+				>= SYMSPI_CLOCK_UP_BACKLOG_FRAMES)) {
+		symspi->p->clock_high = true;
+	}
+
+	return symspi->p->clock_high ? ceiling_hz : low_hz;
+}
+
+// Helper. Applies the selected SPI clock to the SPI transfers of the
+// current xfer, if clock scaling is enabled. Does nothing if the clock
+// didn't change and SPI message was not rebuilt since last time.
+//
+// CONTEXT:
+//      any
+//
+// STATE:
+//      SYMSPI_STATE_XFER
+static inline void symspi_clock_apply(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_CLOCK_SCALING
+	(void)symspi;
+#else
+	// the clock belongs to SPI master
+	if (!symspi->p->spi_master_mode) {
+		return;
+	}
+
+	const unsigned int hz = symspi_clock_select(symspi);
+	const unsigned int applied_hz = symspi->p->clock_applied_hz;
+
+	if (hz == applied_hz && symspi->p->clock_applied_generation
+				== symspi->p->tx_generation) {
+		return;
+	}
+
+	// + the integrity trailer transfer
+	const size_t count = symspi->p->spi_xfers_used
+			     + (symspi->p->integrity_trailer ? 1 : 0);
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		symspi->p->spi_xfers[i].speed_hz = hz;
+	}
+
+	if (applied_hz != 0 && hz > applied_hz) {
+		this_cpu_inc(symspi->p->info->clock_ups);
+	} else if (hz < applied_hz) {
+		this_cpu_inc(symspi->p->info->clock_downs);
+	}
+
+	symspi->p->clock_applied_hz = hz;
+	symspi->p->clock_applied_generation = symspi->p->tx_generation;
+#endif
+}
+
+// Helper. Tracks the link backlog on the xfer cycle end: the cycle
+// which is immediately followed by the next one (our queued data or
+// their request) indicates the backlog, while the cycle followed by
+// the idle link drops the clock back to low speed.
+//
+// CONTEXT:
+//      any
+//
+// @busy true if the next xfer cycle follows immediately
+static inline void symspi_clock_on_cycle_end(struct symspi_dev *symspi
+					     , const bool busy)
+{
+#ifndef SYMSPI_CLOCK_SCALING
+	(void)symspi;
+	(void)busy;
+#else
+	if (busy) {
+		if (symspi->p->clock_backlog_cycles < UINT_MAX) {
+			symspi->p->clock_backlog_cycles++;
+		}
+		return;
+	}
+
+	symspi->p->clock_backlog_cycles = 0;
+	symspi->p->clock_high = false;
+#endif
+}
+
+
+// Helper function ('do_'). Thus no checks.
+//
+// Resizes our xfer data.
+// If resize fails, frees xfer data and sets it's size to 0.
+//
+// PARAMS:
+//      @xfer {valid pointer to selfconsistent xfer} xfer
+//          might be empty, and then all its internal pointers
+//          should be NULL, and @size_bytes should be 0.
+//      @new_size_bytes { >= 0 } new xfer data size in bytes
+//          (size of one buffer)
+//      @capacity_bytes {NULL || valid ptr}
+//          * NULL: the buffers are reallocated to exactly
+//            @new_size_bytes size on every size change.
+//          * valid ptr: to the current capacity of @xfer buffers
+//            (grow-only mode). The buffers are reallocated only
+//            when @new_size_bytes exceeds the capacity, otherwise
+//            only size is updated. Updated on reallocation. The
+//            zero @new_size_bytes frees the buffers anyway.
+//
+// TODO: move all xfer accociated methods to the full_duplex_interface
+//      and make them globally accessible
+static void symspi_do_resize_xfer(struct full_duplex_xfer *xfer
+				  , const size_t new_size_bytes
+				  , size_t *capacity_bytes)
+{
+	if (xfer->size_bytes == new_size_bytes) {
+		return;
+	}
+
+	if (new_size_bytes == 0) {
+		goto free_buffers;
+	}
+
+	if (capacity_bytes && new_size_bytes <= *capacity_bytes) {
+		xfer->size_bytes = new_size_bytes;
+		return;
+	}
+
+	// reallocating current xfer buffers
+	void *new_buf = krealloc(xfer->data_tx, new_size_bytes, GFP_KERNEL);
+	if (!new_buf) {
+		goto free_buffers;
+	}
+	xfer->data_tx = new_buf;
+
+	new_buf = krealloc(xfer->data_rx_buf, new_size_bytes, GFP_KERNEL);
+	if (!new_buf) {
+		goto free_buffers;
+	}
+	xfer->data_rx_buf = new_buf;
+
+	xfer->size_bytes = new_size_bytes;
+	if (capacity_bytes) {
+		*capacity_bytes = new_size_bytes;
+	}
+
+	return;
+
+free_buffers:
+	kfree(xfer->data_tx);
+	kfree(xfer->data_rx_buf);
+	xfer->data_tx = NULL;
+	xfer->data_rx_buf = NULL;
+	xfer->size_bytes = 0;
+	if (capacity_bytes) {
+		*capacity_bytes = 0;
+	}
+
+	return;
+}
+
+// Helper.
+// RETURNS:
+//      true if current default xfer exists and is not empty,
+//      else false.
+static inline bool symspi_is_current_xfer_ok(struct symspi_dev *symspi)
+{
+	return symspi && symspi->p
+		      && symspi->p->current_xfer.size_bytes
+		      && symspi->p->current_xfer.data_tx
+		      && symspi->p->current_xfer.data_rx_buf;
+}
+
+// Helper function, checks if memory regions overlap
+//
+// RETURNS:
+//      true - if overlap, fals - else
+static inline bool regions_overlap(void *r_1, size_t size_1
+		, void *r_2, size_t size_2)
+{
+	return (r_2 < r_1 + size_1) && (r_2 + size_2 - 1 >= r_1);
+}
+
+// Helper function ('do_'). Thus no checks.
+//
+// Copies the xfer metadata (everything except the data buffers
+// and size) from @src to @dst.
+static inline void symspi_do_copy_xfer_meta(struct full_duplex_xfer *dst
+					    , const struct full_duplex_xfer *src)
+{
+	// TODO: to make a bulk copy, to avoid naming members
+	//      (will avoid complications in debugging)
+	dst->id = src->id;
+	dst->done_callback = src->done_callback;
+	dst->fail_callback = src->fail_callback;
+	dst->consumer_data = src->consumer_data;
+	dst->xfers_counter = src->xfers_counter;
+}
+
+// Replaces our current xfer with newly provided one
+// (including the underlying SPI transfer data).
+//
+// If new xfer TX data is the back buffer (see
+// symspi_xfer_buffer_acquire(...)), then the current and back
+// buffers are swapped and no data is copied.
+//
+// In consumer owned buffers mode the new xfer buffers are bound
+// directly, see symspi_do_bind_consumer_xfer(...).
+//
+// NOTE:
+//      No one is assumed to using the current_xfer data
+//      at the moment of execution of this function.
+// NOTE:
+//      data_rx_buf is not zeroed, to not to waste
+//      resourses
 //
 // PARAMS:
 //      symspi
@@ -2211,6 +4724,8 @@ static inline bool regions_overlap(void *r_1, size_t size_1
 //      SYMSPI_ERROR_XFER_SIZE_MISMATCH
 //      SYMSPI_ERROR_NO_MEMORY
 //      SYMSPI_ERROR_OVERLAP
+//      SYMSPI_ERROR_BUFFER_OWNERSHIP
+//      SYMSPI_ERROR_XFER_SIZE_TOO_BIG
 //
 // DBG ERRORS:
 //      SYMSPI_ERROR_LOGICAL
@@ -2229,23 +4744,46 @@ inline static int symspi_replace_xfer(
 		symspi_err("%s: zero ptr to new xfer.", __func__);
 		return -SYMSPI_ERROR_LOGICAL;
 	}
-	if (symspi->p->state != SYMSPI_STATE_XFER_PREPARE
-			&& symspi->p->state != SYMSPI_STATE_XFER
-			&& symspi->p->state != SYMSPI_STATE_ERROR) {
+	const char state = symspi_get_state(symspi);
+	if (state != SYMSPI_STATE_XFER_PREPARE
+			&& state != SYMSPI_STATE_XFER
+			&& state != SYMSPI_STATE_ERROR) {
 		symspi_err("%s: was executed while not in XFER_PREPARE"
 			   " or XFER or ERROR state.", __func__);
 		return -SYMSPI_ERROR_LOGICAL;
 	}
 #endif
 	struct full_duplex_xfer *curr_xfer = &(symspi->p->current_xfer);
+	struct full_duplex_xfer *back_xfer = &(symspi->p->back_xfer);
+	const bool swap_buffers = back_xfer->data_tx
+				  && new_xfer->data_tx == back_xfer->data_tx;
 
 	if (new_xfer->size_bytes == 0) {
 		symspi_err("%s: new xfer orders 0 bytes new size."
 			   " Will not apply.", __func__);
 		return -SYMSPI_ERROR_XFER_SIZE_ZERO;
 	}
-	if (regions_overlap(curr_xfer->data_tx, curr_xfer->size_bytes
-			    , new_xfer->data_tx, new_xfer->size_bytes)) {
+	if (new_xfer->size_bytes > symspi->p->xfer_size_max_bytes) {
+		symspi_err("%s: new xfer size %d exceeds max xfer size %d."
+			   " Will not apply.", __func__
+			   , (int)new_xfer->size_bytes
+			   , (int)symspi->p->xfer_size_max_bytes);
+		return -SYMSPI_ERROR_XFER_SIZE_TOO_BIG;
+	}
+	if (symspi->consumer_owned_buffers) {
+		return symspi_do_bind_consumer_xfer(symspi, new_xfer
+						    , force_size_change);
+	}
+	if (swap_buffers && new_xfer->size_bytes > back_xfer->size_bytes) {
+		symspi_err("%s: new xfer size %d exceeds the acquired back"
+			   " buffer size %d. Will not apply.", __func__
+			   , (int)new_xfer->size_bytes
+			   , (int)back_xfer->size_bytes);
+		return -SYMSPI_ERROR_XFER_SIZE_MISMATCH;
+	}
+	if (!swap_buffers
+		&& regions_overlap(curr_xfer->data_tx, curr_xfer->size_bytes
+				   , new_xfer->data_tx, new_xfer->size_bytes)) {
 		symspi_err("%s: new and current xfers TX datas overlap."
 			   "Current data: %px, size %d;"
 			   "New data: %px, size %d."
@@ -2255,12 +4793,24 @@ inline static int symspi_replace_xfer(
 		return -SYMSPI_ERROR_OVERLAP;
 	}
 
+	// fast path: mostly idle links get the same (default) TX data
+	// all the time, then neither data copying nor SPI message
+	// rebuild (and native transfer configuration) is needed, and
+	// TX payload generation stays the same
+	if (!swap_buffers && curr_xfer->size_bytes == new_xfer->size_bytes
+			&& memcmp(curr_xfer->data_tx, new_xfer->data_tx
+				  , curr_xfer->size_bytes) == 0) {
+		symspi_do_copy_xfer_meta(curr_xfer, new_xfer);
+		this_cpu_inc(symspi->p->info->tx_unchanged_updates);
+		return SYMSPI_SUCCESS;
+	}
+
 	if (curr_xfer->size_bytes != new_xfer->size_bytes) {
 		// If consumer requested to change the xfer size, after
 		// previous xfer was closed, data race conditions and
 		// sync between sides loss may appear (if other side is
 		// not aware about this change).
-		if (symspi->p->state != SYMSPI_STATE_XFER
+		if (symspi_get_state(symspi) != SYMSPI_STATE_XFER
 				&& !force_size_change) {
 			symspi_err("%s: sudden change in xfer size"
 				   " while not in XFER state. Will"
@@ -2268,23 +4818,28 @@ inline static int symspi_replace_xfer(
 			return -SYMSPI_ERROR_XFER_SIZE_MISMATCH;
 		}
 
-		symspi_do_resize_xfer(curr_xfer, new_xfer->size_bytes);
+		if (!swap_buffers) {
+			symspi_do_resize_xfer(curr_xfer, new_xfer->size_bytes
+					, &symspi->p->current_xfer_capacity_bytes);
 
-		if (curr_xfer->size_bytes == 0) {
-			return -SYMSPI_ERROR_NO_MEMORY;
+			if (curr_xfer->size_bytes == 0) {
+				return -SYMSPI_ERROR_NO_MEMORY;
+			}
 		}
 	}
 
-	memcpy(curr_xfer->data_tx , new_xfer->data_tx
-	       , curr_xfer->size_bytes);
+	if (swap_buffers) {
+		// the back buffer is allocated with at least new xfer size
+		symspi_xfer_swap_buffers(curr_xfer, back_xfer);
+		swap(symspi->p->current_xfer_capacity_bytes
+		     , symspi->p->back_xfer_capacity_bytes);
+		curr_xfer->size_bytes = new_xfer->size_bytes;
+	} else {
+		memcpy(curr_xfer->data_tx , new_xfer->data_tx
+		       , curr_xfer->size_bytes);
+	}
 
-	// TODO: to make a bulk copy, to avoid naming members
-	//      (will avoid complications in debugging)
-	curr_xfer->id = new_xfer->id;
-	curr_xfer->done_callback = new_xfer->done_callback;
-	curr_xfer->fail_callback = new_xfer->fail_callback;
-	curr_xfer->consumer_data = new_xfer->consumer_data;
-	curr_xfer->xfers_counter = new_xfer->xfers_counter;
+	symspi_do_copy_xfer_meta(curr_xfer, new_xfer);
 
 	symspi_do_update_native_spi_xfer_data(symspi);
 
@@ -2324,10 +4879,12 @@ static int symspi_update_xfer_sequence(
 			res = SYMSPI_SUCCESS;
 		}
 
-		// will not recursively goto error state
+		// will not recursively goto error state; can be called
+		// in atomic context, so the timeout timer is not waited
+		// for and the next xfer (if any) is started from the work
 		if (original_state != SYMSPI_STATE_ERROR) {
-			symspi_to_idle_sequence(symspi, original_state
-						, false , res);
+			__symspi_do_to_idle_sequence(symspi, original_state
+						     , false , res, true);
 		}
 	}
 
@@ -2340,25 +4897,87 @@ static int symspi_update_xfer_sequence(
 inline static bool symspi_is_their_request(
 		struct symspi_dev __kernel *symspi)
 {
-	// see their_flag_drop_counter description
-	return symspi->p->their_flag_drop_counter == 1
+	// see symspi_dev_private::state_word description
+	return symspi_their_flag_drop_counter(symspi) == 1
 		    && symspi_their_flag_is_set(symspi);
 }
 
-// Small helper to get our state pointer from our general data
+// Small helper to get our state
 //
 // NOTE: only for internal use
-inline static char *symspi_get_state_ptr(void *symspi_dev)
+inline static char symspi_get_state(void *symspi_dev)
 {
-	return &(((struct symspi_dev *)symspi_dev)->p->state);
+	return SYMSPI_STATE_WORD_TO_STATE(atomic_read(
+			&((struct symspi_dev *)symspi_dev)->p->state_word));
 }
 
-// Small helper to get our state
+// Small helper to get their flag drop counter
+// (see symspi_dev_private::state_word).
 //
 // NOTE: only for internal use
-inline static char symspi_get_state(void *symspi_dev)
+inline static int symspi_their_flag_drop_counter(
+		struct symspi_dev *symspi)
+{
+	return SYMSPI_STATE_WORD_TO_COUNTER(
+			atomic_read(&symspi->p->state_word));
+}
+
+// Atomically sets their flag drop counter value, the state is kept
+// as is.
+//
+// NOTE: only for internal use
+inline static void symspi_their_flag_drop_counter_set(
+		struct symspi_dev *symspi, const int value)
+{
+	int old = atomic_read(&symspi->p->state_word);
+	int new;
+
+	do {
+		new = SYMSPI_STATE_WORD(SYMSPI_STATE_WORD_TO_STATE(old)
+					, value);
+	} while (!atomic_try_cmpxchg_release(&symspi->p->state_word
+					     , &old, new));
+}
+
+// Helper. The only primitive to switch the state in state word:
+// atomically replaces the state with @dst_state if and only if current
+// state == @expected_state and (if @expected_counter >= 0) their flag
+// drop counter == @expected_counter. Their flag drop counter is kept
+// as is.
+//
+// NOTE: the switch has release semantics (the data we have
+//      prepared in @expected_state is visible to the one who sees
+//      @dst_state), and on success it gets acquire semantics (we see
+//      the data prepared by the one who switched to @expected_state).
+//      This is what state machine needs, while full barrier
+//      (SEQ_CST) is not needed.
+//
+// RETURNS:
+//      true: if switch was done
+//      false: else
+static inline bool __symspi_state_word_switch(struct symspi_dev *symspi
+					      , const char expected_state
+					      , const char dst_state
+					      , const int expected_counter)
 {
-	return ((struct symspi_dev *)symspi_dev)->p->state;
+	int old = atomic_read(&symspi->p->state_word);
+	int new;
+
+	do {
+		if (SYMSPI_STATE_WORD_TO_STATE(old) != expected_state) {
+			return false;
+		}
+		if (expected_counter >= 0
+			&& SYMSPI_STATE_WORD_TO_COUNTER(old)
+			   != expected_counter) {
+			return false;
+		}
+		new = (old & ~SYMSPI_STATE_WORD_STATE_MASK) | dst_state;
+	} while (!atomic_try_cmpxchg_release(&symspi->p->state_word
+					     , &old, new));
+
+	smp_acquire__after_ctrl_dep();
+	return true;
 }
 
 // Atomically swiches the state from expected_state to
@@ -2374,11 +4993,26 @@ inline static char symspi_get_state(void *symspi_dev)
 inline static bool symspi_switch_strict(void *symspi_dev_ptr,
 	char expected_state, char dst_state)
 {
-	char *state_ptr = symspi_get_state_ptr(symspi_dev_ptr);
+	return __symspi_switch_strict(symspi_dev_ptr, expected_state
+				      , dst_state, -1);
+}
+
+// The same as symspi_switch_strict(...), but also requires
+// their flag drop counter to be equal to @expected_counter
+// (if @expected_counter >= 0) at the moment of switch, so there is
+// no window between the counter check and the switch.
+//
+// NOTE: only for internal use
+inline static bool __symspi_switch_strict(void *symspi_dev_ptr
+		, char expected_state
+		, char dst_state
+		, int expected_counter)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)symspi_dev_ptr;
 
 	// as closing request comes we can't do anything except
 	// leaving the XFER state
-	if (__symspi_is_closing((struct symspi_dev*)symspi_dev_ptr)) {
+	if (__symspi_is_closing(symspi)) {
 		// we should not change any state except XFER and we
 		// should change it to state other than XFER when closing
 		if (expected_state != SYMSPI_STATE_XFER
@@ -2386,21 +5020,21 @@ inline static bool symspi_switch_strict(void *symspi_dev_ptr,
 			return false;
 		}
 
-		__atomic_compare_exchange_n(state_ptr, &expected_state
-				, dst_state, false, __ATOMIC_SEQ_CST
-				, __ATOMIC_SEQ_CST);
+		__symspi_state_word_switch(symspi, expected_state
+					   , dst_state, -1);
 
 		// at this point we are in correct state for closing
 		// anyway ,
-		complete(&(((struct symspi_dev*)symspi_dev_ptr)
-				->p->final_leave_xfer_completion));
+		complete(&symspi->p->final_leave_xfer_completion);
 		return false;
 	}
 
-	bool res = __atomic_compare_exchange_n(state_ptr, &expected_state
-			, dst_state, false, __ATOMIC_SEQ_CST
-			, __ATOMIC_SEQ_CST);
+	bool res = __symspi_state_word_switch(symspi, expected_state
+					      , dst_state, expected_counter);
 	if (res) {
+		symspi_latency_on_switch(symspi, expected_state, dst_state);
+		trace_symspi_state_switch(symspi->index, expected_state
+					  , dst_state, false);
 		symspi_trace_raw(
 				"Switched from %d to %d", (int)expected_state
 				, (int)dst_state);
@@ -2410,7 +5044,8 @@ inline static bool symspi_switch_strict(void *symspi_dev_ptr,
 				, (int)expected_state
 				, (int)dst_state);
 		symspi_trace_raw(
-				"Current state: %d", (int)(*state_ptr));
+				"Current state: %d"
+				, (int)symspi_get_state(symspi));
 	}
 	return res;
 }
@@ -2424,23 +5059,43 @@ inline static bool symspi_switch_strict(void *symspi_dev_ptr,
 inline static char symspi_switch_state_val_forced(void *symspi_dev_ptr
 	, char dst_state)
 {
+	struct symspi_dev *symspi = (struct symspi_dev *)symspi_dev_ptr;
+
 	symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL
 		    , "Forced switching to %d.", (int)dst_state);
-	char *state_ptr = symspi_get_state_ptr(symspi_dev_ptr);
-	return __atomic_exchange_n(state_ptr, dst_state, __ATOMIC_SEQ_CST);
+
+	int old = atomic_read(&symspi->p->state_word);
+	int new;
+
+	do {
+		new = (old & ~SYMSPI_STATE_WORD_STATE_MASK) | dst_state;
+	} while (!atomic_try_cmpxchg_release(&symspi->p->state_word
+					     , &old, new));
+	smp_acquire__after_ctrl_dep();
+
+	const char old_state = SYMSPI_STATE_WORD_TO_STATE(old);
+
+	symspi_latency_on_switch(symspi, old_state, dst_state);
+	trace_symspi_state_switch(symspi->index, old_state, dst_state
+				  , true);
+	return old_state;
 }
 
-// TODO: not used for now, need performance tests to decide
 // Wrapper to launxh xfer. This wrapper is launched by
-// worker from work queue.
-static void symspi_do_xfer_work_wrapper(struct work_struct *work)
+// worker from work queue, when the xfer preparation was deferred
+// cause the SPI device was still resuming (see
+// symspi_pm_xfer_allowed(...)). Resumes the device and goes on with
+// the xfer preparation (our flag raise).
+static void symspi_do_xfer_work_wrapper(struct symspi_work_struct *work)
 {
 	SYMSPI_CHECK_WORK(work, return);
 
 	struct symspi_dev *symspi;
 	SYMSPI_GET_DEVICE_FROM_WORK(symspi, work, xfer_work);
 
-	symspi_do_xfer(symspi);
+	symspi_pm_resume_sync(symspi);
+
+	__symspi_xfer_prepare_to_waiting_prev_sequence(symspi);
 }
 
 
@@ -2484,12 +5139,32 @@ static int symspi_do_xfer(struct symspi_dev *symspi)
 	}
 #endif
 
+	// NOTE: the SPI device was resumed before our flag raise (see
+	//      symspi_xfer_prepare_to_waiting_prev_sequence(...)) and
+	//      we hold its usage reference since then
+
 	// dropping their flag falling edge counter right before xfer
-	__atomic_store_n(&symspi->p->their_flag_drop_counter
-			 , 0, __ATOMIC_SEQ_CST);
+	symspi_their_flag_drop_counter_set(symspi, 0);
+
+	struct spi_message *msg = &symspi->p->spi_msg;
+
+	// the very first xfer might be the capabilities frame
+	if (symspi->p->caps_state == SYMSPI_CAPS_NEGOTIATING) {
+		msg = &symspi->p->caps_spi_msg;
+		symspi->p->caps_xfer_in_flight = true;
+	} else {
+		symspi_integrity_tx_seal(symspi);
+		symspi_clock_apply(symspi);
+	}
+
+	// the xfer might be already done and replaced when spi_async(...)
+	// returns, so the traced values are taken beforehand
+	const int xfer_id = symspi->p->current_xfer.id;
+	const size_t xfer_size = symspi->p->current_xfer.size_bytes;
 
 	// note, SPI_READY flow is enabled/disabled at SPI init time
-	int res = spi_async(symspi->spi, &symspi->p->spi_msg);
+	int res = spi_async(symspi->spi, msg);
+	trace_symspi_spi_submit(symspi->index, xfer_id, xfer_size, res);
 	if (res == 0) {
 		return SYMSPI_SUCCESS;
 	}
@@ -2502,7 +5177,7 @@ static int symspi_do_xfer(struct symspi_dev *symspi)
 
 
 // Work wrapper for recovery sequence
-static void symspi_recovery_sequence_wrapper(struct work_struct *work)
+static void symspi_recovery_sequence_wrapper(struct symspi_work_struct *work)
 {
 	SYMSPI_CHECK_WORK(work, return);
 
@@ -2512,9 +5187,69 @@ static void symspi_recovery_sequence_wrapper(struct work_struct *work)
 	symspi_recovery_sequence(symspi);
 }
 
+// Work wrapper for recovery finalization sequence
+static void symspi_recovery_finish_wrapper(struct symspi_work_struct *work)
+{
+	SYMSPI_CHECK_WORK(work, return);
+
+	struct symspi_dev *symspi;
+	SYMSPI_GET_DEVICE_FROM_WORK(symspi, work, recover_finish_work);
+
+	symspi_recovery_finish_sequence(symspi);
+}
+
+// Work wrapper for the next xfer start deferred by the xfer cycle
+// finalization in atomic context (see __symspi_do_to_idle_sequence(...))
+// or by the TX ring submission (see symspi_data_xchange_batch(...)).
+static void symspi_next_xfer_work_wrapper(struct symspi_work_struct *work)
+{
+	SYMSPI_CHECK_WORK(work, return);
+
+	struct symspi_dev *symspi;
+	SYMSPI_GET_DEVICE_FROM_WORK(symspi, work, next_xfer_work);
+
+	// the xfer might have been already started by their request
+	// meanwhile, then there is nothing to do
+	if (symspi_get_state(symspi) != SYMSPI_STATE_IDLE) {
+		return;
+	}
+	symspi_data_xchange(symspi, NULL, false);
+}
+
+// Helper.
+// (Re)arms the recovery timer to expire in given time with
+// given variance.
+//
+// CONTEXT:
+//      any
+static void __symspi_recovery_timer_arm(struct symspi_dev *symspi
+					, const u64 usecs
+					, const u64 variance
+					, const bool restart)
+{
+	const ktime_t min_delay
+		= ns_to_ktime(((usecs * (100 - variance)) / 100)
+			      * NSEC_PER_USEC);
+	const u64 range_ns = ((usecs * 2 * variance) / 100) * NSEC_PER_USEC;
+
+	if (restart) {
+		hrtimer_set_expires_range_ns(&symspi->p->recovery_timer
+				, ktime_add(ktime_get(), min_delay), range_ns);
+	} else {
+		hrtimer_start_range_ns(&symspi->p->recovery_timer
+				, min_delay, range_ns, HRTIMER_MODE_REL);
+	}
+}
+
 // Attempts to restore the correct device state and bring
 // communication back.
 //
+// Only starts the recovery: drops our flag and launches the
+// recovery timer, which makes the rest of error indication to the
+// other side (see SYMSPI_ERROR_RECOVERY_PULSES) and waits for
+// recovery silence time without blocking the worker, and then
+// schedules symspi_recovery_finish_sequence().
+//
 // NOTE:
 //      not to be called from the timer directly, cause should
 //      wait for timer handler to exit.
@@ -2523,12 +5258,11 @@ static void symspi_recovery_sequence_wrapper(struct work_struct *work)
 //      sleepable
 //
 // RETURNS:
-//      0: (default recovery)/(consumer layer recovery action) was successfull
+//      0: recovery sequence started
 //      <0: negated error code, if recovery failed
 //
 // STATE
-//      SYMSPI_STATE_ERROR -> SYMSPI_STATE_IDLE (if recoverable)
-//                         -> or SYMSPI_STATE_COLD (if non recoverable)
+//      SYMSPI_STATE_ERROR
 // TODO: consider - the error can be triggered almost simultaneously
 //      from other side and from timer, so need to check for concurrence
 //      protection
@@ -2536,15 +5270,14 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 {
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("device data/pointer broken, "
 			"can't recover", return -ENODEV);
+	// always run from @recover_work
+	WARN_ON_ONCE(in_interrupt());
 	SYMSPI_CHECK_STATE(SYMSPI_STATE_ERROR, return -SYMSPI_ERROR_LOGICAL);
 
-	int error_code = symspi->p->last_error;
-	struct full_duplex_xfer *next_xfer = NULL;
-	struct full_duplex_xfer *current_xfer = &symspi->p->current_xfer;
-
+	const int error_code = symspi->p->last_error;
 	struct symspi_error_rec *e_ptr = __symspi_get_error_rec(symspi
 								, error_code);
-	bool report = e_ptr ? e_ptr->last_reported : true;
+	const bool report = e_ptr ? e_ptr->last_reported : true;
 
 	if (report) {
 		symspi_warning_raw("starting recovery of SymSPI, "
@@ -2553,26 +5286,104 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 
 	__symspi_stop_timeout_timer_sync(symspi);
 
-	// report about an error to the other side
-	symspi_our_flag_drop(symspi);
-	symspi_wait_flag_silence_period();
-	symspi_our_flag_set(symspi);
-	symspi_wait_flag_silence_period();
+	// report about an error to the other side, rest of the
+	// indication is done by recovery timer
 	symspi_our_flag_drop(symspi);
-	symspi_wait_flag_silence_period();
-	symspi_our_flag_set(symspi);
-	symspi_wait_flag_silence_period();
-	symspi_our_flag_drop(symspi);
-	symspi_wait_flag_silence_period();
 
-	// idle time of scilence to give other side time to react
-	const unsigned long idle_time_us
-		= SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS * 1000;
-	const int variance
-		= SYMSPI_ERROR_RECOVERY_SILENCE_TIME_VARIANCE_PERCENT;
-	// we allow 10% of variance in sleeping time
-	usleep_range((idle_time_us * (100 - variance)) / 100
-		     , (idle_time_us * (100 + variance)) / 100);
+	// NOTE: always >= 1 (see SYMSPI_ERROR_RECOVERY_PULSES)
+	const unsigned int pulses = symspi->p->params.error_recovery_pulses;
+	symspi->p->recovery_edges_left = 2 * pulses;
+
+	__symspi_recovery_timer_arm(symspi
+		, symspi->p->params.our_flag_inactive_min_time_usec
+		, SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_VARIANCE_PERCENT
+		, false);
+
+	return SYMSPI_SUCCESS;
+}
+
+// Makes the next step of error indication to the other side.
+// When all our flag edges are done, waits for flag silence and
+// recovery silence time, and then schedules the recovery
+// finalization.
+//
+// CONTEXT:
+//      can not sleep (hrtimer callback)
+//
+// STATE
+//      SYMSPI_STATE_ERROR
+static enum hrtimer_restart __symspi_recovery_timer_callback(
+		struct hrtimer *timer)
+{
+	struct symspi_dev_private *priv = container_of(timer
+			, struct symspi_dev_private, recovery_timer);
+	struct symspi_dev *symspi = priv->symspi;
+
+	// device is closing
+	if (symspi_get_state(symspi) != SYMSPI_STATE_ERROR) {
+		return HRTIMER_NORESTART;
+	}
+
+	if (priv->recovery_edges_left == 0) {
+		__symspi_schedule_work(symspi, &priv->recover_finish_work);
+		return HRTIMER_NORESTART;
+	}
+
+	priv->recovery_edges_left--;
+
+	// odd number of edges left: raise, even: drop,
+	// so we always end up with our flag dropped
+	if (priv->recovery_edges_left % 2) {
+		symspi_our_flag_set(symspi);
+	} else {
+		symspi_our_flag_drop(symspi);
+	}
+
+	if (priv->recovery_edges_left) {
+		__symspi_recovery_timer_arm(symspi
+			, priv->params.our_flag_inactive_min_time_usec
+			, SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_VARIANCE_PERCENT
+			, true);
+	} else {
+		// idle time of silence to give other side time to react
+		__symspi_recovery_timer_arm(symspi
+			, priv->params.our_flag_inactive_min_time_usec
+			  + priv->params.error_recovery_silence_time_ms
+			    * 1000ULL
+			, SYMSPI_ERROR_RECOVERY_SILENCE_TIME_VARIANCE_PERCENT
+			, true);
+	}
+
+	return HRTIMER_RESTART;
+}
+
+// Finalizes the recovery after error indication to the other
+// side is done: consults the consumer about the next xfer and
+// brings communication back.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      0: (default recovery)/(consumer layer recovery action) was successfull
+//      <0: negated error code, if recovery failed
+//
+// STATE
+//      SYMSPI_STATE_ERROR -> SYMSPI_STATE_IDLE (if recoverable)
+//                         -> or SYMSPI_STATE_COLD (if non recoverable)
+static int symspi_recovery_finish_sequence(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("device data/pointer broken, "
+			"can't recover", return -ENODEV);
+	SYMSPI_CHECK_STATE(SYMSPI_STATE_ERROR, return -SYMSPI_ERROR_LOGICAL);
+
+	int error_code = symspi->p->last_error;
+	struct full_duplex_xfer *next_xfer = NULL;
+	struct full_duplex_xfer *current_xfer = &symspi->p->current_xfer;
+
+	struct symspi_error_rec *e_ptr = __symspi_get_error_rec(symspi
+								, error_code);
+	bool report = e_ptr ? e_ptr->last_reported : true;
 
 	if (!IS_ERR_OR_NULL(current_xfer->fail_callback)) {
 		next_xfer = current_xfer->fail_callback(
@@ -2597,8 +5408,11 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 						      , true);
 
 		// we need to indicate to consumer that next_xfer
-		// will not be used by us any more
-		if (symspi->xfer_accepted_callback) {
+		// will not be used by us any more (bound consumer
+		// buffers get released only on replacement)
+		if (symspi->xfer_accepted_callback
+				&& (!symspi->consumer_owned_buffers
+				    || next_xfer != symspi->p->bound_xfer)) {
 			symspi->xfer_accepted_callback(next_xfer);
 		}
 
@@ -2615,8 +5429,7 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 	}
 
 	// dropping their error indication
-	__atomic_store_n(&symspi->p->their_flag_drop_counter
-			 , 1, __ATOMIC_SEQ_CST);
+	symspi_their_flag_drop_counter_set(symspi, 1);
 
 	symspi->p->last_error = SYMSPI_SUCCESS;
 	if (report) {
@@ -2629,13 +5442,21 @@ static int symspi_recovery_sequence(struct symspi_dev *symspi)
 // Helper.
 // Waits for appropriate flag silence period (to make
 // other side to detect the drop-raise or raise-drop sequence)
-static void symspi_wait_flag_silence_period()
+//
+// CONTEXT:
+//      sleepable (never reached from timers/ISRs, see
+//      __symspi_do_to_idle_sequence(...))
+static void symspi_wait_flag_silence_period(struct symspi_dev *symspi)
 {
+	if (WARN_ON_ONCE(in_interrupt())) {
+		return;
+	}
+
 	// the delay is needed to make other side detect our flag
 	// raise and drop, otherwise other side may not detect the
 	// drop-raise of our flag
 	const unsigned long usecs
-		= SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC;
+		= symspi->p->params.our_flag_inactive_min_time_usec;
 	const unsigned int variance
 		= SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_VARIANCE_PERCENT;
 	if (usecs) {
@@ -2673,22 +5494,24 @@ static void symspi_our_flag_drop(struct symspi_dev *symspi)
 			      : !SYMSPI_SLAVE_FLAG_ACTIVE_VALUE);
 }
 
+// Helper. The same as symspi_their_flag_is_set(...), but without
+// tracing, for polling loops.
+inline static bool __symspi_their_flag_is_set(struct symspi_dev *symspi)
+{
+	// NOTE: we test against other side
+	return (symspi->p->spi_master_mode
+			? SYMSPI_SLAVE_FLAG_ACTIVE_VALUE
+			: SYMSPI_MASTER_FLAG_ACTIVE_VALUE)
+	       == gpiod_get_raw_value(symspi->gpiod_their_flag);
+}
+
 // Returns status of their flag (true: ACTIVE; false: INACTIVE)
 inline static bool symspi_their_flag_is_set(struct symspi_dev *symspi)
 {
-	// NOTE: we test against other side
-	symspi_trace("Their flag raw value: %d"
-		    , gpiod_get_raw_value(symspi->gpiod_their_flag));
-	if ((symspi->p->spi_master_mode ? SYMSPI_SLAVE_FLAG_ACTIVE_VALUE
-					: SYMSPI_MASTER_FLAG_ACTIVE_VALUE)
-			== gpiod_get_raw_value(symspi->gpiod_their_flag)) {
-		symspi_trace("Their flag is SET");
-	} else {
-		symspi_trace("Their flag is NOT SET");
-	}
-	return (symspi->p->spi_master_mode ? SYMSPI_SLAVE_FLAG_ACTIVE_VALUE
-					   : SYMSPI_MASTER_FLAG_ACTIVE_VALUE)
-		== gpiod_get_raw_value(symspi->gpiod_their_flag);
+	const bool is_set = __symspi_their_flag_is_set(symspi);
+
+	symspi_trace("Their flag %s", is_set ? "SET" : "NOT SET");
+	return is_set;
 }
 
 
@@ -2737,15 +5560,21 @@ static int symspi_try_leave_waiting_prev_sequence(
 		return symspi_do_xfer(symspi);
 	}
 
-	// master spi
+	// master spi: we leave WAITING_PREV only if other side is done
+	// with the previous xfer (exactly one their flag drop), checked
+	// atomically with the switch, so concurrent error indication
+	// (second drop) wins
 	if (symspi->p->hardware_spi_rdy) {
-		if (SYMSPI_SWITCH_STRICT(WAITING_PREV, XFER)) {
+		if (__symspi_switch_strict(symspi, SYMSPI_STATE_WAITING_PREV
+					   , SYMSPI_STATE_XFER, 1)) {
 			__symspi_stop_timeout_timer(symspi);
 			return symspi_do_xfer(symspi);
 		}
-	} else if (SYMSPI_SWITCH_STRICT(WAITING_PREV, WAITING_RDY)) {
+	} else if (__symspi_switch_strict(symspi, SYMSPI_STATE_WAITING_PREV
+					  , SYMSPI_STATE_WAITING_RDY, 1)) {
 		__symspi_restart_timeout_timer(symspi);
-		if (symspi_is_their_request(symspi)) {
+		if (symspi_is_their_request(symspi)
+				|| symspi_busy_poll_their_flag(symspi)) {
 			return symspi_try_leave_waiting_rdy_sequence(symspi);
 		}
 	}
@@ -2753,6 +5582,59 @@ static int symspi_try_leave_waiting_prev_sequence(
 	return SYMSPI_SUCCESS;
 }
 
+// Helper. Busy-waits (for not longer than busy poll budget, see
+// SYMSPI_BUSY_POLL_USEC) for their flag to be set while we are in
+// WAITING_RDY state, so the xfer is started without waiting for their
+// flag interrupt. If budget is over, then their flag ISR will
+// handle the transition as usual.
+//
+// NOTE: only WAITING_RDY is polled: their flag drops (WAITING_PREV)
+//      are counted by ISR for error detection, so getting ahead of
+//      the ISR there would make the late counted drop look like
+//      the other side error indication.
+// NOTE: the set edge we got ahead of is still replayed by the IRQ
+//      thread later, when the cycle might already be IDLE, it is
+//      told from the new request of the other side by their flag
+//      drop counter (see symspi_their_flag_set_isr_sequence(...)).
+// NOTE: in interrupt context (say hrtimer) or with IRQs disabled
+//      the budget is capped to SYMSPI_BUSY_POLL_ATOMIC_MAX_USEC.
+//
+// CONTEXT:
+//      any (spins, doesn't sleep)
+//
+// RETURNS:
+//      true: their flag got set within the budget
+//      false: budget is over, disabled, or we left WAITING_RDY
+static bool symspi_busy_poll_their_flag(struct symspi_dev *symspi)
+{
+	unsigned int budget_us = READ_ONCE(symspi->p->params.busy_poll_usec);
+
+	if (budget_us == 0) {
+		return false;
+	}
+	if (in_interrupt() || irqs_disabled()) {
+		budget_us = min_t(unsigned int, budget_us
+				  , SYMSPI_BUSY_POLL_ATOMIC_MAX_USEC);
+	}
+
+	const ktime_t deadline = ktime_add_us(ktime_get(), budget_us);
+	bool is_set = false;
+
+	while (symspi_get_state(symspi) == SYMSPI_STATE_WAITING_RDY) {
+		if (__symspi_their_flag_is_set(symspi)) {
+			is_set = true;
+			break;
+		}
+		if (ktime_after(ktime_get(), deadline)) {
+			break;
+		}
+		cpu_relax();
+	}
+
+	symspi_trace("Their flag busy poll: %s", is_set ? "SET" : "NOT SET");
+	return is_set;
+}
+
 // Tries to leave the waiting ready state.
 //
 // To be called when conditions for transition are fulfilled.
@@ -2830,7 +5712,7 @@ static void symspi_inc_current_xfer_counter(struct symspi_dev *symspi)
 // CONTEXT:
 //      sleepable
 //
-static void symspi_postprocessing_sequence(struct work_struct *work)
+static void symspi_postprocessing_sequence(struct symspi_work_struct *work)
 {
 	struct symspi_dev *symspi = NULL;
 
@@ -2851,9 +5733,27 @@ static void symspi_postprocessing_sequence(struct work_struct *work)
 	struct full_duplex_xfer *next_xfer = NULL;
 	bool start_immediately = false;
 
+	// capabilities frame is ours, consumer data was not xfered
+	// yet, so we start the next xfer right after it
+	if (symspi->p->caps_frame_received) {
+		symspi->p->caps_frame_received = false;
+		symspi_caps_complete(symspi);
+		symspi_our_flag_drop(symspi);
+		__symspi_start_flag_silence_timer(symspi, true);
+		return;
+	}
+
 	symspi_inc_current_xfer_counter(symspi);
 
 	// notify, provide data to our consumer and optionally get new
+	// (in RX ring mode consumer gets the data from RX ring in its
+	// own context, and provides new data via TX ring, API, or
+	// synchronously via done_callback, if it is set)
+	if (symspi->rx_ready_callback) {
+		symspi_rx_ring_push(symspi);
+	} else if (current_xfer->done_callback) {
+		this_cpu_add(symspi->p->info->bytes_rx, current_xfer->size_bytes);
+	}
 	if (current_xfer->done_callback) {
 		next_xfer = current_xfer->done_callback(
 				current_xfer, symspi->p->next_xfer_id
@@ -2881,27 +5781,38 @@ static void symspi_postprocessing_sequence(struct work_struct *work)
 					, true);
 
 		// we need to indicate to consumer that next_xfer
-		// will not be used by us any more
-		if (symspi->xfer_accepted_callback) {
+		// will not be used by us any more (bound consumer
+		// buffers get released only on replacement)
+		if (symspi->xfer_accepted_callback
+				&& (!symspi->consumer_owned_buffers
+				    || next_xfer != symspi->p->bound_xfer)) {
 			symspi->xfer_accepted_callback(next_xfer);
 		}
 
 		if (res != SYMSPI_SUCCESS) {
 			symspi_our_flag_drop(symspi);
-			symspi_wait_flag_silence_period();
+			symspi_wait_flag_silence_period(symspi);
 			return;
 		};
 	}
 
+	// within the burst we go to the next frame directly
+	// skipping the flag silence period, as long as we have new data
+	const bool has_new_data = next_xfer || start_immediately
+				  || symspi->p->delayed_xfer_request
+				  || symspi_tx_ring_count(symspi) > 0;
+
+	if (symspi_burst_next_frame_sequence(symspi, has_new_data)) {
+		return;
+	}
+
 	symspi_our_flag_drop(symspi);
-	symspi_wait_flag_silence_period();
 
-	// And only after postprocessing of the data is done, then
-	// the xfer cycle is really done, so we move either to IDLE state
-	// or to next xfer.
-	symspi_to_idle_sequence(symspi, SYMSPI_STATE_POSTPROCESSING
-				, start_immediately
-				, SYMSPI_SUCCESS);
+	// And only after postprocessing of the data is done and our
+	// flag stayed inactive long enough, then the xfer cycle is really
+	// done, so we move either to IDLE state or to next xfer (from the
+	// flag silence timer, not to block the workqueue).
+	__symspi_start_flag_silence_timer(symspi, start_immediately);
 
 	return;
 
@@ -2918,6 +5829,72 @@ error_handling:
 				, FULL_DUPLEX_ERROR_NO_DEVICE_PROVIDED);
 }
 
+// Starts the next frame of the current burst if the burst is not
+// finished yet and we have new data for it. The frame is handshaked
+// as usual: our flag drop (kept for burst frame gap only, see
+// SYMSPI_BURST_FRAMES) tells the other side that we are done with
+// the previous frame, and then the xfer preparation raises our flag
+// when we are ready for the next one, so SPI master never starts the
+// frame before SPI slave indicates its readiness.
+//
+// @has_new_data true if consumer provided new data (or asked for the
+//      next xfer) for the next frame, otherwise burst ends.
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      SYMSPI_STATE_POSTPROCESSING -> SYMSPI_STATE_XFER_PREPARE -> ...
+//          when burst continues
+//
+// RETURNS:
+//      true: if the xfer cycle is handled here (next frame of the
+//          burst was started or error handling was triggered),
+//      false: if burst is over (or no burst mode) and ordinary
+//          xfer cycle finalization is to be done by caller.
+static bool symspi_burst_next_frame_sequence(struct symspi_dev *symspi
+					     , const bool has_new_data)
+{
+	// always run from @postprocessing_work
+	WARN_ON_ONCE(in_interrupt());
+
+	symspi->p->burst_frames_done++;
+
+	if (symspi->p->burst_frames_done >= symspi->p->burst_frames
+			|| !has_new_data) {
+		return false;
+	}
+
+	// TX ring data goes to the next frame, as it would do on
+	// the next xfer cycle start
+	if (symspi_tx_ring_count(symspi) > 0) {
+		symspi_tx_ring_pull_sequence(symspi
+					     , SYMSPI_STATE_POSTPROCESSING);
+		// the xfer cycle was finalized on failure
+		if (symspi_get_state(symspi) != SYMSPI_STATE_POSTPROCESSING) {
+			return true;
+		}
+	}
+	symspi->p->delayed_xfer_request = false;
+
+	symspi_our_flag_drop(symspi);
+
+	// other side must see both our flag edges
+	const unsigned int gap_usec = symspi->p->params.burst_frame_gap_usec;
+	if (gap_usec > 0) {
+		usleep_range(gap_usec, gap_usec + gap_usec / 10 + 1);
+	}
+
+	if (!SYMSPI_SWITCH_STRICT(POSTPROCESSING, XFER_PREPARE)) {
+		// someone moved us out of POSTPROCESSING (error handling)
+		return true;
+	}
+
+	symspi_xfer_prepare_to_waiting_prev_sequence(symspi);
+
+	return true;
+}
+
 // Goes to error processing path if there is any error detected/provided.
 //
 // To be called when error detected or when external error absence
@@ -2937,7 +5914,7 @@ error_handling:
 static int symspi_try_to_error_sequence(struct symspi_dev *symspi
 					, int internal_error)
 {
-	bool other_side_error = (symspi->p->their_flag_drop_counter > 1);
+	bool other_side_error = (symspi_their_flag_drop_counter(symspi) > 1);
 
 	if (internal_error != SYMSPI_SUCCESS || other_side_error) {
 		int err_no = (internal_error == SYMSPI_SUCCESS)
@@ -2959,7 +5936,8 @@ static int symspi_try_to_error_sequence(struct symspi_dev *symspi
 //
 // NOTE:
 //      not to be called (directly or indirectly from timer) cause
-//      waits for timer handler to exit.
+//      waits for timer handler to exit. Use __symspi_to_idle_sequence
+//      from timer/atomic contexts.
 //
 // RETURNS:
 //      0 on success
@@ -2992,11 +5970,64 @@ static int symspi_to_idle_sequence(struct symspi_dev *symspi
 	// returning to the IDLE state.
 	__symspi_stop_timeout_timer_sync(symspi);
 
+	return __symspi_to_idle_sequence(symspi, original_state
+					 , start_next_xfer, internal_error);
+}
+
+// The same as symspi_to_idle_sequence(...) but doesn't wait for
+// the timeout timer handler to exit (only stops the timer).
+//
+// CONTEXT:
+//      sleepable (the next xfer start might resize xfer buffers),
+//      see __symspi_do_to_idle_sequence(...) for atomic context
+static int __symspi_to_idle_sequence(struct symspi_dev *symspi
+				     , const int original_state
+				     , bool start_next_xfer
+				     , const int internal_error)
+{
+	return __symspi_do_to_idle_sequence(symspi, original_state
+					    , start_next_xfer, internal_error
+					    , false);
+}
+
+// Helper. Finalizes the xfer cycle, see __symspi_to_idle_sequence(...).
+//
+// @defer_next_xfer if true, then the next xfer (if needed) is started
+//      from @next_xfer_work instead of being started right away.
+//
+// NOTE: in atomic context (say @flag_silence_timer hard IRQ callback)
+//      the error branch only switches the state to ERROR and schedules
+//      @recover_work (see __symspi_error_handle_(...)), so all the
+//      recovery steps run from the work and @recovery_timer, and no
+//      sleeping path (burst, flag silence wait) is reached from here:
+//      @original_state is never ERROR then (recovery finalization runs
+//      from @recover_finish_work).
+//
+// CONTEXT:
+//      any, if @defer_next_xfer is true, sleepable otherwise
+static int __symspi_do_to_idle_sequence(struct symspi_dev *symspi
+					, const int original_state
+					, bool start_next_xfer
+					, const int internal_error
+					, const bool defer_next_xfer)
+{
+	__symspi_stop_timeout_timer(symspi);
+
+	WARN_ON_ONCE(defer_next_xfer && original_state == SYMSPI_STATE_ERROR);
+
 	start_next_xfer = start_next_xfer || symspi->p->delayed_xfer_request;
 
+	// nothing of the xfer cycle is running at this point, so
+	// it is safe to change the timing parameters
+	__symspi_params_apply_pending(symspi);
+	__symspi_caps_apply_pending(symspi);
+
 	symspi_switch_strict((void*)symspi, original_state
 			     , SYMSPI_STATE_IDLE);
 
+	// the next xfer cycle starts a new burst
+	symspi->p->burst_frames_done = 0;
+
 	if (original_state != SYMSPI_STATE_ERROR) {
 		int res = symspi_try_to_error_sequence(symspi, internal_error);
 		if (res != SYMSPI_SUCCESS) {
@@ -3020,10 +6051,21 @@ static int symspi_to_idle_sequence(struct symspi_dev *symspi
 	//
 	// Then the additional customer call will look like other side
 	// ordinary request.
-	if (start_next_xfer || symspi_is_their_request(symspi)) {
+	if (start_next_xfer || symspi_is_their_request(symspi)
+			|| symspi_tx_ring_count(symspi) > 0) {
+		symspi_clock_on_cycle_end(symspi, true);
+		if (defer_next_xfer) {
+			__symspi_schedule_work(symspi
+					       , &symspi->p->next_xfer_work);
+			return SYMSPI_SUCCESS;
+		}
 		return symspi_data_xchange(symspi, NULL, false);
 	}
 
+	// the link is idle, so the device may autosuspend
+	symspi_clock_on_cycle_end(symspi, false);
+	symspi_pm_idle(symspi);
+
 	return SYMSPI_SUCCESS;
 }
 
@@ -3035,11 +6077,21 @@ static inline int __symspi_procfs_init(struct symspi_dev *symspi)
 {
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
 
-	symspi->p->proc_root = proc_mkdir(SYMSPI_PROC_ROOT_NAME, NULL);
+	if (symspi->index == 0) {
+		snprintf(symspi->p->proc_root_name
+			 , sizeof(symspi->p->proc_root_name)
+			 , SYMSPI_PROC_ROOT_NAME);
+	} else {
+		snprintf(symspi->p->proc_root_name
+			 , sizeof(symspi->p->proc_root_name)
+			 , SYMSPI_PROC_ROOT_NAME"%d", symspi->index);
+	}
+
+	symspi->p->proc_root = proc_mkdir(symspi->p->proc_root_name, NULL);
 
 	if (IS_ERR_OR_NULL(symspi->p->proc_root)) {
 		symspi_err("failed to create SymSPI proc root folder"
-			  " with name: "SYMSPI_PROC_ROOT_NAME);
+			  " with name: %s", symspi->p->proc_root_name);
 		return -EIO;
 	}
 	return 0;
@@ -3058,6 +6110,47 @@ static inline void __symspi_procfs_close(struct symspi_dev *symspi)
 	symspi->p->proc_root = NULL;
 }
 
+// Helper. Sums up the per CPU statistics of SymSPI into @dst.
+//
+// NOTE: the values are not consistent snapshot, see
+//      struct symspi_info.
+//
+// CONTEXT:
+//      any
+static void __symspi_info_collect(struct symspi_dev *symspi
+				  , struct symspi_info *dst)
+{
+	memset(dst, 0, sizeof(*dst));
+
+	int cpu;
+	for_each_possible_cpu(cpu) {
+		const struct symspi_info *const src
+			= per_cpu_ptr(symspi->p->info, cpu);
+
+#define SYMSPI_INFO_SUM(field) dst->field += READ_ONCE(src->field)
+
+		SYMSPI_INFO_SUM(other_side_indicated_errors);
+		SYMSPI_INFO_SUM(other_side_no_reaction_errors);
+		SYMSPI_INFO_SUM(xfers_done_ok);
+		SYMSPI_INFO_SUM(their_flag_edges);
+		SYMSPI_INFO_SUM(rx_ring_overruns);
+		SYMSPI_INFO_SUM(their_flag_level_resamples);
+		SYMSPI_INFO_SUM(edge_log_overruns);
+		SYMSPI_INFO_SUM(bytes_tx);
+		SYMSPI_INFO_SUM(bytes_rx);
+		SYMSPI_INFO_SUM(integrity_errors);
+		SYMSPI_INFO_SUM(tx_unchanged_updates);
+		SYMSPI_INFO_SUM(pm_suspends);
+		SYMSPI_INFO_SUM(pm_resumes);
+		SYMSPI_INFO_SUM(pm_resumes_over_budget);
+		SYMSPI_INFO_SUM(pm_deferred_xfers);
+		SYMSPI_INFO_SUM(clock_ups);
+		SYMSPI_INFO_SUM(clock_downs);
+
+#undef SYMSPI_INFO_SUM
+	}
+}
+
 // Helper. Initializes the info structure of SymSPI.
 // NOTE: the SymSPI proc rootfs should be created beforehand,
 //      if not: then we will fail to create info node.
@@ -3070,7 +6163,11 @@ static inline int __symspi_info_init(struct symspi_dev *symspi)
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
 
 	// initial statistics data
-	memset(&symspi->p->info, 0, sizeof(symspi->p->info));
+	int cpu;
+	for_each_possible_cpu(cpu) {
+		memset(per_cpu_ptr(symspi->p->info, cpu), 0
+		       , sizeof(struct symspi_info));
+	}
 
 	// info access operations
 	memset(&symspi->p->info_ops, 0, sizeof(symspi->p->info_ops));
@@ -3099,6 +6196,30 @@ static inline int __symspi_info_init(struct symspi_dev *symspi)
 	return 0;
 }
 
+// Helper. Clears the SymSPI counters: the per CPU info and latency
+// statistics, and the rate meter (it is stopped till the next xfer).
+//
+// CONTEXT:
+//      sleepable, the device is stopped (see __symspi_stop(...))
+static void __symspi_counters_reset(struct symspi_dev *symspi)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		memset(per_cpu_ptr(symspi->p->info, cpu), 0
+		       , sizeof(struct symspi_info));
+		if (symspi->p->latency) {
+			memset(per_cpu_ptr(symspi->p->latency, cpu), 0
+			       , sizeof(struct symspi_latency_stats));
+		}
+	}
+	atomic64_set(&symspi->p->cycle_start_time, 0);
+
+	del_timer_sync(&symspi->p->rate_meter_timer);
+	memset(&symspi->p->rate_meter, 0, sizeof(symspi->p->rate_meter));
+	symspi->p->rate_meter.last_sample_jiffies = jiffies;
+}
+
 // Removes the SymSPI proc info file
 static void __symspi_info_close(struct symspi_dev *symspi)
 {
@@ -3112,16 +6233,88 @@ static void __symspi_info_close(struct symspi_dev *symspi)
 	symspi->p->info_file = NULL;
 }
 
-// Provides the read method for SymSPI info to user world.
-// Is invoked when user reads the /proc/<SYMSPI>/<INFO> file.
+// Helper. Applies the parameters set by user (if any).
 //
-// Is restricted to the file size of SIZE_MAX bytes.
+// CONTEXT:
+//      any
+//
+// STATE:
+//      on the way to IDLE state (nothing of xfer cycle is running)
+static void __symspi_params_apply_pending(struct symspi_dev *symspi)
+{
+	unsigned long flags;
+
+	if (!READ_ONCE(symspi->p->params_pending)) {
+		return;
+	}
+
+	spin_lock_irqsave(&symspi->p->params_lock, flags);
+	symspi->p->params = symspi->p->pending_params;
+	symspi->p->params_pending = false;
+	spin_unlock_irqrestore(&symspi->p->params_lock, flags);
+
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "new timing parameters applied");
+}
+
+// Helper. Creates the SymSPI proc params file.
+// NOTE: the SymSPI proc rootfs should be created beforehand.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static inline int __symspi_params_init(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	memset(&symspi->p->params_ops, 0, sizeof(symspi->p->params_ops));
+	symspi->p->params_ops.read  = &__symspi_params_read;
+	symspi->p->params_ops.write  = &__symspi_params_write;
+	symspi->p->params_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(symspi->p->proc_root)) {
+		symspi_err("failed to create params proc entry:"
+			  " no SymSPI root proc entry");
+		symspi->p->params_file = NULL;
+		return -ENOENT;
+	}
+
+	symspi->p->params_file = proc_create_data(
+					   SYMSPI_PARAMS_FILE_NAME
+					   , SYMSPI_PROC_RW_PERMISSIONS
+					   , symspi->p->proc_root
+					   , &symspi->p->params_ops
+					   , (void*)symspi);
+
+	if (IS_ERR_OR_NULL(symspi->p->params_file)) {
+		symspi_err("failed to create params proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the SymSPI proc params file
+static void __symspi_params_close(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(symspi->p->params_file)) {
+		return;
+	}
+
+	proc_remove(symspi->p->params_file);
+	symspi->p->params_file = NULL;
+}
+
+// Provides the read method for SymSPI params to user world.
+// Is invoked when user reads the /proc/<SYMSPI>/<PARAMS> file.
+// The output is one key=value pair per line, then the pending
+// (not yet applied) values, if any, prefixed with "pending_".
 //
 // RETURNS:
 //      >= 0: number of bytes actually provided to user space, on success
 //      < 0: negated error code, on failure
-//
-static ssize_t __symspi_info_read(struct file *file
+static ssize_t __symspi_params_read(struct file *file
 		, char __user *ubuf, size_t count, loff_t *ppos)
 {
 	SYMSPI_CHECK_PTR(file, return -EINVAL);
@@ -3132,7 +6325,7 @@ static ssize_t __symspi_info_read(struct file *file
 
 	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
 
-	const int BUFFER_SIZE = 2048;
+	const int BUFFER_SIZE = 1024;
 
 	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
 		return 0;
@@ -3144,46 +6337,45 @@ static ssize_t __symspi_info_read(struct file *file
 		return -ENOMEM;
 	}
 
-	const struct symspi_info * const s = &symspi->p->info;
-	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
-		     , "Statistics:\n"
-		       "other side indicated errors:  %llu\n"
-		       "other side no reaction errors:  %llu\n"
-		       "xfers done OK:  %llu\n"
-		       "their flag edges detected:  %llu\n"
-		       "\n"
-		       "Configuration:\n"
-			   "max xfer size: "
-			   macro_val_str(SYMSPI_XFER_SIZE_MAX_BYTES)
-			   " bytes\n"
-			   "our flag min inactive time: "
-               macro_val_str(SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC)
-			   " us\n"
-			   "their flag wait timeout: "
-               macro_val_str(SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC)
-			   " ms\n"
-			   "error recovery silence time: "
-               macro_val_str(SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS)
-			   " ms\n"
-			   "workqueue mode: "macro_val_str(SYMSPI_WORKQUEUE_MODE)"\n"
-			   "verbosity level: "macro_val_str(SYMSPI_VERBOSITY)"\n"
-		       "\n"
-		       "Note: statistical/monitoring"
-		       " info is not expeted to be used in precise"
-		       " measurements due to atomic selfconsistency"
-		       " maintenance would put overhead in the driver.\n"
-			, s->other_side_indicated_errors
-			, s->other_side_no_reaction_errors
-			, s->xfers_done_ok
-			, s->their_flag_edges
-		);
-	len++;
-
-	if (len > BUFFER_SIZE) {
-		symspi_warning("statistics output was too big for buffer"
-			      ", required length: %zu", len);
-		len = BUFFER_SIZE;
-		buf[BUFFER_SIZE - 1] = 0;
+	struct symspi_params active, pending;
+	bool is_pending;
+	unsigned long flags;
+
+	spin_lock_irqsave(&symspi->p->params_lock, flags);
+	active = symspi->p->params;
+	pending = symspi->p->pending_params;
+	is_pending = symspi->p->params_pending;
+	spin_unlock_irqrestore(&symspi->p->params_lock, flags);
+
+	size_t len = (size_t)scnprintf(buf, BUFFER_SIZE
+			, "caps_state=%d\n"
+			  "our_flag_inactive_min_time_usec=%u\n"
+			  "their_flag_wait_timeout_msec=%u\n"
+			  "error_recovery_silence_time_ms=%u\n"
+			  "burst_frame_gap_usec=%u\n"
+			  "busy_poll_usec=%u\n"
+			  "error_recovery_pulses=%u\n"
+			, symspi->p->caps_state
+			, active.our_flag_inactive_min_time_usec
+			, active.their_flag_wait_timeout_msec
+			, active.error_recovery_silence_time_ms
+			, active.burst_frame_gap_usec
+			, active.busy_poll_usec
+			, active.error_recovery_pulses);
+	if (is_pending) {
+		len += scnprintf(buf + len, BUFFER_SIZE - len
+			, "pending_our_flag_inactive_min_time_usec=%u\n"
+			  "pending_their_flag_wait_timeout_msec=%u\n"
+			  "pending_error_recovery_silence_time_ms=%u\n"
+			  "pending_burst_frame_gap_usec=%u\n"
+			  "pending_busy_poll_usec=%u\n"
+			  "pending_error_recovery_pulses=%u\n"
+			, pending.our_flag_inactive_min_time_usec
+			, pending.their_flag_wait_timeout_msec
+			, pending.error_recovery_silence_time_ms
+			, pending.burst_frame_gap_usec
+			, pending.busy_poll_usec
+			, pending.error_recovery_pulses);
 	}
 
 	const unsigned long nbytes_to_copy
@@ -3200,205 +6392,2247 @@ static ssize_t __symspi_info_read(struct file *file
 	return nbytes_to_copy - not_copied;
 }
 
-
-/* ----------------------- SPI CALLBACKS SECTION ----------------------- */
-
-// Will be called upon the xfer finished by SPI driver
-//
-// CONTEXT:
-//      SPI driver calls this callback from context which can't sleep.
+// Helper. Sets the parameter value by its name in @params.
+//
+// RETURNS:
+//      0: on success
+//      -EINVAL: unknown key or value out of range
+static int __symspi_params_set(struct symspi_params *params
+			       , const char *key, const unsigned int value)
+{
+	if (strcmp(key, "our_flag_inactive_min_time_usec") == 0) {
+		if (value > 100000) {
+			return -EINVAL;
+		}
+		params->our_flag_inactive_min_time_usec = value;
+	} else if (strcmp(key, "their_flag_wait_timeout_msec") == 0) {
+		// see SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC notes
+		if (value < jiffies_to_msecs(3) || value > 60000) {
+			return -EINVAL;
+		}
+		params->their_flag_wait_timeout_msec = value;
+	} else if (strcmp(key, "error_recovery_silence_time_ms") == 0) {
+		if (value > 10000) {
+			return -EINVAL;
+		}
+		params->error_recovery_silence_time_ms = value;
+	} else if (strcmp(key, "burst_frame_gap_usec") == 0) {
+		if (value > 10000) {
+			return -EINVAL;
+		}
+		params->burst_frame_gap_usec = value;
+	} else if (strcmp(key, "busy_poll_usec") == 0) {
+		if (value > 1000) {
+			return -EINVAL;
+		}
+		params->busy_poll_usec = value;
+	} else if (strcmp(key, "error_recovery_pulses") == 0) {
+		// see SYMSPI_ERROR_RECOVERY_PULSES notes
+		if (value < 1 || value > 8) {
+			return -EINVAL;
+		}
+		params->error_recovery_pulses = value;
+	} else {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+// Provides the write method for SymSPI params from user world.
+// Accepts one or more "key=value" pairs separated by whitespace
+// (keys are the same as in read output, without "pending_" prefix).
+// The new values are applied upon the next transition of SymSPI
+// to the IDLE state, if any of pairs is invalid, nothing is changed.
+//
+// RETURNS:
+//      >= 0: number of bytes consumed, on success
+//      < 0: negated error code, on failure
+static ssize_t __symspi_params_write(struct file *file
+		, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	if (count == 0 || count > SYMSPI_PARAMS_WRITE_MAX_BYTES) {
+		return -EINVAL;
+	}
+
+	char *buf = memdup_user_nul(ubuf, count);
+
+	if (IS_ERR(buf)) {
+		return PTR_ERR(buf);
+	}
+
+	struct symspi_params new_params;
+	unsigned long flags;
+	int res = 0;
+
+	spin_lock_irqsave(&symspi->p->params_lock, flags);
+	new_params = symspi->p->params_pending ? symspi->p->pending_params
+					       : symspi->p->params;
+	spin_unlock_irqrestore(&symspi->p->params_lock, flags);
+
+	char *cursor = buf;
+	char *pair;
+
+	while ((pair = strsep(&cursor, " \t\n")) != NULL) {
+		if (*pair == '\0') {
+			continue;
+		}
+
+		char *value_str = strchr(pair, '=');
+		unsigned int value;
+
+		if (!value_str) {
+			res = -EINVAL;
+			break;
+		}
+		*value_str++ = '\0';
+
+		res = kstrtouint(value_str, 0, &value);
+		if (res == 0) {
+			res = __symspi_params_set(&new_params, pair, value);
+		}
+		if (res != 0) {
+			symspi_err("invalid parameter: %s", pair);
+			break;
+		}
+	}
+
+	kfree(buf);
+
+	if (res != 0) {
+		return res;
+	}
+
+	spin_lock_irqsave(&symspi->p->params_lock, flags);
+	symspi->p->pending_params = new_params;
+	symspi->p->params_pending = true;
+	spin_unlock_irqrestore(&symspi->p->params_lock, flags);
+
+	return count;
+}
+
+// Helper. Sets the our flag inactive time to be applied upon next
+// transition to IDLE state (keeps other pending parameters).
+//
+// CONTEXT:
+//      any
+static void __symspi_params_stage_flag_inactive_time(
+		struct symspi_dev *symspi, const unsigned int usec)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&symspi->p->params_lock, flags);
+	if (!symspi->p->params_pending) {
+		symspi->p->pending_params = symspi->p->params;
+	}
+	symspi->p->pending_params.our_flag_inactive_min_time_usec = usec;
+	symspi->p->params_pending = true;
+	spin_unlock_irqrestore(&symspi->p->params_lock, flags);
+}
+
+// Inits the capabilities negotiation (if enabled): prepares the
+// capabilities frame of the current xfer size, which will be xfered
+// as the first xfer.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      0: on success (or if negotiation is disabled)
+//      <0: negated error code (negotiation is then disabled)
+static int symspi_caps_init(struct symspi_dev *symspi)
+{
+	symspi->p->caps_state = SYMSPI_CAPS_OFF;
+	symspi->p->caps_xfer_in_flight = false;
+	symspi->p->caps_frame_received = false;
+	atomic_set(&symspi->p->caps_errors, 0);
+	symspi->p->caps_pending = false;
+
+#ifdef SYMSPI_CAPS_NEGOTIATION
+	// both sides use the same default xfer size, so the frame
+	// size matches on both sides
+	const size_t size = symspi->p->current_xfer.size_bytes;
+
+	if (size < sizeof(struct symspi_caps_word)) {
+		symspi_warning("default xfer is too small for capabilities"
+			       " negotiation, negotiation disabled.");
+		return -EINVAL;
+	}
+
+	symspi->p->caps_tx = kzalloc(size, GFP_KERNEL);
+	symspi->p->caps_rx = kzalloc(size, GFP_KERNEL);
+	if (!symspi->p->caps_tx || !symspi->p->caps_rx) {
+		symspi_warning("no memory for capabilities frame,"
+			       " negotiation disabled.");
+		symspi_caps_close(symspi);
+		return -ENOMEM;
+	}
+
+	struct symspi_caps_word *word
+			= (struct symspi_caps_word *)symspi->p->caps_tx;
+
+	word->magic = cpu_to_le32(SYMSPI_CAPS_MAGIC);
+	word->version = SYMSPI_CAPS_VERSION;
+	word->burst_frames = (u8)min(symspi->p->burst_frames, 255);
+	word->min_flag_inactive_usec
+		= cpu_to_le16(SYMSPI_CAPS_MIN_FLAG_INACTIVE_TIME_USEC);
+	word->max_frame_bytes = cpu_to_le32(symspi->p->xfer_size_max_bytes);
+#ifdef SYMSPI_CLOCK_SCALING
+	word->max_speed_hz = cpu_to_le32(symspi->p->clock_ceiling_hz);
+#else
+	word->max_speed_hz = 0;
+#endif
+
+	struct spi_transfer *t = &symspi->p->caps_spi_xfer;
+	struct spi_message *msg = &symspi->p->caps_spi_msg;
+
+	memset(t, 0, sizeof(*t));
+	if (symspi->native_transfer_configuration_hook) {
+		symspi->native_transfer_configuration_hook(
+				&symspi->p->current_xfer, t, sizeof(*t));
+	}
+	t->tx_buf = symspi->p->caps_tx;
+	t->rx_buf = symspi->p->caps_rx;
+	t->len = size;
+
+	spi_message_init(msg);
+	msg->spi = symspi->spi;
+	msg->complete = &symspi_spi_xfer_done_callback;
+	msg->context = (void*)symspi;
+	spi_message_add_tail(t, msg);
+
+	symspi->p->caps_state = SYMSPI_CAPS_NEGOTIATING;
+#endif
+	return 0;
+}
+
+// Frees the capabilities negotiation resources.
+static void symspi_caps_close(struct symspi_dev *symspi)
+{
+	kfree(symspi->p->caps_tx);
+	symspi->p->caps_tx = NULL;
+	kfree(symspi->p->caps_rx);
+	symspi->p->caps_rx = NULL;
+	symspi->p->caps_state = SYMSPI_CAPS_OFF;
+}
+
+// Handles the received capabilities frame: selects the fastest
+// timing supported by both sides. The new timing is applied upon
+// the transition to IDLE state.
+//
+// CONTEXT:
+//      sleepable
+//
+// STATE:
+//      SYMSPI_STATE_POSTPROCESSING
+static void symspi_caps_complete(struct symspi_dev *symspi)
+{
+	const struct symspi_caps_word *their
+			= (const struct symspi_caps_word *)symspi->p->caps_rx;
+
+	if (le32_to_cpu(their->magic) != SYMSPI_CAPS_MAGIC
+			|| their->version < 1) {
+		symspi_warning("other side doesn't support capabilities"
+			       " negotiation, using configured timing.");
+		WRITE_ONCE(symspi->p->caps_state, SYMSPI_CAPS_FALLBACK);
+		WRITE_ONCE(symspi->p->clock_ceiling_hz, 0);
+		return;
+	}
+
+	const unsigned int their_min_usec
+		= le16_to_cpu(their->min_flag_inactive_usec);
+	const unsigned int usec
+		= max_t(unsigned int, their_min_usec
+			, SYMSPI_CAPS_MIN_FLAG_INACTIVE_TIME_USEC);
+	const size_t their_max_bytes = le32_to_cpu(their->max_frame_bytes);
+	// version 1 frame has zeros here
+	const unsigned int their_max_hz = le32_to_cpu(their->max_speed_hz);
+
+	// both sides use the same max number of frames in burst
+	symspi->p->caps_burst_frames = max(min_t(int
+						 , symspi->p->burst_frames
+						 , their->burst_frames), 1);
+	// we never grow the max size, only limit it
+	symspi->p->caps_xfer_size_max_bytes = symspi->p->xfer_size_max_bytes;
+	if (their_max_bytes > 0) {
+		symspi->p->caps_xfer_size_max_bytes
+			= min(symspi->p->xfer_size_max_bytes
+			      , their_max_bytes);
+	}
+
+	// the other side which doesn't announce its clock limit is
+	// used only with low speed clock
+	symspi->p->caps_clock_ceiling_hz
+		= min(symspi->p->clock_ceiling_hz, their_max_hz);
+
+	// applied together with the flag inactive time upon the
+	// transition to IDLE
+	symspi->p->caps_pending = true;
+	__symspi_params_stage_flag_inactive_time(symspi, usec);
+	atomic_set(&symspi->p->caps_errors, 0);
+	WRITE_ONCE(symspi->p->caps_state, SYMSPI_CAPS_NEGOTIATED);
+
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "capabilities negotiated:"
+		    " flag inactive time: %u us, burst frames: %d"
+		    ", max frame: %zu bytes, max clock: %u Hz"
+		    , usec, symspi->p->caps_burst_frames
+		    , symspi->p->caps_xfer_size_max_bytes
+		    , symspi->p->caps_clock_ceiling_hz);
+}
+
+// Helper. Applies the negotiated capabilities (see
+// symspi_caps_complete(...)). The values are published with
+// WRITE_ONCE(...) as symspi_data_xchange_batch(...) reads the max
+// xfer size from any context (the xfer size is checked again upon
+// the xfer taking in XFER_PREPARE state anyway).
+//
+// CONTEXT:
+//      any
+//
+// STATE:
+//      SYMSPI_STATE_POSTPROCESSING or SYMSPI_STATE_ERROR
+//      (on the way to IDLE)
+static void __symspi_caps_apply_pending(struct symspi_dev *symspi)
+{
+	if (!symspi->p->caps_pending) {
+		return;
+	}
+	symspi->p->caps_pending = false;
+
+	WRITE_ONCE(symspi->p->burst_frames, symspi->p->caps_burst_frames);
+	WRITE_ONCE(symspi->p->xfer_size_max_bytes
+		   , symspi->p->caps_xfer_size_max_bytes);
+	// the fallback might have happened meanwhile
+	if (READ_ONCE(symspi->p->caps_state) == SYMSPI_CAPS_NEGOTIATED) {
+		WRITE_ONCE(symspi->p->clock_ceiling_hz
+			   , symspi->p->caps_clock_ceiling_hz);
+	}
+}
+
+// Helper. Falls back to the conservative timing if link errors
+// happen with negotiated timing.
+//
+// CONTEXT:
+//      any
+static void __symspi_caps_on_error(struct symspi_dev *symspi
+				   , unsigned char err_no)
+{
+	if (READ_ONCE(symspi->p->caps_state) != SYMSPI_CAPS_NEGOTIATED) {
+		return;
+	}
+	if (err_no != SYMSPI_ERROR_OTHER_SIDE
+			&& err_no != SYMSPI_ERROR_WAIT_OTHER_SIDE
+			&& err_no != SYMSPI_ERROR_SPI) {
+		return;
+	}
+	// only the one which reaches the limit falls back
+	if (atomic_inc_return(&symspi->p->caps_errors)
+			!= SYMSPI_CAPS_FALLBACK_ERRORS) {
+		return;
+	}
+
+	WRITE_ONCE(symspi->p->caps_state, SYMSPI_CAPS_FALLBACK);
+	__symspi_params_stage_flag_inactive_time(symspi
+			, SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC);
+	// low speed clock only from now on
+	WRITE_ONCE(symspi->p->clock_ceiling_hz, 0);
+	symspi_warning("link errors with negotiated timing, falling back"
+		       " to %d us flag inactive time."
+		       , SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC);
+}
+
+// Helper. Applies the new sample to the fixed point moving average.
+static inline unsigned long long __symspi_ema_apply(
+		const unsigned long long ema, const unsigned long exp_factor
+		, const unsigned long long sample)
+{
+	return (ema * exp_factor
+		+ (sample << SYMSPI_EMA_SHIFT)
+		  * (SYMSPI_EMA_FIXED_1 - exp_factor)) >> SYMSPI_EMA_SHIFT;
+}
+
+// Helper. Applies @secs zero samples to the fixed point moving
+// average (the seconds the rate meter was stopped on idle link).
+static inline unsigned long long __symspi_ema_decay(
+		unsigned long long ema, const unsigned long exp_factor
+		, unsigned long secs)
+{
+	secs = min(secs, (unsigned long)SYMSPI_EMA_DECAY_MAX_SEC);
+	while (secs-- > 0 && ema != 0) {
+		ema = (ema * exp_factor) >> SYMSPI_EMA_SHIFT;
+	}
+	return ema;
+}
+
+// Timer callback: samples the throughput once a second and updates
+// the moving averages. Stops on idle link: the second without xfers
+// while the link is IDLE (or COLD) doesn't re-arm the timer.
+//
+// CONTEXT:
+//      timer (can not sleep)
+static void __symspi_rate_meter_tick(struct timer_list *t)
+{
+	static const unsigned long exp_factors[SYMSPI_EMA_WINDOWS_COUNT] = {
+		SYMSPI_EMA_EXP_1S, SYMSPI_EMA_EXP_10S, SYMSPI_EMA_EXP_60S
+	};
+	struct symspi_dev_private *priv = from_timer(priv, t
+						     , rate_meter_timer);
+	struct symspi_rate_meter *m = &priv->rate_meter;
+
+	const unsigned long now = jiffies;
+	const unsigned long elapsed = max(now - m->last_sample_jiffies, 1UL);
+	// the seconds the meter was stopped had no xfers, the last
+	// (about a) second of the interval keeps all new data
+	const unsigned long stopped_secs
+		= (elapsed > HZ) ? (elapsed - HZ) / HZ : 0;
+	const unsigned long interval = elapsed - stopped_secs * HZ;
+	struct symspi_info info;
+
+	__symspi_info_collect(priv->symspi, &info);
+
+	const unsigned long long xfers = info.xfers_done_ok;
+	const unsigned long long bytes = info.bytes_tx;
+	const unsigned long long bytes_rx = info.bytes_rx;
+
+	// normalizing to exactly 1 second interval
+	const unsigned long long xfers_rate
+		= div_u64((xfers - m->last_xfers) * HZ, interval);
+	const unsigned long long bytes_rate
+		= div_u64((bytes - m->last_bytes) * HZ, interval);
+	const unsigned long long bytes_rx_rate
+		= div_u64((bytes_rx - m->last_bytes_rx) * HZ, interval);
+	int i;
+
+	for (i = 0; i < SYMSPI_EMA_WINDOWS_COUNT; i++) {
+		m->xfers_per_sec_ema[i] = __symspi_ema_apply(
+			__symspi_ema_decay(m->xfers_per_sec_ema[i]
+					   , exp_factors[i], stopped_secs)
+			, exp_factors[i], xfers_rate);
+		m->bytes_per_sec_ema[i] = __symspi_ema_apply(
+			__symspi_ema_decay(m->bytes_per_sec_ema[i]
+					   , exp_factors[i], stopped_secs)
+			, exp_factors[i], bytes_rate);
+		m->bytes_rx_per_sec_ema[i] = __symspi_ema_apply(
+			__symspi_ema_decay(m->bytes_rx_per_sec_ema[i]
+					   , exp_factors[i], stopped_secs)
+			, exp_factors[i], bytes_rx_rate);
+	}
+
+	const bool had_xfers = (xfers != m->last_xfers);
+
+	m->last_sample_jiffies = now;
+	m->last_xfers = xfers;
+	m->last_bytes = bytes;
+	m->last_bytes_rx = bytes_rx;
+
+	// no periodic wakeups on idle link, the next xfer restarts us
+	const char state = symspi_get_state(priv->symspi);
+
+	if (!had_xfers && (state == SYMSPI_STATE_IDLE
+			   || state == SYMSPI_STATE_COLD)) {
+		return;
+	}
+
+	mod_timer(&priv->rate_meter_timer, now + HZ);
+}
+
+// Helper. Restarts the rate meter stopped on idle link.
+//
+// CONTEXT:
+//      any
+static inline void __symspi_rate_meter_wake(struct symspi_dev *symspi)
+{
+	if (!timer_pending(&symspi->p->rate_meter_timer)) {
+		mod_timer(&symspi->p->rate_meter_timer, jiffies + HZ);
+	}
+}
+
+// Helper. Creates the SymSPI proc stats file and starts the
+// throughput meter.
+// NOTE: the SymSPI proc rootfs should be created beforehand.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static inline int __symspi_stats_init(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	memset(&symspi->p->rate_meter, 0, sizeof(symspi->p->rate_meter));
+	symspi->p->rate_meter.last_sample_jiffies = jiffies;
+	mod_timer(&symspi->p->rate_meter_timer, jiffies + HZ);
+
+	memset(&symspi->p->stats_ops, 0, sizeof(symspi->p->stats_ops));
+	symspi->p->stats_ops.read  = &__symspi_stats_read;
+	symspi->p->stats_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(symspi->p->proc_root)) {
+		symspi_err("failed to create stats proc entry:"
+			  " no SymSPI root proc entry");
+		symspi->p->stats_file = NULL;
+		return -ENOENT;
+	}
+
+	symspi->p->stats_file = proc_create_data(
+					   SYMSPI_STATS_FILE_NAME
+					   , SYMSPI_PROC_R_PERMISSIONS
+					   , symspi->p->proc_root
+					   , &symspi->p->stats_ops
+					   , (void*)symspi);
+
+	if (IS_ERR_OR_NULL(symspi->p->stats_file)) {
+		symspi_err("failed to create stats proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the SymSPI proc stats file
+// NOTE: the rate meter timer is stopped in close together with
+//      other timers.
+static void __symspi_stats_close(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(symspi->p->stats_file)) {
+		return;
+	}
+
+	proc_remove(symspi->p->stats_file);
+	symspi->p->stats_file = NULL;
+}
+
+// Helper. Converts fixed point moving average to integer.
+#define SYMSPI_EMA_INT(v) ((v) >> SYMSPI_EMA_SHIFT)
+
+// Helper. The moving average as it is now: the rate meter stopped on
+// idle link has the averages of its last sample, so the @stopped_secs
+// (defined by the caller) idle seconds since then are applied.
+#define SYMSPI_EMA_NOW(m, field, i)					\
+	SYMSPI_EMA_INT(__symspi_ema_decay((m)->field[i]			\
+			, (i) == 0 ? SYMSPI_EMA_EXP_1S			\
+			  : (i) == 1 ? SYMSPI_EMA_EXP_10S		\
+			  : SYMSPI_EMA_EXP_60S				\
+			, stopped_secs))
+
+// Provides the read method for SymSPI stats to user world.
+// Is invoked when user reads the /proc/<SYMSPI>/<STATS> file.
+// The output is one key=value pair per line (rates are per second).
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __symspi_stats_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+	SYMSPI_CHECK_PTR(ppos, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	const int BUFFER_SIZE = 2048;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	struct symspi_info info;
+
+	__symspi_info_collect(symspi, &info);
+
+	const struct symspi_info * const s = &info;
+	const struct symspi_rate_meter * const m = &symspi->p->rate_meter;
+	const unsigned long long xfers = s->xfers_done_ok;
+	const unsigned long stopped_secs
+		= timer_pending(&symspi->p->rate_meter_timer) ? 0
+		  : (jiffies - READ_ONCE(m->last_sample_jiffies)) / HZ;
+
+	size_t len = (size_t)scnprintf(buf, BUFFER_SIZE
+			, "xfers_done_ok=%llu\n"
+			  "bytes_tx=%llu\n"
+			  "bytes_rx=%llu\n"
+			  "avg_frame_bytes=%llu\n"
+			  "xfers_per_sec_1s=%llu\n"
+			  "xfers_per_sec_10s=%llu\n"
+			  "xfers_per_sec_60s=%llu\n"
+			  "bytes_per_sec_1s=%llu\n"
+			  "bytes_per_sec_10s=%llu\n"
+			  "bytes_per_sec_60s=%llu\n"
+			  "bytes_rx_per_sec_1s=%llu\n"
+			  "bytes_rx_per_sec_10s=%llu\n"
+			  "bytes_rx_per_sec_60s=%llu\n"
+			  "other_side_indicated_errors=%llu\n"
+			  "other_side_no_reaction_errors=%llu\n"
+			  "their_flag_edges=%llu\n"
+			  "their_flag_level_resamples=%llu\n"
+			  "edge_log_overruns=%llu\n"
+			  "rx_ring_overruns=%llu\n"
+			  "integrity_errors=%llu\n"
+			  "tx_unchanged_updates=%llu\n"
+			  "pm_suspends=%llu\n"
+			  "pm_resumes=%llu\n"
+			  "pm_resumes_over_budget=%llu\n"
+			  "pm_deferred_xfers=%llu\n"
+			  "pm_resume_last_usec=%u\n"
+			  "pm_resume_max_usec=%u\n"
+			  "clock_ups=%llu\n"
+			  "clock_downs=%llu\n"
+			  "clock_hz=%u\n"
+			, xfers, s->bytes_tx, s->bytes_rx
+			, xfers ? div64_u64(s->bytes_tx, xfers) : 0
+			, SYMSPI_EMA_NOW(m, xfers_per_sec_ema, 0)
+			, SYMSPI_EMA_NOW(m, xfers_per_sec_ema, 1)
+			, SYMSPI_EMA_NOW(m, xfers_per_sec_ema, 2)
+			, SYMSPI_EMA_NOW(m, bytes_per_sec_ema, 0)
+			, SYMSPI_EMA_NOW(m, bytes_per_sec_ema, 1)
+			, SYMSPI_EMA_NOW(m, bytes_per_sec_ema, 2)
+			, SYMSPI_EMA_NOW(m, bytes_rx_per_sec_ema, 0)
+			, SYMSPI_EMA_NOW(m, bytes_rx_per_sec_ema, 1)
+			, SYMSPI_EMA_NOW(m, bytes_rx_per_sec_ema, 2)
+			, s->other_side_indicated_errors
+			, s->other_side_no_reaction_errors
+			, s->their_flag_edges
+			, s->their_flag_level_resamples
+			, s->edge_log_overruns
+			, s->rx_ring_overruns
+			, s->integrity_errors
+			, s->tx_unchanged_updates
+			, s->pm_suspends
+			, s->pm_resumes
+			, s->pm_resumes_over_budget
+			, s->pm_deferred_xfers
+#ifdef SYMSPI_RUNTIME_PM
+			, symspi->p->pm_resume_last_usec
+			, symspi->p->pm_resume_max_usec
+#else
+			, 0U, 0U
+#endif
+			, s->clock_ups
+			, s->clock_downs
+			, symspi->p->clock_applied_hz);
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Helper. Adds the sample to the latency histogram of the phase
+// (on current CPU).
+//
+// CONTEXT:
+//      any
+static inline void symspi_latency_record(struct symspi_dev *symspi
+		, const int phase, const s64 duration_us)
+{
+	const unsigned long long dur_us
+		= duration_us > 0 ? (unsigned long long)duration_us : 0;
+	struct symspi_latency_stats *stats = get_cpu_ptr(symspi->p->latency);
+	struct symspi_latency_hist *hist = &stats->phases[phase];
+	int bucket = fls64(dur_us);
+
+	if (bucket >= SYMSPI_LAT_BUCKETS_COUNT) {
+		bucket = SYMSPI_LAT_BUCKETS_COUNT - 1;
+	}
+	hist->buckets[bucket] += 1;
+	if (hist->count == 0 || dur_us < hist->min_us) {
+		hist->min_us = dur_us;
+	}
+	if (dur_us > hist->max_us) {
+		hist->max_us = dur_us;
+	}
+	hist->sum_us += dur_us;
+	hist->count += 1;
+
+	put_cpu_ptr(symspi->p->latency);
+}
+
+// Helper. Tracks the latency phases on state switch. Is called
+// by the context which actually switched the state.
+//
+// CONTEXT:
+//      any
+static inline void symspi_latency_on_switch(struct symspi_dev *symspi
+		, const char from_state, const char to_state)
+{
+	if (!symspi->p->latency) {
+		return;
+	}
+
+	const ktime_t now = ktime_get();
+
+	if (from_state >= SYMSPI_STATE_XFER_PREPARE
+			&& from_state <= SYMSPI_STATE_POSTPROCESSING) {
+		symspi_latency_record(symspi
+			, SYMSPI_LAT_PHASE_XFER_PREPARE
+			  + (from_state - SYMSPI_STATE_XFER_PREPARE)
+			, ktime_us_delta(now, atomic64_read(
+					&symspi->p->state_enter_time)));
+	}
+
+	if (from_state == SYMSPI_STATE_IDLE) {
+		atomic64_set(&symspi->p->cycle_start_time, now);
+	} else if (to_state == SYMSPI_STATE_IDLE) {
+		const ktime_t cycle_start = atomic64_xchg(
+				&symspi->p->cycle_start_time, 0);
+
+		if (cycle_start != 0) {
+			symspi_latency_record(symspi, SYMSPI_LAT_PHASE_CYCLE
+				, ktime_us_delta(now, cycle_start));
+		}
+	}
+
+	atomic64_set(&symspi->p->state_enter_time, now);
+}
+
+// Helper. Creates the SymSPI proc latency file.
+// NOTE: the SymSPI proc rootfs should be created beforehand.
+//
+// RETURNS:
+//      >= 0: on success,
+//      < 0: on failure (negated error code)
+static inline int __symspi_latency_init(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	if (symspi->p->latency) {
+		int cpu;
+
+		for_each_possible_cpu(cpu) {
+			memset(per_cpu_ptr(symspi->p->latency, cpu), 0
+			       , sizeof(struct symspi_latency_stats));
+		}
+	}
+	atomic64_set(&symspi->p->cycle_start_time, 0);
+
+	memset(&symspi->p->latency_ops, 0, sizeof(symspi->p->latency_ops));
+	symspi->p->latency_ops.read  = &__symspi_latency_read;
+	symspi->p->latency_ops.owner = THIS_MODULE;
+
+	if (IS_ERR_OR_NULL(symspi->p->proc_root)) {
+		symspi_err("failed to create latency proc entry:"
+			  " no SymSPI root proc entry");
+		symspi->p->latency_file = NULL;
+		return -ENOENT;
+	}
+
+	symspi->p->latency_file = proc_create_data(
+					   SYMSPI_LATENCY_FILE_NAME
+					   , SYMSPI_PROC_R_PERMISSIONS
+					   , symspi->p->proc_root
+					   , &symspi->p->latency_ops
+					   , (void*)symspi);
+
+	if (IS_ERR_OR_NULL(symspi->p->latency_file)) {
+		symspi_err("failed to create latency proc entry.");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+// Removes the SymSPI proc latency file
+static void __symspi_latency_close(struct symspi_dev *symspi)
+{
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return);
+
+	if (IS_ERR_OR_NULL(symspi->p->latency_file)) {
+		return;
+	}
+
+	proc_remove(symspi->p->latency_file);
+	symspi->p->latency_file = NULL;
+}
+
+// Helper. Provides the upper bound (us) of the bucket which contains
+// the given percentile of samples.
+static unsigned long long __symspi_latency_percentile(
+		const struct symspi_latency_hist *hist
+		, const unsigned int percent)
+{
+	const unsigned long long target
+		= div_u64(hist->count * percent + 99, 100);
+	unsigned long long acc = 0;
+	int i;
+
+	for (i = 0; i < SYMSPI_LAT_BUCKETS_COUNT; i++) {
+		acc += hist->buckets[i];
+		if (acc >= target) {
+			break;
+		}
+	}
+	return (i >= SYMSPI_LAT_BUCKETS_COUNT - 1) ? hist->max_us : (1ULL << i);
+}
+
+// Provides the read method for SymSPI latency histograms to user
+// world. Is invoked when user reads the /proc/<SYMSPI>/<LATENCY> file.
+// Per CPU histograms are summed up on read.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+static ssize_t __symspi_latency_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+	SYMSPI_CHECK_PTR(ppos, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	static const char *const phase_names[SYMSPI_LAT_PHASES_COUNT] = {
+		"xfer prepare", "waiting prev", "waiting rdy", "xfer"
+		, "postprocessing", "full cycle"
+	};
+	const int BUFFER_SIZE = 4096;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	if (!symspi->p->latency) {
+		return -ENODATA;
+	}
+
+	struct symspi_latency_hist *total
+		= kcalloc(SYMSPI_LAT_PHASES_COUNT, sizeof(*total), GFP_KERNEL);
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (!total || !buf) {
+		kfree(total);
+		kfree(buf);
+		return -ENOMEM;
+	}
+
+	int cpu, ph, i;
+
+	for_each_possible_cpu(cpu) {
+		const struct symspi_latency_stats *stats
+			= per_cpu_ptr(symspi->p->latency, cpu);
+
+		for (ph = 0; ph < SYMSPI_LAT_PHASES_COUNT; ph++) {
+			const struct symspi_latency_hist *h = &stats->phases[ph];
+			struct symspi_latency_hist *t = &total[ph];
+
+			if (h->count == 0) {
+				continue;
+			}
+			for (i = 0; i < SYMSPI_LAT_BUCKETS_COUNT; i++) {
+				t->buckets[i] += h->buckets[i];
+			}
+			if (t->count == 0 || h->min_us < t->min_us) {
+				t->min_us = h->min_us;
+			}
+			if (h->max_us > t->max_us) {
+				t->max_us = h->max_us;
+			}
+			t->sum_us += h->sum_us;
+			t->count += h->count;
+		}
+	}
+
+	size_t len = (size_t)scnprintf(buf, BUFFER_SIZE
+			, "Latency (us), bucket N keeps [2^(N-1), 2^N) us:\n");
+
+	for (ph = 0; ph < SYMSPI_LAT_PHASES_COUNT; ph++) {
+		const struct symspi_latency_hist *t = &total[ph];
+
+		len += scnprintf(buf + len, BUFFER_SIZE - len
+			, "%s:\n  count: %llu, min: %llu, avg: %llu"
+			  ", max: %llu, p50: <%llu, p90: <%llu, p99: <%llu\n"
+			  "  buckets:"
+			, phase_names[ph], t->count, t->min_us
+			, t->count ? div64_u64(t->sum_us, t->count) : 0
+			, t->max_us
+			, __symspi_latency_percentile(t, 50)
+			, __symspi_latency_percentile(t, 90)
+			, __symspi_latency_percentile(t, 99));
+		for (i = 0; i < SYMSPI_LAT_BUCKETS_COUNT; i++) {
+			len += scnprintf(buf + len, BUFFER_SIZE - len
+					 , " %u", t->buckets[i]);
+		}
+		len += scnprintf(buf + len, BUFFER_SIZE - len, "\n");
+	}
+
+	kfree(total);
+	total = NULL;
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+// Provides the read method for SymSPI info to user world.
+// Is invoked when user reads the /proc/<SYMSPI>/<INFO> file.
+//
+// Is restricted to the file size of SIZE_MAX bytes.
+//
+// RETURNS:
+//      >= 0: number of bytes actually provided to user space, on success
+//      < 0: negated error code, on failure
+//
+static ssize_t __symspi_info_read(struct file *file
+		, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	SYMSPI_CHECK_PTR(file, return -EINVAL);
+	SYMSPI_CHECK_PTR(ubuf, return -EINVAL);
+	SYMSPI_CHECK_PTR(ppos, return -EINVAL);
+
+	struct symspi_dev *symspi = (struct symspi_dev *)PDE_DATA(file->f_inode);
+
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("", return -ENODEV);
+
+	const int BUFFER_SIZE = 2048;
+
+	if (*ppos >= BUFFER_SIZE || *ppos > SIZE_MAX) {
+		return 0;
+	}
+
+	char *buf = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+
+	if (IS_ERR_OR_NULL(buf)) {
+		return -ENOMEM;
+	}
+
+	struct symspi_info info;
+
+	__symspi_info_collect(symspi, &info);
+
+	const struct symspi_info * const s = &info;
+	size_t len = (size_t)snprintf(buf, BUFFER_SIZE
+		     , "Statistics:\n"
+		       "other side indicated errors:  %llu\n"
+		       "other side no reaction errors:  %llu\n"
+		       "xfers done OK:  %llu\n"
+		       "their flag edges detected:  %llu\n"
+		       "RX ring overruns:  %llu\n"
+		       "their flag level resamples:  %llu\n"
+		       "edge log overruns:  %llu\n"
+		       "\n"
+		       "Configuration:\n"
+			   "max xfer size: "
+			   macro_val_str(SYMSPI_XFER_SIZE_MAX_BYTES)
+			   " bytes\n"
+			   "preallocated xfer size: "
+			   macro_val_str(SYMSPI_XFER_PREALLOC_SIZE_BYTES)
+			   " bytes\n"
+			   "max SPI transfer size (0 - no limit): "
+			   macro_val_str(SYMSPI_SPI_TRANSFER_MAX_BYTES)
+			   " bytes\n"
+			   "our flag min inactive time (default): "
+               macro_val_str(SYMSPI_OUR_FLAG_INACTIVE_STATE_MIN_TIME_USEC)
+			   " us\n"
+			   "their flag wait timeout (default): "
+               macro_val_str(SYMSPI_THEIR_FLAG_WAIT_TIMEOUT_MSEC)
+			   " ms\n"
+			   "error recovery silence time (default): "
+               macro_val_str(SYMSPI_ERROR_RECOVERY_SILENCE_TIME_MS)
+			   " ms\n"
+			   "error recovery pulses (default): "
+			   macro_val_str(SYMSPI_ERROR_RECOVERY_PULSES)"\n"
+			   "burst frames: "macro_val_str(SYMSPI_BURST_FRAMES)"\n"
+			   "burst frame gap (default): "
+			   macro_val_str(SYMSPI_BURST_FRAME_GAP_USEC)
+			   " us\n"
+			   "workqueue mode: "macro_val_str(SYMSPI_WORKQUEUE_MODE)"\n"
+			   "verbosity level: "macro_val_str(SYMSPI_VERBOSITY)"\n"
+		       "\n"
+		       "Note: statistical/monitoring"
+		       " info is not expeted to be used in precise"
+		       " measurements due to atomic selfconsistency"
+		       " maintenance would put overhead in the driver.\n"
+			, s->other_side_indicated_errors
+			, s->other_side_no_reaction_errors
+			, s->xfers_done_ok
+			, s->their_flag_edges
+			, s->rx_ring_overruns
+			, s->their_flag_level_resamples
+			, s->edge_log_overruns
+		);
+	len++;
+
+	if (len > BUFFER_SIZE) {
+		symspi_warning("statistics output was too big for buffer"
+			      ", required length: %zu", len);
+		len = BUFFER_SIZE;
+		buf[BUFFER_SIZE - 1] = 0;
+	}
+
+	const unsigned long nbytes_to_copy
+			= (len >= (size_t)(*ppos))
+				?  min(len - (size_t)(*ppos), count)
+				: 0;
+	const unsigned long not_copied
+			= copy_to_user(ubuf, buf + (size_t)(*ppos)
+				       , nbytes_to_copy);
+	kfree(buf);
+	buf = NULL;
+	*ppos += nbytes_to_copy - not_copied;
+
+	return nbytes_to_copy - not_copied;
+}
+
+
+/* ----------------------- SPI CALLBACKS SECTION ----------------------- */
+
+// Will be called upon the xfer finished by SPI driver
+//
+// CONTEXT:
+//      SPI driver calls this callback from context which can't sleep.
 //
 // Is called in a context which can not sleep. See spi_async(...)
 // description for more information.
 static void symspi_spi_xfer_done_callback(void *context)
 {
-	struct symspi_dev *symspi = (struct symspi_dev*)context;
+	struct symspi_dev *symspi = (struct symspi_dev*)context;
+
+#ifdef SYMSPI_DEBUG
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided.", return);
+#endif
+	const bool caps_xfer = symspi->p->caps_xfer_in_flight;
+	const int status = caps_xfer ? symspi->p->caps_spi_msg.status
+				     : symspi->p->spi_msg.status;
+
+	symspi->p->caps_xfer_in_flight = false;
+	trace_symspi_spi_done(symspi->index, symspi->p->current_xfer.id
+			      , symspi->p->current_xfer.size_bytes
+			      , status);
+
+	// No one except us can exit the xfer state, even error
+	// handling shall be postponed
+	if (!SYMSPI_SWITCH_STRICT(XFER, POSTPROCESSING)) {
+		__symspi_error_handle(SYMSPI_ERROR_LOGICAL, 0);
+		return;
+	}
+
+	// Trigger postponed error handling if needed
+	if (symspi->p->last_error != SYMSPI_SUCCESS) {
+		__symspi_error_handle(symspi->p->last_error, 0);
+		return;
+	}
+
+	// NOTE: SPI layer uses mostly (always?) standard
+	//      Linux errors.
+	// not all went fine =(
+	if (status != 0) {
+		__symspi_error_handle(SYMSPI_ERROR_SPI, status);
+		return;
+	}
+
+	// verify the data while it is still hot in cache, the corrupted
+	// frame is not to be delivered to the consumer
+	if (!caps_xfer && !symspi_integrity_rx_check(symspi)) {
+		this_cpu_inc(symspi->p->info->integrity_errors);
+		__symspi_error_handle(SYMSPI_ERROR_INTEGRITY, 0);
+		return;
+	}
+
+	symspi->p->caps_frame_received = caps_xfer;
+
+	// update overview info
+	this_cpu_inc(symspi->p->info->xfers_done_ok);
+	this_cpu_add(symspi->p->info->bytes_tx
+		     , symspi->p->current_xfer.size_bytes);
+	__symspi_rate_meter_wake(symspi);
+
+	// all went fine
+	// we'll shedule the data processing
+	// cause we can not run potentially heavy
+	// and unreliable routine within context
+	// which can't sleep
+	__symspi_schedule_work(symspi, &symspi->p->postprocessing_work);
+}
+
+
+/* ----------------------- ISR SECTION --------------------------------- */
+
+// ISR: Hard IRQ part of their flag drop and set edges handling.
+//
+// CONTEXT:
+//      can not sleep (hard IRQ)
+//
+// As long as it is impossible to register separate ISRs for raising
+// and falling edge of the pin, then both are unified under the
+// following ISR.
+//
+// This handler does only the minimal work: samples their flag level
+// (as close to the edge as possible) and records it with timestamp
+// into the edge log, then wakes the IRQ thread
+// (symspi_their_flag_isr_thread(...)) which replays the logged edges
+// in order and runs the state machine sequences.
+//
+// NOTE: in case of fast drop/raise or raise/drop of their flag, the
+//      sampled level may still miss the edge, like:
+//
+//         OTHER FLAG                 EXECUTION
+//
+//       dropped state                some code
+//
+//           raise  ----------------> start of switch to the ISR context
+//                                    still switching
+//
+//           drop   --(isr queued?)-- just switched, starting ISR execution
+//
+//                                    ISR checks the other flag state and
+//                                    gets LO, while it should be first
+//                                    HI, then (in next interupt), LO
+//
+//      such missed edge pair is not restored (the same level may as
+//      well come from a spurious IRQ), when we listen to both edges
+//      the IRQ thread replays only the level changes, and the missed
+//      pair is handled by the state machine timeouts as any other
+//      lost edge.
+// NOTE: if the edge log is full, the edge is not logged, but the
+//      IRQ thread is asked to sample the level again after the log
+//      replay, so the latest level is never lost.
+static irqreturn_t symspi_their_flag_isr(int irq, void *symspi_device)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)symspi_device;
+
+#ifdef SYMSPI_DEBUG
+	SYMSPI_CHECK_DEVICE("No device provided.", return IRQ_HANDLED);
+#endif
+	symspi_trace("Their flag ISR.");
+
+	const unsigned int head = symspi->p->edge_log_head;
+	const unsigned int tail = READ_ONCE(symspi->p->edge_log_tail);
+
+	// track in info
+	this_cpu_inc(symspi->p->info->their_flag_edges);
+
+	if (CIRC_SPACE(head, tail, SYMSPI_EDGE_LOG_SIZE) == 0) {
+		this_cpu_inc(symspi->p->info->edge_log_overruns);
+		WRITE_ONCE(symspi->p->edge_log_resample, true);
+		return IRQ_WAKE_THREAD;
+	}
+
+	struct symspi_edge_log_entry *entry = &symspi->p->edge_log[head];
+
+	entry->timestamp = ktime_get();
+	entry->level = symspi_their_flag_is_set(symspi);
+	trace_symspi_their_flag_edge(symspi->index, entry->level, false);
+
+	smp_store_release(&symspi->p->edge_log_head
+			  , (head + 1) & (SYMSPI_EDGE_LOG_SIZE - 1));
+
+	return IRQ_WAKE_THREAD;
+}
+
+// Helper. Replays the their flag level seen by IRQ thread. When we
+// listen to both edges, the level equal to the last one is not an
+// edge and is skipped, when we listen to the falling edge only
+// (hardware SPI RDY) every level is replayed, as every IRQ is an edge.
+//
+// CONTEXT:
+//      IRQ thread (see symspi_their_flag_isr_thread(...))
+static inline void symspi_their_flag_replay_level(struct symspi_dev *symspi
+						  , const bool level)
+{
+	const bool both_edges = !symspi->p->hardware_spi_rdy;
+	const bool changed = level != symspi->p->their_flag_last_level;
+
+	symspi->p->their_flag_last_level = level;
+	if (both_edges && !changed) {
+		return;
+	}
+
+	// the level is tracked in COLD state too, but nothing is run
+	if (symspi_get_state(symspi) == SYMSPI_STATE_COLD) {
+		return;
+	}
+
+	if (level) {
+		symspi_their_flag_set_isr_sequence(symspi);
+	} else {
+		symspi_their_flag_drop_isr_sequence(symspi);
+	}
+}
+
+// ISR: Threaded IRQ part of their flag drop and set edges handling.
+// Replays all edges recorded in the edge log by
+// symspi_their_flag_isr(...) in order, then the level sampled again
+// (if the edge log was full).
+//
+// CONTEXT:
+//      IRQ thread (sleepable, but state machine sequences called
+//      from here don't sleep)
+static irqreturn_t symspi_their_flag_isr_thread(int irq, void *symspi_device)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)symspi_device;
+
+#ifdef SYMSPI_DEBUG
+	SYMSPI_CHECK_DEVICE("No device provided.", return IRQ_HANDLED);
+#endif
+
+	while (true) {
+		const unsigned int head
+			= smp_load_acquire(&symspi->p->edge_log_head);
+		const unsigned int tail = symspi->p->edge_log_tail;
+
+		if (CIRC_CNT(head, tail, SYMSPI_EDGE_LOG_SIZE) == 0) {
+			// the edges were not logged, so the level after
+			// them is taken as is
+			if (!xchg(&symspi->p->edge_log_resample, false)) {
+				break;
+			}
+
+			const bool level = symspi_their_flag_is_set(symspi);
+
+			this_cpu_inc(
+				symspi->p->info->their_flag_level_resamples);
+			trace_symspi_their_flag_edge(symspi->index, level, true);
+			symspi_their_flag_replay_level(symspi, level);
+			continue;
+		}
+
+		const bool level = symspi->p->edge_log[tail].level;
+
+		// release the entry before processing, so hard IRQ has
+		// the max room while we run the sequences
+		smp_store_release(&symspi->p->edge_log_tail
+				  , (tail + 1) & (SYMSPI_EDGE_LOG_SIZE - 1));
+
+		symspi_their_flag_replay_level(symspi, level);
+	}
+
+	return IRQ_HANDLED;
+}
+
+// Handles their flag drop edge: from ACTIVE to INACTIVE
+// (falling edge of the flag means: "previous xfer was processed")
+//
+// CONTEXT:
+//      IRQ thread, must not sleep
+//
+// \param symspi_dev is a pointer on our symspi data
+//
+static void symspi_their_flag_drop_isr_sequence(
+		struct symspi_dev *symspi)
+{
+#ifdef SYMSPI_DEBUG
+	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided.", return);
+#endif
+	// the counter lives in state word high bits, so the state is
+	// not affected
+	const int counter = SYMSPI_STATE_WORD_TO_COUNTER(
+			atomic_add_return_release(
+				SYMSPI_STATE_WORD_COUNTER_ONE
+				, &symspi->p->state_word));
+
+	// ISR does nothing but counter management on SPI slave side
+	if (counter == 1 && symspi->p->spi_master_mode) {
+		symspi_try_leave_waiting_prev_sequence(symspi);
+		return;
+	}
+
+	// we launch the recovery procedure only on crossing the border
+	// between valid and invalid values to avoid overhead in case of
+	// error indication from the other side
+	if (counter >= 2) {
+		__symspi_error_handle(SYMSPI_ERROR_OTHER_SIDE, 0);
+		return;
+	}
+
+	if (counter <= 0) {
+		symspi_err("Unexpected (<= 0) their flag drop counter value."
+			   " Something is really broken.");
+	}
+}
+
+// Handles their flag set edge: from INACTIVE to ACTIVE
+// (raised flag means: "ready for xfer + [have data to send]")
+//
+// CONTEXT:
+//      IRQ thread, must not sleep
+//
+// \param symspi_dev is a pointer on our symspi data
+//
+// On this interrupt we should initiate the xfer.
+static void symspi_their_flag_set_isr_sequence(
+		struct symspi_dev *symspi)
+{
+#ifdef SYMSPI_DEBUG
+	SYMSPI_CHECK_DEVICE("No device provided.", return);
+#endif
+	// TODO: Use the softIRQs
+	// see: https://notes.shichao.io/lkd/ch8/#implementing-softirqs
+	// for detailed description
+	//
+	// Register them as ~network TX/RX level,
+	// as long as ICCom which is a consumer of the is actually
+	// the same inter process communication mechanics.
+
+	// the other side request comes only after its flag drop
+	// following our last xfer start (drop counter is reset there),
+	// so the set edge with no drop since then is the edge of that
+	// xfer, which busy poll got ahead of (see
+	// symspi_busy_poll_their_flag(...)), being replayed late
+	// NOTE: the counter is incremented only by IRQ thread (us), and
+	//      is reset only on the xfer start (not in IDLE), so it stays
+	//      the same till the switch
+	if (symspi->p->spi_master_mode && !symspi->p->hardware_spi_rdy
+			&& symspi_their_flag_drop_counter(symspi) == 0
+			&& symspi_get_state(symspi) == SYMSPI_STATE_IDLE) {
+		symspi_trace("Their flag set edge of the done xfer, ignored.");
+		return;
+	}
+
+	// other side initiated xfer sequence
+	if (SYMSPI_SWITCH_STRICT(IDLE, XFER_PREPARE)) {
+		// their flag raise is our wake up source
+		symspi_pm_wake(symspi);
+		// no work queueing here, to decrease communication latency
+		// as long as symspi_do_xfer() contains lightweight
+		// determined operations (we don't require consumer data
+		// here, it is already prepared)
+		symspi_xfer_prepare_to_waiting_prev_sequence(symspi);
+		return;
+	}
+
+	// in absence of SPI_RDY hardware support on SPI
+	// master side, we have to trigger SPI xfer manually
+	if (symspi->p->spi_master_mode && !symspi->p->hardware_spi_rdy) {
+		symspi_try_leave_waiting_rdy_sequence(symspi);
+	}
+}
+
+/* --------------------- RUNTIME PM SECTION ---------------------------- */
+
+// Helper. Enables the runtime PM of the SPI device with autosuspend
+// and sets the resume latency PM QoS constraint. Right after the
+// start the device is considered suspended, the first xfer
+// resumes it.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_pm_init(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	struct device *dev = &symspi->spi->dev;
+
+	atomic_set(&symspi->p->pm_held, 0);
+	symspi->p->pm_wake_time = 0;
+	symspi->p->pm_last_idle_jiffies = jiffies;
+	timer_setup(&symspi->p->pm_idle_timer
+		    , __symspi_pm_idle_timer_callback, 0);
+	symspi->p->pm_resume_last_usec = 0;
+	symspi->p->pm_resume_max_usec = 0;
+
+	// not vital: only the deeper power states might be used
+	const int res = dev_pm_qos_add_request(dev, &symspi->p->pm_qos
+					, DEV_PM_QOS_RESUME_LATENCY
+					, SYMSPI_RESUME_LATENCY_BUDGET_USEC);
+	if (res < 0) {
+		symspi_warning("failed to set resume latency constraint"
+			       ", err: %d", res);
+	}
+
+	pm_runtime_set_autosuspend_delay(dev, SYMSPI_AUTOSUSPEND_DELAY_MSEC);
+	pm_runtime_use_autosuspend(dev);
+	pm_runtime_enable(dev);
+	symspi->p->pm_enabled = true;
+#endif
+}
+
+// Helper. Disables the runtime PM of the SPI device and releases
+// our usage reference if any. After this call no runtime PM callbacks
+// are running or will be called.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_pm_close(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	if (!symspi->p->pm_enabled) {
+		return;
+	}
+
+	struct device *dev = &symspi->spi->dev;
+
+	del_timer_sync(&symspi->p->pm_idle_timer);
+	pm_runtime_disable(dev);
+	if (atomic_xchg(&symspi->p->pm_held, 0)) {
+		pm_runtime_put_noidle(dev);
+	}
+	pm_runtime_dont_use_autosuspend(dev);
+	pm_runtime_set_suspended(dev);
+
+	if (dev_pm_qos_request_active(&symspi->p->pm_qos)) {
+		dev_pm_qos_remove_request(&symspi->p->pm_qos);
+	}
+	symspi->p->pm_enabled = false;
+#endif
+}
+
+// Helper. Takes the runtime PM usage reference of the SPI device
+// (once per busy period) and triggers its asynchronous resume if
+// it is suspended. No-op if the reference is held already (the link
+// is busy or was idle for less than SYMSPI_PM_IDLE_HOLD_MSEC), so
+// it costs a single atomic op on the busy link.
+//
+// CONTEXT:
+//      any
+static inline void symspi_pm_wake(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	if (atomic_xchg(&symspi->p->pm_held, 1)) {
+		return;
+	}
+
+	symspi->p->pm_wake_time = ktime_get();
+	pm_runtime_get(&symspi->spi->dev);
+#endif
+}
+
+#ifdef SYMSPI_RUNTIME_PM
+// Helper. Releases the runtime PM usage reference of the SPI device
+// (if held), so the device autosuspends after
+// SYMSPI_AUTOSUSPEND_DELAY_MSEC unless woken up again.
+//
+// CONTEXT:
+//      any
+static inline void __symspi_pm_put(struct symspi_dev *symspi)
+{
+	if (!atomic_xchg(&symspi->p->pm_held, 0)) {
+		return;
+	}
+
+	pm_runtime_mark_last_busy(&symspi->spi->dev);
+	pm_runtime_put_autosuspend(&symspi->spi->dev);
+}
+
+// Releases the runtime PM usage reference of the SPI device when
+// the link stayed idle for SYMSPI_PM_IDLE_HOLD_MSEC, otherwise
+// rearms itself to check again when the hold time since the last
+// idle is over.
+//
+// CONTEXT:
+//      softirq
+static void __symspi_pm_idle_timer_callback(struct timer_list *t)
+{
+	struct symspi_dev_private *priv = from_timer(priv, t
+						     , pm_idle_timer);
+	struct symspi_dev *symspi = priv->symspi;
+
+	// the busy link will rearm us when it gets idle again
+	if (symspi_get_state(symspi) != SYMSPI_STATE_IDLE) {
+		return;
+	}
+
+	const unsigned long release_jiffies
+		= READ_ONCE(priv->pm_last_idle_jiffies)
+		  + msecs_to_jiffies(SYMSPI_PM_IDLE_HOLD_MSEC);
+
+	if (time_before(jiffies, release_jiffies)) {
+		mod_timer(&priv->pm_idle_timer, release_jiffies);
+		return;
+	}
+
+	__symspi_pm_put(symspi);
+
+	// the link might have left IDLE (and found the reference
+	// still held) right before we released the reference,
+	// then we take it back
+	if (symspi_get_state(symspi) != SYMSPI_STATE_IDLE) {
+		symspi_pm_wake(symspi);
+	}
+}
+#endif
+
+// Helper. Notes that the link got idle: the runtime PM usage
+// reference of the SPI device is kept for SYMSPI_PM_IDLE_HOLD_MSEC
+// more (see @pm_idle_timer), so the next xfer cycle started within
+// this time doesn't need to take it again. Costs a store and the
+// timer check per idle entry.
+//
+// CONTEXT:
+//      any
+static inline void symspi_pm_idle(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	if (!atomic_read(&symspi->p->pm_held)) {
+		return;
+	}
+
+	WRITE_ONCE(symspi->p->pm_last_idle_jiffies, jiffies);
+	if (!timer_pending(&symspi->p->pm_idle_timer)) {
+		mod_timer(&symspi->p->pm_idle_timer, jiffies
+			  + msecs_to_jiffies(SYMSPI_PM_IDLE_HOLD_MSEC));
+	}
+#endif
+}
+
+// Helper. Releases the runtime PM usage reference of the SPI device
+// (if held) right away, used when the link stops.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_pm_release(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	del_timer_sync(&symspi->p->pm_idle_timer);
+	__symspi_pm_put(symspi);
+#endif
+}
+
+// Helper. Checks if the SPI device is active, so we can raise our
+// flag and the SPI xfer can be submitted right away. If the device
+// is still resuming, then the xfer preparation is deferred to the
+// work queue (see symspi_do_xfer_work_wrapper(...)) which waits for
+// the resume.
+//
+// CONTEXT:
+//      any
+//
+// RETURNS:
+//      true: if device is active and the xfer preparation can go on
+//      false: if the xfer preparation was deferred
+static inline bool symspi_pm_xfer_allowed(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+	return true;
+#else
+	// NOTE: we hold the usage reference here, so the active device
+	//      can not start suspending
+	if (likely(pm_runtime_active(&symspi->spi->dev))) {
+		return true;
+	}
+
+	this_cpu_inc(symspi->p->info->pm_deferred_xfers);
+	__symspi_schedule_work(symspi, &symspi->p->xfer_work);
+	return false;
+#endif
+}
+
+// Helper. Synchronously resumes the SPI device before the deferred
+// xfer submission.
+//
+// NOTE: resume failure is only reported: the SPI core manages
+//      the SPI controller power on its own, so we still can try
+//      to submit the xfer, and otherwise we get stuck in XFER state.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_pm_resume_sync(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_RUNTIME_PM
+	(void)symspi;
+#else
+	const int res = pm_runtime_resume(&symspi->spi->dev);
+	if (res < 0) {
+		symspi_warning("failed to resume SPI device, err: %d", res);
+	}
+#endif
+}
+
+#ifdef SYMSPI_RUNTIME_PM
+// Runtime PM suspend callback of the SPI device. Refuses to suspend
+// if the link got busy while the suspend was pending, or the other
+// side is about to start the xfer.
+//
+// CONTEXT:
+//      sleepable
+static int symspi_runtime_suspend(struct device *dev)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)dev_get_drvdata(dev);
+
+	if (IS_ERR_OR_NULL(symspi) || IS_ERR_OR_NULL(symspi->p)) {
+		return 0;
+	}
+
+	const char state = symspi_get_state(symspi);
+
+	if ((state != SYMSPI_STATE_IDLE && state != SYMSPI_STATE_COLD)
+			|| symspi_their_flag_is_set(symspi)) {
+		return -EBUSY;
+	}
+
+	// no periodic wakeups while suspended
+	del_timer_sync(&symspi->p->rate_meter_timer);
+
+	this_cpu_inc(symspi->p->info->pm_suspends);
+	symspi_info(SYMSPI_LOG_INFO_DBG_LEVEL, "suspended");
+
+	return 0;
+}
+
+// Runtime PM resume callback of the SPI device. Accounts the resume
+// latency (from the wake up request till the device is resumed).
+//
+// CONTEXT:
+//      sleepable
+static int symspi_runtime_resume(struct device *dev)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)dev_get_drvdata(dev);
+
+	if (IS_ERR_OR_NULL(symspi) || IS_ERR_OR_NULL(symspi->p)) {
+		return 0;
+	}
+
+	// NOTE: the rate meter is restarted by the next xfer
+
+	this_cpu_inc(symspi->p->info->pm_resumes);
+
+	const ktime_t wake_time = symspi->p->pm_wake_time;
+
+	if (wake_time == 0) {
+		// resumed not by the link activity
+		return 0;
+	}
+	symspi->p->pm_wake_time = 0;
+
+	const unsigned int latency_usec
+		= (unsigned int)ktime_us_delta(ktime_get(), wake_time);
+
+	symspi->p->pm_resume_last_usec = latency_usec;
+	symspi->p->pm_resume_max_usec
+		= max(symspi->p->pm_resume_max_usec, latency_usec);
+
+	if (latency_usec > SYMSPI_RESUME_LATENCY_BUDGET_USEC) {
+		this_cpu_inc(symspi->p->info->pm_resumes_over_budget);
+		symspi_warning("resume took %u us, while budget is "
+			       macro_val_str(SYMSPI_RESUME_LATENCY_BUDGET_USEC)
+			       " us", latency_usec);
+	}
+
+	return 0;
+}
+
+static const struct dev_pm_ops symspi_pm_ops = {
+	SET_RUNTIME_PM_OPS(symspi_runtime_suspend, symspi_runtime_resume
+			   , NULL)
+};
+#endif
+
+/* --------------------- CHAR DEVICE SECTION --------------------------- */
+
+#ifdef SYMSPI_CHARDEV
+
+// The SymSPI char device (see SYMSPI_CHARDEV and symspi_uapi.h).
+//
+// @misc the misc device (/dev/@name).
+// @name the misc device name.
+// @symspi {valid ptr} the SymSPI device served.
+// @ref the references counter: one is held by the SymSPI device,
+//      one by the open file, the last one frees the struct.
+// @lock protects all fields below (except the ones written by
+//      xfer accepted callback) and serializes the RX work and the
+//      ioctls.
+// @removed true if the SymSPI device was removed.
+// @in_use true while the char device is open.
+// @active true while the char device owns the running SymSPI link.
+// @area {NULL || valid ptr} the shared (mmap'ed) area, allocated on
+//      open, freed on release.
+//      OWNERSHIP: our module
+// @area_size the @area size (page aligned).
+// @ctrl {NULL || valid ptr} the control header at @area beginning.
+//      NOTE: is writable by userspace, so the indexes are read
+//          from it only once per use and are validated.
+// @frame_max_bytes the max frame size (slot data capacity), the
+//      device max xfer size, the link one (negotiated on link start)
+//      never exceeds it.
+// @slot_size the ring slot size (header + data capacity, aligned).
+// @tx_offset the TX slots offset in @area.
+// @rx_offset the RX slots offset in @area.
+// @tx_xfers the xfers bound to the TX slots (by slot).
+// @idle_xfer the initial default xfer (zeroed frame).
+// @idle_data the @idle_xfer data.
+// @tx_submitted the number of TX frames given to SymSPI TX ring.
+// @tx_released the number of TX frames taken by SymSPI (their slots
+//      are free for userspace again), is written only by the xfer
+//      accepted callback (serialized by SymSPI).
+// @rx_head the number of RX frames published to userspace.
+// @force_size_change the force_size_change flag the TX frames are
+//      given to SymSPI with (see SYMSPI_IOC_SET_FORCE_SIZE).
+// @io_lock serializes the rings processing (@rx_work and TX kick)
+//      and its settings (@force_size_change, @eventfd), is never held
+//      over symspi_close(...) (the closing link runs its pending
+//      works, @rx_work among them), nests in @lock.
+// @rx_work drains the SymSPI RX ring into the shared RX ring and
+//      refills the SymSPI TX ring from the shared TX ring, runs in
+//      the SymSPI device work queue (see __symspi_schedule_work(...)),
+//      reinited on every link start.
+// @wait the poll(...) wait queue.
+// @eventfd {NULL || valid ptr} is signaled on new RX frames.
+struct symspi_chardev {
+	struct miscdevice misc;
+	char name[SYMSPI_PROC_ROOT_NAME_MAX_LEN];
+	struct symspi_dev *symspi;
+	struct kref ref;
+
+	struct mutex lock;
+	struct mutex io_lock;
+	bool removed;
+	bool in_use;
+	bool active;
+
+	void *area;
+	size_t area_size;
+	struct symspi_uapi_ctrl *ctrl;
+	size_t frame_max_bytes;
+	size_t slot_size;
+	size_t tx_offset;
+	size_t rx_offset;
+
+	struct full_duplex_xfer tx_xfers[SYMSPI_CHARDEV_RING_SLOTS];
+	struct full_duplex_xfer idle_xfer;
+	void *idle_data;
+	u32 tx_submitted;
+	u32 tx_released;
+	u32 rx_head;
+	bool force_size_change;
+
+	struct symspi_work_struct rx_work;
+	wait_queue_head_t wait;
+	struct eventfd_ctx *eventfd;
+};
+
+// all char devices, indexed by symspi_dev::index
+// (protected by symspi_devices_lock)
+static struct symspi_chardev *symspi_chardevs[SYMSPI_MAX_DEVICES];
+
+// Helper.
+// RETURNS:
+//      the shared ring slot of given @index
+static inline struct symspi_uapi_slot *symspi_chardev_slot(
+		struct symspi_chardev *cdev, const size_t ring_offset
+		, const u32 index)
+{
+	return (struct symspi_uapi_slot *)((u8 *)cdev->area + ring_offset
+			+ (index & (SYMSPI_CHARDEV_RING_SLOTS - 1))
+			  * cdev->slot_size);
+}
+
+static void symspi_chardev_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct symspi_chardev, ref));
+}
+
+// Releases the TX slot of the xfer taken by SymSPI.
+//
+// CONTEXT:
+//      any
+static void symspi_chardev_xfer_accepted(struct full_duplex_xfer *xfer)
+{
+	struct symspi_chardev *cdev = (struct symspi_chardev *)xfer->consumer_data;
+
+	if (!cdev || xfer == &cdev->idle_xfer) {
+		return;
+	}
+
+	cdev->tx_released++;
+	smp_store_release(&cdev->ctrl->tx.tail, cdev->tx_released);
+	wake_up_interruptible(&cdev->wait);
+}
+
+// Notifies us about new data in SymSPI RX ring.
+//
+// CONTEXT:
+//      sleepable, lightweight
+static void symspi_chardev_rx_ready(void *device)
+{
+	struct symspi_dev *symspi = (struct symspi_dev *)device;
+	struct symspi_chardev *cdev = symspi_chardevs[symspi->index];
 
-#ifdef SYMSPI_DEBUG
-	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided.", return);
-#endif
+	if (cdev) {
+		__symspi_schedule_work(symspi, &cdev->rx_work);
+	}
+}
 
-	// No one except us can exit the xfer state, even error
-	// handling shall be postponed
-	if (!SYMSPI_SWITCH_STRICT(XFER, POSTPROCESSING)) {
-		__symspi_error_handle(SYMSPI_ERROR_LOGICAL, 0);
+// Helper. Gives the TX frames published by userspace to SymSPI TX ring.
+// The frames are cut to the link max xfer size (it can be lowered by
+// capabilities negotiation).
+//
+// CONTEXT:
+//      sleepable, @cdev->io_lock is held, @cdev->active
+static void __symspi_chardev_tx_refill(struct symspi_chardev *cdev)
+{
+	struct full_duplex_xfer *batch[SYMSPI_TX_RING_SIZE];
+	const u32 head = smp_load_acquire(&cdev->ctrl->tx.head);
+	const u32 released = READ_ONCE(cdev->tx_released);
+	const size_t size_max = min_t(size_t, cdev->frame_max_bytes
+			, READ_ONCE(cdev->symspi->p->xfer_size_max_bytes));
+	u32 count = head - cdev->tx_submitted;
+	u32 i;
+
+	if (head - released > SYMSPI_CHARDEV_RING_SLOTS
+			|| count > SYMSPI_CHARDEV_RING_SLOTS) {
+		symspi_warning("%s: invalid TX ring head: %u", cdev->name, head);
 		return;
 	}
-
-	// Trigger postponed error handling if needed
-	if (symspi->p->last_error != SYMSPI_SUCCESS) {
-		__symspi_error_handle(symspi->p->last_error, 0);
+	count = min_t(u32, count, SYMSPI_TX_RING_SIZE);
+	if (count == 0) {
 		return;
 	}
 
-	// NOTE: SPI layer uses mostly (always?) standard
-	//      Linux errors.
-	// not all went fine =(
-	if (symspi->p->spi_msg.status != 0) {
-		__symspi_error_handle(SYMSPI_ERROR_SPI
-				      , symspi->p->spi_msg.status);
-		return;
+	for (i = 0; i < count; i++) {
+		const u32 index = cdev->tx_submitted + i;
+		struct symspi_uapi_slot *slot = symspi_chardev_slot(cdev
+						, cdev->tx_offset, index);
+		struct full_duplex_xfer *xfer = &cdev->tx_xfers[
+				index & (SYMSPI_CHARDEV_RING_SLOTS - 1)];
+
+		xfer->size_bytes = clamp_t(size_t, READ_ONCE(slot->size_bytes)
+					   , 1, size_max);
+		xfer->data_tx = slot->data;
+		batch[i] = xfer;
 	}
 
-	// update overview info
-	symspi->p->info.xfers_done_ok += 1;
+	const int res = symspi_data_xchange_batch((void*)cdev->symspi, batch
+						  , count
+						  , cdev->force_size_change);
 
-	// all went fine
-	// we'll shedule the data processing
-	// cause we can not run potentially heavy
-	// and unreliable routine within context
-	// which can't sleep
-	__symspi_schedule_work(symspi, &symspi->p->postprocessing_work);
+	if (res < 0) {
+		symspi_warning("%s: TX frames submission failed: %d"
+			       , cdev->name, res);
+		return;
+	}
+	cdev->tx_submitted += res;
 }
 
-
-/* ----------------------- ISR SECTION --------------------------------- */
-
-// ISR: Handles their flag drop and set edges
+// Moves the received frames to the shared RX ring, and refills
+// SymSPI TX ring.
 //
 // CONTEXT:
-//      can not sleep (ISR)
-//
-// As long as it is impossible to register separate ISRs for raising
-// and falling edge of the pin, then both are unified under the
-// following ISR.
-//
-// TODO: the issue exists that in case of fast drop/raise or raise/drop
-//      of other side flag, we will not be able to detect it cause
-//      if this ISR we manually check the flag state AFTER the interrupt
-//      happened, so if flag state was altered in following way:
-//
-//         OTHER FLAG                 EXECUTION
-//
-//       dropped state                some code
-//
-//           raise  ----------------> start of switch to the ISR context
-//                                    still switching
-//
-//           drop   --(isr queued?)-- just switched, starting ISR execution
-//
-//                                    ISR checks the other flag state and
-//                                    gets LO, while it should be first
-//                                    HI, then (in next interupt), LO
-//
-//      this might be fixed if have separate handlers for GPIO raise and
-//      drop events, but this functionality is not provided at GPIO
-//      abstration layer, which allows only to register single ISR to
-//      only drop, or only raise, or only to drop/raise events. Clarify
-//      if hardware allows us to register one ISR to raise and other ISR
-//      to drop.
-static irqreturn_t symspi_their_flag_isr(int irq, void *symspi_device)
+//      sleepable
+static void symspi_chardev_rx_work(struct symspi_work_struct *work)
 {
-	struct symspi_dev *symspi = (struct symspi_dev *)symspi_device;
+	struct symspi_chardev *cdev = container_of(work, struct symspi_chardev
+						   , rx_work);
+	bool delivered = false;
+	const void *data;
+	size_t size;
+	int xfer_id;
 
-#ifdef SYMSPI_DEBUG
-	SYMSPI_CHECK_DEVICE("No device provided.", return IRQ_HANDLED);
-#endif
-	symspi_trace("Their flag ISR.");
+	mutex_lock(&cdev->io_lock);
 
-	if (symspi->p->state == SYMSPI_STATE_COLD) {
-		return IRQ_HANDLED;
+	if (!cdev->active) {
+		goto unlock;
 	}
 
-	if (symspi_their_flag_is_set(symspi)) {
-		symspi_their_flag_set_isr_sequence(symspi);
-	} else {
-		symspi_their_flag_drop_isr_sequence(symspi);
+	struct symspi_uapi_ctrl *ctrl = cdev->ctrl;
+
+	while ((data = symspi_rx_ring_peek((void*)cdev->symspi, &size
+					   , &xfer_id)) != NULL) {
+		if (IS_ERR(data)) {
+			break;
+		}
+
+		const u32 tail = smp_load_acquire(&ctrl->rx.tail);
+
+		if (cdev->rx_head - tail >= SYMSPI_CHARDEV_RING_SLOTS) {
+			WRITE_ONCE(ctrl->rx.dropped, ctrl->rx.dropped + 1);
+		} else {
+			struct symspi_uapi_slot *slot = symspi_chardev_slot(
+					cdev, cdev->rx_offset, cdev->rx_head);
+
+			size = min(size, cdev->frame_max_bytes);
+			memcpy(slot->data, data, size);
+			slot->size_bytes = size;
+			slot->xfer_id = xfer_id;
+
+			cdev->rx_head++;
+			smp_store_release(&ctrl->rx.head, cdev->rx_head);
+			delivered = true;
+		}
+
+		symspi_rx_ring_release((void*)cdev->symspi);
 	}
 
-	// track in info
-	symspi->p->info.their_flag_edges += 1;
+	__symspi_chardev_tx_refill(cdev);
 
-	return IRQ_HANDLED;
+	if (delivered) {
+		wake_up_interruptible(&cdev->wait);
+		if (cdev->eventfd) {
+			eventfd_signal(cdev->eventfd, 1);
+		}
+	}
+
+unlock:
+	mutex_unlock(&cdev->io_lock);
 }
 
-// Handles their flag drop edge: from ACTIVE to INACTIVE
-// (falling edge of the flag means: "previous xfer was processed")
+// Helper. Allocates and initializes the shared area.
 //
 // CONTEXT:
-//      can not sleep (ISR)
+//      sleepable, @cdev->lock is held
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int __symspi_chardev_area_init(struct symspi_chardev *cdev)
+{
+	const size_t ring_bytes = SYMSPI_CHARDEV_RING_SLOTS * cdev->slot_size;
+	struct symspi_uapi_ctrl *ctrl;
+	int i;
+
+	cdev->tx_offset = ALIGN(sizeof(struct symspi_uapi_ctrl)
+				, SMP_CACHE_BYTES);
+	cdev->rx_offset = cdev->tx_offset + ring_bytes;
+	cdev->area_size = PAGE_ALIGN(cdev->rx_offset + ring_bytes);
+
+	cdev->area = vmalloc_user(cdev->area_size);
+	if (!cdev->area) {
+		return -ENOMEM;
+	}
+	cdev->idle_data = kzalloc(cdev->frame_max_bytes, GFP_KERNEL);
+	if (!cdev->idle_data) {
+		vfree(cdev->area);
+		cdev->area = NULL;
+		return -ENOMEM;
+	}
+
+	ctrl = (struct symspi_uapi_ctrl *)cdev->area;
+	ctrl->magic = SYMSPI_UAPI_MAGIC;
+	ctrl->version = SYMSPI_UAPI_VERSION;
+	ctrl->frame_max_bytes = cdev->frame_max_bytes;
+	ctrl->map_size = cdev->area_size;
+	ctrl->tx.slots_count = SYMSPI_CHARDEV_RING_SLOTS;
+	ctrl->tx.slot_size = cdev->slot_size;
+	ctrl->tx.offset = cdev->tx_offset;
+	ctrl->rx.slots_count = SYMSPI_CHARDEV_RING_SLOTS;
+	ctrl->rx.slot_size = cdev->slot_size;
+	ctrl->rx.offset = cdev->rx_offset;
+	cdev->ctrl = ctrl;
+
+	cdev->tx_submitted = 0;
+	cdev->tx_released = 0;
+	cdev->rx_head = 0;
+	cdev->force_size_change = false;
+
+	for (i = 0; i < SYMSPI_CHARDEV_RING_SLOTS; i++) {
+		memset(&cdev->tx_xfers[i], 0, sizeof(cdev->tx_xfers[i]));
+		cdev->tx_xfers[i].consumer_data = cdev;
+	}
+	memset(&cdev->idle_xfer, 0, sizeof(cdev->idle_xfer));
+	cdev->idle_xfer.size_bytes = cdev->frame_max_bytes;
+	cdev->idle_xfer.data_tx = cdev->idle_data;
+	cdev->idle_xfer.consumer_data = cdev;
+
+	return 0;
+}
+
+// Helper. Frees the shared area.
 //
-// \param symspi_dev is a pointer on our symspi data
+// CONTEXT:
+//      sleepable, @cdev->lock is held
+static void __symspi_chardev_area_free(struct symspi_chardev *cdev)
+{
+	cdev->ctrl = NULL;
+	vfree(cdev->area);
+	cdev->area = NULL;
+	kfree(cdev->idle_data);
+	cdev->idle_data = NULL;
+}
+
+// Helper. Stops the link owned by the char device.
 //
-static void symspi_their_flag_drop_isr_sequence(
-		struct symspi_dev *symspi)
+// CONTEXT:
+//      sleepable, @cdev->lock is held
+static void __symspi_chardev_deactivate(struct symspi_chardev *cdev)
 {
-#ifdef SYMSPI_DEBUG
-	SYMSPI_CHECK_DEVICE_AND_PRIVATE("No device provided.", return);
-#endif
-	int *counter_ptr = &(symspi->p->their_flag_drop_counter);
+	if (!cdev->active) {
+		return;
+	}
+	mutex_lock(&cdev->io_lock);
+	cdev->active = false;
+	mutex_unlock(&cdev->io_lock);
+
+	// the pending @rx_work is run by the closing link, and does
+	// nothing
+	symspi_close((void*)cdev->symspi);
+	cdev->symspi->xfer_accepted_callback = NULL;
+	cdev->symspi->rx_ready_callback = NULL;
+}
 
-	// NOTE: we could use the kernel provided function, but
-	//          with current kernel version, all atomic operations
-	//          except those for x86 arc are implemented there
-	//          by blocking the interrupts, which is slow.
-	// TODO: if we move to new kernel, use kernel-defined
-	//       atomic operations, like:
-	//          atomic_add(1, counter_ptr);
-	//
-	// For now will use GCC atomic builtin.
+static int symspi_chardev_open(struct inode *inode, struct file *file)
+{
+	struct symspi_chardev *cdev = container_of(file->private_data
+						   , struct symspi_chardev
+						   , misc);
+	struct symspi_dev *symspi = cdev->symspi;
+	int res;
 
-	const int counter = __atomic_add_fetch(counter_ptr, 1
-					       , __ATOMIC_SEQ_CST);
+	mutex_lock(&cdev->lock);
 
-	// ISR does nothing but counter management on SPI slave side
-	if (counter == 1 && symspi->p->spi_master_mode) {
-		symspi_try_leave_waiting_prev_sequence(symspi);
-		return;
+	if (cdev->removed) {
+		res = -ENODEV;
+		goto unlock;
+	}
+	if (cdev->in_use || symspi_is_running((void*)symspi)) {
+		symspi_info(SYMSPI_LOG_INFO_OPT_LEVEL, "%s: device is busy"
+			    , cdev->name);
+		res = -EBUSY;
+		goto unlock;
 	}
 
-	// we launch the recovery procedure only on crossing the border
-	// between valid and invalid values to avoid overhead in case of
-	// error indication from the other side
-	if (counter >= 2) {
-		__symspi_error_handle(SYMSPI_ERROR_OTHER_SIDE, 0);
-		return;
+	res = __symspi_chardev_area_init(cdev);
+	if (res != 0) {
+		goto unlock;
 	}
 
-	if (counter <= 0) {
-		symspi_err("Unexpected (<= 0) their flag drop counter value."
-			   " Something is really broken.");
+	// the link start brings the new work queue
+	SYMSPI_INIT_WORK(&cdev->rx_work, &symspi_chardev_rx_work);
+	symspi->xfer_accepted_callback = &symspi_chardev_xfer_accepted;
+	symspi->rx_ready_callback = &symspi_chardev_rx_ready;
+	symspi->consumer_owned_buffers = false;
+
+	res = symspi_init((void*)symspi, &cdev->idle_xfer);
+	if (res < 0) {
+		symspi_err("%s: failed to start SymSPI: %d", cdev->name, res);
+		symspi->xfer_accepted_callback = NULL;
+		symspi->rx_ready_callback = NULL;
+		__symspi_chardev_area_free(cdev);
+		goto unlock;
 	}
+
+	kref_get(&cdev->ref);
+	cdev->in_use = true;
+	cdev->active = true;
+	file->private_data = cdev;
+	res = 0;
+
+unlock:
+	mutex_unlock(&cdev->lock);
+	return res;
 }
 
-// Handles their flag set edge: from INACTIVE to ACTIVE
-// (raised flag means: "ready for xfer + [have data to send]")
+static int symspi_chardev_release(struct inode *inode, struct file *file)
+{
+	struct symspi_chardev *cdev = (struct symspi_chardev *)file->private_data;
+
+	mutex_lock(&cdev->lock);
+	__symspi_chardev_deactivate(cdev);
+	mutex_unlock(&cdev->lock);
+
+	__symspi_cancel_closed_work_sync(cdev->symspi, &cdev->rx_work);
+
+	mutex_lock(&cdev->lock);
+	if (cdev->eventfd) {
+		eventfd_ctx_put(cdev->eventfd);
+		cdev->eventfd = NULL;
+	}
+	__symspi_chardev_area_free(cdev);
+	cdev->in_use = false;
+	mutex_unlock(&cdev->lock);
+
+	kref_put(&cdev->ref, &symspi_chardev_free);
+	return 0;
+}
+
+static int symspi_chardev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct symspi_chardev *cdev = (struct symspi_chardev *)file->private_data;
+
+	if (vma->vm_pgoff != 0
+			|| vma->vm_end - vma->vm_start > cdev->area_size) {
+		return -EINVAL;
+	}
+
+	return remap_vmalloc_range(vma, cdev->area, 0);
+}
+
+static __poll_t symspi_chardev_poll(struct file *file, poll_table *wait)
+{
+	struct symspi_chardev *cdev = (struct symspi_chardev *)file->private_data;
+	const struct symspi_uapi_ctrl *ctrl = cdev->ctrl;
+	__poll_t mask = 0;
+
+	poll_wait(file, &cdev->wait, wait);
+
+	if (READ_ONCE(cdev->rx_head) != READ_ONCE(ctrl->rx.tail)) {
+		mask |= EPOLLIN | EPOLLRDNORM;
+	}
+	if (READ_ONCE(ctrl->tx.head) - READ_ONCE(cdev->tx_released)
+			< SYMSPI_CHARDEV_RING_SLOTS) {
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	}
+	return mask;
+}
+
+static long symspi_chardev_ioctl(struct file *file, unsigned int cmd
+				 , unsigned long arg)
+{
+	struct symspi_chardev *cdev = (struct symspi_chardev *)file->private_data;
+	struct eventfd_ctx *ctx = NULL;
+	long res = 0;
+	__s32 fd;
+
+	switch (cmd) {
+	case SYMSPI_IOC_TX_KICK:
+		mutex_lock(&cdev->io_lock);
+		if (cdev->active) {
+			__symspi_chardev_tx_refill(cdev);
+		} else {
+			res = -ENODEV;
+		}
+		mutex_unlock(&cdev->io_lock);
+		return res;
+	case SYMSPI_IOC_SET_FORCE_SIZE:
+		mutex_lock(&cdev->io_lock);
+		cdev->force_size_change = (arg != 0);
+		mutex_unlock(&cdev->io_lock);
+		return 0;
+	case SYMSPI_IOC_SET_EVENTFD:
+		if (get_user(fd, (__s32 __user *)arg)) {
+			return -EFAULT;
+		}
+		if (fd >= 0) {
+			ctx = eventfd_ctx_fdget(fd);
+			if (IS_ERR(ctx)) {
+				return PTR_ERR(ctx);
+			}
+		}
+		mutex_lock(&cdev->io_lock);
+		swap(ctx, cdev->eventfd);
+		mutex_unlock(&cdev->io_lock);
+		if (ctx) {
+			eventfd_ctx_put(ctx);
+		}
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations symspi_chardev_fops = {
+	.owner = THIS_MODULE,
+	.open = symspi_chardev_open,
+	.release = symspi_chardev_release,
+	.mmap = symspi_chardev_mmap,
+	.poll = symspi_chardev_poll,
+	.unlocked_ioctl = symspi_chardev_ioctl,
+	.llseek = noop_llseek,
+};
+
+#endif /* SYMSPI_CHARDEV */
+
+// Creates the char device for the probed SymSPI device (see
+// SYMSPI_CHARDEV).
 //
 // CONTEXT:
-//      can not sleep (ISR)
-//
-// \param symspi_dev is a pointer on our symspi data
-//
-// On this interrupt we should initiate the xfer.
-static void symspi_their_flag_set_isr_sequence(
-		struct symspi_dev *symspi)
+//      sleepable
+// RETURNS:
+//      0: on success (or if char device is disabled)
+//      <0: negated error code
+static int symspi_chardev_init(struct symspi_dev *symspi)
 {
-#ifdef SYMSPI_DEBUG
-	SYMSPI_CHECK_DEVICE("No device provided.", return);
+#ifndef SYMSPI_CHARDEV
+	(void)symspi;
+	return 0;
+#else
+	struct symspi_chardev *cdev = kzalloc(sizeof(*cdev), GFP_KERNEL);
+
+	if (!cdev) {
+		return -ENOMEM;
+	}
+
+	cdev->symspi = symspi;
+	kref_init(&cdev->ref);
+	mutex_init(&cdev->lock);
+	mutex_init(&cdev->io_lock);
+	SYMSPI_INIT_WORK(&cdev->rx_work, &symspi_chardev_rx_work);
+	init_waitqueue_head(&cdev->wait);
+	// the shared area is laid out before the link start, so the
+	// slots are of the device max xfer size, the link one
+	// (negotiated) is applied on TX frames submission
+	cdev->frame_max_bytes = SYMSPI_XFER_SIZE_MAX_BYTES;
+	cdev->slot_size = ALIGN(sizeof(struct symspi_uapi_slot)
+				+ cdev->frame_max_bytes, sizeof(u64));
+
+	snprintf(cdev->name, sizeof(cdev->name), "symspi%d", symspi->index);
+	cdev->misc.minor = MISC_DYNAMIC_MINOR;
+	cdev->misc.name = cdev->name;
+	cdev->misc.fops = &symspi_chardev_fops;
+	cdev->misc.parent = &symspi->spi->dev;
+
+	symspi_chardevs[symspi->index] = cdev;
+
+	const int res = misc_register(&cdev->misc);
+
+	if (res != 0) {
+		symspi_chardevs[symspi->index] = NULL;
+		kfree(cdev);
+		return res;
+	}
+
+	return 0;
 #endif
-	// TODO: Use the softIRQs
-	// see: https://notes.shichao.io/lkd/ch8/#implementing-softirqs
-	// for detailed description
-	//
-	// Register them as ~network TX/RX level,
-	// as long as ICCom which is a consumer of the is actually
-	// the same inter process communication mechanics.
+}
 
-	// other side initiated xfer sequence
-	if (SYMSPI_SWITCH_STRICT(IDLE, XFER_PREPARE)) {
-		// no work queueing here, to decrease communication latency
-		// as long as symspi_do_xfer() contains lightweight
-		// determined operations (we don't require consumer data
-		// here, it is already prepared)
-		symspi_xfer_prepare_to_waiting_prev_sequence(symspi);
+// Removes the char device of the SymSPI device, the open file (if
+// any) loses the link, but stays valid till release.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_chardev_close(struct symspi_dev *symspi)
+{
+#ifndef SYMSPI_CHARDEV
+	(void)symspi;
+#else
+	struct symspi_chardev *cdev = symspi_chardevs[symspi->index];
+
+	if (!cdev) {
 		return;
 	}
 
-	// in absence of SPI_RDY hardware support on SPI
-	// master side, we have to trigger SPI xfer manually
-	if (symspi->p->spi_master_mode && !symspi->p->hardware_spi_rdy) {
-		symspi_try_leave_waiting_rdy_sequence(symspi);
-	}
+	misc_deregister(&cdev->misc);
+
+	mutex_lock(&cdev->lock);
+	cdev->removed = true;
+	__symspi_chardev_deactivate(cdev);
+	mutex_unlock(&cdev->lock);
+
+	__symspi_cancel_closed_work_sync(symspi, &cdev->rx_work);
+	symspi_chardevs[symspi->index] = NULL;
+
+	kref_put(&cdev->ref, &symspi_chardev_free);
+#endif
 }
 
 /* --------------------- EXTERNAL SECTION ------------------------------ */
@@ -3410,12 +8644,14 @@ static void symspi_their_flag_set_isr_sequence(
 // @symspi {valid ptr to memory area allocated for symspi_dev struct}
 //      should point to area where to initialize symspi_dev struct.
 //      This memory area is managed by consumer.
+// @index the index of the device in the devices table.
 //
 // RETURNS:
 //      * negated error code on error (casted to pointer)
 //      * 0 on success
 static int symspi_make_default_device(
-		struct spi_device *spi, struct symspi_dev *symspi)
+		struct spi_device *spi, struct symspi_dev *symspi
+		, const int index)
 {
 	if (IS_ERR_OR_NULL(spi)) {
 		symspi_err("No spi device provided.");
@@ -3449,8 +8685,11 @@ static int symspi_make_default_device(
 		goto free_our_flag_gpiod;
 	}
 
+	symspi->index = index;
 	symspi->spi = spi;
 	symspi->xfer_accepted_callback = NULL;
+	symspi->rx_ready_callback = NULL;
+	symspi->consumer_owned_buffers = false;
 	symspi->p = NULL;
 
 	return SYMSPI_SUCCESS;
@@ -3474,11 +8713,13 @@ static void symspi_destroy_device(struct symspi_dev *symspi)
 		return;
 	}
 	if (!IS_ERR_OR_NULL(symspi->p)
-			&& symspi->p->state != SYMSPI_STATE_COLD) {
+			&& symspi_get_state(symspi) != SYMSPI_STATE_COLD) {
 		symspi_close((void*)symspi);
 	}
 
 	symspi->xfer_accepted_callback = NULL;
+	symspi->rx_ready_callback = NULL;
+	symspi->consumer_owned_buffers = false;
 	symspi->spi = NULL;
 
 	if (!IS_ERR_OR_NULL(symspi->gpiod_our_flag)) {
@@ -3495,6 +8736,8 @@ static void symspi_destroy_device(struct symspi_dev *symspi)
 /* --------------------- MODULE HOUSEKEEPING SECTION ------------------- */
 
 EXPORT_SYMBOL(symspi_get_global_device);
+EXPORT_SYMBOL(symspi_get_device);
+EXPORT_SYMBOL(symspi_get_device_by_name);
 EXPORT_SYMBOL(symspi_data_xchange);
 EXPORT_SYMBOL(symspi_default_data_update);
 EXPORT_SYMBOL(symspi_init);
@@ -3502,6 +8745,11 @@ EXPORT_SYMBOL(symspi_close);
 EXPORT_SYMBOL(symspi_is_running);
 EXPORT_SYMBOL(symspi_reset);
 EXPORT_SYMBOL(symspi_iface);
+EXPORT_SYMBOL(symspi_xfer_buffer_acquire);
+EXPORT_SYMBOL(symspi_data_xchange_batch);
+EXPORT_SYMBOL(symspi_rx_ring_peek);
+EXPORT_SYMBOL(symspi_rx_ring_release);
+EXPORT_SYMBOL(symspi_rx_ring_overruns);
 
 // The module is to be used via export symbols.
 //
@@ -3509,7 +8757,8 @@ EXPORT_SYMBOL(symspi_iface);
 // 1. Upon the symspi compatible device (declared in device tree)
 //    is found, kernel loads the SymSPI driver.
 // 2. SymSPI driver makes initialization of own structures including
-//    symspi_dev structure and keeps it in static global variable.
+//    symspi_dev structure (one per probed SPI device) and keeps it in
+//    the static devices table (and as SPI driver data).
 // 3. SymSPI driver exports symbols to access the symspi_dev structure
 //    and all API function of SymSPI.
 // 4. Other driver, like ICCom driver will call exported symbols to
@@ -3521,14 +8770,11 @@ EXPORT_SYMBOL(symspi_iface);
 
 
 
-// TODO[Harald comment]: Driver data can be usually stored in a
-// field of the spi_device struct itself by using
-// spi_set_drvdata(spi, symspi_dev); In other functions you can get it by
-// struct symspi_dev* pdata = spi_get_drvdata(spi);
-//
-//
-// Allocates single global symspi device with default
-// configuration. If fails all related resources are freed.
+// Allocates a new symspi device with default configuration for
+// the given SPI device and registers it in the devices table
+// (the device is stored as SPI driver data). The first probed
+// device is also available as global device.
+// If fails all related resources are freed.
 //
 // NOTE:
 //      even if probe function fails, then module will still be
@@ -3540,58 +8786,101 @@ EXPORT_SYMBOL(symspi_iface);
 //      * 0 on success
 static int symspi_probe(struct spi_device *spi)
 {
-	// At the moment we'll make a global symspi device
-	// which will work with the device stated in DT.
-
-	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "module loading");
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "device probing");
 	symspi_info(SYMSPI_LOG_INFO_OPT_LEVEL, "spi device: %px", spi);
 
 	int fail_res = 0;
+	int index;
+
+	mutex_lock(&symspi_devices_lock);
+
+	for (index = 0; index < SYMSPI_MAX_DEVICES; index++) {
+		if (!symspi_devices[index]) {
+			break;
+		}
+	}
+	if (index == SYMSPI_MAX_DEVICES) {
+		symspi_err("no free slot for the symspi device, max"
+			   " devices number: %d", SYMSPI_MAX_DEVICES);
+		fail_res = -ENOSPC;
+		goto failure;
+	}
 
-	symspi_global_device_ptr = kmalloc(sizeof(struct symspi_dev)
+	struct symspi_dev *symspi = kmalloc(sizeof(struct symspi_dev)
 					    , GFP_KERNEL);
-	if (!symspi_global_device_ptr) {
-		symspi_err("no memory to allocate global symspi device");
+	if (!symspi) {
+		symspi_err("no memory to allocate symspi device");
 		fail_res = -ENOMEM;
 		goto failure;
 	}
 
-	fail_res = symspi_make_default_device(spi, symspi_global_device_ptr);
+	fail_res = symspi_make_default_device(spi, symspi, index);
 	if (fail_res != 0) {
 		symspi_err("could not create default symspi device, err = %d"
 			   , fail_res);
-		goto free_global_symspi_dev;
+		goto free_symspi_dev;
+	}
+
+	symspi_devices[index] = symspi;
+	if (index == 0) {
+		symspi_global_device_ptr = symspi;
 	}
+	spi_set_drvdata(spi, symspi);
+
+	// not vital: the device is still available to kernel consumers
+	const int cdev_res = symspi_chardev_init(symspi);
+
+	if (cdev_res != 0) {
+		symspi_warning("failed to create char device, err = %d"
+			       , cdev_res);
+	}
+
+	mutex_unlock(&symspi_devices_lock);
 
 	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL
-		    , "created symspi global device at %px (at COLD state)"
-		    , symspi_global_device_ptr);
+		    , "created symspi device %d at %px (at COLD state)"
+		    , index, symspi);
 
 	// Here the device is ready to be initialized and run.
 
 	return SYMSPI_SUCCESS;
 
-free_global_symspi_dev:
-	kfree(symspi_global_device_ptr);
-	symspi_global_device_ptr = ERR_PTR(fail_res);
+free_symspi_dev:
+	kfree(symspi);
 failure:
+	if (index == 0) {
+		symspi_global_device_ptr = ERR_PTR(fail_res);
+	}
+	mutex_unlock(&symspi_devices_lock);
 	return fail_res;
 }
 
 static int symspi_remove(struct spi_device *spi)
 {
+	struct symspi_dev *symspi = spi_get_drvdata(spi);
+
 	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL
-		    , "module unloading: global dev ptr: %px"
-		    , symspi_global_device_ptr);
+		    , "device removing: dev ptr: %px", symspi);
 
-	symspi_destroy_device(symspi_global_device_ptr);
+	if (IS_ERR_OR_NULL(symspi)) {
+		return SYMSPI_SUCCESS;
+	}
 
-	if (!IS_ERR_OR_NULL(symspi_global_device_ptr)) {
-		kfree(symspi_global_device_ptr);
+	mutex_lock(&symspi_devices_lock);
+	symspi_chardev_close(symspi);
+	if (symspi->index >= 0 && symspi->index < SYMSPI_MAX_DEVICES) {
+		symspi_devices[symspi->index] = NULL;
+	}
+	if (symspi_global_device_ptr == symspi) {
+		symspi_global_device_ptr = NULL;
 	}
-	symspi_global_device_ptr = NULL;
+	mutex_unlock(&symspi_devices_lock);
 
-	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "module unloaded");
+	spi_set_drvdata(spi, NULL);
+	symspi_destroy_device(symspi);
+	kfree(symspi);
+
+	symspi_info(SYMSPI_LOG_INFO_KEY_LEVEL, "device removed");
 
 	return SYMSPI_SUCCESS;
 }
@@ -3617,6 +8906,9 @@ static struct spi_driver symspi_spi_driver = {
 	.driver = {
 		.name = "symspi",
 		.of_match_table = of_match_ptr(symspi1_dt_ids_match),
+#ifdef SYMSPI_RUNTIME_PM
+		.pm = &symspi_pm_ops,
+#endif
 	},
 	.probe = symspi_probe,
 	.remove = symspi_remove,
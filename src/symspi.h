@@ -35,7 +35,7 @@
 
 
 // NOTE: Keep updated if adding/removing error type
-#define SYMSPI_ERROR_TYPES_COUNT 14
+#define SYMSPI_ERROR_TYPES_COUNT 18
 
 
 // no error code, keep it 0
@@ -74,6 +74,13 @@
 #define SYMSPI_ERROR_WAIT_OTHER_SIDE 16
 // error trying to create private work queue
 #define SYMSPI_ERROR_WORKQUEUE_INIT 17
+// consumer owned buffers mode: xfer buffers are missing or
+// conflict with buffers which are currently owned by SymSPI
+#define SYMSPI_ERROR_BUFFER_OWNERSHIP 18
+// xfer size exceeds the maximum xfer size of the device
+#define SYMSPI_ERROR_XFER_SIZE_TOO_BIG 19
+// received frame failed the integrity check (see SYMSPI_INTEGRITY)
+#define SYMSPI_ERROR_INTEGRITY 20
 
 
 /* --------------------- DATA STRUCTS SECTION ---------------------------*/
@@ -86,7 +93,46 @@
 //      may do whatever it whants with its xfer data. If NULL,
 //      then ignored.
 //      CONTEXT:
-//          sleepable
+//          sleepable (the TX ring xfers are also taken and released
+//          in sleepable context, see symspi_data_xchange_batch(...))
+//      NOTE: in @consumer_owned_buffers mode it is called when SymSPI
+//          releases the xfer buffers which were bound to the
+//          transport: when bound xfer gets replaced by the next one,
+//          when next xfer was rejected, or on SymSPI close.
+// @rx_ready_callback {NULL || valid ptr} if set, then SymSPI works
+//      in RX ring mode: the received data of every xfer is copied
+//      into the RX ring (of preallocated buffers) and this callback
+//      is called to notify consumer that new data is available in
+//      RX ring (see symspi_rx_ring_peek(...)), consumer drains the
+//      ring in its own context. The next TX data is then to be
+//      provided via symspi_data_xchange_batch(...) or
+//      symspi_data_xchange(...), or, if the xfer has done_callback
+//      set, it is still called right after the ring push (its RX
+//      data is the same as the pushed one, and can be ignored) to
+//      let consumer update the TX data synchronously, as in
+//      ordinary mode. If ring is full, the received data is dropped
+//      (and counted as overrun, the warning is ratelimited).
+//      NOTE: is to be set before symspi_init(...) and not changed
+//          while SymSPI is not in COLD state.
+//      CONTEXT:
+//          sleepable, but must be lightweight (just a notification)
+//      @device the symspi device which got new RX data
+// @consumer_owned_buffers if true, then SymSPI doesn't copy the xfer
+//      data into its own buffers, but binds the TX and RX buffers of
+//      consumer xfer directly to underlying SPI transfer (zero copy).
+//      Every xfer provided to SymSPI (including the default one) then
+//      MUST have valid DMA-capable (say kmalloc'ed) data_tx and
+//      data_rx_buf buffers of size_bytes size. The ownership over
+//      the xfer buffers passes to SymSPI when the xfer is accepted
+//      and returns to consumer only via @xfer_accepted_callback.
+//      Consumer should not touch the buffers owned by SymSPI (except
+//      the reading of RX data within the done_callback as usual).
+//      NOTE: is to be set before symspi_init(...) and not changed
+//          while SymSPI is not in COLD state.
+// @index the index of the device among all probed SymSPI devices
+//      (see symspi_get_device(...)), also defines the device procfs
+//      directory and workqueue names. Set by SymSPI at probe.
+//      Consumer should not change it.
 // @spi {valid ptr} the SPI device to work with.
 //      Consumer should keep the device alive and untouched while
 //      SymSPI is not in COLD state.
@@ -118,6 +164,11 @@
 //      will be called (if !NULL) when the native transport configuration
 //      is created for the underlying transport device so tranport details
 //      are defined for the transfer.
+//      NOTE: is not called again when consumer provides the new xfer
+//          with the same TX data and size as the current one (the
+//          native transport configuration is reused then).
+//      NOTE: with SYMSPI_CLOCK_SCALING the speed_hz set by the hook
+//          is overridden on SPI master side.
 //      CONTEXT:
 //          can not sleep
 //      @xfer{valid ptr}  the current full-duplex transfer for which
@@ -141,6 +192,12 @@ struct symspi_dev {
 
 	void (*xfer_accepted_callback)(struct full_duplex_xfer *xfer);
 
+	void (*rx_ready_callback)(void *device);
+
+	bool consumer_owned_buffers;
+
+	int index;
+
 	struct spi_device *spi;
 
 	struct gpio_desc *gpiod_our_flag;
@@ -175,6 +232,21 @@ int symspi_reset(void __kernel *device
 		, struct full_duplex_xfer *default_xfer);
 const struct full_duplex_sym_iface *symspi_iface(void);
 
+// not a part of general interface
+int symspi_data_xchange_batch(void __kernel *device
+		, struct full_duplex_xfer **xfers
+		, size_t count
+		, bool force_size_change);
+const void *symspi_rx_ring_peek(void __kernel *device
+		, size_t *size_bytes__out
+		, int *xfer_id__out);
+int symspi_rx_ring_release(void __kernel *device);
+unsigned long long symspi_rx_ring_overruns(void __kernel *device);
+void *symspi_xfer_buffer_acquire(void __kernel *device
+		, const size_t size_bytes);
+
 // not a part of general interface
 struct symspi_dev *symspi_get_global_device(void);
+struct symspi_dev *symspi_get_device(const unsigned int index);
+struct symspi_dev *symspi_get_device_by_name(const char *name);
 
@@ -0,0 +1,680 @@
+/*
+ * This file provides a linux kernel module which simulates the other
+ * side of the symmetrical SPI driver (SymSPI) link, so the SymSPI can
+ * be run and benchmarked on a single board without the second chip.
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * The simulator creates:
+ *
+ *   * a fake SPI master controller, which "xfers" the data after the
+ *     time the real bus would take (frame bits / SPI clock + per
+ *     frame overhead), RX data is either loopback of TX data (MOSI
+ *     wired to MISO) or zeros;
+ *   * a virtual 2 lines GPIO chip: line 0 is SymSPI our flag
+ *     ("symspi-hsk-out"), line 1 is SymSPI their flag ("symspi-hsk-in")
+ *     with the IRQ (via irq_sim) fired on every flag edge;
+ *   * the SymSPI SPI device ("symspi1") on the fake controller, with
+ *     the GPIO lookup table, so the SymSPI driver probes on it as on
+ *     a real board.
+ *
+ * The simulated other side follows the SymSPI protocol as SPI slave:
+ *
+ *   IDLE --(our flag raised | own request)--> [ready delay] -->
+ *   READY (their flag raised) --(SPI xfer)--> PROCESSING
+ *   --[process delay]--> their flag dropped --> IDLE
+ *
+ * The typical usage from Bash is the following:
+ *
+ *      # Bash:
+ *      insmod symspi.ko; sleep 0.2;
+ *      insmod symspi_sim.ko ready_delay_usec=20 process_delay_usec=50
+ *      insmod symspi_test.ko
+ *      cat /proc/symspi/latency /proc/symspi/stats
+ *      rmmod symspi_test; rmmod symspi_sim
+ *
+ * NOTE: the timing parameters can be changed at runtime via
+ *      /sys/module/symspi_sim/parameters/, and are applied from the
+ *      next event on (except request_interval_usec which is applied
+ *      on module load only).
+ * NOTE: irq_sim API is used, which is available from kernel 4.17 on.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/platform_device.h>
+#include <linux/spi/spi.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/irq_sim.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+
+#define SYMSPI_SIM_LOG_PREFIX "SYMSPI_SIM: "
+
+#define symspi_sim_err(fmt, ...)					\
+	pr_err(SYMSPI_SIM_LOG_PREFIX"%s: at %d line: "fmt"\n"		\
+	       , __func__, __LINE__, ##__VA_ARGS__)
+#define symspi_sim_info(fmt, ...)					\
+	pr_info(SYMSPI_SIM_LOG_PREFIX""fmt"\n", ##__VA_ARGS__)
+
+#define SYMSPI_SIM_NAME "symspi_sim"
+
+// The GPIO lines of the simulator GPIO chip
+#define SYMSPI_SIM_GPIO_OUR_FLAG 0
+#define SYMSPI_SIM_GPIO_THEIR_FLAG 1
+#define SYMSPI_SIM_GPIO_COUNT 2
+
+// The simulated other side states
+#define SYMSPI_SIM_STATE_IDLE 0
+#define SYMSPI_SIM_STATE_READY 1
+#define SYMSPI_SIM_STATE_PROCESSING 2
+
+/* --------------------- PARAMETERS SECTION ----------------------------- */
+
+// the time from the request (our flag raise or own request) till
+// their flag raise (other side prepares its data)
+static unsigned int ready_delay_usec = 20;
+module_param(ready_delay_usec, uint, 0644);
+MODULE_PARM_DESC(ready_delay_usec, "Other side xfer preparation time (us)");
+
+// the time from the xfer end till their flag drop (other side
+// processes the received data)
+static unsigned int process_delay_usec = 50;
+module_param(process_delay_usec, uint, 0644);
+MODULE_PARM_DESC(process_delay_usec
+		 , "Other side received data processing time (us)");
+
+// the fixed per frame SPI controller overhead
+static unsigned int xfer_overhead_usec = 5;
+module_param(xfer_overhead_usec, uint, 0644);
+MODULE_PARM_DESC(xfer_overhead_usec, "SPI controller per frame overhead (us)");
+
+// the SPI clock used when the transfer doesn't define it
+static unsigned int max_speed_hz = 10000000;
+module_param(max_speed_hz, uint, 0444);
+MODULE_PARM_DESC(max_speed_hz, "Simulated SPI controller max clock (Hz)");
+
+// if not 0, then the other side requests the xfer on its own with
+// the given period
+static unsigned int request_interval_usec;
+module_param(request_interval_usec, uint, 0444);
+MODULE_PARM_DESC(request_interval_usec
+		 , "Other side own xfer requests period (us), 0 - never");
+
+// if true, then the RX data is the same as TX data, else zeros
+static bool loopback = true;
+module_param(loopback, bool, 0644);
+MODULE_PARM_DESC(loopback, "RX data is loopback of TX data");
+
+/* --------------------- DATA STRUCTS SECTION --------------------------- */
+
+// The simulator device.
+//
+// @pdev the parent platform device.
+// @master the fake SPI master controller.
+// @spi the SymSPI SPI device on @master.
+// @gc the virtual flags GPIO chip.
+// @irq_sim the their flag IRQ simulator.
+// @lookup the GPIO lookup table of @spi.
+// @lock protects all fields below.
+// @state the simulated other side state (SYMSPI_SIM_STATE_*).
+// @our_flag the level of SymSPI our flag.
+// @their_flag the level of SymSPI their flag (driven by simulator).
+// @flag_timer drives the other side delays (ready and process).
+// @flag_timer_pending true if @flag_timer is armed.
+// @request_pending true, if own request came while the other side was
+//      busy, and should be handled upon entering IDLE.
+// @request_timer the other side own requests timer.
+// @xfer_timer the SPI xfer duration timer.
+// @msg {NULL || valid ptr} the SPI message in flight.
+// @xfers the number of simulated SPI xfers.
+// @bytes the number of simulated SPI xfer bytes.
+// @requests the number of other side own requests.
+// @protocol_errors the number of SPI xfers started while the other
+//      side was not ready.
+struct symspi_sim {
+	struct platform_device *pdev;
+	struct spi_master *master;
+	struct spi_device *spi;
+	struct gpio_chip gc;
+	struct irq_sim irq_sim;
+	struct gpiod_lookup_table *lookup;
+
+	spinlock_t lock;
+	int state;
+	bool our_flag;
+	bool their_flag;
+	struct hrtimer flag_timer;
+	bool flag_timer_pending;
+	bool request_pending;
+	struct hrtimer request_timer;
+	struct hrtimer xfer_timer;
+	struct spi_message *msg;
+
+	unsigned long long xfers;
+	unsigned long long bytes;
+	unsigned long long requests;
+	unsigned long long protocol_errors;
+};
+
+static struct symspi_sim *symspi_sim_dev;
+
+/* --------------------- OTHER SIDE SECTION ----------------------------- */
+
+// Helper. Arms the other side delay timer.
+//
+// CONTEXT:
+//      any, @sim->lock is held
+static void symspi_sim_arm_flag_timer(struct symspi_sim *sim
+				      , const unsigned int usec)
+{
+	sim->flag_timer_pending = true;
+	hrtimer_start(&sim->flag_timer, ns_to_ktime((u64)usec * NSEC_PER_USEC)
+		      , HRTIMER_MODE_REL);
+}
+
+// Helper. Starts the other side xfer preparation, if the other side
+// is idle, else postpones the request till IDLE.
+//
+// CONTEXT:
+//      any, @sim->lock is held
+static void symspi_sim_request(struct symspi_sim *sim)
+{
+	if (sim->state != SYMSPI_SIM_STATE_IDLE || sim->flag_timer_pending) {
+		sim->request_pending = true;
+		return;
+	}
+	symspi_sim_arm_flag_timer(sim, READ_ONCE(ready_delay_usec));
+}
+
+// Timer callback: the other side delay is over, so the other side
+// raises (ready for xfer) or drops (xfer processed) its flag.
+//
+// CONTEXT:
+//      hrtimer (can not sleep)
+static enum hrtimer_restart symspi_sim_flag_timer_cb(struct hrtimer *timer)
+{
+	struct symspi_sim *sim = container_of(timer, struct symspi_sim
+					      , flag_timer);
+	unsigned long flags;
+	bool edge = false;
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	sim->flag_timer_pending = false;
+
+	switch (sim->state) {
+	case SYMSPI_SIM_STATE_IDLE:
+		sim->their_flag = true;
+		sim->state = SYMSPI_SIM_STATE_READY;
+		edge = true;
+		break;
+	case SYMSPI_SIM_STATE_PROCESSING:
+		sim->their_flag = false;
+		sim->state = SYMSPI_SIM_STATE_IDLE;
+		edge = true;
+		// SymSPI wants the next xfer, or we have our own request
+		if (sim->our_flag || sim->request_pending) {
+			sim->request_pending = false;
+			symspi_sim_request(sim);
+		}
+		break;
+	default:
+		break;
+	}
+
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	if (edge) {
+		irq_sim_fire(&sim->irq_sim, 0);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+// Timer callback: the other side requests the xfer on its own.
+//
+// CONTEXT:
+//      hrtimer (can not sleep)
+static enum hrtimer_restart symspi_sim_request_timer_cb(
+		struct hrtimer *timer)
+{
+	struct symspi_sim *sim = container_of(timer, struct symspi_sim
+					      , request_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	sim->requests++;
+	symspi_sim_request(sim);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	hrtimer_forward_now(timer, ns_to_ktime((u64)request_interval_usec
+					       * NSEC_PER_USEC));
+	return HRTIMER_RESTART;
+}
+
+// Handles SymSPI our flag level change.
+//
+// CONTEXT:
+//      any
+static void symspi_sim_our_flag_changed(struct symspi_sim *sim
+					, const bool level)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	if (sim->our_flag == level) {
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return;
+	}
+	sim->our_flag = level;
+
+	// the busy other side will check our flag upon entering IDLE
+	if (level && sim->state == SYMSPI_SIM_STATE_IDLE
+			&& !sim->flag_timer_pending) {
+		symspi_sim_arm_flag_timer(sim, READ_ONCE(ready_delay_usec));
+	}
+
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+/* --------------------- SPI CONTROLLER SECTION ------------------------- */
+
+// Timer callback: the simulated SPI xfer is done.
+//
+// CONTEXT:
+//      hrtimer (can not sleep)
+static enum hrtimer_restart symspi_sim_xfer_timer_cb(struct hrtimer *timer)
+{
+	struct symspi_sim *sim = container_of(timer, struct symspi_sim
+					      , xfer_timer);
+	const bool echo = READ_ONCE(loopback);
+	struct spi_transfer *t;
+	struct spi_message *msg;
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	msg = sim->msg;
+	sim->msg = NULL;
+
+	if (!msg) {
+		spin_unlock_irqrestore(&sim->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	list_for_each_entry(t, &msg->transfers, transfer_list) {
+		if (t->rx_buf) {
+			if (echo && t->tx_buf) {
+				memcpy(t->rx_buf, t->tx_buf, t->len);
+			} else {
+				memset(t->rx_buf, 0, t->len);
+			}
+		}
+		msg->actual_length += t->len;
+	}
+
+	sim->xfers++;
+	sim->bytes += msg->actual_length;
+
+	if (sim->state == SYMSPI_SIM_STATE_READY) {
+		sim->state = SYMSPI_SIM_STATE_PROCESSING;
+		symspi_sim_arm_flag_timer(sim, READ_ONCE(process_delay_usec));
+	}
+
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	msg->status = 0;
+	if (msg->complete) {
+		msg->complete(msg->context);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+// SPI controller transfer hook: starts the simulated xfer of the
+// message, which is completed after the time the real bus would
+// take.
+//
+// CONTEXT:
+//      any (see spi_async(...))
+static int symspi_sim_transfer(struct spi_device *spi
+			       , struct spi_message *msg)
+{
+	struct symspi_sim *sim = spi_master_get_devdata(spi->master);
+	struct spi_transfer *t;
+	unsigned long flags;
+	u64 duration_ns = (u64)READ_ONCE(xfer_overhead_usec) * NSEC_PER_USEC;
+
+	list_for_each_entry(t, &msg->transfers, transfer_list) {
+		const u32 hz = t->speed_hz ? t->speed_hz
+				: (spi->max_speed_hz ? spi->max_speed_hz
+				   : max_speed_hz);
+
+		duration_ns += div_u64((u64)t->len * BITS_PER_BYTE
+				       * NSEC_PER_SEC, max_t(u32, hz, 1));
+	}
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	if (sim->msg) {
+		spin_unlock_irqrestore(&sim->lock, flags);
+		symspi_sim_err("only one message at a time is supported");
+		return -EBUSY;
+	}
+
+	// SymSPI must wait for other side readiness
+	if (sim->state != SYMSPI_SIM_STATE_READY) {
+		sim->protocol_errors++;
+	}
+
+	msg->actual_length = 0;
+	msg->status = -EINPROGRESS;
+	sim->msg = msg;
+	hrtimer_start(&sim->xfer_timer, ns_to_ktime(duration_ns)
+		      , HRTIMER_MODE_REL);
+
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return 0;
+}
+
+static int symspi_sim_setup(struct spi_device *spi)
+{
+	return 0;
+}
+
+/* --------------------- GPIO CHIP SECTION ------------------------------ */
+
+static int symspi_sim_gpio_get(struct gpio_chip *gc, unsigned int offset)
+{
+	struct symspi_sim *sim = gpiochip_get_data(gc);
+
+	return offset == SYMSPI_SIM_GPIO_OUR_FLAG ? READ_ONCE(sim->our_flag)
+						  : READ_ONCE(sim->their_flag);
+}
+
+static void symspi_sim_gpio_set(struct gpio_chip *gc, unsigned int offset
+				, int value)
+{
+	struct symspi_sim *sim = gpiochip_get_data(gc);
+
+	if (offset == SYMSPI_SIM_GPIO_OUR_FLAG) {
+		symspi_sim_our_flag_changed(sim, !!value);
+	}
+}
+
+// our flag is output, their flag is input (0: out, 1: in)
+static int symspi_sim_gpio_get_direction(struct gpio_chip *gc
+					 , unsigned int offset)
+{
+	return offset == SYMSPI_SIM_GPIO_OUR_FLAG ? 0 : 1;
+}
+
+static int symspi_sim_gpio_direction_input(struct gpio_chip *gc
+					   , unsigned int offset)
+{
+	return offset == SYMSPI_SIM_GPIO_THEIR_FLAG ? 0 : -EINVAL;
+}
+
+static int symspi_sim_gpio_direction_output(struct gpio_chip *gc
+					    , unsigned int offset
+					    , int value)
+{
+	if (offset != SYMSPI_SIM_GPIO_OUR_FLAG) {
+		return -EINVAL;
+	}
+	symspi_sim_gpio_set(gc, offset, value);
+	return 0;
+}
+
+static int symspi_sim_gpio_to_irq(struct gpio_chip *gc, unsigned int offset)
+{
+	struct symspi_sim *sim = gpiochip_get_data(gc);
+
+	if (offset != SYMSPI_SIM_GPIO_THEIR_FLAG) {
+		return -ENXIO;
+	}
+	return irq_sim_irqnum(&sim->irq_sim, 0);
+}
+
+/* --------------------- MODULE SECTION --------------------------------- */
+
+// Creates the simulator and the SymSPI SPI device on it.
+//
+// RETURNS:
+//      0: on success
+//      < 0: negated error code
+static int symspi_sim_create(struct symspi_sim *sim)
+{
+	struct spi_board_info info = {
+		.modalias = "symspi1",
+		.max_speed_hz = max_speed_hz,
+		.chip_select = 0,
+		.mode = SPI_MODE_0,
+	};
+	int res;
+
+	spin_lock_init(&sim->lock);
+	sim->state = SYMSPI_SIM_STATE_IDLE;
+
+	hrtimer_init(&sim->flag_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->flag_timer.function = &symspi_sim_flag_timer_cb;
+	hrtimer_init(&sim->request_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->request_timer.function = &symspi_sim_request_timer_cb;
+	hrtimer_init(&sim->xfer_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sim->xfer_timer.function = &symspi_sim_xfer_timer_cb;
+
+	sim->pdev = platform_device_register_simple(SYMSPI_SIM_NAME
+						    , PLATFORM_DEVID_NONE
+						    , NULL, 0);
+	if (IS_ERR(sim->pdev)) {
+		symspi_sim_err("failed to register platform device");
+		return PTR_ERR(sim->pdev);
+	}
+
+	// their flag IRQ
+	res = irq_sim_init(&sim->irq_sim, 1);
+	if (res < 0) {
+		symspi_sim_err("failed to init IRQ simulator: %d", res);
+		goto free_pdev;
+	}
+
+	// flags GPIO chip
+	sim->gc.label = SYMSPI_SIM_NAME;
+	sim->gc.parent = &sim->pdev->dev;
+	sim->gc.owner = THIS_MODULE;
+	sim->gc.base = -1;
+	sim->gc.ngpio = SYMSPI_SIM_GPIO_COUNT;
+	sim->gc.can_sleep = false;
+	sim->gc.get = &symspi_sim_gpio_get;
+	sim->gc.set = &symspi_sim_gpio_set;
+	sim->gc.get_direction = &symspi_sim_gpio_get_direction;
+	sim->gc.direction_input = &symspi_sim_gpio_direction_input;
+	sim->gc.direction_output = &symspi_sim_gpio_direction_output;
+	sim->gc.to_irq = &symspi_sim_gpio_to_irq;
+
+	res = gpiochip_add_data(&sim->gc, sim);
+	if (res < 0) {
+		symspi_sim_err("failed to add GPIO chip: %d", res);
+		goto free_irq_sim;
+	}
+
+	// SPI controller
+	sim->master = spi_alloc_master(&sim->pdev->dev, 0);
+	if (!sim->master) {
+		symspi_sim_err("failed to allocate SPI master");
+		res = -ENOMEM;
+		goto free_gpiochip;
+	}
+	spi_master_set_devdata(sim->master, sim);
+	sim->master->bus_num = -1;
+	sim->master->num_chipselect = 1;
+	sim->master->mode_bits = SPI_CPOL | SPI_CPHA | SPI_CS_HIGH;
+	sim->master->max_speed_hz = max_speed_hz;
+	sim->master->setup = &symspi_sim_setup;
+	sim->master->transfer = &symspi_sim_transfer;
+
+	res = spi_register_master(sim->master);
+	if (res < 0) {
+		symspi_sim_err("failed to register SPI master: %d", res);
+		spi_master_put(sim->master);
+		sim->master = NULL;
+		goto free_gpiochip;
+	}
+
+	// the SymSPI flags for the SymSPI SPI device, which gets
+	// name from its bus number and chip select
+	sim->lookup = kzalloc(struct_size(sim->lookup, table, 3), GFP_KERNEL);
+	if (!sim->lookup) {
+		res = -ENOMEM;
+		goto free_master;
+	}
+	sim->lookup->dev_id = kasprintf(GFP_KERNEL, "spi%d.0"
+					, sim->master->bus_num);
+	if (!sim->lookup->dev_id) {
+		res = -ENOMEM;
+		goto free_lookup;
+	}
+	sim->lookup->table[0] = (struct gpiod_lookup)GPIO_LOOKUP(
+			SYMSPI_SIM_NAME, SYMSPI_SIM_GPIO_OUR_FLAG
+			, "symspi-hsk-out", GPIO_ACTIVE_HIGH);
+	sim->lookup->table[1] = (struct gpiod_lookup)GPIO_LOOKUP(
+			SYMSPI_SIM_NAME, SYMSPI_SIM_GPIO_THEIR_FLAG
+			, "symspi-hsk-in", GPIO_ACTIVE_HIGH);
+	gpiod_add_lookup_table(sim->lookup);
+
+	// SymSPI driver probes on it
+	info.bus_num = sim->master->bus_num;
+	sim->spi = spi_new_device(sim->master, &info);
+	if (!sim->spi) {
+		symspi_sim_err("failed to create SymSPI SPI device");
+		res = -ENODEV;
+		goto free_lookup_table;
+	}
+
+	if (request_interval_usec > 0) {
+		hrtimer_start(&sim->request_timer
+			      , ns_to_ktime((u64)request_interval_usec
+					    * NSEC_PER_USEC)
+			      , HRTIMER_MODE_REL);
+	}
+
+	return 0;
+
+free_lookup_table:
+	gpiod_remove_lookup_table(sim->lookup);
+	kfree(sim->lookup->dev_id);
+free_lookup:
+	kfree(sim->lookup);
+	sim->lookup = NULL;
+free_master:
+	spi_unregister_master(sim->master);
+	sim->master = NULL;
+free_gpiochip:
+	gpiochip_remove(&sim->gc);
+free_irq_sim:
+	irq_sim_fini(&sim->irq_sim);
+free_pdev:
+	platform_device_unregister(sim->pdev);
+	return res;
+}
+
+// Destroys the simulator together with the SymSPI SPI device.
+static void symspi_sim_destroy(struct symspi_sim *sim)
+{
+	hrtimer_cancel(&sim->request_timer);
+
+	// SymSPI device removal closes SymSPI and releases the flags
+	spi_unregister_device(sim->spi);
+	sim->spi = NULL;
+
+	hrtimer_cancel(&sim->xfer_timer);
+	hrtimer_cancel(&sim->flag_timer);
+
+	gpiod_remove_lookup_table(sim->lookup);
+	kfree(sim->lookup->dev_id);
+	kfree(sim->lookup);
+	sim->lookup = NULL;
+
+	spi_unregister_master(sim->master);
+	sim->master = NULL;
+
+	gpiochip_remove(&sim->gc);
+	irq_sim_fini(&sim->irq_sim);
+	platform_device_unregister(sim->pdev);
+}
+
+static int __init symspi_sim_module_init(void)
+{
+	struct symspi_sim *sim;
+	int res;
+
+	symspi_sim_info("loading module");
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim) {
+		return -ENOMEM;
+	}
+
+	res = symspi_sim_create(sim);
+
+	if (res < 0) {
+		symspi_sim_err("failed to create simulator: %d", res);
+		kfree(sim);
+		return res;
+	}
+	symspi_sim_dev = sim;
+
+	symspi_sim_info("simulated SymSPI device: %s, ready delay: %u us"
+			", process delay: %u us, xfer overhead: %u us"
+			", clock: %u Hz, own request period: %u us"
+			, dev_name(&sim->spi->dev), ready_delay_usec
+			, process_delay_usec, xfer_overhead_usec
+			, max_speed_hz, request_interval_usec);
+
+	return 0;
+}
+
+static void __exit symspi_sim_module_exit(void)
+{
+	struct symspi_sim *sim = symspi_sim_dev;
+
+	symspi_sim_destroy(sim);
+	symspi_sim_dev = NULL;
+
+	symspi_sim_info("xfers: %llu, bytes: %llu, own requests: %llu"
+			", protocol errors: %llu", sim->xfers, sim->bytes
+			, sim->requests, sim->protocol_errors);
+	kfree(sim);
+
+	symspi_sim_info("module unloaded");
+}
+
+module_init(symspi_sim_module_init);
+module_exit(symspi_sim_module_exit);
+
+MODULE_DESCRIPTION("Module simulating the other side of symmetrical SPI"
+		   " communication.");
+MODULE_AUTHOR("Artem Gulyaev <Artem.Gulyaev@bosch.com>");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,922 @@
+/*
+ * This file defines the stream layer of the symmetrical SPI driver
+ * (SymSPI): the variable length messages are coalesced into / split
+ * across the SymSPI frames of a single fixed size.
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * The stream layer owns the SymSPI device for the time it is open
+ * (the same way as the SymSPI char device does): it starts SymSPI
+ * with the empty frame as default xfer, and then feeds the SymSPI
+ * TX ring (see symspi_data_xchange_batch(...)) with the frames
+ * built from the queued consumer messages.
+ *
+ * Only SYMSPI_STREAM_TX_DEPTH frames are given to SymSPI at a time,
+ * all messages sent while the link is busy with them wait in the
+ * queue and are packed together into the next frame, so the more
+ * loaded the link is the more messages go in a single cycle.
+ *
+ * The typical usage is the following:
+ *
+ *      stream = symspi_stream_open(symspi, 64, 1024, &my_msg_cb, my);
+ *      ...
+ *      symspi_stream_send(stream, msg, msg_size, GFP_KERNEL);
+ *      ...
+ *      symspi_stream_close(stream);
+ *
+ * For frame format see symspi_stream.h.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/err.h>
+#include <linux/atomic.h>
+#include <linux/random.h>
+#include <asm/unaligned.h>
+
+#include "symspi_stream.h"
+#include "symspi_stream_internal.h"
+
+#define SYMSPI_STREAM_LOG_PREFIX "SYMSPI_STREAM: "
+
+#define symspi_stream_err(fmt, ...)					\
+	pr_err(SYMSPI_STREAM_LOG_PREFIX"%s: at %d line: "fmt"\n"	\
+	       , __func__, __LINE__, ##__VA_ARGS__)
+#define symspi_stream_warning(fmt, ...)					\
+	pr_warn(SYMSPI_STREAM_LOG_PREFIX"%s: at %d line: "fmt"\n"	\
+		, __func__, __LINE__, ##__VA_ARGS__)
+
+// The max number of bytes of not yet framed messages the stream
+// keeps, symspi_stream_send(...) fails with -ENOBUFS above it
+// (back-pressure).
+#ifndef SYMSPI_STREAM_TX_QUEUE_MAX_BYTES
+#define SYMSPI_STREAM_TX_QUEUE_MAX_BYTES 65536
+#endif
+
+// The number of frames given to SymSPI TX ring at a time: one
+// being xfered, and the next one ready to go without waiting for
+// us, must not exceed SYMSPI TX ring size.
+#define SYMSPI_STREAM_TX_DEPTH 2
+
+// Frame header: seq number byte, and session byte.
+#define SYMSPI_STREAM_FRAME_HDR_BYTES 2
+// Seq number of the frame without data.
+#define SYMSPI_STREAM_SEQ_EMPTY 0
+// Session id which is never sent (no session seen yet).
+#define SYMSPI_STREAM_SESSION_NONE 0
+
+// Chunk header: le16.
+#define SYMSPI_STREAM_CHUNK_HDR_BYTES 2
+#define SYMSPI_STREAM_CHUNK_LEN_MASK 0x3FFF
+#define SYMSPI_STREAM_CHUNK_FIRST 0x4000
+#define SYMSPI_STREAM_CHUNK_LAST 0x8000
+
+// The frame must fit the headers and at least one data byte.
+#define SYMSPI_STREAM_FRAME_MIN_BYTES					\
+	(SYMSPI_STREAM_FRAME_HDR_BYTES + SYMSPI_STREAM_CHUNK_HDR_BYTES + 1)
+
+/* --------------------- DATA STRUCTS SECTION ---------------------------*/
+
+// The queued consumer message.
+//
+// @list the anchor in symspi_stream::tx_queue
+// @size_bytes the message size
+// @data the message data
+struct symspi_stream_msg {
+	struct list_head list;
+	size_t size_bytes;
+	u8 data[];
+};
+
+// The stream TX frame.
+//
+// @xfer the SymSPI xfer of the frame
+// @data the frame data (frame_bytes size)
+// @queued true while the frame is in SymSPI TX ring (not yet taken
+//      by SymSPI)
+struct symspi_stream_frame {
+	struct full_duplex_xfer xfer;
+	u8 *data;
+	bool queued;
+};
+
+// The stream.
+//
+// @symspi the SymSPI device the stream works over
+// @frame_bytes the fixed frame size
+// @msg_max_bytes the max message size (both directions)
+// @msg_received the consumer message received callback
+// @consumer_data the consumer data for @msg_received
+// @lock protects the TX state (queue and frames) and @stats,
+//      can be taken from any context
+// @closing set on close, no more frames are given to SymSPI then
+// @tx_queue the queue of not fully framed messages
+// @tx_queued_bytes the total size of messages in @tx_queue
+// @tx_msg_offset the number of bytes of the @tx_queue head message
+//      which are already framed
+// @tx_seq the seq number of the last built frame
+// @tx_session our session id {1..255}, differs from the one of
+//      previously opened stream
+// @tx_frames the TX frames
+// @tx_work gives the built frames to SymSPI (the only SymSPI TX ring
+//      producer, so it is not concurrent)
+// @idle_xfer the empty frame xfer (SymSPI default xfer)
+// @idle_data the empty frame data
+// @rx_session the other side session id, SYMSPI_STREAM_SESSION_NONE
+//      till the first frame
+// @rx_seq_valid true if we got at least one data frame in the
+//      current other side session
+// @rx_seq the seq number of the last received data frame
+// @rx_msg_ongoing true when message reassembly is ongoing
+// @rx_msg_overflow true when ongoing message exceeds @msg_max_bytes
+// @rx_msg_size the number of bytes reassembled so far
+// @rx_msg the message reassembly buffer (@msg_max_bytes size)
+// @stats the stream statistics
+//
+// NOTE: the RX state is used only from SymSPI done callback, which is
+//      serialized by SymSPI (or from symspi_stream_frame_push(...),
+//      which is serialized by consumer).
+// NOTE: @symspi is NULL for the detached stream (see
+//      symspi_stream_open_detached(...)).
+struct symspi_stream {
+	struct symspi_dev *symspi;
+	size_t frame_bytes;
+	size_t msg_max_bytes;
+	symspi_stream_msg_received_t msg_received;
+	void *consumer_data;
+
+	spinlock_t lock;
+	bool closing;
+
+	struct list_head tx_queue;
+	size_t tx_queued_bytes;
+	size_t tx_msg_offset;
+	u8 tx_seq;
+	u8 tx_session;
+	struct symspi_stream_frame tx_frames[SYMSPI_STREAM_TX_DEPTH];
+	struct work_struct tx_work;
+
+	struct full_duplex_xfer idle_xfer;
+	u8 *idle_data;
+
+	u8 rx_session;
+	bool rx_seq_valid;
+	u8 rx_seq;
+	bool rx_msg_ongoing;
+	bool rx_msg_overflow;
+	size_t rx_msg_size;
+	u8 *rx_msg;
+
+	struct symspi_stream_stats stats;
+};
+
+/* -------------------------- TX SECTION --------------------------------*/
+
+// Helper.
+// RETURNS:
+//      the next data frame seq number after @seq (skipping the
+//      empty frame seq).
+static inline u8 symspi_stream_seq_next(const u8 seq)
+{
+	return (seq == 0xFF) ? 1 : seq + 1;
+}
+
+// the session id of the last opened stream
+static atomic_t symspi_stream_last_session
+		= ATOMIC_INIT(SYMSPI_STREAM_SESSION_NONE);
+
+// Helper.
+// RETURNS:
+//      the new session id {1..255}, which differs from the one of the
+//      previously opened stream (the first one is random, so it most
+//      likely differs from the one before module reload as well).
+static u8 symspi_stream_session_next(void)
+{
+	int old, new;
+
+	do {
+		old = atomic_read(&symspi_stream_last_session);
+		new = (old == SYMSPI_STREAM_SESSION_NONE)
+		      ? (int)(get_random_u32() % 0xFF) + 1
+		      : symspi_stream_seq_next((u8)old);
+	} while (atomic_cmpxchg(&symspi_stream_last_session, old, new) != old);
+
+	return (u8)new;
+}
+
+// Helper. Packs the queued messages into the frame data.
+//
+// CONTEXT:
+//      any, @stream->lock is held
+// RETURNS:
+//      true: if frame got data
+//      false: if there was nothing to send
+static bool __symspi_stream_frame_build(struct symspi_stream *stream
+					, u8 *const data)
+{
+	const size_t size = stream->frame_bytes;
+	size_t offset = SYMSPI_STREAM_FRAME_HDR_BYTES;
+
+	while (!list_empty(&stream->tx_queue)
+			&& offset + SYMSPI_STREAM_CHUNK_HDR_BYTES < size) {
+		struct symspi_stream_msg *msg = list_first_entry(
+				&stream->tx_queue, struct symspi_stream_msg
+				, list);
+		const size_t remaining = msg->size_bytes
+					 - stream->tx_msg_offset;
+		const size_t chunk = min3(remaining
+				, size - offset - SYMSPI_STREAM_CHUNK_HDR_BYTES
+				, (size_t)SYMSPI_STREAM_CHUNK_LEN_MASK);
+		u16 hdr = (u16)chunk;
+
+		if (stream->tx_msg_offset == 0) {
+			hdr |= SYMSPI_STREAM_CHUNK_FIRST;
+		}
+		if (chunk == remaining) {
+			hdr |= SYMSPI_STREAM_CHUNK_LAST;
+		}
+
+		put_unaligned_le16(hdr, data + offset);
+		offset += SYMSPI_STREAM_CHUNK_HDR_BYTES;
+		memcpy(data + offset, msg->data + stream->tx_msg_offset
+		       , chunk);
+		offset += chunk;
+
+		if (chunk == remaining) {
+			list_del(&msg->list);
+			stream->tx_queued_bytes -= msg->size_bytes;
+			stream->tx_msg_offset = 0;
+			stream->stats.msgs_tx++;
+			kfree(msg);
+		} else {
+			stream->tx_msg_offset += chunk;
+		}
+	}
+
+	if (offset == SYMSPI_STREAM_FRAME_HDR_BYTES) {
+		return false;
+	}
+
+	// zero chunk header (or no space for it) ends the frame
+	memset(data + offset, 0, size - offset);
+	stream->tx_seq = symspi_stream_seq_next(stream->tx_seq);
+	data[0] = stream->tx_seq;
+	data[1] = stream->tx_session;
+	stream->stats.frames_tx++;
+
+	return true;
+}
+
+// Builds the frames from the queued messages and gives them to
+// SymSPI, as long as there are free frames.
+//
+// CONTEXT:
+//      sleepable
+static void symspi_stream_tx_work(struct work_struct *work)
+{
+	struct symspi_stream *stream = container_of(work, struct symspi_stream
+						    , tx_work);
+	struct full_duplex_xfer *xfer;
+	unsigned long flags;
+	int i;
+
+	for (;;) {
+		struct symspi_stream_frame *frame = NULL;
+
+		spin_lock_irqsave(&stream->lock, flags);
+
+		if (stream->closing) {
+			spin_unlock_irqrestore(&stream->lock, flags);
+			return;
+		}
+		for (i = 0; i < SYMSPI_STREAM_TX_DEPTH; i++) {
+			if (!stream->tx_frames[i].queued) {
+				frame = &stream->tx_frames[i];
+				break;
+			}
+		}
+		if (!frame || !__symspi_stream_frame_build(stream
+							   , frame->data)) {
+			spin_unlock_irqrestore(&stream->lock, flags);
+			return;
+		}
+		frame->queued = true;
+
+		spin_unlock_irqrestore(&stream->lock, flags);
+
+		xfer = &frame->xfer;
+		const int res = symspi_data_xchange_batch((void*)stream->symspi
+							  , &xfer, 1, false);
+
+		if (res == 1) {
+			continue;
+		}
+
+		// the frame data is lost, the other side will see the seq gap
+		symspi_stream_warning("frame submission failed: %d", res);
+		spin_lock_irqsave(&stream->lock, flags);
+		frame->queued = false;
+		stream->stats.xfer_errors++;
+		spin_unlock_irqrestore(&stream->lock, flags);
+		return;
+	}
+}
+
+// Frees the TX frame taken by SymSPI, and schedules the next frame
+// build.
+//
+// CONTEXT:
+//      any
+static void symspi_stream_xfer_accepted(struct full_duplex_xfer *xfer)
+{
+	struct symspi_stream *stream = (struct symspi_stream *)xfer->consumer_data;
+	struct symspi_stream_frame *frame;
+	unsigned long flags;
+
+	if (!stream || xfer == &stream->idle_xfer) {
+		return;
+	}
+
+	frame = container_of(xfer, struct symspi_stream_frame, xfer);
+
+	// queued under the lock, so close doesn't miss it
+	spin_lock_irqsave(&stream->lock, flags);
+	frame->queued = false;
+	if (!stream->closing) {
+		queue_work(system_highpri_wq, &stream->tx_work);
+	}
+	spin_unlock_irqrestore(&stream->lock, flags);
+}
+
+/* -------------------------- RX SECTION --------------------------------*/
+
+// Helper. Drops the ongoing message reassembly (if any).
+//
+// CONTEXT:
+//      RX frame parsing, @stream->lock is held
+static void __symspi_stream_rx_msg_drop(struct symspi_stream *stream)
+{
+	if (stream->rx_msg_ongoing) {
+		stream->rx_msg_ongoing = false;
+		stream->stats.msgs_rx_dropped++;
+	}
+}
+
+// Helper. Parses the received frame and delivers the complete
+// messages to consumer.
+//
+// CONTEXT:
+//      SymSPI done callback (sleepable), or consumer context for
+//      the detached stream
+static void symspi_stream_rx_frame(struct symspi_stream *stream
+				   , const u8 *const data
+				   , const size_t size)
+{
+	size_t offset = SYMSPI_STREAM_FRAME_HDR_BYTES;
+	const u8 seq = data[0];
+	const u8 session = data[1];
+	unsigned long flags;
+
+	spin_lock_irqsave(&stream->lock, flags);
+
+	// the other side has reopened its stream: its seq restarts, and
+	// its partial message (if any) is gone, it is not a frame loss
+	if (session != stream->rx_session) {
+		if (stream->rx_session != SYMSPI_STREAM_SESSION_NONE) {
+			stream->stats.peer_restarts++;
+		}
+		stream->rx_session = session;
+		stream->rx_seq_valid = false;
+		__symspi_stream_rx_msg_drop(stream);
+	}
+
+	if (seq == SYMSPI_STREAM_SEQ_EMPTY) {
+		spin_unlock_irqrestore(&stream->lock, flags);
+		return;
+	}
+
+	// SymSPI xfers our last frame again when the other side asks
+	// for xfer while we have nothing new, and so does the other side
+	if (stream->rx_seq_valid && seq == stream->rx_seq) {
+		stream->stats.frames_rx_dup++;
+		spin_unlock_irqrestore(&stream->lock, flags);
+		return;
+	}
+	if (stream->rx_seq_valid
+			&& seq != symspi_stream_seq_next(stream->rx_seq)) {
+		// the seq space is {1..255}
+		stream->stats.frames_rx_lost +=
+				(seq + 0xFF - stream->rx_seq - 1) % 0xFF;
+		__symspi_stream_rx_msg_drop(stream);
+	}
+	stream->rx_seq = seq;
+	stream->rx_seq_valid = true;
+	stream->stats.frames_rx++;
+
+	while (offset + SYMSPI_STREAM_CHUNK_HDR_BYTES < size) {
+		const u16 hdr = get_unaligned_le16(data + offset);
+		const size_t len = hdr & SYMSPI_STREAM_CHUNK_LEN_MASK;
+
+		if (hdr == 0) {
+			break;
+		}
+		offset += SYMSPI_STREAM_CHUNK_HDR_BYTES;
+		if (len == 0 || len > size - offset) {
+			stream->stats.frames_rx_corrupted++;
+			__symspi_stream_rx_msg_drop(stream);
+			break;
+		}
+
+		if (hdr & SYMSPI_STREAM_CHUNK_FIRST) {
+			__symspi_stream_rx_msg_drop(stream);
+			stream->rx_msg_ongoing = true;
+			stream->rx_msg_overflow = false;
+			stream->rx_msg_size = 0;
+		} else if (!stream->rx_msg_ongoing) {
+			// the rest of the message we have lost the beginning of
+			offset += len;
+			continue;
+		}
+
+		if (stream->rx_msg_size + len > stream->msg_max_bytes) {
+			stream->rx_msg_overflow = true;
+		} else {
+			memcpy(stream->rx_msg + stream->rx_msg_size
+			       , data + offset, len);
+			stream->rx_msg_size += len;
+		}
+		offset += len;
+
+		if (!(hdr & SYMSPI_STREAM_CHUNK_LAST)) {
+			continue;
+		}
+
+		stream->rx_msg_ongoing = false;
+		if (stream->rx_msg_overflow) {
+			symspi_stream_warning("too big message dropped");
+			stream->stats.msgs_rx_dropped++;
+			continue;
+		}
+		stream->stats.msgs_rx++;
+
+		// the reassembly buffer is not touched by anyone else
+		spin_unlock_irqrestore(&stream->lock, flags);
+		stream->msg_received(stream->rx_msg, stream->rx_msg_size
+				     , stream->consumer_data);
+		spin_lock_irqsave(&stream->lock, flags);
+	}
+
+	spin_unlock_irqrestore(&stream->lock, flags);
+}
+
+// SymSPI xfer done callback for all stream frames.
+//
+// CONTEXT:
+//      sleepable
+static struct full_duplex_xfer *symspi_stream_xfer_done(
+		const struct full_duplex_xfer __kernel *done_xfer
+		, const int next_xfer_id
+		, bool __kernel *start_immediately__out
+		, void *consumer_data)
+{
+	struct symspi_stream *stream = (struct symspi_stream *)consumer_data;
+
+	// the queued frames are started by SymSPI TX ring
+	*start_immediately__out = false;
+
+	if (done_xfer->size_bytes == stream->frame_bytes) {
+		symspi_stream_rx_frame(stream, done_xfer->data_rx_buf
+				       , done_xfer->size_bytes);
+	}
+
+	return NULL;
+}
+
+// SymSPI xfer fail callback for all stream frames.
+//
+// CONTEXT:
+//      sleepable
+static struct full_duplex_xfer *symspi_stream_xfer_failed(
+		const struct full_duplex_xfer __kernel *failed_xfer
+		, const int next_xfer_id
+		, int error_code
+		, void *consumer_data)
+{
+	struct symspi_stream *stream = (struct symspi_stream *)consumer_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stream->lock, flags);
+	stream->stats.xfer_errors++;
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	// the frame is repeated, the other side drops it if it has
+	// already got it (same seq)
+	return NULL;
+}
+
+/* ------------------------- MAIN SECTION -------------------------------*/
+
+// Helper. Initializes the xfer of the stream frame.
+static void symspi_stream_xfer_init(struct symspi_stream *stream
+				    , struct full_duplex_xfer *xfer
+				    , u8 *data)
+{
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->size_bytes = stream->frame_bytes;
+	xfer->data_tx = data;
+	xfer->done_callback = &symspi_stream_xfer_done;
+	xfer->fail_callback = &symspi_stream_xfer_failed;
+	xfer->consumer_data = stream;
+}
+
+// Helper. Frees the stream and all its buffers.
+static void symspi_stream_free(struct symspi_stream *stream)
+{
+	struct symspi_stream_msg *msg, *tmp;
+	int i;
+
+	list_for_each_entry_safe(msg, tmp, &stream->tx_queue, list) {
+		list_del(&msg->list);
+		kfree(msg);
+	}
+	for (i = 0; i < SYMSPI_STREAM_TX_DEPTH; i++) {
+		kfree(stream->tx_frames[i].data);
+	}
+	kfree(stream->idle_data);
+	kfree(stream->rx_msg);
+	kfree(stream);
+}
+
+// Helper. Allocates and initializes the stream, not bound to any
+// SymSPI device yet.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      valid ptr: the stream
+//      ERR_PTR: on failure:
+//          -EINVAL: bad arguments
+//          -ENOMEM: no memory
+static struct symspi_stream *symspi_stream_alloc(size_t frame_bytes
+		, size_t msg_max_bytes
+		, symspi_stream_msg_received_t msg_received
+		, void *consumer_data)
+{
+	struct symspi_stream *stream;
+	int i;
+
+	if (!msg_received || msg_max_bytes == 0
+			|| frame_bytes < SYMSPI_STREAM_FRAME_MIN_BYTES) {
+		symspi_stream_err("bad arguments: frame size: %zu"
+				  ", max msg size: %zu"
+				  , frame_bytes, msg_max_bytes);
+		return ERR_PTR(-EINVAL);
+	}
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (!stream) {
+		return ERR_PTR(-ENOMEM);
+	}
+
+	stream->frame_bytes = frame_bytes;
+	stream->msg_max_bytes = msg_max_bytes;
+	stream->msg_received = msg_received;
+	stream->consumer_data = consumer_data;
+	spin_lock_init(&stream->lock);
+	INIT_LIST_HEAD(&stream->tx_queue);
+	INIT_WORK(&stream->tx_work, &symspi_stream_tx_work);
+
+	for (i = 0; i < SYMSPI_STREAM_TX_DEPTH; i++) {
+		stream->tx_frames[i].data = kzalloc(frame_bytes, GFP_KERNEL);
+		if (!stream->tx_frames[i].data) {
+			goto free;
+		}
+		symspi_stream_xfer_init(stream, &stream->tx_frames[i].xfer
+					, stream->tx_frames[i].data);
+	}
+	stream->idle_data = kzalloc(frame_bytes, GFP_KERNEL);
+	stream->rx_msg = kmalloc(msg_max_bytes, GFP_KERNEL);
+	if (!stream->idle_data || !stream->rx_msg) {
+		goto free;
+	}
+	symspi_stream_xfer_init(stream, &stream->idle_xfer, stream->idle_data);
+
+	// the empty frame tells the other side about our session as well
+	stream->tx_session = symspi_stream_session_next();
+	stream->idle_data[0] = SYMSPI_STREAM_SEQ_EMPTY;
+	stream->idle_data[1] = stream->tx_session;
+
+	return stream;
+
+free:
+	symspi_stream_free(stream);
+	return ERR_PTR(-ENOMEM);
+}
+
+// API:
+//
+// Opens the stream over the SymSPI device: starts SymSPI with
+// the empty frame as default xfer, and owns the device
+// (xfer_accepted_callback) till symspi_stream_close(...).
+//
+// @symspi {valid ptr to probed, not running SymSPI device}
+// @frame_bytes {SYMSPI_STREAM_FRAME_MIN_BYTES..SymSPI max xfer size}
+//      the size of every frame, MUST be the same on both sides.
+// @msg_max_bytes {>0} the max message size we send and receive,
+//      the bigger received messages are dropped.
+// @msg_received {valid ptr} is called on every received message.
+// @consumer_data is given to @msg_received.
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      valid ptr: the stream
+//      ERR_PTR: on failure:
+//          -EINVAL: bad arguments
+//          -EBUSY: SymSPI device is already running
+//          -ENOMEM: no memory
+//          other: the SymSPI init error
+struct symspi_stream *symspi_stream_open(struct symspi_dev *symspi
+		, size_t frame_bytes
+		, size_t msg_max_bytes
+		, symspi_stream_msg_received_t msg_received
+		, void *consumer_data)
+{
+	struct symspi_stream *stream;
+	int res;
+
+	if (IS_ERR_OR_NULL(symspi)) {
+		symspi_stream_err("no SymSPI device");
+		return ERR_PTR(-EINVAL);
+	}
+	if (symspi_is_running((void*)symspi)) {
+		symspi_stream_err("SymSPI device is busy");
+		return ERR_PTR(-EBUSY);
+	}
+
+	stream = symspi_stream_alloc(frame_bytes, msg_max_bytes
+				     , msg_received, consumer_data);
+	if (IS_ERR(stream)) {
+		return stream;
+	}
+	stream->symspi = symspi;
+
+	symspi->xfer_accepted_callback = &symspi_stream_xfer_accepted;
+	symspi->rx_ready_callback = NULL;
+	symspi->consumer_owned_buffers = false;
+
+	res = symspi_init((void*)symspi, &stream->idle_xfer);
+	if (res < 0) {
+		symspi_stream_err("failed to start SymSPI: %d", res);
+		symspi->xfer_accepted_callback = NULL;
+		symspi_stream_free(stream);
+		return ERR_PTR(res);
+	}
+
+	return stream;
+}
+
+// API:
+//
+// Queues the message to be sent. The message is copied, so consumer
+// can reuse its buffer right after the call.
+//
+// @stream {valid ptr} the stream
+// @data {valid ptr} the message data
+// @size_bytes {1..msg_max_bytes} the message size
+// @gfp the message copy allocation flags
+//
+// CONTEXT:
+//      any (with appropriate @gfp)
+//
+// RETURNS:
+//      0: on success
+//      -EINVAL: bad arguments
+//      -ENOBUFS: the queue is full (SYMSPI_STREAM_TX_QUEUE_MAX_BYTES)
+//      -ENOMEM: no memory
+//      -ENODEV: the stream is closing
+int symspi_stream_send(struct symspi_stream *stream
+		, const void *data
+		, size_t size_bytes
+		, gfp_t gfp)
+{
+	struct symspi_stream_msg *msg;
+	unsigned long flags;
+
+	if (IS_ERR_OR_NULL(stream) || !data || size_bytes == 0
+			|| size_bytes > stream->msg_max_bytes) {
+		return -EINVAL;
+	}
+	if (READ_ONCE(stream->tx_queued_bytes) + size_bytes
+			> SYMSPI_STREAM_TX_QUEUE_MAX_BYTES) {
+		return -ENOBUFS;
+	}
+
+	msg = kmalloc(sizeof(*msg) + size_bytes, gfp);
+	if (!msg) {
+		return -ENOMEM;
+	}
+	msg->size_bytes = size_bytes;
+	memcpy(msg->data, data, size_bytes);
+
+	spin_lock_irqsave(&stream->lock, flags);
+	if (stream->closing) {
+		spin_unlock_irqrestore(&stream->lock, flags);
+		kfree(msg);
+		return -ENODEV;
+	}
+	list_add_tail(&msg->list, &stream->tx_queue);
+	stream->tx_queued_bytes += size_bytes;
+	// the detached stream frames are pulled by consumer
+	if (stream->symspi) {
+		queue_work(system_highpri_wq, &stream->tx_work);
+	}
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	return 0;
+}
+
+// API:
+//
+// Provides the snapshot of the stream statistics.
+//
+// @stream {valid ptr} the stream
+// @stats__out {valid ptr} where to write the statistics
+//
+// CONTEXT:
+//      any
+void symspi_stream_stats_get(struct symspi_stream *stream
+		, struct symspi_stream_stats *stats__out)
+{
+	unsigned long flags;
+
+	if (IS_ERR_OR_NULL(stream) || !stats__out) {
+		return;
+	}
+
+	spin_lock_irqsave(&stream->lock, flags);
+	*stats__out = stream->stats;
+	spin_unlock_irqrestore(&stream->lock, flags);
+}
+
+// API:
+//
+// Closes the stream: stops SymSPI (if bound) and drops not yet sent
+// messages.
+//
+// @stream {valid ptr || ERR_PTR || NULL} the stream
+//
+// CONTEXT:
+//      sleepable
+void symspi_stream_close(struct symspi_stream *stream)
+{
+	struct symspi_dev *symspi;
+	unsigned long flags;
+
+	if (IS_ERR_OR_NULL(stream)) {
+		return;
+	}
+	symspi = stream->symspi;
+
+	spin_lock_irqsave(&stream->lock, flags);
+	stream->closing = true;
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	cancel_work_sync(&stream->tx_work);
+
+	if (symspi) {
+		symspi_close((void*)symspi);
+		symspi->xfer_accepted_callback = NULL;
+	}
+
+	symspi_stream_free(stream);
+}
+
+#ifdef SYMSPI_TEST_MODULE
+
+// TEST API:
+//
+// Opens the stream which is not bound to any SymSPI device: the
+// consumer moves the frames by itself, taking the frames to send
+// with symspi_stream_frame_pull(...) and giving the received ones
+// to symspi_stream_frame_push(...). Is used for the framing
+// testing only (see symspi_stream_internal.h).
+//
+// @frame_bytes, @msg_max_bytes, @msg_received, @consumer_data
+//      see symspi_stream_open(...)
+//
+// CONTEXT:
+//      sleepable
+//
+// RETURNS:
+//      valid ptr: the stream
+//      ERR_PTR: on failure:
+//          -EINVAL: bad arguments
+//          -ENOMEM: no memory
+struct symspi_stream *symspi_stream_open_detached(size_t frame_bytes
+		, size_t msg_max_bytes
+		, symspi_stream_msg_received_t msg_received
+		, void *consumer_data)
+{
+	return symspi_stream_alloc(frame_bytes, msg_max_bytes
+				   , msg_received, consumer_data);
+}
+
+// TEST API:
+//
+// Builds the next frame to send from the queued messages. Detached
+// stream only (see symspi_stream_open_detached(...)).
+//
+// @stream {valid ptr} the detached stream
+// @data__out {valid ptr} [frame_bytes] the frame is written here
+//
+// CONTEXT:
+//      any
+//
+// RETURNS:
+//      true: if the frame was built
+//      false: if there is nothing to send (or not a detached stream)
+bool symspi_stream_frame_pull(struct symspi_stream *stream
+		, u8 *data__out)
+{
+	unsigned long flags;
+	bool built;
+
+	if (IS_ERR_OR_NULL(stream) || !data__out || stream->symspi) {
+		return false;
+	}
+
+	spin_lock_irqsave(&stream->lock, flags);
+	built = __symspi_stream_frame_build(stream, data__out);
+	spin_unlock_irqrestore(&stream->lock, flags);
+
+	return built;
+}
+
+// TEST API:
+//
+// Parses the received frame, the complete messages are delivered
+// to the stream msg_received callback before the return. Detached
+// stream only (see symspi_stream_open_detached(...)).
+//
+// @stream {valid ptr} the detached stream
+// @data {valid ptr} the frame data
+// @size_bytes the frame size, MUST be the stream frame size
+//
+// CONTEXT:
+//      sleepable (as msg_received callback), not concurrent for
+//      the same stream
+//
+// RETURNS:
+//      0: on success (even if the frame was dropped, see stats)
+//      -EINVAL: bad arguments (or not a detached stream)
+int symspi_stream_frame_push(struct symspi_stream *stream
+		, const u8 *data
+		, size_t size_bytes)
+{
+	if (IS_ERR_OR_NULL(stream) || !data || stream->symspi
+			|| size_bytes != stream->frame_bytes) {
+		return -EINVAL;
+	}
+
+	symspi_stream_rx_frame(stream, data, size_bytes);
+	return 0;
+}
+
+EXPORT_SYMBOL_GPL(symspi_stream_open_detached);
+EXPORT_SYMBOL_GPL(symspi_stream_frame_pull);
+EXPORT_SYMBOL_GPL(symspi_stream_frame_push);
+
+#endif /* SYMSPI_TEST_MODULE */
+
+EXPORT_SYMBOL(symspi_stream_open);
+EXPORT_SYMBOL(symspi_stream_send);
+EXPORT_SYMBOL(symspi_stream_stats_get);
+EXPORT_SYMBOL(symspi_stream_close);
+
+MODULE_DESCRIPTION("Symmetrical SPI stream layer: variable length messages"
+		   " over fixed size frames.");
+MODULE_AUTHOR("Artem Gulyaev <Artem.Gulyaev@bosch.com>");
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,119 @@
+/*
+ * This file defines the kernel API of the symmetrical SPI driver
+ * (SymSPI) stream layer: variable length messages over fixed size
+ * SymSPI frames.
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef SYMSPI_STREAM_HEADER_DEFINED
+#define SYMSPI_STREAM_HEADER_DEFINED
+
+#include <linux/types.h>
+#include "symspi.h"
+
+// The stream layer sends the consumer messages of any size (up to
+// the configured max) over SymSPI frames of a single fixed size,
+// so no xfer size changes are ever needed:
+//
+//   * several small messages are coalesced in one frame,
+//   * a big message is split in chunks across several frames.
+//
+// Frame layout (all frames have the same size):
+//
+//      +-----+------+--------+-------+--------+-------+-- - - --+
+//      | seq | sess | chunk  | chunk | chunk  | chunk | 0 (pad) |
+//      |     |      | header | data  | header | data  |         |
+//      +-----+------+--------+-------+--------+-------+-- - - --+
+//
+//   * seq: {1..255} the data frame sequence number (wraps skipping 0),
+//     0 for empty frame (no data),
+//   * sess: {1..255} the sender session id, every stream open gets
+//     the new one (it differs from the previous one),
+//   * chunk header: le16: bits 0..13: chunk data length (> 0),
+//     bit 14: the first chunk of a message, bit 15: the last chunk
+//     of a message; zero header ends the frame.
+//
+// The receiving side drops the repeated frames (same seq, SymSPI
+// xfers the last frame again when the other side asks for xfer
+// while we have no data), and drops partially received messages
+// when a frame is lost (seq gap). When the session id changes (the
+// other side has reopened its stream and so restarted its seq), the
+// receiving side drops the partial message and starts following
+// the new seq from the first frame of the new session, so the
+// first frame is neither taken for a repeated one nor counted as
+// a frame loss.
+//
+// NOTE: both sides must use the same frame size.
+
+// The stream statistics.
+//
+// @msgs_tx the number of fully sent messages
+// @msgs_rx the number of received (delivered) messages
+// @frames_tx the number of data frames given to SymSPI
+// @frames_rx the number of new data frames received
+// @frames_rx_dup the number of repeated frames dropped
+// @frames_rx_lost the number of detected lost frames (seq gaps)
+// @msgs_rx_dropped the number of dropped partial/oversized messages
+// @frames_rx_corrupted the number of frames with broken chunk headers
+// @xfer_errors the number of failed xfers
+// @peer_restarts the number of the other side stream reopens seen
+struct symspi_stream_stats {
+	u64 msgs_tx;
+	u64 msgs_rx;
+	u64 frames_tx;
+	u64 frames_rx;
+	u64 frames_rx_dup;
+	u64 frames_rx_lost;
+	u64 msgs_rx_dropped;
+	u64 frames_rx_corrupted;
+	u64 xfer_errors;
+	u64 peer_restarts;
+};
+
+// The message received callback.
+//
+// CONTEXT:
+//      sleepable (SymSPI postprocessing), but should not block
+//      for long, as link waits for it
+// @data the message data, valid only within the callback
+// @size_bytes the message size
+// @consumer_data the consumer data given to symspi_stream_open(...)
+typedef void (*symspi_stream_msg_received_t)(const void *data
+					     , size_t size_bytes
+					     , void *consumer_data);
+
+struct symspi_stream;
+
+/* -------------------- API DECLARATIONS SECTION ------------------------*/
+/* ------------ for documentation, see symspi_stream.c file -------------*/
+
+struct symspi_stream *symspi_stream_open(struct symspi_dev *symspi
+		, size_t frame_bytes
+		, size_t msg_max_bytes
+		, symspi_stream_msg_received_t msg_received
+		, void *consumer_data);
+int symspi_stream_send(struct symspi_stream *stream
+		, const void *data
+		, size_t size_bytes
+		, gfp_t gfp);
+void symspi_stream_stats_get(struct symspi_stream *stream
+		, struct symspi_stream_stats *stats__out);
+void symspi_stream_close(struct symspi_stream *stream);
+
+#endif /* SYMSPI_STREAM_HEADER_DEFINED */
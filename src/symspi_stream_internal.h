@@ -0,0 +1,51 @@
+/*
+ * This file defines the internal (test only) part of the symmetrical
+ * SPI driver (SymSPI) stream layer, which is not a part of the stream
+ * kernel API (see symspi_stream.h).
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+#ifndef SYMSPI_STREAM_INTERNAL_HEADER_DEFINED
+#define SYMSPI_STREAM_INTERNAL_HEADER_DEFINED
+
+#include "symspi_stream.h"
+
+// The detached stream: the stream not bound to any SymSPI device,
+// its frames are moved by the caller. Is used only for the framing
+// testing (see symspi_test.c), and so is built only together with
+// the test module (SYMSPI_TEST_MODULE).
+
+#ifdef SYMSPI_TEST_MODULE
+
+/* -------------------- API DECLARATIONS SECTION ------------------------*/
+/* ------------ for documentation, see symspi_stream.c file -------------*/
+
+struct symspi_stream *symspi_stream_open_detached(size_t frame_bytes
+		, size_t msg_max_bytes
+		, symspi_stream_msg_received_t msg_received
+		, void *consumer_data);
+bool symspi_stream_frame_pull(struct symspi_stream *stream
+		, u8 *data__out);
+int symspi_stream_frame_push(struct symspi_stream *stream
+		, const u8 *data
+		, size_t size_bytes);
+
+#endif /* SYMSPI_TEST_MODULE */
+
+#endif /* SYMSPI_STREAM_INTERNAL_HEADER_DEFINED */
@@ -57,7 +57,29 @@
 #include <linux/printk.h>
 #include <linux/delay.h>
 #include <linux/spi/spi.h>
+#include <linux/proc_fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/utsname.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/random.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/mman.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+#include <asm/unaligned.h>
 #include "./symspi.h"
+#include "./symspi_uapi.h"
+#ifdef SYMSPI_STREAM
+#include "./symspi_stream.h"
+#include "./symspi_stream_internal.h"
+#endif
 
 // DEV STACK
 //
@@ -627,6 +649,15 @@ struct full_duplex_xfer symspi_test_xfer_1b_to_64b_xfer = {
                 return &symspi_test_xfer_##xfer;                     \
         }
 
+// keeps the current xfer, doesn't trigger the next xfer
+#define SYMSPI_TEST_JNEXT_PASSIVE_NULL(test, phase)                  \
+        if (symspi_test_##test##__xfer_counter                       \
+                        == phase) {                                  \
+                *start_immediately__out = false;                     \
+                symspi_test_##test##__xfer_counter++;                \
+                return NULL;                                         \
+        }
+
 #define SYMSPI_TEST_VERIFY_JNEXT(test, phase, next_xfer, exp_data, fail_xfer) \
         if (symspi_test_##test##__xfer_counter == phase) {           \
                 SYMSPI_TEST_VERIFY_RX(exp_data, test, fail_xfer);    \
@@ -1331,193 +1362,2736 @@ bool symspi_test_12(struct symspi_dev *symspi)
 }
 
 
-/*----------------------------- MAIN -------------------------------*/
+// TEST 13
+// TEST 1 sequence, but xfers data is written directly into the
+// SymSPI back buffer (see symspi_xfer_buffer_acquire(...)), so
+// SymSPI swaps the buffers instead of copying the data.
+//      * XFER 1
+//          * TX: predefined 64 byte request package (in back buffer)
+//          * RX: irrelevant
+//      * XFER 2
+//          * TX: default 64 byte package (in back buffer)
+//          * RX: predefined 64 byte answer package
+// if 2nd xfer RX data equals to expected (predefined), then test
+// is passed
+#define SYMSPI_TEST_13 13
 
-static bool symspi_test_exiting = false;
+struct symspi_dev *symspi_test_13__symspi;
+struct full_duplex_xfer symspi_test_xfer_13_back_buffer = {
+        .size_bytes = 64
+        , .data_tx = NULL
+        , .data_rx_buf = NULL
+        , .consumer_data = NULL
+        , .done_callback = NULL
+        , .fail_callback = NULL
+};
 
-struct full_duplex_xfer * symspi_test_xfer_done_default_callback(
-                        const struct full_duplex_xfer __kernel *done_xfer
-                        , const int next_xfer_id
-                        , bool __kernel *start_immediately__out
-                        , void *consumer_data)
+// Fills the SymSPI back buffer with given data and points the
+// test 13 xfer to it.
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+int symspi_test_13__fill_back_buffer(const void *data, size_t size)
 {
-        symspi_test_info_raw("default callback: xfer done");
-        symspi_test_printout_xfer(done_xfer);
+        void *buffer = symspi_xfer_buffer_acquire(
+                                (void*)symspi_test_13__symspi, size);
+        if (IS_ERR(buffer)) {
+                symspi_test_err("failed to acquire back buffer: %ld"
+                                , PTR_ERR(buffer));
+                return PTR_ERR(buffer);
+        }
+        memcpy(buffer, data, size);
+        symspi_test_xfer_13_back_buffer.data_tx = buffer;
+        symspi_test_xfer_13_back_buffer.size_bytes = size;
+        return 0;
+}
 
-        // gracefull shutdown path
-        if (symspi_test_exiting) {
-                return ERR_PTR(-ENODATA);
+SYMSPI_TEST_DEFINE_TEST(13)
+SYMSPI_TEST_STANDARD_CALLBACK(13)
+{
+        bool equal;
+
+        // we have xfered our request
+        if (symspi_test_13__xfer_counter == 1) {
+                if (symspi_test_13__fill_back_buffer(
+                                symspi_test_xfer_data_64b_default
+                                , sizeof(symspi_test_xfer_data_64b_default))
+                                        != 0) {
+                        SYMSPI_TEST_FAIL_FINISH_SEQ(13, 64b_default
+                                        , "no back buffer");
+                }
         }
+        SYMSPI_TEST_JNEXT_XFER(13, 1, 13_back_buffer);
 
-        return NULL;
+        // we have done the answer xfer, verifying the answer
+        SYMSPI_TEST_VERIFY_RX(64b_answer, 13, 64b_default);
+
+        SYMSPI_TEST_UNBIND_XFER(13_back_buffer, 13);
+        SYMSPI_TEST_FINISH_SEQ(13, 64b_default);
 }
 
+bool symspi_test_13(struct symspi_dev *symspi)
+{
+        SYMSPI_TEST_INITIATE_TEST_ACTIONS(13);
 
-/*-------------------- MODULE HOUSEKEEPING -------------------------*/
+        symspi_test_13__symspi = symspi;
+        if (symspi_test_13__fill_back_buffer(
+                        symspi_test_xfer_data_64b_request
+                        , sizeof(symspi_test_xfer_data_64b_request)) != 0) {
+                return false;
+        }
 
-extern struct symspi_dev *symspi_get_global_device(void);
+        SYMSPI_TEST_BIND_TO_TEST(64b_default, 13);
+        SYMSPI_TEST_BIND_TO_TEST(13_back_buffer, 13);
 
-extern int symspi_data_xchange(void __kernel *device
-                , struct __kernel full_duplex_xfer *xfer
-                , bool force_size_change);
-extern int symspi_default_data_update(void __kernel *device
-                , struct full_duplex_xfer *xfer
-                , bool force_size_change);
-extern int symspi_init(void __kernel *device
-                , struct full_duplex_xfer *default_xfer);
-extern int symspi_close(void __kernel *device);
-extern bool symspi_is_running(void __kernel *device);
-extern int symspi_reset(void __kernel *device
-                , struct full_duplex_xfer *default_xfer);
+        // TODO: may fail due to xfer requested from other side
+        // FIXME
+        symspi_data_xchange((void*)symspi
+                            , &symspi_test_xfer_13_back_buffer
+                            , true);
 
+        SYMSPI_TEST_FINALIZE(13, 2);
+}
 
-struct symspi_test_test {
-        bool (*routine)(struct symspi_dev *);
-        char *name;
-        bool result;
-};
 
-// If you add a new test, add it here
-static struct symspi_test_test symspi_test_tests[] = {
-        { symspi_test_1, "TEST 1: 64 byte request-answer", false }
-        , { symspi_test_2, "TEST 2: 64 byte - 1 byte - 64 byte", false }
-        , { symspi_test_3, "TEST 3: 1000x heavy load of:"
-                           " 64 byte request-answer", false }
-        , { symspi_test_4, "TEST 4: 1000x heavy load of:"
-                           " 64 byte - 1 byte - 64 byte", false }
-        , { symspi_test_5, "TEST 5: switch to 1 byte mode"
-                           ", 1000x of: 1 byte request-answer"
-                           ", switch back to 64 byte mode", false }
-        , { symspi_test_7, "TEST 7: single xfer initiated by other"
-                           " side (upon our previous request)", false }
-        , { symspi_test_8, "TEST 8: 1000x of other side initiated xfers"
-                           " (no wait from our side)", false }
-        , { symspi_test_9, "TEST 9: single 1 byte xfer initiated by other"
-                           " side (upon our previous request)", false }
-        , { symspi_test_10
-            , "TEST 10: 1000x of 1 byte xfer initiated by other"
-              " side (upon our previous request every time)"
-            , false }
-        , { symspi_test_11
-            , "TEST 11: 1000x of 64 byte xfer initiated by other"
-              " side (upon our single request)", false }
-        , { symspi_test_12
-            , "TEST 12: 1000x of 64 byte xfer initiated together"
-              " (both sides run to trigger initialization)"
-            , false }
-};
+// TEST 14
+// TEST 1 sequence, but both xfers are enqueued at once into the
+// SymSPI TX ring (see symspi_data_xchange_batch(...)), so SymSPI
+// starts the second xfer by itself.
+//      * XFER 1
+//          * TX: predefined 64 byte request package
+//          * RX: irrelevant
+//      * XFER 2
+//          * TX: default 64 byte package
+//          * RX: predefined 64 byte answer package
+// if 2nd xfer RX data equals to expected (predefined), then test
+// is passed
+#define SYMSPI_TEST_14 14
 
-static void symspi_test_configure_symspi(struct symspi_dev *symspi)
+SYMSPI_TEST_DEFINE_TEST(14)
+SYMSPI_TEST_STANDARD_CALLBACK(14)
 {
-        // adjusting SPI mode
+        bool equal;
 
-        // sets the single brust size in bits (amount of bits to be
-        // xfered at once between SS raise and SS drop);
-        // NOTE: right now works only up to 32 bits (probably as long
-        //      as fifo on iMX is of 32bits width); (depth of fifo is
-        //      64 entries);
-        // WARNING: the spi device adjusts the bit order according to
-        //      the word size, so if you set 32 bit word size, then
-        //      it will send the most significant of 32 bits first
-        //      then less, less and so on to the less significant one.
-        //      Which will cause the byte order inversion in groups
-        //      of 4 bytes.
-        //symspi->spi->bits_per_word = 32;
-        //
-        // spi_device
-        //#define	SPI_CPHA	0x01			/* clock phase */
-        //#define	SPI_CPOL	0x02			/* clock polarity */
+        // we have xfered our request, the next xfer is in the ring
+        SYMSPI_TEST_JNEXT_PASSIVE_NULL(14, 1);
 
+        // we have done the answer xfer, verifying the answer
+        SYMSPI_TEST_VERIFY_RX(64b_answer, 14, 64b_default);
 
-        //  * when SS disabled, clock is HI
-        //  * data is valid on clock change from LO -> HI
-        symspi->spi->bits_per_word = 8;
-        symspi->spi->mode |= (SPI_CPOL | SPI_CPHA);
-        symspi->spi->master->setup(symspi->spi);
+        SYMSPI_TEST_FINISH_SEQ(14, 64b_default);
 }
 
-static void symspi_test_print_results(void)
+bool symspi_test_14(struct symspi_dev *symspi)
 {
-        symspi_test_info_raw("========= SYMSPI TEST RESULTS =========");
+        SYMSPI_TEST_INITIATE_TEST_ACTIONS(14);
 
-        int tests_count = ARRAY_SIZE(symspi_test_tests);
-        int failed_count = 0;
-        int i;
-        for (i = 0; i < tests_count; i++) {
-                if (symspi_test_tests[i].result) {
-                        symspi_test_info_raw("test[%d]:     OK: %s", i
-                                             , symspi_test_tests[i].name);
-                } else {
-                        symspi_test_err_raw("test[%d]:     FAILED!: %s"
-                                            , i, symspi_test_tests[i].name);
-                        failed_count++;
-                }
+        SYMSPI_TEST_BIND_TO_TEST(64b_default, 14);
+        SYMSPI_TEST_BIND_TO_TEST(64b_request, 14);
+
+        struct full_duplex_xfer *batch[] = {
+                &symspi_test_xfer_64b_request
+                , &symspi_test_xfer_64b_default
+        };
+
+        // TODO: may fail due to xfer requested from other side
+        // FIXME
+        res = symspi_data_xchange_batch((void*)symspi, batch
+                                        , ARRAY_SIZE(batch), true);
+        if (res != (int)ARRAY_SIZE(batch)) {
+                symspi_test_err("enqueue failed: %d", res);
+                SYMSPI_TEST_UNBIND_XFER(64b_request, 14);
+                SYMSPI_TEST_UNBIND_XFER(64b_default, 14);
+                return false;
         }
 
-        if (failed_count == 0) {
-                symspi_test_info_raw("ALL TESTS PASSED.");
-        } else {
-                symspi_test_err_raw("%d/%d TESTS FAILED", failed_count
-                                    , tests_count);
+        SYMSPI_TEST_FINALIZE(14, 2);
+}
+
+
+#ifdef SYMSPI_STREAM
+
+// TEST 15
+// The stream layer framing (see symspi_stream.h) over the detached
+// streams (no link involved): the frames built by the sender stream
+// are given to the receiver stream directly, some of them skipped,
+// repeated or corrupted on the way.
+//      * exact fit message (chunk takes the rest of the frame),
+//        coalesced messages, message split across frames, message
+//        over the chunk length limit, zero length message rejection,
+//      * repeated frame is dropped, seq wraps 255 -> 1 without loss,
+//        seq gap (also across the wrap) is counted as lost frames
+//        and drops the partial message,
+//      * zero length chunk and chunk longer than the rest of the
+//        frame are counted as corrupted and drop the partial message,
+//      * sender reopen (new session, seq restarts) is neither taken
+//        for a repeat nor counted as loss, and the partial message
+//        of the old session is dropped.
+// if all received messages and statistics are as expected, then
+// test is passed
+// NOTE: is compiled in with BOSCH_SYMSPI_STREAM_MODULE only, and then
+//      the symspi_stream module is to be loaded before this one.
+#define SYMSPI_TEST_15 15
+
+// the wire format (see symspi_stream.h)
+#define SYMSPI_TEST_15_FRAME_HDR_BYTES 2
+#define SYMSPI_TEST_15_CHUNK_HDR_BYTES 2
+#define SYMSPI_TEST_15_CHUNK_LEN_MASK 0x3FFF
+#define SYMSPI_TEST_15_CHUNK_FIRST 0x4000
+#define SYMSPI_TEST_15_CHUNK_LAST 0x8000
+
+#define SYMSPI_TEST_15_FRAME_BYTES 16
+// the max single chunk data size in the frame
+#define SYMSPI_TEST_15_CHUNK_MAX_BYTES (SYMSPI_TEST_15_FRAME_BYTES       \
+                                        - SYMSPI_TEST_15_FRAME_HDR_BYTES \
+                                        - SYMSPI_TEST_15_CHUNK_HDR_BYTES)
+// the frame which fits a chunk over the chunk length limit
+#define SYMSPI_TEST_15_BIG_FRAME_BYTES (SYMSPI_TEST_15_CHUNK_LEN_MASK + 17)
+#define SYMSPI_TEST_15_BIG_MSG_BYTES (SYMSPI_TEST_15_CHUNK_LEN_MASK + 101)
+#define SYMSPI_TEST_15_MSG_MAX_BYTES (2 * SYMSPI_TEST_15_BIG_MSG_BYTES)
+// enough single frame messages to wrap the seq
+#define SYMSPI_TEST_15_WRAP_FRAMES 300
+
+// The receiver side of test 15.
+//
+// @data [SYMSPI_TEST_15_MSG_MAX_BYTES] the last received message
+// @size the last received message size
+// @count the number of received messages
+struct symspi_test_15_rx {
+        u8 *data;
+        size_t size;
+        int count;
+};
+
+struct symspi_test_15_rx symspi_test_15__rx;
+u8 *symspi_test_15__msg;
+u8 *symspi_test_15__frames[3];
+
+void symspi_test_15__msg_received(const void *data, size_t size_bytes
+                                  , void *consumer_data)
+{
+        struct symspi_test_15_rx *rx = (struct symspi_test_15_rx *)consumer_data;
+
+        if (size_bytes <= SYMSPI_TEST_15_MSG_MAX_BYTES) {
+                memcpy(rx->data, data, size_bytes);
         }
+        rx->size = size_bytes;
+        rx->count++;
 }
 
-// RETURNS:
-//      0 if all tests passed,
-//      or negated first failed test index
-static int __init symspi_test_module_init(void)
+// Fills the test message.
+void symspi_test_15__fill(u8 *data, const size_t size, const u8 seed)
 {
-        symspi_test_info("loading module");
+        size_t i;
 
-        struct symspi_dev *symspi = symspi_get_global_device();
+        for (i = 0; i < size; i++) {
+                data[i] = (u8)(seed + i * 3);
+        }
+}
 
-        if (IS_ERR_OR_NULL(symspi)) {
-                symspi_test_err("global symspi device unavailable"
-                                ", err: %ld" , PTR_ERR(symspi));
-                return -ENODEV;
+// RETURNS:
+//      true: if the last received message is the test message of
+//          given @size and @seed.
+bool symspi_test_15__rx_is(const size_t size, const u8 seed)
+{
+        size_t i;
+
+        if (symspi_test_15__rx.size != size) {
+                symspi_test_err("received %zu bytes, expected %zu"
+                                , symspi_test_15__rx.size, size);
+                return false;
         }
-        symspi_test_info_raw("symspi device: %px", symspi);
+        for (i = 0; i < size; i++) {
+                if (symspi_test_15__rx.data[i] != (u8)(seed + i * 3)) {
+                        symspi_test_err("received data mismatch at %zu"
+                                        , i);
+                        return false;
+                }
+        }
+        return true;
+}
 
-        symspi_test_configure_symspi(symspi);
+// Queues the test message of given @size and @seed.
+// RETURNS:
+//      see symspi_stream_send(...)
+int symspi_test_15__send(struct symspi_stream *tx, const size_t size
+                         , const u8 seed)
+{
+        symspi_test_15__fill(symspi_test_15__msg, size, seed);
+        return symspi_stream_send(tx, symspi_test_15__msg, size
+                                  , GFP_KERNEL);
+}
 
-        if (symspi_test_run_symspi(symspi) != 0) {
-                symspi_test_err("Symspi loading failed. Abort.");
-                return -ENODEV;
+// Moves all frames the sender has into the receiver.
+// RETURNS:
+//      the number of moved frames
+int symspi_test_15__flush(struct symspi_stream *tx, struct symspi_stream *rx
+                          , u8 *frame, const size_t frame_bytes)
+{
+        int frames = 0;
+
+        while (symspi_stream_frame_pull(tx, frame)) {
+                symspi_stream_frame_push(rx, frame, frame_bytes);
+                frames++;
         }
+        return frames;
+}
 
-        symspi_test_info("symspi inited");
-        symspi_test_info("starting tests...");
+#define SYMSPI_TEST_15_CHECK(cond, fmt, ...)                         \
+        if (!(cond)) {                                               \
+                symspi_test_err("test 15: "fmt, ##__VA_ARGS__);      \
+                goto done;                                           \
+        }
 
-        if (sizeof(symspi_test_tests) == 0) {
-                symspi_test_err("No tests to run!");
-                return -1;
+// checks the receiver statistics delta since @before snapshot
+#define SYMSPI_TEST_15_CHECK_STAT(field, delta)                      \
+        symspi_stream_stats_get(rx, &st);                            \
+        SYMSPI_TEST_15_CHECK(st.field - before.field == (delta)      \
+                             , #field": %llu, expected %llu"         \
+                             , st.field - before.field               \
+                             , (unsigned long long)(delta))
+
+// Verifies the message split over the chunk length limit.
+// RETURNS:
+//      true: on success
+bool symspi_test_15__big(void)
+{
+        const size_t frame_bytes = SYMSPI_TEST_15_BIG_FRAME_BYTES;
+        struct symspi_stream *tx = NULL, *rx = NULL;
+        u8 *frame = kmalloc(frame_bytes, GFP_KERNEL);
+        bool result = false;
+        int count;
+        u16 hdr;
+
+        if (!frame) {
+                return false;
         }
+        tx = symspi_stream_open_detached(frame_bytes
+                        , SYMSPI_TEST_15_MSG_MAX_BYTES
+                        , &symspi_test_15__msg_received, NULL);
+        rx = symspi_stream_open_detached(frame_bytes
+                        , SYMSPI_TEST_15_MSG_MAX_BYTES
+                        , &symspi_test_15__msg_received
+                        , &symspi_test_15__rx);
+        SYMSPI_TEST_15_CHECK(!IS_ERR(tx) && !IS_ERR(rx)
+                             , "big frame streams open failed");
+
+        count = symspi_test_15__rx.count;
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , SYMSPI_TEST_15_BIG_MSG_BYTES, 0x21) == 0
+                             , "big message send failed");
+
+        SYMSPI_TEST_15_CHECK(symspi_stream_frame_pull(tx, frame)
+                             , "no big frame");
+        hdr = get_unaligned_le16(frame + SYMSPI_TEST_15_FRAME_HDR_BYTES);
+        SYMSPI_TEST_15_CHECK(hdr == (SYMSPI_TEST_15_CHUNK_LEN_MASK
+                                     | SYMSPI_TEST_15_CHUNK_FIRST)
+                             , "first chunk header: 0x%04x", hdr);
+        symspi_stream_frame_push(rx, frame, frame_bytes);
+
+        SYMSPI_TEST_15_CHECK(symspi_test_15__flush(tx, rx, frame
+                                                   , frame_bytes) == 1
+                             , "big message takes not 2 frames");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == count + 1
+                             , "big message not received");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx_is(
+                                SYMSPI_TEST_15_BIG_MSG_BYTES, 0x21)
+                             , "big message corrupted");
+        result = true;
+
+done:
+        symspi_stream_close(tx);
+        symspi_stream_close(rx);
+        kfree(frame);
+        return result;
+}
 
-        // run all decladed tests
+bool symspi_test_15(struct symspi_dev *symspi)
+{
+        const size_t fsize = SYMSPI_TEST_15_FRAME_BYTES;
+        struct symspi_stream *tx = NULL, *rx = NULL;
+        struct symspi_stream_stats before, st;
+        u8 *frame = kmalloc(fsize, GFP_KERNEL);
+        bool result = false;
+        bool wrapped = false;
+        u8 prev_seq = 0;
+        u8 session;
+        int count;
+        int bad;
         int i;
-        int tests_count = ARRAY_SIZE(symspi_test_tests);
-        int failed_count = 0;
-        for (i = 0; i < tests_count ; i++) {
-                symspi_test_info("starting test: [%d]", (i + 1));
-                if (!(symspi_test_tests[i].routine(symspi))) {
-                        symspi_test_err("test %d failed, see dmesg"
-                                        " for details.", (i + 1));
-                        symspi_test_tests[i].result = false;
-                        failed_count++;
-                } else {
-                        symspi_test_tests[i].result = true;
+
+        pr_info("SYMSPI_TEST: 15: starting\n.");
+
+        symspi_test_15__rx.data = kmalloc(SYMSPI_TEST_15_MSG_MAX_BYTES
+                                          , GFP_KERNEL);
+        symspi_test_15__msg = kmalloc(SYMSPI_TEST_15_MSG_MAX_BYTES
+                                      , GFP_KERNEL);
+        for (i = 0; i < ARRAY_SIZE(symspi_test_15__frames); i++) {
+                symspi_test_15__frames[i] = kmalloc(fsize, GFP_KERNEL);
+                SYMSPI_TEST_15_CHECK(symspi_test_15__frames[i], "no memory");
+        }
+        SYMSPI_TEST_15_CHECK(frame && symspi_test_15__rx.data
+                             && symspi_test_15__msg, "no memory");
+        symspi_test_15__rx.count = 0;
+
+        tx = symspi_stream_open_detached(fsize, SYMSPI_TEST_15_MSG_MAX_BYTES
+                        , &symspi_test_15__msg_received, NULL);
+        rx = symspi_stream_open_detached(fsize, SYMSPI_TEST_15_MSG_MAX_BYTES
+                        , &symspi_test_15__msg_received
+                        , &symspi_test_15__rx);
+        SYMSPI_TEST_15_CHECK(!IS_ERR(tx) && !IS_ERR(rx)
+                             , "streams open failed");
+        symspi_stream_stats_get(rx, &before);
+
+        // zero length message
+        SYMSPI_TEST_15_CHECK(symspi_stream_send(tx, symspi_test_15__msg, 0
+                                                , GFP_KERNEL) == -EINVAL
+                             , "zero length message accepted");
+        SYMSPI_TEST_15_CHECK(!symspi_stream_frame_pull(tx, frame)
+                             , "frame without messages");
+
+        // exact fit: single chunk till the frame end
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , SYMSPI_TEST_15_CHUNK_MAX_BYTES, 1) == 0
+                             , "send failed");
+        SYMSPI_TEST_15_CHECK(symspi_stream_frame_pull(tx, frame)
+                             , "no exact fit frame");
+        SYMSPI_TEST_15_CHECK(get_unaligned_le16(frame
+                                        + SYMSPI_TEST_15_FRAME_HDR_BYTES)
+                             == (SYMSPI_TEST_15_CHUNK_MAX_BYTES
+                                 | SYMSPI_TEST_15_CHUNK_FIRST
+                                 | SYMSPI_TEST_15_CHUNK_LAST)
+                             , "exact fit chunk header");
+        SYMSPI_TEST_15_CHECK(!symspi_stream_frame_pull(tx
+                                        , symspi_test_15__frames[0])
+                             , "exact fit takes 2 frames");
+        session = frame[1];
+        symspi_stream_frame_push(rx, frame, fsize);
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == 1
+                             && symspi_test_15__rx_is(
+                                        SYMSPI_TEST_15_CHUNK_MAX_BYTES, 1)
+                             , "exact fit message");
+
+        // repeated frame
+        symspi_stream_frame_push(rx, frame, fsize);
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == 1
+                             , "repeated frame delivered");
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_dup, 1);
+
+        // coalesced: two messages in one frame
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 3, 2) == 0
+                             && symspi_test_15__send(tx, 4, 3) == 0
+                             , "send failed");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__flush(tx, rx, frame
+                                                   , fsize) == 1
+                             , "coalesced messages take not 1 frame");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == 3
+                             && symspi_test_15__rx_is(4, 3)
+                             , "coalesced messages");
+
+        // split: three frames
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , 3 * SYMSPI_TEST_15_CHUNK_MAX_BYTES - 1
+                                , 4) == 0
+                             , "send failed");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__flush(tx, rx, frame
+                                                   , fsize) == 3
+                             , "split message takes not 3 frames");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == 4
+                             && symspi_test_15__rx_is(
+                                3 * SYMSPI_TEST_15_CHUNK_MAX_BYTES - 1, 4)
+                             , "split message");
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 0);
+        SYMSPI_TEST_15_CHECK_STAT(msgs_rx_dropped, 0);
+
+        // seq gap: the middle frame of split message is lost
+        symspi_stream_stats_get(rx, &before);
+        count = symspi_test_15__rx.count;
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , 3 * SYMSPI_TEST_15_CHUNK_MAX_BYTES, 5) == 0
+                             , "send failed");
+        for (i = 0; i < 3; i++) {
+                SYMSPI_TEST_15_CHECK(symspi_stream_frame_pull(tx
+                                        , symspi_test_15__frames[i])
+                                     , "no frame %d", i);
+        }
+        symspi_stream_frame_push(rx, symspi_test_15__frames[0], fsize);
+        symspi_stream_frame_push(rx, symspi_test_15__frames[2], fsize);
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == count
+                             , "message with lost frame delivered");
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 1);
+        SYMSPI_TEST_15_CHECK_STAT(msgs_rx_dropped, 1);
+
+        // seq wrap 255 -> 1 without loss
+        symspi_stream_stats_get(rx, &before);
+        count = symspi_test_15__rx.count;
+        for (i = 0; i < SYMSPI_TEST_15_WRAP_FRAMES; i++) {
+                SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 1, (u8)i) == 0
+                                     && symspi_stream_frame_pull(tx, frame)
+                                     , "wrap frame %d", i);
+                SYMSPI_TEST_15_CHECK(frame[0] != 0, "data frame seq 0");
+                if (prev_seq == 0xFF) {
+                        SYMSPI_TEST_15_CHECK(frame[0] == 1
+                                             , "seq after 255: %u", frame[0]);
+                        wrapped = true;
                 }
-                // to distinguish between tests in logic diagram
-                msleep(500);
+                prev_seq = frame[0];
+                symspi_stream_frame_push(rx, frame, fsize);
+        }
+        SYMSPI_TEST_15_CHECK(wrapped, "seq didn't wrap");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count
+                             == count + SYMSPI_TEST_15_WRAP_FRAMES
+                             && symspi_test_15__rx_is(1
+                                        , (u8)(SYMSPI_TEST_15_WRAP_FRAMES - 1))
+                             , "wrap messages");
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 0);
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_dup, 0);
+
+        // seq gap across the wrap: 255 and 1 are lost
+        do {
+                SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 1, 0) == 0
+                                     && symspi_stream_frame_pull(tx, frame)
+                                     , "no frame");
+                symspi_stream_frame_push(rx, frame, fsize);
+        } while (frame[0] != 0xFE);
+        symspi_stream_stats_get(rx, &before);
+        for (i = 0; i < 3; i++) {
+                SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 1, 0) == 0
+                                     && symspi_stream_frame_pull(tx, frame)
+                                     , "no frame");
+        }
+        SYMSPI_TEST_15_CHECK(frame[0] == 2, "seq after 255, 1: %u"
+                             , frame[0]);
+        symspi_stream_frame_push(rx, frame, fsize);
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 2);
+
+        // corrupted: zero length chunk, then too long chunk, in the
+        // middle of split message
+        symspi_stream_stats_get(rx, &before);
+        count = symspi_test_15__rx.count;
+        for (bad = 0; bad < 2; bad++) {
+                const u16 bad_hdr = (bad == 0)
+                                    ? SYMSPI_TEST_15_CHUNK_FIRST
+                                    : SYMSPI_TEST_15_CHUNK_MAX_BYTES + 1;
+
+                SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , 3 * SYMSPI_TEST_15_CHUNK_MAX_BYTES, 6) == 0
+                                     , "send failed");
+                for (i = 0; i < 3; i++) {
+                        SYMSPI_TEST_15_CHECK(symspi_stream_frame_pull(tx
+                                                , symspi_test_15__frames[i])
+                                             , "no frame %d", i);
+                }
+                put_unaligned_le16(bad_hdr, symspi_test_15__frames[1]
+                                            + SYMSPI_TEST_15_FRAME_HDR_BYTES);
+                for (i = 0; i < 3; i++) {
+                        symspi_stream_frame_push(rx
+                                        , symspi_test_15__frames[i], fsize);
+                }
+        }
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == count
+                             , "corrupted message delivered");
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_corrupted, 2);
+        SYMSPI_TEST_15_CHECK_STAT(msgs_rx_dropped, 2);
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 0);
+
+        // the stream goes on after corruption
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 5, 7) == 0
+                             && symspi_test_15__flush(tx, rx, frame
+                                                      , fsize) == 1
+                             && symspi_test_15__rx.count == count + 1
+                             && symspi_test_15__rx_is(5, 7)
+                             , "message after corrupted frames");
+
+        // sender reopen with partial message in flight
+        symspi_stream_stats_get(rx, &before);
+        count = symspi_test_15__rx.count;
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx
+                                , 2 * SYMSPI_TEST_15_CHUNK_MAX_BYTES, 8) == 0
+                             && symspi_stream_frame_pull(tx, frame)
+                             , "no frame");
+        symspi_stream_frame_push(rx, frame, fsize);
+        symspi_stream_close(tx);
+        tx = symspi_stream_open_detached(fsize, SYMSPI_TEST_15_MSG_MAX_BYTES
+                        , &symspi_test_15__msg_received, NULL);
+        SYMSPI_TEST_15_CHECK(!IS_ERR(tx), "stream reopen failed");
+        SYMSPI_TEST_15_CHECK(symspi_test_15__send(tx, 5, 9) == 0
+                             && symspi_stream_frame_pull(tx, frame)
+                             , "no frame");
+        SYMSPI_TEST_15_CHECK(frame[0] == 1 && frame[1] != session
+                             , "reopened stream seq: %u, session: %u"
+                             , frame[0], frame[1]);
+        symspi_stream_frame_push(rx, frame, fsize);
+        SYMSPI_TEST_15_CHECK(symspi_test_15__rx.count == count + 1
+                             && symspi_test_15__rx_is(5, 9)
+                             , "first message after sender reopen");
+        SYMSPI_TEST_15_CHECK_STAT(peer_restarts, 1);
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_dup, 0);
+        SYMSPI_TEST_15_CHECK_STAT(frames_rx_lost, 0);
+        SYMSPI_TEST_15_CHECK_STAT(msgs_rx_dropped, 1);
+
+        result = symspi_test_15__big();
+
+done:
+        symspi_stream_close(tx);
+        symspi_stream_close(rx);
+        for (i = 0; i < ARRAY_SIZE(symspi_test_15__frames); i++) {
+                kfree(symspi_test_15__frames[i]);
+                symspi_test_15__frames[i] = NULL;
         }
+        kfree(symspi_test_15__msg);
+        kfree(symspi_test_15__rx.data);
+        kfree(frame);
 
-        symspi_test_print_results();
+        if (result) {
+                pr_info("SYMSPI_TEST: TEST 15: OK.\n");
+        } else {
+                pr_err("SYMSPI_TEST: TEST 15: FAIL!.\n");
+        }
+        return result;
+}
+
+#endif /* SYMSPI_STREAM */
+
+// TEST 16
+// TEST 1 sequence in the RX ring mode (see
+// symspi_dev::rx_ready_callback): both xfers are enqueued at once
+// into the TX ring, and the received data is drained from the RX
+// ring (no done callbacks). Then the RX ring is not drained while
+// the link goes on till the ring overruns, and after the drain TEST 1
+// sequence is repeated.
+//      * XFER 1
+//          * TX: predefined 64 byte request package
+//          * RX: irrelevant
+//      * XFER 2
+//          * TX: default 64 byte package
+//          * RX: predefined 64 byte answer package (from RX ring)
+//      * XFERs 3..N (RX ring is not drained)
+//          * TX: default 64 byte package
+//          * RX: irrelevant
+//      * XFER N + 1, N + 2: as XFER 1, 2
+// if both answers are found in the RX ring, all frames in the RX
+// ring are of 64 bytes, the overruns are counted (see
+// symspi_rx_ring_overruns(...)) while the ring still keeps frames,
+// and the ring is usable again after the drain, then test is passed
+#define SYMSPI_TEST_16 16
+
+// how many xfers we give to the TX ring at once to overrun RX ring
+#define SYMSPI_TEST_16_BURST 4
+
+struct completion symspi_test_16__rx_ready;
+
+// CONTEXT:
+//      sleepable, lightweight
+void symspi_test_16__rx_ready_callback(void *device)
+{
+        complete(&symspi_test_16__rx_ready);
+}
+
+// Drains the RX ring till the 64 byte answer package is found.
+//
+// RETURNS:
+//      true: if answer was found in time and all frames were valid
+bool symspi_test_16__drain_till_answer(struct symspi_dev *symspi)
+{
+        const unsigned long deadline = jiffies + msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(2));
+        const void *data;
+        size_t size;
+        int xfer_id;
+
+        for (;;) {
+                data = symspi_rx_ring_peek((void*)symspi, &size, &xfer_id);
+                if (IS_ERR(data)) {
+                        symspi_test_err("peek failed: %ld", PTR_ERR(data));
+                        return false;
+                }
+                if (!data) {
+                        const long left = (long)(deadline - jiffies);
+
+                        if (left <= 0 || wait_for_completion_timeout(
+                                        &symspi_test_16__rx_ready, left) == 0) {
+                                symspi_test_err("no answer in RX ring");
+                                return false;
+                        }
+                        continue;
+                }
+
+                if (size != sizeof(symspi_test_xfer_data_64b_answer)) {
+                        symspi_test_err("RX ring frame of xfer %d has"
+                                        " %zu bytes", xfer_id, size);
+                        return false;
+                }
+
+                const bool answer = symspi_test_packages_equal(data
+                                , (int)size
+                                , symspi_test_xfer_data_64b_answer
+                                , sizeof(symspi_test_xfer_data_64b_answer));
+
+                if (symspi_rx_ring_release((void*)symspi) != 0) {
+                        symspi_test_err("release failed");
+                        return false;
+                }
+                if (answer) {
+                        return true;
+                }
+        }
+}
+
+// Enqueues TEST 1 sequence into the TX ring.
+//
+// RETURNS:
+//      true: on success
+bool symspi_test_16__request(struct symspi_dev *symspi)
+{
+        struct full_duplex_xfer *batch[] = {
+                &symspi_test_xfer_64b_request
+                , &symspi_test_xfer_64b_default
+        };
+
+        // TODO: may fail due to xfer requested from other side
+        // FIXME
+        const int res = symspi_data_xchange_batch((void*)symspi, batch
+                                                  , ARRAY_SIZE(batch)
+                                                  , true);
+        if (res != (int)ARRAY_SIZE(batch)) {
+                symspi_test_err("enqueue failed: %d", res);
+                return false;
+        }
+        return true;
+}
+
+// Runs the link with RX ring not drained till it overruns, then
+// drains the ring.
+//
+// RETURNS:
+//      true: if overrun was counted and the ring kept valid frames
+bool symspi_test_16__overrun(struct symspi_dev *symspi)
+{
+        const unsigned long deadline = jiffies + msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(100));
+        const unsigned long long overruns_before
+                        = symspi_rx_ring_overruns((void*)symspi);
+        struct full_duplex_xfer *batch[SYMSPI_TEST_16_BURST];
+        const void *data;
+        size_t size;
+        int drained = 0;
+        int i;
+
+        for (i = 0; i < SYMSPI_TEST_16_BURST; i++) {
+                batch[i] = &symspi_test_xfer_64b_default;
+        }
+
+        while (symspi_rx_ring_overruns((void*)symspi) == overruns_before) {
+                if (time_after(jiffies, deadline)) {
+                        symspi_test_err("RX ring didn't overrun");
+                        return false;
+                }
+                // the TX ring might be full still, then we just wait
+                symspi_data_xchange_batch((void*)symspi, batch
+                                          , ARRAY_SIZE(batch), true);
+                msleep(1);
+        }
+
+        // the overrun frames are dropped, not the ones in the ring;
+        // NOTE: other side may still give us frames while we drain
+        while ((data = symspi_rx_ring_peek((void*)symspi, &size, NULL))
+                        != NULL) {
+                if (IS_ERR(data)
+                                || size != symspi_test_xfer_64b_default
+                                           .size_bytes) {
+                        symspi_test_err("bad RX ring frame after overrun");
+                        return false;
+                }
+                symspi_rx_ring_release((void*)symspi);
+                drained++;
+                if (time_after(jiffies, deadline)) {
+                        symspi_test_err("RX ring drain didn't finish");
+                        return false;
+                }
+        }
+        if (drained == 0) {
+                symspi_test_err("RX ring is empty after overrun");
+                return false;
+        }
+
+        symspi_test_info("RX ring overruns: %llu, drained frames: %d"
+                         , symspi_rx_ring_overruns((void*)symspi)
+                           - overruns_before, drained);
+        return true;
+}
+
+bool symspi_test_16(struct symspi_dev *symspi)
+{
+        bool result = false;
+
+        pr_info("SYMSPI_TEST: 16: starting\n.");
+
+        // RX ring mode is to be set while SymSPI is in COLD state
+        symspi_close((void*)symspi);
+        init_completion(&symspi_test_16__rx_ready);
+        symspi->rx_ready_callback = &symspi_test_16__rx_ready_callback;
+
+        if (symspi_test_run_symspi(symspi) != 0) {
+                goto done;
+        }
+
+        if (!symspi_test_16__request(symspi)
+                        || !symspi_test_16__drain_till_answer(symspi)) {
+                goto done;
+        }
+        if (!symspi_test_16__overrun(symspi)) {
+                goto done;
+        }
+        if (!symspi_test_16__request(symspi)
+                        || !symspi_test_16__drain_till_answer(symspi)) {
+                symspi_test_err("RX ring is not usable after overrun");
+                goto done;
+        }
+        result = true;
+
+done:
+        symspi_close((void*)symspi);
+        symspi->rx_ready_callback = NULL;
+        symspi_test_run_symspi(symspi);
+
+        if (result) {
+                pr_info("SYMSPI_TEST: TEST 16: OK.\n");
+        } else {
+                pr_err("SYMSPI_TEST: TEST 16: FAIL!.\n");
+        }
+        return result;
+}
+
+
+/*-------------------- BENCHMARK SECTION ---------------------------*/
+
+// BENCHMARK MODE
+//
+// Instead of the correctness tests, sweeps the initiator roles,
+// frame sizes (1, 2, 4, ... bench_max_frame_bytes) and burst lengths
+// (xfers enqueued at once, see symspi_data_xchange_batch(...)) and
+// measures for every combination (point):
+//      * xfers/s and bytes/s (payload bytes in one direction),
+//      * p50/p99/p999/max latency from the xfer request
+//        (symspi_data_xchange*(...) call) till its done callback.
+//
+// In the "their" role (other side initiates all xfers) the request
+// moment is not visible from our side, so the latency is the
+// interval between consecutive done callbacks, and only burst 1 is
+// measured.
+//
+// The report is published at /proc/symspi_test/benchmark, one
+// key=value line per point. The format is stable (new keys are only
+// appended, format= is increased on incompatible changes), so runs
+// on different kernels/driver versions can be compared directly.
+//
+// The typical usage with the simulated other side (see symspi_sim.c):
+//
+//      # Bash:
+//      insmod symspi.ko; insmod symspi_sim.ko
+//      insmod symspi_test.ko benchmark=1 bench_roles=1
+//      cat /proc/symspi_test/benchmark > our.txt; rmmod symspi_test
+//      rmmod symspi_sim; insmod symspi_sim.ko request_interval_usec=200
+//      insmod symspi_test.ko benchmark=1 bench_roles=2
+//      cat /proc/symspi_test/benchmark > their.txt
+//
+// NOTE: the xfers initiated by the other side during the "our" role
+//      are counted as ours, so run the roles separately if the other
+//      side initiates xfers on its own.
+// NOTE: SymSPI is closed after the sweep.
+
+static bool benchmark = false;
+module_param(benchmark, bool, 0444);
+MODULE_PARM_DESC(benchmark, "Run the benchmark sweep instead of the tests");
+
+static unsigned int bench_xfers = 1000;
+module_param(bench_xfers, uint, 0444);
+MODULE_PARM_DESC(bench_xfers, "Number of xfers per benchmark point");
+
+static unsigned int bench_max_frame_bytes = 64;
+module_param(bench_max_frame_bytes, uint, 0444);
+MODULE_PARM_DESC(bench_max_frame_bytes
+                 , "The biggest benchmarked frame size (bytes)");
+
+static unsigned int bench_roles = 0x3;
+module_param(bench_roles, uint, 0444);
+MODULE_PARM_DESC(bench_roles, "Benchmarked initiator roles bitmask:"
+                 " 1 - our side, 2 - their side");
+
+#define SYMSPI_TEST_BENCH_REPORT_FORMAT 1
+#define SYMSPI_TEST_BENCH_PROC_DIR_NAME "symspi_test"
+#define SYMSPI_TEST_BENCH_PROC_FILE_NAME "benchmark"
+#define SYMSPI_TEST_BENCH_REPORT_MAX_BYTES (4 * PAGE_SIZE)
+#define SYMSPI_TEST_BENCH_BURST_MAX 16
+
+#define SYMSPI_TEST_BENCH_ROLE_OUR 0
+#define SYMSPI_TEST_BENCH_ROLE_THEIR 1
+#define SYMSPI_TEST_BENCH_ROLES_COUNT 2
+
+static const char *const symspi_test_bench_role_names[] = {
+        "our", "their"
+};
+
+static const unsigned int symspi_test_bench_bursts[] = {
+        1, 4, SYMSPI_TEST_BENCH_BURST_MAX
+};
+
+// The currently benchmarked point.
+//
+// @role SYMSPI_TEST_BENCH_ROLE_*
+// @frame_bytes the xfer size
+// @burst the number of xfers requested at once
+// @xfers_total the number of xfers to measure
+// @samples_ns [@xfers_total] the latencies of done xfers
+// @done the number of done xfers
+// @burst_done_target the number of done xfers to finish the current
+//      burst at
+// @burst_start the time the current burst was requested at
+// @start the point start time
+// @last_done the last xfer done time
+// @burst_completion completed when @burst_done_target is reached
+// @aborted if true, then xfers done are not counted
+struct symspi_test_bench_point {
+        int role;
+        unsigned int frame_bytes;
+        unsigned int burst;
+        unsigned int xfers_total;
+
+        u64 *samples_ns;
+        atomic_t done;
+        unsigned int burst_done_target;
+        ktime_t burst_start;
+        ktime_t start;
+        ktime_t last_done;
+        struct completion burst_completion;
+        bool aborted;
+};
+
+static struct symspi_test_bench_point symspi_test_bench_point;
+static struct full_duplex_xfer
+                symspi_test_bench_xfers[SYMSPI_TEST_BENCH_BURST_MAX];
+static char *symspi_test_bench_tx_data;
+
+static char *symspi_test_bench_report;
+static size_t symspi_test_bench_report_len;
+static struct proc_dir_entry *symspi_test_bench_proc_dir;
+static struct file_operations symspi_test_bench_proc_ops;
+
+// Records the done xfer latency.
+//
+// CONTEXT:
+//      SymSPI done callback (can not sleep)
+struct full_duplex_xfer *symspi_test_bench_xfer_done_callback(
+                        const struct full_duplex_xfer __kernel *done_xfer
+                        , const int next_xfer_id
+                        , bool __kernel *start_immediately__out
+                        , void *consumer_data)
+{
+        struct symspi_test_bench_point *p = &symspi_test_bench_point;
+        const ktime_t now = ktime_get();
+
+        *start_immediately__out = false;
+
+        if (READ_ONCE(p->aborted)) {
+                return NULL;
+        }
+
+        const int idx = atomic_inc_return(&p->done) - 1;
+        if (idx >= p->xfers_total) {
+                return NULL;
+        }
+
+        const ktime_t from = (p->role == SYMSPI_TEST_BENCH_ROLE_OUR)
+                             ? p->burst_start : p->last_done;
+        p->samples_ns[idx] = ktime_to_ns(ktime_sub(now, from));
+        p->last_done = now;
+
+        if (idx + 1 >= p->burst_done_target) {
+                complete(&p->burst_completion);
+        }
+
+        return NULL;
+}
+
+// Runs the point where we request all xfers.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_bench_run_our(struct symspi_dev *symspi
+                                     , struct symspi_test_bench_point *p)
+{
+        struct full_duplex_xfer *batch[SYMSPI_TEST_BENCH_BURST_MAX];
+        unsigned int submitted = 0;
+        int i;
+
+        for (i = 0; i < SYMSPI_TEST_BENCH_BURST_MAX; i++) {
+                batch[i] = &symspi_test_bench_xfers[i];
+        }
+
+        while (submitted < p->xfers_total) {
+                const unsigned int count = min(p->burst
+                                               , p->xfers_total - submitted);
+                int res;
+
+                reinit_completion(&p->burst_completion);
+                p->burst_done_target = submitted + count;
+                p->burst_start = ktime_get();
+
+                if (count == 1) {
+                        res = symspi_data_xchange((void*)symspi, batch[0]
+                                                  , true);
+                        res = res < 0 ? res : 1;
+                } else {
+                        res = symspi_data_xchange_batch((void*)symspi
+                                                        , batch, count
+                                                        , true);
+                }
+                if (res < 0) {
+                        symspi_test_err("benchmark xfer request failed: %d"
+                                        , res);
+                        return res;
+                }
+                if (res == 0) {
+                        symspi_test_err("benchmark xfer ring is full");
+                        return -EBUSY;
+                }
+                // ring back-pressure: waiting for enqueued part only
+                p->burst_done_target = submitted + res;
+
+                if (wait_for_completion_timeout(&p->burst_completion
+                                , msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(res)))
+                                == 0) {
+                        return -ETIMEDOUT;
+                }
+                submitted += res;
+        }
+
+        return 0;
+}
+
+// Runs the point where the other side initiates all xfers.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_bench_run_their(struct symspi_dev *symspi
+                                       , struct symspi_test_bench_point *p)
+{
+        reinit_completion(&p->burst_completion);
+        p->burst_done_target = p->xfers_total;
+        p->last_done = ktime_get();
+
+        const int res = symspi_default_data_update((void*)symspi
+                                        , &symspi_test_bench_xfers[0]
+                                        , true);
+        if (res < 0) {
+                symspi_test_err("benchmark default xfer update failed: %d"
+                                , res);
+                return res;
+        }
+
+        if (wait_for_completion_timeout(&p->burst_completion
+                        , msecs_to_jiffies(
+                                symspi_test_get_timeout_ms(p->xfers_total)))
+                        == 0) {
+                return -ETIMEDOUT;
+        }
+
+        return 0;
+}
+
+static int symspi_test_bench_cmp_u64(const void *a, const void *b)
+{
+        const u64 x = *(const u64 *)a;
+        const u64 y = *(const u64 *)b;
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// RETURNS:
+//      the @per_mille percentile of @n sorted samples
+static inline u64 symspi_test_bench_percentile(const u64 *sorted
+                                               , const unsigned int n
+                                               , const unsigned int per_mille)
+{
+        return n == 0 ? 0 : sorted[div_u64((u64)(n - 1) * per_mille, 1000)];
+}
+
+// Appends the point results line to the report.
+static void symspi_test_bench_report_point(
+                struct symspi_test_bench_point *p, const int res)
+{
+        const unsigned int n = min_t(unsigned int, atomic_read(&p->done)
+                                     , p->xfers_total);
+        const u64 elapsed_ns = n == 0 ? 0 : ktime_to_ns(
+                                        ktime_sub(p->last_done, p->start));
+        const char *status = res == 0 ? "ok"
+                                : (res == -ETIMEDOUT ? "timeout" : "error");
+
+        sort(p->samples_ns, n, sizeof(*p->samples_ns)
+             , &symspi_test_bench_cmp_u64, NULL);
+
+        symspi_test_bench_report_len += scnprintf(
+                symspi_test_bench_report + symspi_test_bench_report_len
+                , SYMSPI_TEST_BENCH_REPORT_MAX_BYTES
+                  - symspi_test_bench_report_len
+                , "role=%s frame_bytes=%u burst=%u xfers=%u status=%s"
+                  " elapsed_ns=%llu xfers_per_sec=%llu bytes_per_sec=%llu"
+                  " p50_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu\n"
+                , symspi_test_bench_role_names[p->role], p->frame_bytes
+                , p->burst, n, status, elapsed_ns
+                , elapsed_ns ? div64_u64((u64)n * NSEC_PER_SEC
+                                         , elapsed_ns) : 0
+                , elapsed_ns ? div64_u64((u64)n * p->frame_bytes
+                                         * NSEC_PER_SEC, elapsed_ns) : 0
+                , symspi_test_bench_percentile(p->samples_ns, n, 500)
+                , symspi_test_bench_percentile(p->samples_ns, n, 990)
+                , symspi_test_bench_percentile(p->samples_ns, n, 999)
+                , n ? p->samples_ns[n - 1] : 0);
+}
+
+// Runs a single benchmark point.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_bench_run_point(struct symspi_dev *symspi
+                                       , const int role
+                                       , const unsigned int frame_bytes
+                                       , const unsigned int burst)
+{
+        struct symspi_test_bench_point *p = &symspi_test_bench_point;
+        int i;
+        int res;
+
+        WRITE_ONCE(p->aborted, true);
+
+        p->role = role;
+        p->frame_bytes = frame_bytes;
+        p->burst = burst;
+        p->xfers_total = bench_xfers;
+        atomic_set(&p->done, 0);
+        for (i = 0; i < SYMSPI_TEST_BENCH_BURST_MAX; i++) {
+                symspi_test_bench_xfers[i].size_bytes = frame_bytes;
+        }
+        p->start = ktime_get();
+        p->last_done = p->start;
+
+        WRITE_ONCE(p->aborted, false);
+
+        if (role == SYMSPI_TEST_BENCH_ROLE_OUR) {
+                res = symspi_test_bench_run_our(symspi, p);
+        } else {
+                res = symspi_test_bench_run_their(symspi, p);
+        }
+
+        WRITE_ONCE(p->aborted, true);
+
+        symspi_test_bench_report_point(p, res);
+
+        symspi_test_info_raw("benchmark: role: %s, frame: %u, burst: %u"
+                             ": %s (%d)", symspi_test_bench_role_names[role]
+                             , frame_bytes, burst, res == 0 ? "done"
+                                                           : "failed"
+                             , res);
+        return res;
+}
+
+static ssize_t symspi_test_bench_proc_read(struct file *file
+                , char __user *ubuf, size_t count, loff_t *ppos)
+{
+        return simple_read_from_buffer(ubuf, count, ppos
+                                       , symspi_test_bench_report
+                                       , symspi_test_bench_report_len);
+}
+
+// Frees the benchmark resources and removes the report file.
+static void symspi_test_bench_close(void)
+{
+        if (!IS_ERR_OR_NULL(symspi_test_bench_proc_dir)) {
+                proc_remove(symspi_test_bench_proc_dir);
+        }
+        symspi_test_bench_proc_dir = NULL;
+
+        vfree(symspi_test_bench_point.samples_ns);
+        symspi_test_bench_point.samples_ns = NULL;
+        kfree(symspi_test_bench_tx_data);
+        symspi_test_bench_tx_data = NULL;
+        kfree(symspi_test_bench_report);
+        symspi_test_bench_report = NULL;
+        symspi_test_bench_report_len = 0;
+}
+
+// Runs the whole benchmark sweep on the running SymSPI device, and
+// publishes the report.
+//
+// RETURNS:
+//      0: on success (even if some points failed, see report)
+//      <0: negated error code
+static int symspi_test_bench_run(struct symspi_dev *symspi)
+{
+        struct symspi_test_bench_point *p = &symspi_test_bench_point;
+        int role;
+        int i;
+
+        if (bench_xfers == 0 || bench_max_frame_bytes == 0) {
+                symspi_test_err("benchmark: nothing to measure");
+                return -EINVAL;
+        }
+
+        symspi_test_bench_report = kzalloc(
+                        SYMSPI_TEST_BENCH_REPORT_MAX_BYTES, GFP_KERNEL);
+        symspi_test_bench_tx_data = kmalloc(bench_max_frame_bytes
+                                            , GFP_KERNEL);
+        p->samples_ns = vmalloc(array_size(bench_xfers
+                                           , sizeof(*p->samples_ns)));
+        if (!symspi_test_bench_report || !symspi_test_bench_tx_data
+                        || !p->samples_ns) {
+                symspi_test_bench_close();
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < bench_max_frame_bytes; i++) {
+                symspi_test_bench_tx_data[i] = (char)i;
+        }
+        for (i = 0; i < SYMSPI_TEST_BENCH_BURST_MAX; i++) {
+                struct full_duplex_xfer *x = &symspi_test_bench_xfers[i];
+
+                x->data_tx = symspi_test_bench_tx_data;
+                x->data_rx_buf = NULL;
+                x->consumer_data = NULL;
+                x->done_callback = &symspi_test_bench_xfer_done_callback;
+                x->fail_callback = NULL;
+        }
+        init_completion(&p->burst_completion);
+        p->aborted = true;
+
+        symspi_test_bench_report_len = scnprintf(symspi_test_bench_report
+                        , SYMSPI_TEST_BENCH_REPORT_MAX_BYTES
+                        , "format=%d\nkernel=%s\nxfers_per_point=%u\n"
+                        , SYMSPI_TEST_BENCH_REPORT_FORMAT
+                        , utsname()->release, bench_xfers);
+
+        for (role = 0; role < SYMSPI_TEST_BENCH_ROLES_COUNT; role++) {
+                unsigned int frame_bytes = 1;
+
+                if (!(bench_roles & BIT(role))) {
+                        continue;
+                }
+
+                while (true) {
+                        int res = 0;
+
+                        for (i = 0; i < ARRAY_SIZE(symspi_test_bench_bursts)
+                                    && res != -ETIMEDOUT; i++) {
+                                const unsigned int burst
+                                                = symspi_test_bench_bursts[i];
+
+                                if (role == SYMSPI_TEST_BENCH_ROLE_THEIR
+                                                && burst > 1) {
+                                        break;
+                                }
+                                res = symspi_test_bench_run_point(symspi
+                                                , role, frame_bytes, burst);
+                        }
+                        // the link state is unknown after timeout
+                        if (res == -ETIMEDOUT) {
+                                symspi_test_err("benchmark: timeout"
+                                                ", sweep stopped");
+                                goto sweep_done;
+                        }
+
+                        if (frame_bytes >= bench_max_frame_bytes) {
+                                break;
+                        }
+                        frame_bytes = min(frame_bytes * 2
+                                          , bench_max_frame_bytes);
+                }
+        }
+
+sweep_done:
+        // no more callbacks into our data after this point
+        symspi_close((void*)symspi);
+
+        memset(&symspi_test_bench_proc_ops, 0
+               , sizeof(symspi_test_bench_proc_ops));
+        symspi_test_bench_proc_ops.read = &symspi_test_bench_proc_read;
+        symspi_test_bench_proc_ops.owner = THIS_MODULE;
+
+        symspi_test_bench_proc_dir = proc_mkdir(
+                        SYMSPI_TEST_BENCH_PROC_DIR_NAME, NULL);
+        if (IS_ERR_OR_NULL(symspi_test_bench_proc_dir)
+                        || IS_ERR_OR_NULL(proc_create(
+                                SYMSPI_TEST_BENCH_PROC_FILE_NAME, 0444
+                                , symspi_test_bench_proc_dir
+                                , &symspi_test_bench_proc_ops))) {
+                symspi_test_err("failed to create benchmark proc entry");
+                symspi_test_bench_close();
+                return -EIO;
+        }
+
+        symspi_test_info_raw("benchmark done, see /proc/"
+                             SYMSPI_TEST_BENCH_PROC_DIR_NAME"/"
+                             SYMSPI_TEST_BENCH_PROC_FILE_NAME);
+        return 0;
+}
+
+
+/*-------------------- CHARDEV SECTION -----------------------------*/
+
+// CHARDEV MODE
+//
+// Instead of the correctness tests, runs the SymSPI char device
+// (/dev/symspi<index>, see symspi_uapi.h) through its shared rings
+// the way a userspace process does, against the loopback other
+// side (see symspi_sim.c, loopback=1), which returns every our
+// frame as RX data of the same xfer. Verifies that:
+//      * the second open of the node fails with EBUSY,
+//      * the shared area header is consistent,
+//      * the TX frame of other size than the current xfer is dropped
+//        (its slot is freed) while the forced size change is off,
+//      * with SYMSPI_IOC_SET_FORCE_SIZE on, the frames of all sizes
+//        (1..frame_max_bytes, twice the ring size of frames, so both
+//        rings wrap) come back via the RX ring in order and intact,
+//        and no RX frame is dropped,
+//      * the unknown ioctl fails with ENOTTY, poll reports POLLOUT.
+//
+// The typical usage from Bash is the following:
+//
+//      # Bash:
+//      insmod symspi.ko; insmod symspi_sim.ko loopback=1
+//      insmod symspi_test.ko chardev_test=1 && echo "PASSED"
+//
+// NOTE: the shared area is mapped into the insmod process, and the
+//      node is released (SymSPI is closed) only when insmod returns,
+//      so nothing else is run in this mode.
+// NOTE: is available only when SymSPI is built with
+//      BOSCH_SYMSPI_CHARDEV.
+
+#ifdef SYMSPI_CHARDEV
+
+static bool chardev_test = false;
+module_param(chardev_test, bool, 0444);
+MODULE_PARM_DESC(chardev_test, "Run the char device loopback test instead"
+                 " of the tests");
+
+// how long we wait for the frame which must not come
+#define SYMSPI_TEST_CHARDEV_SILENCE_MSEC 100
+
+// The char device test state.
+//
+// @file the open node
+// @area the shared area (userspace address in insmod process)
+// @ctrl the shared area header (userspace address)
+// @hdr the shared area header copy (read only fields)
+// @tx_head the number of TX frames we have published
+// @rx_tail the number of RX frames we have consumed
+// @frame [hdr.frame_max_bytes] the RX frame data
+struct symspi_test_chardev {
+        struct file *file;
+        unsigned long area;
+        struct symspi_uapi_ctrl __user *ctrl;
+        struct symspi_uapi_ctrl hdr;
+        u32 tx_head;
+        u32 rx_tail;
+        u8 *frame;
+};
+
+static long symspi_test_chardev_ioctl(struct symspi_test_chardev *cd
+                                      , unsigned int cmd
+                                      , unsigned long arg)
+{
+        return cd->file->f_op->unlocked_ioctl(cd->file, cmd, arg);
+}
+
+// RETURNS:
+//      the userspace address of the ring slot of given @index
+static struct symspi_uapi_slot __user *symspi_test_chardev_slot(
+                struct symspi_test_chardev *cd
+                , const struct symspi_uapi_ring *ring
+                , const u32 index)
+{
+        return (struct symspi_uapi_slot __user *)(cd->area + ring->offset
+                        + (index & (ring->slots_count - 1))
+                          * ring->slot_size);
+}
+
+// RETURNS:
+//      the size of the loopback test frame of given @index
+static size_t symspi_test_chardev_frame_size(struct symspi_test_chardev *cd
+                                             , const u32 index)
+{
+        return 1 + index % cd->hdr.frame_max_bytes;
+}
+
+// Fills the loopback test frame of given @index.
+static void symspi_test_chardev_frame_fill(u8 *data, const size_t size
+                                           , const u32 index)
+{
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                data[i] = (u8)(index * 7 + i);
+        }
+}
+
+// RETURNS:
+//      true: if @data is the loopback test frame of given @index
+static bool symspi_test_chardev_frame_check(struct symspi_test_chardev *cd
+                                            , const u8 *data
+                                            , const size_t size
+                                            , const u32 index)
+{
+        size_t i;
+
+        if (size != symspi_test_chardev_frame_size(cd, index)) {
+                return false;
+        }
+        for (i = 0; i < size; i++) {
+                if (data[i] != (u8)(index * 7 + i)) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+// Publishes the TX frame and kicks the link, waits for the free
+// slot if TX ring is full.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_tx(struct symspi_test_chardev *cd
+                                  , const void *data, const u32 size)
+{
+        const unsigned long deadline = jiffies + msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(1));
+        struct symspi_uapi_slot __user *slot;
+        u32 tail;
+
+        for (;;) {
+                if (get_user(tail, &cd->ctrl->tx.tail)) {
+                        return -EFAULT;
+                }
+                if (cd->tx_head - tail < cd->hdr.tx.slots_count) {
+                        break;
+                }
+                if (time_after(jiffies, deadline)) {
+                        symspi_test_err("no free TX slot");
+                        return -ETIMEDOUT;
+                }
+                usleep_range(100, 200);
+        }
+        // the slot is ours after the tail was read
+        smp_mb();
+
+        slot = symspi_test_chardev_slot(cd, &cd->hdr.tx, cd->tx_head);
+        if (put_user(size, &slot->size_bytes)
+                        || copy_to_user(slot->data, data, size)) {
+                return -EFAULT;
+        }
+
+        // publish (store-release)
+        smp_wmb();
+        cd->tx_head++;
+        if (put_user(cd->tx_head, &cd->ctrl->tx.head)) {
+                return -EFAULT;
+        }
+
+        return (int)symspi_test_chardev_ioctl(cd, SYMSPI_IOC_TX_KICK, 0);
+}
+
+// Takes the oldest RX frame (if any) into @cd->frame.
+//
+// RETURNS:
+//      >0: the frame size
+//      -EAGAIN: RX ring is empty
+//      <0: negated error code
+static int symspi_test_chardev_rx(struct symspi_test_chardev *cd
+                                  , s32 *xfer_id__out)
+{
+        struct symspi_uapi_slot __user *slot;
+        struct symspi_uapi_slot hdr;
+        u32 head;
+
+        if (get_user(head, &cd->ctrl->rx.head)) {
+                return -EFAULT;
+        }
+        if (head == cd->rx_tail) {
+                return -EAGAIN;
+        }
+        // read the slot after the head (load-acquire)
+        smp_rmb();
+
+        slot = symspi_test_chardev_slot(cd, &cd->hdr.rx, cd->rx_tail);
+        if (copy_from_user(&hdr, slot, sizeof(hdr))) {
+                return -EFAULT;
+        }
+        if (hdr.size_bytes == 0 || hdr.size_bytes > cd->hdr.frame_max_bytes) {
+                symspi_test_err("bad RX frame size: %u", hdr.size_bytes);
+                return -EINVAL;
+        }
+        if (copy_from_user(cd->frame, slot->data, hdr.size_bytes)) {
+                return -EFAULT;
+        }
+
+        // free the slot (store-release)
+        smp_mb();
+        cd->rx_tail++;
+        if (put_user(cd->rx_tail, &cd->ctrl->rx.tail)) {
+                return -EFAULT;
+        }
+
+        if (xfer_id__out) {
+                *xfer_id__out = hdr.xfer_id;
+        }
+        return (int)hdr.size_bytes;
+}
+
+// Verifies that the TX frame of other size than the current xfer is
+// dropped while the forced size change is off.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_size_check(struct symspi_test_chardev *cd)
+{
+        // the current xfer is the initial zeroed frame of max size
+        const u32 size = cd->hdr.frame_max_bytes - 1;
+        const unsigned long deadline = jiffies + msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(1));
+        u32 tail;
+        int res;
+
+        if (size == 0) {
+                symspi_test_info("frame_max_bytes is 1, size check skipped");
+                return 0;
+        }
+
+        symspi_test_chardev_frame_fill(cd->frame, size, 0);
+        res = symspi_test_chardev_tx(cd, cd->frame, size);
+        if (res != 0) {
+                symspi_test_err("TX failed: %d", res);
+                return res;
+        }
+
+        // the slot is to be freed nevertheless
+        do {
+                if (get_user(tail, &cd->ctrl->tx.tail)) {
+                        return -EFAULT;
+                }
+                if (time_after(jiffies, deadline)) {
+                        symspi_test_err("TX slot of dropped frame"
+                                        " was not freed");
+                        return -ETIMEDOUT;
+                }
+                usleep_range(100, 200);
+        } while (tail != cd->tx_head);
+
+        msleep(SYMSPI_TEST_CHARDEV_SILENCE_MSEC);
+
+        while ((res = symspi_test_chardev_rx(cd, NULL)) > 0) {
+                if (res != cd->hdr.frame_max_bytes) {
+                        symspi_test_err("frame of %d bytes was xfered"
+                                        " without forced size change"
+                                        , res);
+                        return -EINVAL;
+                }
+        }
+
+        return res == -EAGAIN ? 0 : res;
+}
+
+// Checks the next RX frames (if any) against the loopback frames
+// sequence.
+//
+// @rx_next the index of the next expected frame, is updated
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_loopback_rx(struct symspi_test_chardev *cd
+                                           , u32 *rx_next)
+{
+        s32 xfer_id;
+        int res;
+
+        while ((res = symspi_test_chardev_rx(cd, &xfer_id)) > 0) {
+                if (symspi_test_chardev_frame_check(cd, cd->frame, res
+                                                    , *rx_next)) {
+                        (*rx_next)++;
+                        continue;
+                }
+                // the other side asked for xfer while we had nothing
+                // new, so SymSPI xfered our last frame again
+                if (*rx_next > 0 && symspi_test_chardev_frame_check(cd
+                                        , cd->frame, res, *rx_next - 1)) {
+                        continue;
+                }
+                symspi_test_err("unexpected RX frame (xfer %d), while"
+                                " expected frame %u", xfer_id, *rx_next);
+                print_hex_dump(KERN_DEBUG, "RX data: ", 0, 16, 1
+                               , cd->frame, res, true);
+                return -EINVAL;
+        }
+
+        return res == -EAGAIN ? 0 : res;
+}
+
+// Waits till the loopback frames up to @target came back.
+//
+// @rx_next the index of the next expected frame, is updated
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_loopback_wait(struct symspi_test_chardev *cd
+                                             , u32 *rx_next
+                                             , const u32 target)
+{
+        const unsigned long deadline = jiffies + msecs_to_jiffies(
+                        symspi_test_get_timeout_ms(target - *rx_next));
+        int res;
+
+        for (;;) {
+                res = symspi_test_chardev_loopback_rx(cd, rx_next);
+                if (res != 0 || *rx_next >= target) {
+                        return res;
+                }
+                if (time_after(jiffies, deadline)) {
+                        symspi_test_err("got %u of %u frames back"
+                                        , *rx_next, target);
+                        return -ETIMEDOUT;
+                }
+                usleep_range(100, 200);
+        }
+}
+
+// Xfers the frames of all sizes and verifies they come back.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_loopback(struct symspi_test_chardev *cd)
+{
+        const u32 frames = 2 * max(cd->hdr.tx.slots_count
+                                   , cd->hdr.rx.slots_count);
+        // keeps RX ring from overrun while we are busy with TX
+        const u32 in_flight_max = cd->hdr.rx.slots_count / 2;
+        u8 *tx_data = kmalloc(cd->hdr.frame_max_bytes, GFP_KERNEL);
+        u32 rx_next = 0;
+        u64 dropped;
+        u32 i;
+        int res;
+
+        if (!tx_data) {
+                return -ENOMEM;
+        }
+
+        res = (int)symspi_test_chardev_ioctl(cd, SYMSPI_IOC_SET_FORCE_SIZE, 1);
+        if (res != 0) {
+                symspi_test_err("failed to enable forced size: %d", res);
+                goto done;
+        }
+
+        for (i = 0; i < frames; i++) {
+                const size_t size = symspi_test_chardev_frame_size(cd, i);
+
+                if (i - rx_next >= in_flight_max) {
+                        res = symspi_test_chardev_loopback_wait(cd
+                                        , &rx_next, i - in_flight_max + 1);
+                        if (res != 0) {
+                                goto done;
+                        }
+                }
+
+                symspi_test_chardev_frame_fill(tx_data, size, i);
+                res = symspi_test_chardev_tx(cd, tx_data, size);
+                if (res != 0) {
+                        symspi_test_err("TX of frame %u failed: %d"
+                                        , i, res);
+                        goto done;
+                }
+                res = symspi_test_chardev_loopback_rx(cd, &rx_next);
+                if (res != 0) {
+                        goto done;
+                }
+        }
+
+        res = symspi_test_chardev_loopback_wait(cd, &rx_next, frames);
+        if (res != 0) {
+                goto done;
+        }
+
+        if (copy_from_user(&dropped, &cd->ctrl->rx.dropped
+                           , sizeof(dropped))) {
+                res = -EFAULT;
+                goto done;
+        }
+        if (dropped != 0) {
+                symspi_test_err("%llu RX frames dropped", dropped);
+                res = -EINVAL;
+        }
+
+done:
+        kfree(tx_data);
+        return res;
+}
+
+// Runs the char device test (see CHARDEV MODE).
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_chardev_run(struct symspi_dev *symspi)
+{
+        struct symspi_test_chardev cd;
+        struct file *second;
+        unsigned long addr;
+        char path[32];
+        int res;
+
+        memset(&cd, 0, sizeof(cd));
+        snprintf(path, sizeof(path), "/dev/symspi%d", symspi->index);
+
+        // the node owns the link while open
+        symspi_close((void*)symspi);
+
+        cd.file = filp_open(path, O_RDWR, 0);
+        if (IS_ERR(cd.file)) {
+                symspi_test_err("failed to open %s: %ld", path
+                                , PTR_ERR(cd.file));
+                return PTR_ERR(cd.file);
+        }
+
+        second = filp_open(path, O_RDWR, 0);
+        if (!IS_ERR(second) || PTR_ERR(second) != -EBUSY) {
+                symspi_test_err("second open: %ld, while expected %d"
+                                , IS_ERR(second) ? PTR_ERR(second) : 0
+                                , -EBUSY);
+                if (!IS_ERR(second)) {
+                        filp_close(second, NULL);
+                }
+                res = -EINVAL;
+                goto close;
+        }
+
+        // the header first, to know the whole area size
+        addr = vm_mmap(cd.file, 0, PAGE_SIZE, PROT_READ | PROT_WRITE
+                       , MAP_SHARED, 0);
+        if (IS_ERR_VALUE(addr)) {
+                symspi_test_err("failed to map the header: %ld"
+                                , (long)addr);
+                res = (int)addr;
+                goto close;
+        }
+        res = copy_from_user(&cd.hdr, (void __user *)addr, sizeof(cd.hdr))
+              ? -EFAULT : 0;
+        vm_munmap(addr, PAGE_SIZE);
+        if (res != 0) {
+                goto close;
+        }
+
+        if (cd.hdr.magic != SYMSPI_UAPI_MAGIC
+                        || cd.hdr.version != SYMSPI_UAPI_VERSION
+                        || cd.hdr.frame_max_bytes == 0
+                        || !is_power_of_2(cd.hdr.tx.slots_count)
+                        || !is_power_of_2(cd.hdr.rx.slots_count)
+                        || cd.hdr.tx.slot_size < sizeof(struct symspi_uapi_slot)
+                                                 + cd.hdr.frame_max_bytes
+                        || cd.hdr.rx.slot_size < sizeof(struct symspi_uapi_slot)
+                                                 + cd.hdr.frame_max_bytes
+                        || cd.hdr.tx.offset < sizeof(cd.hdr)
+                        || cd.hdr.rx.offset < cd.hdr.tx.offset
+                                + cd.hdr.tx.slots_count * cd.hdr.tx.slot_size
+                        || cd.hdr.map_size < cd.hdr.rx.offset
+                                + cd.hdr.rx.slots_count * cd.hdr.rx.slot_size
+                        || cd.hdr.tx.head != 0 || cd.hdr.rx.head != 0) {
+                symspi_test_err("inconsistent shared area header");
+                print_hex_dump(KERN_DEBUG, "header: ", 0, 16, 1
+                               , &cd.hdr, sizeof(cd.hdr), true);
+                res = -EINVAL;
+                goto close;
+        }
+
+        cd.area = vm_mmap(cd.file, 0, cd.hdr.map_size
+                          , PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+        if (IS_ERR_VALUE(cd.area)) {
+                symspi_test_err("failed to map the area: %ld"
+                                , (long)cd.area);
+                res = (int)cd.area;
+                goto close;
+        }
+        cd.ctrl = (struct symspi_uapi_ctrl __user *)cd.area;
+
+        cd.frame = kmalloc(cd.hdr.frame_max_bytes, GFP_KERNEL);
+        if (!cd.frame) {
+                res = -ENOMEM;
+                goto unmap;
+        }
+
+        res = symspi_test_chardev_size_check(&cd);
+        if (res != 0) {
+                goto unmap;
+        }
+        res = symspi_test_chardev_loopback(&cd);
+        if (res != 0) {
+                goto unmap;
+        }
+
+        res = (int)symspi_test_chardev_ioctl(&cd
+                        , _IO(SYMSPI_IOC_MAGIC, 0x7F), 0);
+        if (res != -ENOTTY) {
+                symspi_test_err("unknown ioctl: %d, while expected %d"
+                                , res, -ENOTTY);
+                res = -EINVAL;
+                goto unmap;
+        }
+        if (!(vfs_poll(cd.file, NULL) & EPOLLOUT)) {
+                symspi_test_err("no POLLOUT with empty TX ring");
+                res = -EINVAL;
+                goto unmap;
+        }
+        res = 0;
+
+unmap:
+        vm_munmap(cd.area, cd.hdr.map_size);
+close:
+        filp_close(cd.file, NULL);
+        kfree(cd.frame);
+
+        if (res == 0) {
+                symspi_test_info_raw("char device test passed");
+        } else {
+                symspi_test_err_raw("char device test FAILED: %d", res);
+        }
+        return res;
+}
+
+#endif /* SYMSPI_CHARDEV */
+
+/*-------------------- STRESS SECTION ------------------------------*/
+
+// STRESS MODE
+//
+// The long running (soak) load, controlled from userspace via
+// debugfs, the compiled-in test vectors are not used:
+//
+//      /sys/kernel/debug/symspi_test/control (write):
+//          start [key=value ...]: (re)starts the load with given
+//              parameters (not given ones get defaults), and resets
+//              the results:
+//                  duration_ms: the load duration, 0 - till stop
+//                  min_bytes, max_bytes: our xfer size is uniformly
+//                      distributed in [min_bytes; max_bytes]
+//                  rate: offered rate of our xfers (xfers/s),
+//                      0 - back-to-back
+//                  initiator: our | their | both, the side which
+//                      initiates the xfers (for "their" the other
+//                      side is expected to initiate by its own)
+//          stop: stops the load (the results are kept)
+//          reset: resets the results (the load continues)
+//
+//      /sys/kernel/debug/symspi_test/results (read):
+//          the parameters and results of the current/last load in
+//          key=value lines, latencies (our xfer request till its
+//          done callback) are given in microseconds, percentiles
+//          are the upper bounds of log2 histogram buckets.
+//
+// The typical usage from Bash is the following:
+//
+//      # Bash:
+//      insmod symspi_test.ko run_tests=0
+//      echo "start duration_ms=3600000 min_bytes=1 max_bytes=64"\
+//           " rate=2000 initiator=both" > /sys/kernel/debug/symspi_test/control
+//      watch cat /sys/kernel/debug/symspi_test/results
+//
+// NOTE: our xfer is considered done on the first xfer done after our
+//      request, so with initiator=both the other side xfer which is
+//      already in progress is accounted as ours.
+
+static bool run_tests = true;
+module_param(run_tests, bool, 0444);
+MODULE_PARM_DESC(run_tests, "Run the compiled-in tests on module insertion");
+
+#define SYMSPI_TEST_STRESS_DIR_NAME "symspi_test"
+#define SYMSPI_TEST_STRESS_MAX_FRAME_BYTES 4096
+#define SYMSPI_TEST_STRESS_CMD_MAX_BYTES 256
+#define SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES 2048
+// bucket 0: 0 us, bucket k: [2^(k-1); 2^k) us
+#define SYMSPI_TEST_STRESS_HIST_BUCKETS 32
+// the period the passive load thread checks the stop conditions with
+#define SYMSPI_TEST_STRESS_PASSIVE_CHECK_MSEC 100
+
+#define SYMSPI_TEST_STRESS_INITIATOR_OUR 0x1
+#define SYMSPI_TEST_STRESS_INITIATOR_THEIR 0x2
+#define SYMSPI_TEST_STRESS_INITIATOR_BOTH 0x3
+
+// The stress load parameters (see STRESS MODE).
+struct symspi_test_stress_params {
+        unsigned int duration_ms;
+        unsigned int min_bytes;
+        unsigned int max_bytes;
+        unsigned int rate;
+        int initiator;
+};
+
+static const struct symspi_test_stress_params
+                symspi_test_stress_default_params = {
+        .duration_ms = 0
+        , .min_bytes = 64
+        , .max_bytes = 64
+        , .rate = 0
+        , .initiator = SYMSPI_TEST_STRESS_INITIATOR_OUR
+};
+
+// The stress load results.
+//
+// @start the load (or last reset) time
+// @end the load end time (valid when load is not running)
+// @our_xfers the number of done xfers requested by us
+// @their_xfers the number of other done xfers
+// @bytes the payload bytes xfered (one direction)
+// @errors the number of failed our xfer requests
+// @timeouts the number of our xfer requests which were not done
+//      in time
+// @lat_*_ns our xfers latency
+// @hist our xfers latency log2 histogram
+struct symspi_test_stress_results {
+        ktime_t start;
+        ktime_t end;
+        u64 our_xfers;
+        u64 their_xfers;
+        u64 bytes;
+        u64 errors;
+        u64 timeouts;
+        u64 lat_min_ns;
+        u64 lat_max_ns;
+        u64 lat_sum_ns;
+        u64 hist[SYMSPI_TEST_STRESS_HIST_BUCKETS];
+};
+
+// The stress load device.
+//
+// @symspi the SymSPI device under load
+// @dir the debugfs directory
+// @control_lock serializes the control commands
+// @thread {NULL || valid ptr} the load thread
+// @params the current/last load parameters
+// @xfer our xfer
+// @tx_data [SYMSPI_TEST_STRESS_MAX_FRAME_BYTES] our xfer TX data
+// @our_done completed when our xfer is done
+// @lock protects all fields below
+// @running true while the load is running
+// @our_pending true while our xfer is in flight
+// @request_time the time our xfer was requested at
+// @results the current/last load results
+struct symspi_test_stress {
+        struct symspi_dev *symspi;
+        struct dentry *dir;
+        struct mutex control_lock;
+        struct task_struct *thread;
+        struct symspi_test_stress_params params;
+        struct full_duplex_xfer xfer;
+        char *tx_data;
+        struct completion our_done;
+
+        spinlock_t lock;
+        bool running;
+        bool our_pending;
+        ktime_t request_time;
+        struct symspi_test_stress_results results;
+};
+
+static struct symspi_test_stress symspi_test_stress;
+
+// Helper. Resets the results.
+//
+// CONTEXT:
+//      @s->lock is held
+static void __symspi_test_stress_results_reset(struct symspi_test_stress *s)
+{
+        memset(&s->results, 0, sizeof(s->results));
+        s->results.lat_min_ns = U64_MAX;
+        s->results.start = ktime_get();
+        s->results.end = s->results.start;
+}
+
+// Helper. Accounts our xfer latency.
+//
+// CONTEXT:
+//      @s->lock is held
+static void __symspi_test_stress_latency_add(struct symspi_test_stress *s
+                                             , const u64 ns)
+{
+        struct symspi_test_stress_results *r = &s->results;
+        const u64 usec = div_u64(ns, NSEC_PER_USEC);
+
+        r->lat_min_ns = min(r->lat_min_ns, ns);
+        r->lat_max_ns = max(r->lat_max_ns, ns);
+        r->lat_sum_ns += ns;
+        r->hist[min_t(int, fls64(usec)
+                      , SYMSPI_TEST_STRESS_HIST_BUCKETS - 1)]++;
+}
+
+// Accounts the done xfer.
+//
+// CONTEXT:
+//      SymSPI done callback (can not sleep)
+struct full_duplex_xfer *symspi_test_stress_xfer_done_callback(
+                        const struct full_duplex_xfer __kernel *done_xfer
+                        , const int next_xfer_id
+                        , bool __kernel *start_immediately__out
+                        , void *consumer_data)
+{
+        struct symspi_test_stress *s = &symspi_test_stress;
+        const ktime_t now = ktime_get();
+        unsigned long flags;
+        bool ours = false;
+
+        *start_immediately__out = false;
+
+        spin_lock_irqsave(&s->lock, flags);
+
+        if (!s->running) {
+                spin_unlock_irqrestore(&s->lock, flags);
+                return NULL;
+        }
+
+        s->results.bytes += done_xfer->size_bytes;
+        if (s->our_pending) {
+                s->our_pending = false;
+                s->results.our_xfers++;
+                __symspi_test_stress_latency_add(s, ktime_to_ns(
+                                ktime_sub(now, s->request_time)));
+                ours = true;
+        } else {
+                s->results.their_xfers++;
+        }
+
+        spin_unlock_irqrestore(&s->lock, flags);
+
+        if (ours) {
+                complete(&s->our_done);
+        }
+
+        return NULL;
+}
+
+// Requests our single xfer and waits for it to be done.
+static void symspi_test_stress_our_xfer(struct symspi_test_stress *s)
+{
+        const struct symspi_test_stress_params *p = &s->params;
+        unsigned long flags;
+
+        s->xfer.size_bytes = p->min_bytes
+                        + prandom_u32_max(p->max_bytes - p->min_bytes + 1);
+        reinit_completion(&s->our_done);
+
+        spin_lock_irqsave(&s->lock, flags);
+        s->our_pending = true;
+        s->request_time = ktime_get();
+        spin_unlock_irqrestore(&s->lock, flags);
+
+        const int res = symspi_data_xchange((void*)s->symspi, &s->xfer
+                                            , true);
+
+        if (res >= 0 && wait_for_completion_timeout(&s->our_done
+                                , msecs_to_jiffies(
+                                        symspi_test_get_timeout_ms(1)))
+                        != 0) {
+                return;
+        }
+
+        spin_lock_irqsave(&s->lock, flags);
+        s->our_pending = false;
+        if (res < 0) {
+                s->results.errors++;
+        } else {
+                s->results.timeouts++;
+        }
+        spin_unlock_irqrestore(&s->lock, flags);
+
+        // not to spin on the broken link
+        if (res < 0) {
+                msleep(SYMSPI_TEST_STRESS_PASSIVE_CHECK_MSEC);
+        }
+}
+
+// The load thread: runs till duration is over, and then waits to be
+// stopped.
+static int symspi_test_stress_thread(void *data)
+{
+        struct symspi_test_stress *s = (struct symspi_test_stress *)data;
+        const struct symspi_test_stress_params *p = &s->params;
+        const ktime_t end = p->duration_ms
+                            ? ktime_add_ms(ktime_get(), p->duration_ms)
+                            : KTIME_MAX;
+        ktime_t next = ktime_get();
+        unsigned long flags;
+
+        // the passive side xfers carry our default data
+        s->xfer.size_bytes = p->max_bytes;
+        symspi_default_data_update((void*)s->symspi, &s->xfer, true);
+
+        while (!kthread_should_stop() && ktime_before(ktime_get(), end)) {
+                if (!(p->initiator & SYMSPI_TEST_STRESS_INITIATOR_OUR)) {
+                        msleep_interruptible(
+                                SYMSPI_TEST_STRESS_PASSIVE_CHECK_MSEC);
+                        continue;
+                }
+
+                if (p->rate > 0) {
+                        next = ktime_add_ns(next, div_u64(NSEC_PER_SEC
+                                                          , p->rate));
+                        set_current_state(TASK_INTERRUPTIBLE);
+                        schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+                }
+
+                symspi_test_stress_our_xfer(s);
+        }
+
+        spin_lock_irqsave(&s->lock, flags);
+        s->running = false;
+        s->results.end = ktime_get();
+        spin_unlock_irqrestore(&s->lock, flags);
+
+        symspi_test_info_raw("stress load finished");
+
+        set_current_state(TASK_INTERRUPTIBLE);
+        while (!kthread_should_stop()) {
+                schedule();
+                set_current_state(TASK_INTERRUPTIBLE);
+        }
+        __set_current_state(TASK_RUNNING);
+
+        return 0;
+}
+
+// Helper. Stops the load thread if any.
+//
+// CONTEXT:
+//      @s->control_lock is held
+static void __symspi_test_stress_stop(struct symspi_test_stress *s)
+{
+        unsigned long flags;
+
+        if (!s->thread) {
+                return;
+        }
+
+        kthread_stop(s->thread);
+        s->thread = NULL;
+
+        spin_lock_irqsave(&s->lock, flags);
+        if (s->running) {
+                s->running = false;
+                s->results.end = ktime_get();
+        }
+        spin_unlock_irqrestore(&s->lock, flags);
+}
+
+// Helper. (Re)starts the load with given parameters.
+//
+// CONTEXT:
+//      @s->control_lock is held
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int __symspi_test_stress_start(struct symspi_test_stress *s
+                , const struct symspi_test_stress_params *params)
+{
+        struct task_struct *thread;
+        unsigned long flags;
+
+        __symspi_test_stress_stop(s);
+
+        s->params = *params;
+
+        spin_lock_irqsave(&s->lock, flags);
+        __symspi_test_stress_results_reset(s);
+        s->our_pending = false;
+        s->running = true;
+        spin_unlock_irqrestore(&s->lock, flags);
+
+        thread = kthread_run(&symspi_test_stress_thread, s
+                             , "symspi_test_stress");
+        if (IS_ERR(thread)) {
+                spin_lock_irqsave(&s->lock, flags);
+                s->running = false;
+                spin_unlock_irqrestore(&s->lock, flags);
+                return PTR_ERR(thread);
+        }
+        s->thread = thread;
+
+        symspi_test_info_raw("stress load started: duration: %u ms"
+                             ", size: %u..%u bytes, rate: %u xfers/s"
+                             ", initiator: %d", params->duration_ms
+                             , params->min_bytes, params->max_bytes
+                             , params->rate, params->initiator);
+        return 0;
+}
+
+// Helper. Parses the "start" command parameters.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_stress_parse_params(char *cursor
+                , struct symspi_test_stress_params *params)
+{
+        char *pair;
+
+        *params = symspi_test_stress_default_params;
+
+        while ((pair = strsep(&cursor, " \t\n")) != NULL) {
+                if (*pair == '\0') {
+                        continue;
+                }
+
+                char *value_str = strchr(pair, '=');
+                unsigned int value;
+
+                if (!value_str) {
+                        return -EINVAL;
+                }
+                *value_str++ = '\0';
+
+                if (strcmp(pair, "initiator") == 0) {
+                        if (strcmp(value_str, "our") == 0) {
+                                params->initiator
+                                        = SYMSPI_TEST_STRESS_INITIATOR_OUR;
+                        } else if (strcmp(value_str, "their") == 0) {
+                                params->initiator
+                                        = SYMSPI_TEST_STRESS_INITIATOR_THEIR;
+                        } else if (strcmp(value_str, "both") == 0) {
+                                params->initiator
+                                        = SYMSPI_TEST_STRESS_INITIATOR_BOTH;
+                        } else {
+                                return -EINVAL;
+                        }
+                        continue;
+                }
+
+                if (kstrtouint(value_str, 0, &value) != 0) {
+                        return -EINVAL;
+                }
+
+                if (strcmp(pair, "duration_ms") == 0) {
+                        params->duration_ms = value;
+                } else if (strcmp(pair, "min_bytes") == 0) {
+                        params->min_bytes = value;
+                } else if (strcmp(pair, "max_bytes") == 0) {
+                        params->max_bytes = value;
+                } else if (strcmp(pair, "rate") == 0) {
+                        params->rate = value;
+                } else {
+                        symspi_test_err("unknown stress parameter: %s"
+                                        , pair);
+                        return -EINVAL;
+                }
+        }
+
+        if (params->min_bytes == 0 || params->min_bytes > params->max_bytes
+                        || params->max_bytes
+                           > SYMSPI_TEST_STRESS_MAX_FRAME_BYTES) {
+                symspi_test_err("wrong stress frame size range: %u..%u"
+                                , params->min_bytes, params->max_bytes);
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+static ssize_t symspi_test_stress_control_write(struct file *file
+                , const char __user *ubuf, size_t count, loff_t *ppos)
+{
+        struct symspi_test_stress *s = &symspi_test_stress;
+        struct symspi_test_stress_params params;
+        unsigned long flags;
+        int res = 0;
+
+        if (count == 0 || count > SYMSPI_TEST_STRESS_CMD_MAX_BYTES) {
+                return -EINVAL;
+        }
+
+        char *buf = memdup_user_nul(ubuf, count);
+
+        if (IS_ERR(buf)) {
+                return PTR_ERR(buf);
+        }
+
+        char *cursor = buf;
+        char *cmd = strsep(&cursor, " \t\n");
+
+        mutex_lock(&s->control_lock);
+
+        if (strcmp(cmd, "start") == 0) {
+                res = symspi_test_stress_parse_params(cursor, &params);
+                if (res == 0) {
+                        res = __symspi_test_stress_start(s, &params);
+                }
+        } else if (strcmp(cmd, "stop") == 0) {
+                __symspi_test_stress_stop(s);
+        } else if (strcmp(cmd, "reset") == 0) {
+                spin_lock_irqsave(&s->lock, flags);
+                __symspi_test_stress_results_reset(s);
+                spin_unlock_irqrestore(&s->lock, flags);
+        } else {
+                symspi_test_err("unknown stress command: %s", cmd);
+                res = -EINVAL;
+        }
+
+        mutex_unlock(&s->control_lock);
+
+        kfree(buf);
+        return res < 0 ? res : count;
+}
+
+// RETURNS:
+//      the upper bound (us) of the histogram bucket where the
+//      @per_mille of our xfers is reached
+static u64 symspi_test_stress_percentile(
+                const struct symspi_test_stress_results *r
+                , const unsigned int per_mille)
+{
+        const u64 target = div_u64(r->our_xfers * per_mille + 999, 1000);
+        u64 sum = 0;
+        int i;
+
+        if (r->our_xfers == 0) {
+                return 0;
+        }
+
+        for (i = 0; i < SYMSPI_TEST_STRESS_HIST_BUCKETS; i++) {
+                sum += r->hist[i];
+                if (sum >= target) {
+                        break;
+                }
+        }
+        return i == 0 ? 0 : (1ULL << min(i, 63));
+}
+
+static ssize_t symspi_test_stress_results_read(struct file *file
+                , char __user *ubuf, size_t count, loff_t *ppos)
+{
+        struct symspi_test_stress *s = &symspi_test_stress;
+        struct symspi_test_stress_results r;
+        struct symspi_test_stress_params p;
+        unsigned long flags;
+        bool running;
+
+        if (*ppos >= SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES) {
+                return 0;
+        }
+
+        char *buf = kmalloc(SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES
+                            , GFP_KERNEL);
+
+        if (!buf) {
+                return -ENOMEM;
+        }
+
+        mutex_lock(&s->control_lock);
+        p = s->params;
+        spin_lock_irqsave(&s->lock, flags);
+        running = s->running;
+        r = s->results;
+        spin_unlock_irqrestore(&s->lock, flags);
+        mutex_unlock(&s->control_lock);
+
+        const u64 elapsed_ns = ktime_to_ns(ktime_sub(
+                                running ? ktime_get() : r.end, r.start));
+        const u64 xfers = r.our_xfers + r.their_xfers;
+        int i;
+
+        size_t len = (size_t)scnprintf(buf
+                        , SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES
+                        , "state=%s\n"
+                          "duration_ms=%u\n"
+                          "min_bytes=%u\n"
+                          "max_bytes=%u\n"
+                          "rate=%u\n"
+                          "initiator=%s\n"
+                          "elapsed_ms=%llu\n"
+                          "our_xfers=%llu\n"
+                          "their_xfers=%llu\n"
+                          "bytes=%llu\n"
+                          "errors=%llu\n"
+                          "timeouts=%llu\n"
+                          "xfers_per_sec=%llu\n"
+                          "bytes_per_sec=%llu\n"
+                          "lat_min_us=%llu\n"
+                          "lat_avg_us=%llu\n"
+                          "lat_max_us=%llu\n"
+                          "lat_p50_us=%llu\n"
+                          "lat_p99_us=%llu\n"
+                          "lat_p999_us=%llu\n"
+                          "lat_hist_us="
+                        , running ? "running" : "idle"
+                        , p.duration_ms, p.min_bytes, p.max_bytes, p.rate
+                        , p.initiator == SYMSPI_TEST_STRESS_INITIATOR_BOTH
+                          ? "both"
+                          : (p.initiator
+                             == SYMSPI_TEST_STRESS_INITIATOR_THEIR
+                             ? "their" : "our")
+                        , div_u64(elapsed_ns, NSEC_PER_MSEC)
+                        , r.our_xfers, r.their_xfers, r.bytes
+                        , r.errors, r.timeouts
+                        , elapsed_ns ? div64_u64(xfers * NSEC_PER_SEC
+                                                 , elapsed_ns) : 0
+                        , elapsed_ns ? div64_u64(r.bytes * NSEC_PER_SEC
+                                                 , elapsed_ns) : 0
+                        , r.our_xfers ? div_u64(r.lat_min_ns
+                                                , NSEC_PER_USEC) : 0
+                        , r.our_xfers ? div64_u64(r.lat_sum_ns
+                                                  , r.our_xfers
+                                                    * NSEC_PER_USEC) : 0
+                        , div_u64(r.lat_max_ns, NSEC_PER_USEC)
+                        , symspi_test_stress_percentile(&r, 500)
+                        , symspi_test_stress_percentile(&r, 990)
+                        , symspi_test_stress_percentile(&r, 999));
+
+        // bucket upper bound (us):count
+        for (i = 0; i < SYMSPI_TEST_STRESS_HIST_BUCKETS; i++) {
+                len += scnprintf(buf + len
+                                 , SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES - len
+                                 , "%s%llu:%llu", i ? "," : ""
+                                 , i ? (1ULL << i) : 0ULL, r.hist[i]);
+        }
+        len += scnprintf(buf + len, SYMSPI_TEST_STRESS_RESULTS_MAX_BYTES - len
+                         , "\n");
+
+        const ssize_t res = simple_read_from_buffer(ubuf, count, ppos
+                                                    , buf, len);
+        kfree(buf);
+        return res;
+}
+
+static const struct file_operations symspi_test_stress_control_ops = {
+        .owner = THIS_MODULE
+        , .write = &symspi_test_stress_control_write
+};
+
+static const struct file_operations symspi_test_stress_results_ops = {
+        .owner = THIS_MODULE
+        , .read = &symspi_test_stress_results_read
+};
+
+// Creates the stress load control interface for the running SymSPI
+// device.
+//
+// RETURNS:
+//      0: on success
+//      <0: negated error code
+static int symspi_test_stress_init(struct symspi_dev *symspi)
+{
+        struct symspi_test_stress *s = &symspi_test_stress;
+        int i;
+
+        s->symspi = symspi;
+        mutex_init(&s->control_lock);
+        spin_lock_init(&s->lock);
+        init_completion(&s->our_done);
+        s->params = symspi_test_stress_default_params;
+        __symspi_test_stress_results_reset(s);
+
+        s->tx_data = kmalloc(SYMSPI_TEST_STRESS_MAX_FRAME_BYTES, GFP_KERNEL);
+        if (!s->tx_data) {
+                return -ENOMEM;
+        }
+        for (i = 0; i < SYMSPI_TEST_STRESS_MAX_FRAME_BYTES; i++) {
+                s->tx_data[i] = (char)i;
+        }
+
+        s->xfer.size_bytes = s->params.max_bytes;
+        s->xfer.data_tx = s->tx_data;
+        s->xfer.data_rx_buf = NULL;
+        s->xfer.consumer_data = NULL;
+        s->xfer.done_callback = &symspi_test_stress_xfer_done_callback;
+        s->xfer.fail_callback = NULL;
+
+        s->dir = debugfs_create_dir(SYMSPI_TEST_STRESS_DIR_NAME, NULL);
+        if (IS_ERR_OR_NULL(s->dir)) {
+                symspi_test_err("failed to create stress debugfs dir");
+                kfree(s->tx_data);
+                s->tx_data = NULL;
+                s->dir = NULL;
+                return -ENODEV;
+        }
+        debugfs_create_file("control", 0200, s->dir, NULL
+                            , &symspi_test_stress_control_ops);
+        debugfs_create_file("results", 0444, s->dir, NULL
+                            , &symspi_test_stress_results_ops);
+
+        return 0;
+}
+
+// Stops the load and removes the stress load control interface.
+static void symspi_test_stress_close(void)
+{
+        struct symspi_test_stress *s = &symspi_test_stress;
+
+        if (!s->dir) {
+                return;
+        }
+
+        debugfs_remove_recursive(s->dir);
+        s->dir = NULL;
+
+        mutex_lock(&s->control_lock);
+        __symspi_test_stress_stop(s);
+        mutex_unlock(&s->control_lock);
+
+        // no more callbacks into our xfer after this point
+        symspi_close((void*)s->symspi);
+
+        kfree(s->tx_data);
+        s->tx_data = NULL;
+}
+
+
+/*----------------------------- MAIN -------------------------------*/
+
+static bool symspi_test_exiting = false;
+
+struct full_duplex_xfer * symspi_test_xfer_done_default_callback(
+                        const struct full_duplex_xfer __kernel *done_xfer
+                        , const int next_xfer_id
+                        , bool __kernel *start_immediately__out
+                        , void *consumer_data)
+{
+        symspi_test_info_raw("default callback: xfer done");
+        symspi_test_printout_xfer(done_xfer);
+
+        // gracefull shutdown path
+        if (symspi_test_exiting) {
+                return ERR_PTR(-ENODATA);
+        }
+
+        return NULL;
+}
+
+
+/*-------------------- MODULE HOUSEKEEPING -------------------------*/
+
+extern struct symspi_dev *symspi_get_global_device(void);
+
+extern int symspi_data_xchange(void __kernel *device
+                , struct __kernel full_duplex_xfer *xfer
+                , bool force_size_change);
+extern int symspi_default_data_update(void __kernel *device
+                , struct full_duplex_xfer *xfer
+                , bool force_size_change);
+extern int symspi_init(void __kernel *device
+                , struct full_duplex_xfer *default_xfer);
+extern int symspi_close(void __kernel *device);
+extern bool symspi_is_running(void __kernel *device);
+extern int symspi_reset(void __kernel *device
+                , struct full_duplex_xfer *default_xfer);
+extern void *symspi_xfer_buffer_acquire(void __kernel *device
+                , const size_t size_bytes);
+extern int symspi_data_xchange_batch(void __kernel *device
+                , struct full_duplex_xfer **xfers
+                , size_t count
+                , bool force_size_change);
+extern const void *symspi_rx_ring_peek(void __kernel *device
+                , size_t *size_bytes__out
+                , int *xfer_id__out);
+extern int symspi_rx_ring_release(void __kernel *device);
+extern unsigned long long symspi_rx_ring_overruns(void __kernel *device);
+
+
+struct symspi_test_test {
+        bool (*routine)(struct symspi_dev *);
+        char *name;
+        bool result;
+};
+
+// If you add a new test, add it here
+static struct symspi_test_test symspi_test_tests[] = {
+        { symspi_test_1, "TEST 1: 64 byte request-answer", false }
+        , { symspi_test_2, "TEST 2: 64 byte - 1 byte - 64 byte", false }
+        , { symspi_test_3, "TEST 3: 1000x heavy load of:"
+                           " 64 byte request-answer", false }
+        , { symspi_test_4, "TEST 4: 1000x heavy load of:"
+                           " 64 byte - 1 byte - 64 byte", false }
+        , { symspi_test_5, "TEST 5: switch to 1 byte mode"
+                           ", 1000x of: 1 byte request-answer"
+                           ", switch back to 64 byte mode", false }
+        , { symspi_test_7, "TEST 7: single xfer initiated by other"
+                           " side (upon our previous request)", false }
+        , { symspi_test_8, "TEST 8: 1000x of other side initiated xfers"
+                           " (no wait from our side)", false }
+        , { symspi_test_9, "TEST 9: single 1 byte xfer initiated by other"
+                           " side (upon our previous request)", false }
+        , { symspi_test_10
+            , "TEST 10: 1000x of 1 byte xfer initiated by other"
+              " side (upon our previous request every time)"
+            , false }
+        , { symspi_test_11
+            , "TEST 11: 1000x of 64 byte xfer initiated by other"
+              " side (upon our single request)", false }
+        , { symspi_test_12
+            , "TEST 12: 1000x of 64 byte xfer initiated together"
+              " (both sides run to trigger initialization)"
+            , false }
+        , { symspi_test_13
+            , "TEST 13: 64 byte request-answer via the back buffer"
+              " (no data copy on xfer update)", false }
+        , { symspi_test_14
+            , "TEST 14: 64 byte request-answer via the TX ring"
+              " (both xfers enqueued at once)", false }
+#ifdef SYMSPI_STREAM
+        , { symspi_test_15
+            , "TEST 15: stream layer framing: split/coalesced messages"
+              ", seq wrap, lost/repeated/corrupted frames, sender"
+              " reopen", false }
+#endif
+        , { symspi_test_16
+            , "TEST 16: 64 byte request-answer via the RX ring"
+              " (drained by consumer), RX ring overrun and recovery"
+            , false }
+};
+
+static void symspi_test_configure_symspi(struct symspi_dev *symspi)
+{
+        // adjusting SPI mode
+
+        // sets the single brust size in bits (amount of bits to be
+        // xfered at once between SS raise and SS drop);
+        // NOTE: right now works only up to 32 bits (probably as long
+        //      as fifo on iMX is of 32bits width); (depth of fifo is
+        //      64 entries);
+        // WARNING: the spi device adjusts the bit order according to
+        //      the word size, so if you set 32 bit word size, then
+        //      it will send the most significant of 32 bits first
+        //      then less, less and so on to the less significant one.
+        //      Which will cause the byte order inversion in groups
+        //      of 4 bytes.
+        //symspi->spi->bits_per_word = 32;
+        //
+        // spi_device
+        //#define	SPI_CPHA	0x01			/* clock phase */
+        //#define	SPI_CPOL	0x02			/* clock polarity */
+
+
+        //  * when SS disabled, clock is HI
+        //  * data is valid on clock change from LO -> HI
+        symspi->spi->bits_per_word = 8;
+        symspi->spi->mode |= (SPI_CPOL | SPI_CPHA);
+        symspi->spi->master->setup(symspi->spi);
+}
+
+static void symspi_test_print_results(void)
+{
+        symspi_test_info_raw("========= SYMSPI TEST RESULTS =========");
+
+        int tests_count = ARRAY_SIZE(symspi_test_tests);
+        int failed_count = 0;
+        int i;
+        for (i = 0; i < tests_count; i++) {
+                if (symspi_test_tests[i].result) {
+                        symspi_test_info_raw("test[%d]:     OK: %s", i
+                                             , symspi_test_tests[i].name);
+                } else {
+                        symspi_test_err_raw("test[%d]:     FAILED!: %s"
+                                            , i, symspi_test_tests[i].name);
+                        failed_count++;
+                }
+        }
+
+        if (failed_count == 0) {
+                symspi_test_info_raw("ALL TESTS PASSED.");
+        } else {
+                symspi_test_err_raw("%d/%d TESTS FAILED", failed_count
+                                    , tests_count);
+        }
+}
+
+// RETURNS:
+//      0 if all tests passed,
+//      or negated first failed test index
+static int __init symspi_test_module_init(void)
+{
+        symspi_test_info("loading module");
+
+        struct symspi_dev *symspi = symspi_get_global_device();
+
+        if (IS_ERR_OR_NULL(symspi)) {
+                symspi_test_err("global symspi device unavailable"
+                                ", err: %ld" , PTR_ERR(symspi));
+                return -ENODEV;
+        }
+        symspi_test_info_raw("symspi device: %px", symspi);
+
+        symspi_test_configure_symspi(symspi);
+
+        if (symspi_test_run_symspi(symspi) != 0) {
+                symspi_test_err("Symspi loading failed. Abort.");
+                return -ENODEV;
+        }
+
+        symspi_test_info("symspi inited");
+
+        if (benchmark) {
+                symspi_test_info("starting benchmark...");
+                return symspi_test_bench_run(symspi);
+        }
+
+#ifdef SYMSPI_CHARDEV
+        if (chardev_test) {
+                symspi_test_info("starting char device test...");
+                return symspi_test_chardev_run(symspi);
+        }
+#endif
+
+        if (!run_tests) {
+                return symspi_test_stress_init(symspi);
+        }
+
+        symspi_test_info("starting tests...");
+
+        if (sizeof(symspi_test_tests) == 0) {
+                symspi_test_err("No tests to run!");
+                return -1;
+        }
+
+        // run all decladed tests
+        int i;
+        int tests_count = ARRAY_SIZE(symspi_test_tests);
+        int failed_count = 0;
+        for (i = 0; i < tests_count ; i++) {
+                symspi_test_info("starting test: [%d]", (i + 1));
+                if (!(symspi_test_tests[i].routine(symspi))) {
+                        symspi_test_err("test %d failed, see dmesg"
+                                        " for details.", (i + 1));
+                        symspi_test_tests[i].result = false;
+                        failed_count++;
+                } else {
+                        symspi_test_tests[i].result = true;
+                }
+                // to distinguish between tests in logic diagram
+                msleep(500);
+        }
+
+        symspi_test_print_results();
+
+        if (failed_count > 0) {
+                return -failed_count;
+        }
 
-        return failed_count > 0 ? -failed_count : 0;
+        // the soak load is available after successful tests as well
+        return symspi_test_stress_init(symspi);
 }
 
 static void __exit symspi_test_module_exit(void)
 {
+        symspi_test_stress_close();
+        symspi_test_bench_close();
         symspi_test_info_raw("module unloaded");
 }
 
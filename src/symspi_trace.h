@@ -0,0 +1,154 @@
+/*
+ * This file declares the tracepoints of SymSPI driver.
+ *
+ * Driver for the Symmetrical SPI (SymSPI) communication between independent
+ * CPUs, which uses the SPI bus + 2 GPIO handshaking lines to implement
+ * full duplex and fully symmetrical communication between parties.
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0
+
+// The tracepoints are available in ftrace/perf under "symspi" system,
+// say: /sys/kernel/debug/tracing/events/symspi/. When disabled they
+// cost nearly nothing (static key check).
+//
+// NOTE: the file is included by symspi.c with CREATE_TRACE_POINTS
+//      defined, which requires the symspi.c source directory to be
+//      in include path (see Makefile).
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM symspi
+
+#if !defined(_SYMSPI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SYMSPI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// SymSPI state change.
+//
+// @dev_index the index of the SymSPI device
+// @from_state the state before switch
+// @to_state the state after switch
+// @forced true, if the state was set unconditionally
+//      (symspi_switch_state_val_forced(...))
+TRACE_EVENT(symspi_state_switch,
+
+	TP_PROTO(int dev_index, int from_state, int to_state, bool forced),
+
+	TP_ARGS(dev_index, from_state, to_state, forced),
+
+	TP_STRUCT__entry(
+		__field(int, dev_index)
+		__field(int, from_state)
+		__field(int, to_state)
+		__field(bool, forced)
+	),
+
+	TP_fast_assign(
+		__entry->dev_index = dev_index;
+		__entry->from_state = from_state;
+		__entry->to_state = to_state;
+		__entry->forced = forced;
+	),
+
+	TP_printk("dev=%d %d -> %d%s", __entry->dev_index
+		  , __entry->from_state, __entry->to_state
+		  , __entry->forced ? " (forced)" : "")
+);
+
+// Their flag edge.
+//
+// @dev_index the index of the SymSPI device
+// @level the sampled their flag level (true: ACTIVE)
+// @resampled true, if the level was sampled by IRQ thread again
+//      cause the edge log was full (the edge was not logged)
+TRACE_EVENT(symspi_their_flag_edge,
+
+	TP_PROTO(int dev_index, bool level, bool resampled),
+
+	TP_ARGS(dev_index, level, resampled),
+
+	TP_STRUCT__entry(
+		__field(int, dev_index)
+		__field(bool, level)
+		__field(bool, resampled)
+	),
+
+	TP_fast_assign(
+		__entry->dev_index = dev_index;
+		__entry->level = level;
+		__entry->resampled = resampled;
+	),
+
+	TP_printk("dev=%d their flag %s%s", __entry->dev_index
+		  , __entry->level ? "SET" : "DROP"
+		  , __entry->resampled ? " (resampled)" : "")
+);
+
+// The common template for SPI xfer events.
+//
+// @dev_index the index of the SymSPI device
+// @xfer_id the id of current xfer
+// @size_bytes the size of current xfer
+// @status the result of spi_async(...) for submission, and SPI
+//      message status for completion
+DECLARE_EVENT_CLASS(symspi_spi_xfer_class,
+
+	TP_PROTO(int dev_index, int xfer_id, size_t size_bytes, int status),
+
+	TP_ARGS(dev_index, xfer_id, size_bytes, status),
+
+	TP_STRUCT__entry(
+		__field(int, dev_index)
+		__field(int, xfer_id)
+		__field(size_t, size_bytes)
+		__field(int, status)
+	),
+
+	TP_fast_assign(
+		__entry->dev_index = dev_index;
+		__entry->xfer_id = xfer_id;
+		__entry->size_bytes = size_bytes;
+		__entry->status = status;
+	),
+
+	TP_printk("dev=%d xfer id=%d size=%zu status=%d"
+		  , __entry->dev_index, __entry->xfer_id
+		  , __entry->size_bytes, __entry->status)
+);
+
+// SPI message is submitted via spi_async(...).
+DEFINE_EVENT(symspi_spi_xfer_class, symspi_spi_submit,
+	TP_PROTO(int dev_index, int xfer_id, size_t size_bytes, int status),
+	TP_ARGS(dev_index, xfer_id, size_bytes, status)
+);
+
+// SPI message is done (symspi_spi_xfer_done_callback(...)).
+DEFINE_EVENT(symspi_spi_xfer_class, symspi_spi_done,
+	TP_PROTO(int dev_index, int xfer_id, size_t size_bytes, int status),
+	TP_ARGS(dev_index, xfer_id, size_bytes, status)
+);
+
+#endif /* _SYMSPI_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE symspi_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,154 @@
+/*
+ * This file defines the userspace interface of the symmetrical SPI
+ * driver (SymSPI) char device (see SYMSPI_CHARDEV in symspi.c).
+ *
+ * Copyright (c) 2020 Robert Bosch GmbH
+ * Artem Gulyaev <Artem.Gulyaev@de.bosch.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note
+
+#ifndef SYMSPI_UAPI_HEADER_DEFINED
+#define SYMSPI_UAPI_HEADER_DEFINED
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// USAGE
+//
+// Every SymSPI device is available as /dev/symspi<index>. The device
+// can be opened by a single process at a time, and only if it is not
+// used by a kernel consumer: open starts the SymSPI link, release
+// closes it.
+//
+// The process maps the whole shared area (see
+// symspi_uapi_ctrl::map_size) at offset 0:
+//
+//      +-------------------+ 0
+//      | symspi_uapi_ctrl  |
+//      +-------------------+ tx.offset
+//      | TX slots          | tx.slots_count * tx.slot_size
+//      +-------------------+ rx.offset
+//      | RX slots          | rx.slots_count * rx.slot_size
+//      +-------------------+
+//
+// Both rings are single producer, single consumer rings with free
+// running (wrapping) u32 indexes, the slot of index i is
+// (i & (slots_count - 1)). The producer writes the slot, and then
+// publishes it by head increment (store-release), the consumer reads
+// the head (load-acquire), reads the slot, and then frees it by tail
+// increment (store-release).
+//
+// TX (userspace -> link): userspace is producer. Every frame is
+// xfered in a separate xfer, in order. The slots are freed by the
+// driver as soon as their data was taken by SymSPI. As long as the
+// link is busy the driver picks up new frames by itself, so only
+// when the link got idle with frames published, userspace kicks it
+// with SYMSPI_IOC_TX_KICK (one call per batch, not per frame).
+// When the TX ring is empty, the link (upon the other side request)
+// xfers the last TX frame again (SymSPI default xfer semantics),
+// initially the zeroed frame of frame_max_bytes size.
+//
+// Frame size: SymSPI xfers of both sides must be of the same size,
+// so by default every TX frame must have the size of the current
+// xfer (initially frame_max_bytes), the frame of other size is
+// dropped (its slot is freed, but nothing is xfered). To change
+// the xfer size, userspace enables the forced size change with
+// SYMSPI_IOC_SET_FORCE_SIZE (and agrees the size switch with the
+// other side by its own protocol). The TX frame bigger than the
+// link max xfer size (frame_max_bytes or less, if the link
+// capabilities negotiation lowered it) is cut to it.
+//
+// RX (link -> userspace): driver is producer. Every xfer received
+// data goes into a RX slot, if RX ring is full, the frame is dropped
+// and counted in rx.dropped.
+//
+// Notifications: poll()/epoll() reports POLLIN when RX ring is not
+// empty, POLLOUT when TX ring has a free slot. Also eventfd set via
+// SYMSPI_IOC_SET_EVENTFD is signaled on new RX frames.
+//
+// NOTE: the rings save the syscall per frame, but not the data
+//      copies: the shared area is vmalloc'ed (not DMA capable), so
+//      it can not be bound to the SPI transfer directly (SymSPI
+//      consumer owned buffers mode), and so the TX frame is copied
+//      into SymSPI xfer buffer when SymSPI takes it, and the RX frame
+//      is copied from SymSPI xfer buffer into SymSPI RX ring and then
+//      into the RX slot.
+
+// "SYMC"
+#define SYMSPI_UAPI_MAGIC 0x434D5953
+#define SYMSPI_UAPI_VERSION 1
+
+// The shared ring descriptor.
+//
+// @head the number of published slots (written by producer).
+// @tail the number of freed slots (written by consumer).
+// @slots_count the number of slots (power of 2).
+// @slot_size the slot size in bytes (struct symspi_uapi_slot header
+//      and data capacity, aligned).
+// @offset the slots area offset from the shared area beginning.
+// @dropped the number of frames dropped due to full ring (RX only).
+struct symspi_uapi_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 slots_count;
+	__u32 slot_size;
+	__u32 offset;
+	__u32 reserved;
+	__u64 dropped;
+};
+
+// The control header at the beginning of shared area.
+//
+// @magic SYMSPI_UAPI_MAGIC
+// @version SYMSPI_UAPI_VERSION
+// @frame_max_bytes the max frame size (slot data capacity).
+// @map_size the whole shared area size.
+// @tx the TX ring (producer: userspace).
+// @rx the RX ring (producer: driver).
+//
+// NOTE: all fields except the indexes are read only for userspace.
+struct symspi_uapi_ctrl {
+	__u32 magic;
+	__u32 version;
+	__u32 frame_max_bytes;
+	__u32 map_size;
+	struct symspi_uapi_ring tx;
+	struct symspi_uapi_ring rx;
+};
+
+// The ring slot.
+//
+// @size_bytes {1..frame_max_bytes} the frame size.
+// @xfer_id the SymSPI xfer id the frame was received in (RX only).
+// @data the frame data.
+struct symspi_uapi_slot {
+	__u32 size_bytes;
+	__s32 xfer_id;
+	__u8 data[];
+};
+
+#define SYMSPI_IOC_MAGIC 0xB5
+
+// Starts the xfer of published TX frames, if the link is idle.
+#define SYMSPI_IOC_TX_KICK _IO(SYMSPI_IOC_MAGIC, 1)
+// Sets the eventfd (int fd, -1 to unset) to be signaled on RX frames.
+#define SYMSPI_IOC_SET_EVENTFD _IOW(SYMSPI_IOC_MAGIC, 2, __s32)
+// Enables (arg != 0) or disables (arg == 0, default) the forced
+// xfer size change for the TX frames submitted from now on (see
+// Frame size above), arg is the value itself, not a pointer.
+#define SYMSPI_IOC_SET_FORCE_SIZE _IO(SYMSPI_IOC_MAGIC, 3)
+
+#endif /* SYMSPI_UAPI_HEADER_DEFINED */